@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "str.h"
 
 #include <ctype.h>
@@ -6,9 +10,148 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifdef STR_HAVE_POSIX
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#if defined(__linux__) && !defined(STR_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define STR_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef STR_HAVE_THREADS
+#if !defined(_POSIX_THREADS) || _POSIX_THREADS < 0
+#error "POSIX threads are not available; define STR_NO_THREADS to build without the concurrent utilities"
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
 #define UINT64_MAX_STRLEN 20
 
+/* 10^19, the largest power of ten below 2^64 */
+#define INT128_CHUNK_DIVISOR 10000000000000000000ULL
+#define INT128_CHUNK_DIGITS 19
+
+#define CRC32_POLY 0xEDB88320
+#define CRC32C_POLY 0x82F63B78
+
+/* Bytes per lane of the 3-way interleaved CRC-32C and x^(8 * N) mod P for N = 1 and 2 lanes */
+#define CRC32C_LANE 1024
+#define CRC32C_SHIFT_LANE 0xE4172B16
+#define CRC32C_SHIFT_2LANES 0x0D65762A
+
+#define ADLER32_BASE 65521
+#define ADLER32_NMAX 5552
+
+#define XXH64_PRIME_1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME_3 0x165667B19E3779F9ULL
+#define XXH64_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME_5 0x27D4EB2F165667C5ULL
+
+#define VARINT_MAX_LENGTH 10
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_MAX_INPUT_SIZE 0x7E000000
+#define LZ4_HASH_LOG 12
+#define LZ4_HC_HASH_LOG 15
+#define LZ4_HC_WINDOW 65536
+
+#define COLLECTION_MAGIC "STRC"
+#define COLLECTION_VERSION 1
+#define COLLECTION_HEADER_SIZE 16
+#define COLLECTION_BATCH 1024
+
+/* Beyond this many changed rows, a table lookup per byte beats the pshufb translation */
+#define TRANSLATE_MAX_ROWS 8
+
+/* xxd layout: 16 bytes per line, hex digits in pairs of bytes separated by spaces */
+#define HEXDUMP_LINE_BYTES 16
+#define HEXDUMP_HEX_WIDTH 39
+
+/* Bytes classified at once by StrTokenizer and the smallest table of StrTermCounter */
+#define TOKENIZER_BLOCK 64
+#define TERM_COUNTER_MIN_SLOTS 16
+
+/* Hash functions of a MinHash signature processed per pass, and the smallest table of StrLshIndex */
+#define SKETCH_BLOCK 256
+#define LSH_MIN_SLOTS 64
+
+/* Slots of the set that dedupes the candidates of a StrLshIndex query before it moves to the heap */
+#define LSH_QUERY_SLOTS 128
+
+/* The smallest edit script allocation of StrDiff */
+#define DIFF_MIN_EDITS 16
+
+#define LOGGER_BATCH 64
+#define LOGGER_WAIT_NS 10000000
+
+/* Message buffers that grew past this size are freed once written instead of being recycled */
+#define LOGGER_RECYCLE_MAX 65536
+
+/* Writes merged into one writev() call by the fallback of StrIoQueue */
+#define STR_IO_BATCH 64
+
+#define FNV1A_64_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV1A_64_PRIME 0x00000100000001B3ULL
+
+/* Length of YYYY-MM-DDTHH:MM:SS and the range of seconds it can represent (0000-01-01 to 9999-12-31) */
+#define TIMESTAMP_DATETIME_LENGTH 19
+#define TIMESTAMP_MIN_SECONDS (-62167219200LL)
+#define TIMESTAMP_MAX_SECONDS 253402300799LL
+
+/* Range of seconds whose nanoseconds fit in an int64_t (1677-09-21 to 2262-04-11) */
+#define EPOCH_NS_MIN_SECONDS (-9223372036LL)
+#define EPOCH_NS_MAX_SECONDS 9223372035LL
+
+#define COMMON_LOG_TIMESTAMP_LENGTH 26
+
+/* Byte masks for validating and converting digits 8 at a time (SWAR) */
+#define SWAR_ZEROS 0x3030303030303030ULL
+#define SWAR_SIXES 0x0606060606060606ULL
+#define SWAR_THREES 0x3333333333333333ULL
+#define SWAR_HIGH_NIBBLES 0xF0F0F0F0F0F0F0F0ULL
+
+/* YYYY-MM- and DDTHH:MM, with the first byte in the lowest bits; the T is checked separately */
+#define SWAR_DATE_DIGITS 0x00FFFF00FFFFFFFFULL
+#define SWAR_DATE_LITERALS 0xFF0000FF00000000ULL
+#define SWAR_DATE_PATTERN 0x2D00002D00000000ULL
+#define SWAR_TIME_DIGITS 0xFFFF00FFFF00FFFFULL
+#define SWAR_TIME_LITERALS 0x0000FF0000000000ULL
+#define SWAR_TIME_PATTERN 0x00003A0000000000ULL
+
+#ifdef STR_HAVE_THREADS
+#define STR_THREAD_LOCAL _Thread_local
+#else
+#define STR_THREAD_LOCAL
+#endif
+
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define STR_TAIL_P(str) ((str)->value + (str)->length)
 
 /**
@@ -39,7 +182,7 @@ static int str_memncmp(const char *a, int64_t a_len, const char *b, int64_t b_le
 
 static char *str_memnstr(char *s, int64_t s_len, const char *needle, int64_t needle_len)
 {
-    if (s_len == 0 || needle_len == 0) {
+    if (needle_len == 0) {
         /* All strings contain an empty string */
         return s;
     }
@@ -59,8 +202,9 @@ static char *str_memnstr(char *s, int64_t s_len, const char *needle, int64_t nee
                     return s;
                 }
 
-                /* Not the needle. Check again */
-                s = memchr(s + needle_len, *needle, end - s + needle_len);
+                /* Not the needle. Check again from the next byte */
+                s++;
+                s = memchr(s, *needle, end - s);
             }
         }
     }
@@ -69,345 +213,874 @@ static char *str_memnstr(char *s, int64_t s_len, const char *needle, int64_t nee
     return NULL;
 }
 
-bool str_init_size(Str *str, int64_t size)
+/**
+ * A compiled set of bytes.
+ *
+ * The bitmap is used for the scalar path. The nibble tables drive the SIMD classifier: a byte
+ * belongs to the set if the row selected by its low nibble has the bit of its high nibble set.
+ * Rows for high nibbles 0-7 and 8-15 are kept in separate tables because a row only has 8 bits.
+ */
+typedef struct StrByteSet
 {
-    char *mem = malloc(sizeof(char) * size);
-    if (mem) {
-        str->value = mem;
-        str->size = size;
-        str->length = 0;
-        mem[0] = '\0';
-        return true;
-    }
+    uint8_t bitmap[32];
+    uint8_t rows_low[16];
+    uint8_t rows_high[16];
+} StrByteSet;
 
-    return false;
+static void str_byteset_init(StrByteSet *set, const char *chars, int64_t length)
+{
+    memset(set, 0, sizeof(StrByteSet));
+
+    for (int64_t i = 0; i < length; i++) {
+        uint8_t c = (uint8_t) chars[i];
+        set->bitmap[c >> 3] |= (uint8_t) (1 << (c & 7));
+
+        if (c < 0x80) {
+            set->rows_low[c & 0x0F] |= (uint8_t) (1 << (c >> 4));
+        } else {
+            set->rows_high[c & 0x0F] |= (uint8_t) (1 << ((c >> 4) & 7));
+        }
+    }
 }
 
-void str_finalize(Str *str)
+static inline bool str_byteset_contains(const StrByteSet *set, uint8_t c)
 {
-    if (str && str->value) {
-        free(str->value);
-        str->value = NULL;
-        str->size = 0;
-        str->length = 0;
-    }
+    return (set->bitmap[c >> 3] >> (c & 7)) & 1;
 }
 
-bool str_set_size(Str *str, int64_t size)
+#if defined(__SSSE3__)
+/**
+ * Classifies 16 bytes at once. Returns 0xFF for each byte present in the set.
+ */
+static inline __m128i str_byteset_match16(__m128i rows_low, __m128i rows_high, __m128i v)
 {
-    char *mem = realloc(str->value, sizeof(char) * size);
-    if (mem) {
-        str->value = mem;
-        str->size = size;
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
 
-        if (str->length >= size) {
-            str->length = size - 1;
-            str->value[str->length] = '\0';
-        }
+    __m128i lo = _mm_and_si128(v, nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    __m128i high_half = _mm_cmplt_epi8(v, _mm_setzero_si128());
 
-        return true;
-    }
+    __m128i rows = _mm_or_si128(
+        _mm_andnot_si128(high_half, _mm_shuffle_epi8(rows_low, lo)),
+        _mm_and_si128(high_half, _mm_shuffle_epi8(rows_high, lo))
+    );
 
-    return false;
+    __m128i bit = _mm_shuffle_epi8(bits, hi);
+    return _mm_cmpeq_epi8(_mm_and_si128(rows, bit), bit);
 }
+#endif
 
-bool str_set_length(Str *str, int64_t length)
+#if defined(__AVX2__)
+static inline __m256i str_byteset_match32(__m256i rows_low, __m256i rows_high, __m256i v)
 {
-    if (str_ensure_capacity(str, length + 1)) {
-        if (length > str->length) {
-            memset(STR_TAIL_P(str), 0, length - str->length);
-        }
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128
+    );
 
-        str->value[length] = '\0';
-        str->length = length;
-        return true;
-    }
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
 
-    return false;
+    __m256i rows = _mm256_blendv_epi8(
+        _mm256_shuffle_epi8(rows_low, lo),
+        _mm256_shuffle_epi8(rows_high, lo),
+        v
+    );
+
+    __m256i bit = _mm256_shuffle_epi8(bits, hi);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(rows, bit), bit);
 }
+#endif
 
-bool str_ensure_capacity(Str *str, int64_t min_size)
+/**
+ * Returns the index of the first byte whose membership in the set equals `in_set`,
+ * or `length` if there is no such byte.
+ */
+static int64_t str_byteset_scan(const StrByteSet *set, const char *s, int64_t length, bool in_set)
 {
-    if (min_size > str->size) {
-        int64_t size = str->size * 2;
+    int64_t i = 0;
 
-        if (min_size > size) {
-            size = min_size;
-        }
+#if defined(__AVX2__)
+    __m256i rows_low32 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) set->rows_low));
+    __m256i rows_high32 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) set->rows_high));
+    uint32_t invert32 = in_set ? 0 : UINT32_MAX;
 
-        return str_set_size(str, size);
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(str_byteset_match32(rows_low32, rows_high32, v)) ^ invert32;
+
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
     }
+#endif
 
-    /* Allocated memory is large enough */
-    return true;
-}
+#if defined(__SSSE3__)
+    __m128i rows_low = _mm_loadu_si128((const __m128i *) set->rows_low);
+    __m128i rows_high = _mm_loadu_si128((const __m128i *) set->rows_high);
+    uint32_t invert = in_set ? 0 : 0xFFFF;
 
-bool str_copy(const Str *source, Str *destination)
-{
-    if (str_init_size(destination, source->length + 1)) {
-        memcpy(destination->value, source->value, source->length);
-        destination->value[source->length] = '\0';
-        destination->length = source->length;
-        return true;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(str_byteset_match16(rows_low, rows_high, v)) ^ invert;
+
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
     }
+#endif
 
-    return false;
-}
+    for (; i < length; i++) {
+        if (str_byteset_contains(set, (uint8_t) s[i]) == in_set) {
+            break;
+        }
+    }
 
-int str_compare(const Str *a, const Str *b)
-{
-    return str_memncmp(a->value, a->length, b->value, b->length);
+    return i;
 }
 
-int str_compare_str(const Str *str, const char *s, int64_t length)
+/**
+ * Scans the Str object from the given offset. Returns the offset of the first matching byte or -1.
+ */
+static int64_t str_find_in_set(const Str *str, int64_t offset, const char *set, int64_t length, bool in_set)
 {
-    if (length < 0) {
-        length = str_get_len(s);
+    if (offset < 0 || offset >= str->length) {
+        return -1;
     }
 
-    return str_memncmp(str->value, str->length, s, length);
-}
-
-bool str_equals_str(const Str *a, const char *s, int64_t length)
-{
     if (length < 0) {
-        length = str_get_len(s);
+        length = str_get_len(set);
     }
 
-    return a->length == length && memcmp(a->value, s, length) == 0;
+    StrByteSet byteset;
+    str_byteset_init(&byteset, set, length);
+
+    int64_t n = str->length - offset;
+    int64_t i = str_byteset_scan(&byteset, str->value + offset, n, in_set);
+    return i < n ? offset + i : -1;
 }
 
-int64_t str_indexof_str(const Str *str, const char *substr, int64_t length)
+/**
+ * Finds the n-th line feed in the range [s, e). Returns a pointer to it or NULL if the range
+ * contains fewer line feeds. In both cases, `found` receives the number of line feeds skipped.
+ */
+static const char *str_find_nth_newline(const char *s, const char *e, int64_t n, int64_t *found)
 {
-    if (length < 0) {
-        length = str_get_len(substr);
+    int64_t skipped = 0;
+
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; s + 16 <= e; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) s);
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        int64_t count = __builtin_popcount(mask);
+
+        if (count < n - skipped) {
+            skipped += count;
+            continue;
+        }
+
+        /* The line feed we are looking for is in this block */
+        while (++skipped < n) {
+            mask &= mask - 1;
+        }
+
+        *found = skipped;
+        return s + __builtin_ctz(mask);
     }
+#endif
 
-    const char *r = str_memnstr(str->value, str->length, substr, length);
-    if (r) {
-        return (int64_t) (r - str->value);
-    } else {
-        return -1;
+    while (s < e && skipped < n) {
+        const char *p = memchr(s, '\n', e - s);
+        if (p == NULL) {
+            break;
+        }
+
+        if (++skipped == n) {
+            *found = skipped;
+            return p;
+        }
+
+        s = p + 1;
     }
+
+    *found = skipped;
+    return NULL;
 }
 
-bool str_contains_str(const Str *str, const char *substr, int64_t length)
+static const uint32_t crc32_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+static uint64_t str_fnv1a_update(uint64_t hash, const char *s, int64_t length)
 {
-    if (length < 0) {
-        length = str_get_len(substr);
+    for (int64_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) s[i];
+        hash *= FNV1A_64_PRIME;
     }
 
-    const char *r = str_memnstr(str->value, str->length, substr, length);
-    return r != NULL;
+    return hash;
 }
 
-bool str_starts_with_str(const Str *str, const char *prefix, int64_t length)
+
+#if !defined(__SSE4_2__) || !defined(__x86_64__)
+static const uint32_t crc32c_table[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C,
+    0x26A1E7E8, 0xD4CA64EB, 0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B,
+    0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24, 0x105EC76F, 0xE235446C,
+    0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC,
+    0xBC267848, 0x4E4DFB4B, 0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A,
+    0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35, 0xAA64D611, 0x580F5512,
+    0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD,
+    0x1642AE59, 0xE4292D5A, 0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A,
+    0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595, 0x417B1DBC, 0xB3109EBF,
+    0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F,
+    0xED03A29B, 0x1F682198, 0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927,
+    0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38, 0xDBFC821C, 0x2997011F,
+    0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E,
+    0x4767748A, 0xB50CF789, 0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859,
+    0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46, 0x7198540D, 0x83F3D70E,
+    0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE,
+    0xDDE0EB2A, 0x2F8B6829, 0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C,
+    0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93, 0x082F63B7, 0xFA44E0B4,
+    0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B,
+    0xB4091BFF, 0x466298FC, 0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C,
+    0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033, 0xA24BB5A6, 0x502036A5,
+    0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975,
+    0x0E330A81, 0xFC588982, 0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D,
+    0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622, 0x38CC2A06, 0xCAA7A905,
+    0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8,
+    0xE52CC12C, 0x1747422F, 0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF,
+    0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0, 0xD3D3E1AB, 0x21B862A8,
+    0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78,
+    0x7FAB5E8C, 0x8DC0DD8F, 0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE,
+    0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1, 0x69E9F0D5, 0x9B8273D6,
+    0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69,
+    0xD5CF889D, 0x27A40B9E, 0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E,
+    0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351,
+};
+#endif
+
+/**
+ * Multiplies two polynomials modulo the (bit-reflected) CRC polynomial.
+ */
+static uint32_t crc_multmodp(uint32_t a, uint32_t b, uint32_t poly)
 {
-    if (length < 0) {
-        length = str_get_len(prefix);
+    uint32_t m = (uint32_t) 1 << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ poly : b >> 1;
     }
 
-    return str->length >= length && memcmp(str->value, prefix, length) == 0;
+    return p;
 }
 
-bool str_ends_with_str(const Str *str, const char *suffix, int64_t length)
+/**
+ * Returns x^(8 * n) modulo the CRC polynomial, the operator that appends n zero bytes to a CRC register.
+ */
+static uint32_t crc_x8nmodp(int64_t n, uint32_t poly)
 {
-    if (length < 0) {
-        length = str_get_len(suffix);
+    uint32_t result = (uint32_t) 1 << 31;
+    uint32_t power = (uint32_t) 1 << (31 - 8);
+
+    while (n > 0) {
+        if (n & 1) {
+            result = crc_multmodp(power, result, poly);
+        }
+
+        power = crc_multmodp(power, power, poly);
+        n >>= 1;
     }
 
-    return length >= 0 && memcmp(STR_TAIL_P(str) - length, suffix, length) == 0;
+    return result;
 }
 
-bool str_append_char(Str *str, char c)
+static uint32_t crc_table_update(const uint32_t *table, uint32_t crc, const uint8_t *s, int64_t length)
 {
-    if (str_ensure_capacity(str, str->length + 2)) {
-        str->value[str->length++] = c;
-        str->value[str->length] = '\0';
-        return true;
+    for (int64_t i = 0; i < length; i++) {
+        crc = table[(crc ^ s[i]) & 0xFF] ^ (crc >> 8);
     }
 
-    return false;
+    return crc;
 }
 
-bool str_append_str(Str *str, const char *s, int64_t len)
+#if defined(__PCLMUL__) && defined(__SSE4_1__)
+/**
+ * Folds 16-byte blocks with carry-less multiplication (Gopal et al., "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction"). The length must be a multiple of 16 and at least 64.
+ * Takes and returns the raw (not inverted) CRC register.
+ */
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *s, int64_t length)
 {
-    if (len < 0) {
-        len = str_get_len(s);
+    const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124);
+    const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (s + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *) (s + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *) (s + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *) (s + 0x30));
+    __m128i x5;
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    s += 64;
+    length -= 64;
+
+    /* Fold 4 blocks in parallel */
+    while (length >= 64) {
+        __m128i y1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i y2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i y3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i y4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, y1), _mm_loadu_si128((const __m128i *) (s + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, y2), _mm_loadu_si128((const __m128i *) (s + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, y3), _mm_loadu_si128((const __m128i *) (s + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, y4), _mm_loadu_si128((const __m128i *) (s + 0x30)));
+
+        s += 64;
+        length -= 64;
     }
 
-    int64_t new_length = str->length + len;
-    if (str_ensure_capacity(str, new_length + 1)) {
-        memcpy(STR_TAIL_P(str), s, len);
-        str->value[new_length] = '\0';
-        str->length = new_length;
-        return true;
+    /* Fold into 128 bits */
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold the remaining 16-byte blocks */
+    while (length >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) s)), x5);
+
+        s += 16;
+        length -= 16;
     }
 
-    return false;
+    /* Fold 128 bits into 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
 }
+#endif
 
-bool str_append_format(Str *str, const char *format, ...)
+#if defined(__SSE4_2__) && defined(__x86_64__)
+/**
+ * Computes CRC-32C with the crc32 instruction. Long inputs are split into 3 lanes that are processed
+ * in parallel to hide the latency of the instruction, and the lanes are recombined with a multiplication.
+ * Takes and returns the raw (not inverted) CRC register.
+ */
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *s, int64_t length)
 {
-    va_list args;
-    va_start(args, format);
-
-    int length = vsnprintf(NULL, 0, format, args);
-    int64_t new_length = str->length + length;
+    uint64_t a = crc;
 
-    bool result = false;
+    while (length >= 3 * CRC32C_LANE) {
+        uint64_t b = 0;
+        uint64_t c = 0;
 
-    if (str_ensure_capacity(str, new_length + 1)) {
-        int written = vsnprintf(STR_TAIL_P(str), str->size - str->length, format, args);
+        for (int64_t i = 0; i < CRC32C_LANE; i += 8) {
+            uint64_t va, vb, vc;
+            memcpy(&va, s + i, 8);
+            memcpy(&vb, s + CRC32C_LANE + i, 8);
+            memcpy(&vc, s + 2 * CRC32C_LANE + i, 8);
 
-        if (written == length) {
-            result = true;
-            str->value[new_length] = '\0';
-            str->length = new_length;
-            result = true;
-        } else {
-            /* Restore \0 if vsnprintf() removed it */
-            str->value[str->length] = '\0';
+            a = _mm_crc32_u64(a, va);
+            b = _mm_crc32_u64(b, vb);
+            c = _mm_crc32_u64(c, vc);
         }
+
+        a = crc_multmodp(CRC32C_SHIFT_2LANES, (uint32_t) a, CRC32C_POLY)
+            ^ crc_multmodp(CRC32C_SHIFT_LANE, (uint32_t) b, CRC32C_POLY)
+            ^ c;
+
+        s += 3 * CRC32C_LANE;
+        length -= 3 * CRC32C_LANE;
     }
 
-    va_end(args);
-    return result;
-}
+    for (; length >= 8; s += 8, length -= 8) {
+        uint64_t v;
+        memcpy(&v, s, 8);
+        a = _mm_crc32_u64(a, v);
+    }
 
-static char *uint_to_string(char *buffer, uint64_t n, uint64_t base)
-{
-    *buffer = '\0';
-    do {
-        *--buffer = (char) ((n % base) + '0');
-        n /= base;
-    } while (n > 0);
+    uint32_t result = (uint32_t) a;
+    for (; length > 0; s++, length--) {
+        result = _mm_crc32_u8(result, *s);
+    }
 
-    return buffer;
+    return result;
 }
+#endif
 
-static char *int_to_string(char *buffer, int64_t n, uint64_t base)
+/**
+ * Sets the new length of the string after bytes were written past its end and restores the NULL terminator.
+ */
+static inline void str_commit_append(Str *str, int64_t length)
 {
-    if (n < 0) {
-        char *result = uint_to_string(buffer, ~((uint64_t) n) + 1, base);
-        *--result = '-';
-        return result;
-    } else {
-        return uint_to_string(buffer, n, base);
-    }
+    str->length = length;
+    str->value[length] = '\0';
 }
 
-bool str_append_int(Str *str, int64_t value)
+/**
+ * Records that bytes already in the string were changed or removed, so that its digests start over.
+ * The in-place functions take a const Str: they modify its bytes, and only this bookkeeping field.
+ */
+static inline void str_modified(const Str *str)
 {
-    if ((uint64_t) value <= 9) {
-        return str_append_char(str, (char) (value + '0'));
-    } else {
-        char buffer[UINT64_MAX_STRLEN + 1];
-        char *result = int_to_string(buffer + sizeof(buffer) - 1, value, 10);
-        return str_append_str(str, result, (int64_t) (buffer + sizeof(buffer) - 1 - result));
-    }
+    ((Str *) str)->generation++;
 }
 
-bool str_append_uint(Str *str, uint64_t value)
+/**
+ * Returns the number of significant bits of the value (at least 1).
+ */
+static inline int str_bit_length(uint64_t value)
 {
-    if (value <= 9) {
-        return str_append_char(str, (char) (value + '0'));
-    } else {
-        char buffer[UINT64_MAX_STRLEN + 1];
-        char *result = uint_to_string(buffer + sizeof(buffer) - 1, value, 10);
-        return str_append_str(str, result, (int64_t) (buffer + sizeof(buffer) - 1 - result));
+#if defined(__GNUC__)
+    return 64 - __builtin_clzll(value | 1);
+#else
+    int n = 1;
+    while (value >>= 1) {
+        n++;
     }
+
+    return n;
+#endif
 }
 
-bool str_append_float(Str *str, double value, int precision)
+static inline uint64_t str_load_u64le(const char *s)
 {
-    return str_append_format(str, "%.*f", precision, value);
+    uint64_t value;
+    memcpy(&value, s, 8);
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
 }
 
-static void str_case_convert(const Str *str, int (*convert)(int))
+/**
+ * Returns the number of leading bytes that `a` and `b` have in common, comparing up to `limit` bytes.
+ * Compares 8 bytes at a time.
+ */
+static int64_t str_common_prefix(const uint8_t *a, const uint8_t *b, int64_t limit)
 {
-    char *s = str->value;
-    const char *e = STR_TAIL_P(str);
+    int64_t n = 0;
 
-    while (s < e) {
-        *s = (char) convert(*s);
-        s++;
-    }
+    for (; n + 8 <= limit; n += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+
+        if (x != y) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return n + (__builtin_ctzll(x ^ y) >> 3);
+#else
+            break;
+#endif
+        }
+    }
+
+    while (n < limit && a[n] == b[n]) {
+        n++;
+    }
+
+    return n;
 }
 
-void str_to_lower(const Str *str)
+/**
+ * Returns the number of trailing bytes that `a` and `b` have in common, comparing up to `limit` bytes.
+ * `a` and `b` point past the end of the texts. Compares 8 bytes at a time.
+ */
+static int64_t str_common_suffix(const uint8_t *a, const uint8_t *b, int64_t limit)
 {
-    str_case_convert(str, tolower);
+    int64_t n = 0;
+
+    for (; n + 8 <= limit; n += 8) {
+        uint64_t x, y;
+        memcpy(&x, a - n - 8, 8);
+        memcpy(&y, b - n - 8, 8);
+
+        if (x != y) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return n + (__builtin_clzll(x ^ y) >> 3);
+#else
+            break;
+#endif
+        }
+    }
+
+    while (n < limit && a[-n - 1] == b[-n - 1]) {
+        n++;
+    }
+
+    return n;
 }
 
-void str_to_upper(const Str *str)
+static inline uint32_t lz4_read32(const uint8_t *p)
 {
-    str_case_convert(str, toupper);
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
 }
 
-void str_trim(Str *str, StrTrimOptions options)
+static inline uint32_t lz4_hash(uint32_t v, int hash_log)
 {
-    const char *s = str->value;
-    const char *e = STR_TAIL_P(str);
+    return (v * 2654435761U) >> (32 - hash_log);
+}
 
-    if (options & STR_TRIM_LEFT) {
-        for (; s < e; s++) {
-            if (!isspace(*s)) {
-                break;
+static uint8_t *lz4_write_length(uint8_t *op, int64_t length)
+{
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+/**
+ * Writes a sequence: the literals followed by a match. A match length of zero writes the last literals.
+ */
+static uint8_t *lz4_write_sequence(uint8_t *op, const uint8_t *literals, int64_t literal_length,
+                                   int64_t offset, int64_t match_length)
+{
+    uint8_t *token = op++;
+
+    if (literal_length >= 15) {
+        *token = 15 << 4;
+        op = lz4_write_length(op, literal_length - 15);
+    } else {
+        *token = (uint8_t) (literal_length << 4);
+    }
+
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length == 0) {
+        return op;
+    }
+
+    *op++ = (uint8_t) offset;
+    *op++ = (uint8_t) (offset >> 8);
+
+    match_length -= LZ4_MIN_MATCH;
+    if (match_length >= 15) {
+        *token |= 15;
+        op = lz4_write_length(op, match_length - 15);
+    } else {
+        *token |= (uint8_t) match_length;
+    }
+
+    return op;
+}
+
+/**
+ * Greedy compressor: a single hash table remembers the last position of each 4-byte prefix.
+ */
+static uint8_t *lz4_compress_fast(const uint8_t *src, int64_t length, uint8_t *op)
+{
+    int32_t table[1 << LZ4_HASH_LOG];
+    const uint8_t *anchor = src;
+
+    if (length > LZ4_MF_LIMIT) {
+        const uint8_t *ip = src;
+        const uint8_t *match_limit = src + length - LZ4_LAST_LITERALS;
+        const uint8_t *mf_limit = src + length - LZ4_MF_LIMIT;
+        int64_t misses = 0;
+
+        memset(table, 0xFF, sizeof(table));
+
+        while (ip <= mf_limit) {
+            uint32_t sequence = lz4_read32(ip);
+            uint32_t h = lz4_hash(sequence, LZ4_HASH_LOG);
+            int32_t candidate = table[h];
+
+            table[h] = (int32_t) (ip - src);
+
+            if (candidate < 0 || ip - src - candidate > LZ4_MAX_OFFSET || lz4_read32(src + candidate) != sequence) {
+                /* Step faster through incompressible data */
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+
+            const uint8_t *ref = src + candidate;
+            misses = 0;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            int64_t match_length = LZ4_MIN_MATCH + str_common_prefix(
+                ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, match_limit - ip - LZ4_MIN_MATCH
+            );
+
+            op = lz4_write_sequence(op, anchor, ip - anchor, ip - ref, match_length);
+            ip += match_length;
+            anchor = ip;
+
+            if (ip <= mf_limit) {
+                table[lz4_hash(lz4_read32(ip - 2), LZ4_HASH_LOG)] = (int32_t) (ip - 2 - src);
             }
         }
+    }
 
-        if (s == e) {
-            /* Trim to empty string */
-            str->value[0] = '\0';
-            str->length = 0;
-            return;
+    return lz4_write_sequence(op, anchor, src + length - anchor, 0, 0);
+}
+
+typedef struct Lz4HcState
+{
+    const uint8_t *src;
+    int32_t *head;
+    int32_t *chain;
+    int64_t next_to_insert;
+    int max_attempts;
+} Lz4HcState;
+
+/**
+ * Finds the longest match for the given position by walking the hash chain. Returns its length (0 if none).
+ */
+static int64_t lz4_hc_find(Lz4HcState *state, const uint8_t *ip, const uint8_t *match_limit, const uint8_t **match)
+{
+    const uint8_t *src = state->src;
+    int64_t position = ip - src;
+
+    /* Insert every position up to this one into the chains */
+    for (; state->next_to_insert <= position; state->next_to_insert++) {
+        int64_t p = state->next_to_insert;
+        uint32_t h = lz4_hash(lz4_read32(src + p), LZ4_HC_HASH_LOG);
+        state->chain[p & (LZ4_HC_WINDOW - 1)] = state->head[h];
+        state->head[h] = (int32_t) p;
+    }
+
+    uint32_t sequence = lz4_read32(ip);
+    int64_t best = 0;
+    int32_t candidate = state->chain[position & (LZ4_HC_WINDOW - 1)];
+
+    for (int attempts = state->max_attempts; candidate >= 0 && attempts > 0; attempts--) {
+        if (position - candidate > LZ4_MAX_OFFSET) {
+            break;
         }
 
-        str->length -= s - str->value;
-        if (s > str->value) {
-            memmove(str->value, s, str->length);
+        const uint8_t *ref = src + candidate;
+        if (lz4_read32(ref) == sequence) {
+            int64_t length = LZ4_MIN_MATCH + str_common_prefix(
+                ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, match_limit - ip - LZ4_MIN_MATCH
+            );
+
+            if (length > best) {
+                best = length;
+                *match = ref;
+            }
         }
+
+        candidate = state->chain[candidate & (LZ4_HC_WINDOW - 1)];
     }
 
-    if (options & STR_TRIM_RIGHT) {
-        for (e = e - 1; e >= s; e--) {
-            if (!isspace(*e)) {
-                break;
+    return best;
+}
+
+/**
+ * High compression: hash chains over the 64 KiB window plus one step of lazy matching.
+ */
+static uint8_t *lz4_compress_hc(const uint8_t *src, int64_t length, uint8_t *op, int max_attempts)
+{
+    const uint8_t *anchor = src;
+
+    if (length > LZ4_MF_LIMIT) {
+        Lz4HcState state;
+        state.src = src;
+        state.head = malloc(sizeof(int32_t) * ((1 << LZ4_HC_HASH_LOG) + LZ4_HC_WINDOW));
+        state.next_to_insert = 0;
+        state.max_attempts = max_attempts;
+
+        if (state.head == NULL) {
+            return NULL;
+        }
+
+        state.chain = state.head + (1 << LZ4_HC_HASH_LOG);
+        memset(state.head, 0xFF, sizeof(int32_t) * ((1 << LZ4_HC_HASH_LOG) + LZ4_HC_WINDOW));
+
+        const uint8_t *ip = src;
+        const uint8_t *match_limit = src + length - LZ4_LAST_LITERALS;
+        const uint8_t *mf_limit = src + length - LZ4_MF_LIMIT;
+
+        while (ip <= mf_limit) {
+            const uint8_t *match;
+            int64_t match_length = lz4_hc_find(&state, ip, match_limit, &match);
+
+            if (match_length == 0) {
+                ip++;
+                continue;
+            }
+
+            /* Prefer a longer match starting at the next byte */
+            while (ip + 1 <= mf_limit) {
+                const uint8_t *next_match;
+                int64_t next_length = lz4_hc_find(&state, ip + 1, match_limit, &next_match);
+
+                if (next_length <= match_length) {
+                    break;
+                }
+
+                ip++;
+                match = next_match;
+                match_length = next_length;
             }
+
+            op = lz4_write_sequence(op, anchor, ip - anchor, ip - match, match_length);
+            ip += match_length;
+            anchor = ip;
         }
 
-        str->length = e - s + 1;
+        free(state.head);
     }
 
-    str->value[str->length] = '\0';
+    return lz4_write_sequence(op, anchor, src + length - anchor, 0, 0);
 }
 
-bool str_repeat(Str *str, int multiply)
+bool str_init_size(Str *str, int64_t size)
 {
-    if (multiply < 0) {
-        return false;
+    char *mem = malloc(sizeof(char) * size);
+    if (mem) {
+        str->value = mem;
+        str->size = size;
+        str->length = 0;
+        str->generation = 0;
+        mem[0] = '\0';
+        return true;
     }
 
-    if (multiply == 0 || str->length == 0) {
-        // Truncate to empty
-        str->value[0] = '\0';
+    return false;
+}
+
+void str_finalize(Str *str)
+{
+    if (str && str->value) {
+        free(str->value);
+        str->value = NULL;
+        str->size = 0;
         str->length = 0;
+    }
+}
+
+bool str_set_size(Str *str, int64_t size)
+{
+    char *mem = realloc(str->value, sizeof(char) * size);
+    if (mem) {
+        str->value = mem;
+        str->size = size;
+
+        if (str->length >= size) {
+            str->length = size - 1;
+            str->value[str->length] = '\0';
+            str_modified(str);
+        }
+
         return true;
     }
 
-    int64_t length = str->length * multiply;
-    if (str_ensure_capacity(str, length + 1)) {
-        if (str->length == 1) {
-            memset(str->value, str->value[0], length);
-        } else {
-            char *s = STR_TAIL_P(str);
-            const char *e = str->value + length;
+    return false;
+}
 
-            while (s < e) {
-                memmove(s, str->value, str->length);
-                s += str->length;
-            }
+bool str_set_length(Str *str, int64_t length)
+{
+    if (str_ensure_capacity(str, length + 1)) {
+        if (length > str->length) {
+            memset(STR_TAIL_P(str), 0, length - str->length);
+        } else if (length < str->length) {
+            str_modified(str);
         }
 
         str->value[length] = '\0';
@@ -417,3 +1090,5544 @@ bool str_repeat(Str *str, int multiply)
 
     return false;
 }
+
+bool str_ensure_capacity(Str *str, int64_t min_size)
+{
+    if (min_size > str->size) {
+        int64_t size = str->size * 2;
+
+        if (min_size > size) {
+            size = min_size;
+        }
+
+        return str_set_size(str, size);
+    }
+
+    /* Allocated memory is large enough */
+    return true;
+}
+
+bool str_copy(const Str *source, Str *destination)
+{
+    if (str_init_size(destination, source->length + 1)) {
+        memcpy(destination->value, source->value, source->length);
+        destination->value[source->length] = '\0';
+        destination->length = source->length;
+        return true;
+    }
+
+    return false;
+}
+
+void str_digest_init(StrDigest *digest, Str *str)
+{
+    digest->str = str;
+    str_digest_reset(digest);
+}
+
+void str_digest_reset(StrDigest *digest)
+{
+    digest->fnv1a = FNV1A_64_OFFSET_BASIS;
+    digest->crc32 = 0;
+    digest->length = 0;
+    digest->generation = digest->str->generation;
+}
+
+/**
+ * Feeds the bytes appended to the string since the last update. If the string was shrunk or edited in place
+ * meanwhile, its generation changed and the digest starts over. (The length check catches a truncation
+ * made by writing `length` directly.)
+ */
+static void str_digest_update(StrDigest *digest)
+{
+    const Str *str = digest->str;
+
+    if (str->generation != digest->generation || str->length < digest->length) {
+        str_digest_reset(digest);
+    }
+
+    const char *s = str->value + digest->length;
+    int64_t length = str->length - digest->length;
+
+    digest->fnv1a = str_fnv1a_update(digest->fnv1a, s, length);
+    digest->crc32 = str_crc32_update(digest->crc32, s, length);
+    digest->length = str->length;
+}
+
+bool str_digest_append(StrDigest *digest, const char *s, int64_t length)
+{
+    if (!str_append_str(digest->str, s, length)) {
+        return false;
+    }
+
+    /* The bytes were just copied, so they are hashed while they are still in the cache */
+    str_digest_update(digest);
+    return true;
+}
+
+uint64_t str_digest_fnv1a(StrDigest *digest)
+{
+    str_digest_update(digest);
+    return digest->fnv1a;
+}
+
+uint32_t str_digest_crc32(StrDigest *digest)
+{
+    str_digest_update(digest);
+    return digest->crc32;
+}
+
+uint32_t str_crc32_update(uint32_t crc, const char *s, int64_t length)
+{
+    const uint8_t *p = (const uint8_t *) s;
+    crc = ~crc;
+
+#if defined(__PCLMUL__) && defined(__SSE4_1__)
+    if (length >= 64) {
+        int64_t blocks = length & ~(int64_t) 15;
+        crc = crc32_pclmul(crc, p, blocks);
+        p += blocks;
+        length -= blocks;
+    }
+#endif
+
+    return ~crc_table_update(crc32_table, crc, p, length);
+}
+
+uint32_t str_crc32c_update(uint32_t crc, const char *s, int64_t length)
+{
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    return ~crc32c_sse42(~crc, (const uint8_t *) s, length);
+#else
+    return ~crc_table_update(crc32c_table, ~crc, (const uint8_t *) s, length);
+#endif
+}
+
+uint32_t str_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t length2)
+{
+    return crc_multmodp(crc_x8nmodp(length2, CRC32_POLY), crc1, CRC32_POLY) ^ crc2;
+}
+
+uint32_t str_crc32c_combine(uint32_t crc1, uint32_t crc2, int64_t length2)
+{
+    return crc_multmodp(crc_x8nmodp(length2, CRC32C_POLY), crc1, CRC32C_POLY) ^ crc2;
+}
+
+uint32_t str_adler32_update(uint32_t adler, const char *s, int64_t length)
+{
+    const uint8_t *p = (const uint8_t *) s;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (length > 0) {
+        /* Defer the modulo as long as the sums cannot overflow */
+        int64_t n = MIN(length, ADLER32_NMAX);
+        length -= n;
+
+        for (; n >= 4; n -= 4, p += 4) {
+            a += p[0];
+            b += a;
+            a += p[1];
+            b += a;
+            a += p[2];
+            b += a;
+            a += p[3];
+            b += a;
+        }
+
+        for (; n > 0; n--, p++) {
+            a += *p;
+            b += a;
+        }
+
+        a %= ADLER32_BASE;
+        b %= ADLER32_BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+uint32_t str_adler32_combine(uint32_t adler1, uint32_t adler2, int64_t length2)
+{
+    uint32_t rem = (uint32_t) (length2 % ADLER32_BASE);
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (rem * sum1) % ADLER32_BASE;
+
+    sum1 += (adler2 & 0xFFFF) + ADLER32_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER32_BASE - rem;
+
+    if (sum1 >= ADLER32_BASE) {
+        sum1 -= ADLER32_BASE;
+    }
+
+    if (sum1 >= ADLER32_BASE) {
+        sum1 -= ADLER32_BASE;
+    }
+
+    if (sum2 >= (ADLER32_BASE << 1)) {
+        sum2 -= (ADLER32_BASE << 1);
+    }
+
+    if (sum2 >= ADLER32_BASE) {
+        sum2 -= ADLER32_BASE;
+    }
+
+    return (sum2 << 16) | sum1;
+}
+
+static inline uint64_t xxh64_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH64_PRIME_2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH64_PRIME_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+static inline uint64_t xxh64_read64(const uint8_t *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24
+           | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static inline uint32_t xxh64_read32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+uint64_t str_xxh64_str(const char *s, int64_t length, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *) s;
+    const uint8_t *e = p + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + XXH64_PRIME_1 + XXH64_PRIME_2;
+        uint64_t v2 = seed + XXH64_PRIME_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH64_PRIME_1;
+
+        for (; p + 32 <= e; p += 32) {
+            v1 = xxh64_round(v1, xxh64_read64(p));
+            v2 = xxh64_round(v2, xxh64_read64(p + 8));
+            v3 = xxh64_round(v3, xxh64_read64(p + 16));
+            v4 = xxh64_round(v4, xxh64_read64(p + 24));
+        }
+
+        hash = xxh64_rotl(v1, 1) + xxh64_rotl(v2, 7) + xxh64_rotl(v3, 12) + xxh64_rotl(v4, 18);
+        hash = xxh64_merge_round(hash, v1);
+        hash = xxh64_merge_round(hash, v2);
+        hash = xxh64_merge_round(hash, v3);
+        hash = xxh64_merge_round(hash, v4);
+    } else {
+        hash = seed + XXH64_PRIME_5;
+    }
+
+    hash += (uint64_t) length;
+
+    for (; p + 8 <= e; p += 8) {
+        hash ^= xxh64_round(0, xxh64_read64(p));
+        hash = xxh64_rotl(hash, 27) * XXH64_PRIME_1 + XXH64_PRIME_4;
+    }
+
+    if (p + 4 <= e) {
+        hash ^= (uint64_t) xxh64_read32(p) * XXH64_PRIME_1;
+        hash = xxh64_rotl(hash, 23) * XXH64_PRIME_2 + XXH64_PRIME_3;
+        p += 4;
+    }
+
+    for (; p < e; p++) {
+        hash ^= *p * XXH64_PRIME_5;
+        hash = xxh64_rotl(hash, 11) * XXH64_PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH64_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= XXH64_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+int str_compare(const Str *a, const Str *b)
+{
+    return str_memncmp(a->value, a->length, b->value, b->length);
+}
+
+int str_compare_str(const Str *str, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    return str_memncmp(str->value, str->length, s, length);
+}
+
+static inline bool str_is_digit(uint8_t c)
+{
+    return (unsigned) (c - '0') < 10;
+}
+
+/**
+ * Compares two strings in natural order. Equal bytes are skipped 8 at a time; a skipped prefix that ends
+ * inside a run of digits is backed up to the start of the run, which is then compared by value.
+ */
+static int str_natural_cmp(const uint8_t *a, int64_t a_length, const uint8_t *b, int64_t b_length)
+{
+    int64_t i = 0, j = 0;
+    int zeros = 0;
+
+    for (;;) {
+        int64_t p = str_common_prefix(a + i, b + j, MIN(a_length - i, b_length - j));
+
+        if ((i + p < a_length && str_is_digit(a[i + p])) || (j + p < b_length && str_is_digit(b[j + p]))) {
+            while (p > 0 && str_is_digit(a[i + p - 1])) {
+                p--;
+            }
+        }
+
+        i += p;
+        j += p;
+
+        if (i == a_length || j == b_length) {
+            break;
+        }
+
+        if (!str_is_digit(a[i]) || !str_is_digit(b[j])) {
+            return a[i] < b[j] ? -1 : 1;
+        }
+
+        int64_t a_digits = i, b_digits = j;
+        while (a_digits < a_length && a[a_digits] == '0') {
+            a_digits++;
+        }
+
+        while (b_digits < b_length && b[b_digits] == '0') {
+            b_digits++;
+        }
+
+        int64_t a_end = a_digits, b_end = b_digits;
+        while (a_end < a_length && str_is_digit(a[a_end])) {
+            a_end++;
+        }
+
+        while (b_end < b_length && str_is_digit(b[b_end])) {
+            b_end++;
+        }
+
+        /* Without leading zeros, the longer number is the greater one */
+        if (a_end - a_digits != b_end - b_digits) {
+            return a_end - a_digits < b_end - b_digits ? -1 : 1;
+        }
+
+        int r = memcmp(a + a_digits, b + b_digits, a_end - a_digits);
+        if (r != 0) {
+            return r < 0 ? -1 : 1;
+        }
+
+        if (zeros == 0 && a_digits - i != b_digits - j) {
+            zeros = a_digits - i < b_digits - j ? -1 : 1;
+        }
+
+        i = a_end;
+        j = b_end;
+    }
+
+    if (i < a_length || j < b_length) {
+        return i < a_length ? 1 : -1;
+    }
+
+    return zeros;
+}
+
+int str_compare_natural(const Str *a, const Str *b)
+{
+    return str_natural_cmp((const uint8_t *) a->value, a->length, (const uint8_t *) b->value, b->length);
+}
+
+int str_compare_natural_str(const Str *str, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    return str_natural_cmp((const uint8_t *) str->value, str->length, (const uint8_t *) s, length);
+}
+
+/**
+ * Writes a count so that smaller counts compare lower with memcmp(): one byte below 255, otherwise 255
+ * followed by the count in big-endian order.
+ */
+static inline char *str_natural_key_count(char *p, uint64_t count)
+{
+    if (count < 0xFF) {
+        *p++ = (char) count;
+        return p;
+    }
+
+    *p++ = (char) 0xFF;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        *p++ = (char) (count >> shift);
+    }
+
+    return p;
+}
+
+bool str_append_natural_key(Str *str, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    if (!str_ensure_capacity(str, str->length + 4 * length + 2 + 1)) {
+        return false;
+    }
+
+    const uint8_t *src = (const uint8_t *) s;
+    char *p = STR_TAIL_P(str);
+    int64_t runs = 0;
+
+    /*
+     * Other bytes are copied, with NUL escaped as NUL 0x01 so the terminator NUL NUL sorts before
+     * anything that could follow. A digit run is '0' (which orders against other bytes as any digit
+     * does), its number of significant digits, then the digits packed two per byte.
+     */
+    for (int64_t i = 0; i < length;) {
+        if (!str_is_digit(src[i])) {
+            *p++ = (char) src[i];
+            if (src[i] == 0) {
+                *p++ = 0x01;
+            }
+
+            i++;
+            continue;
+        }
+
+        int64_t digits = i;
+        while (digits < length && src[digits] == '0') {
+            digits++;
+        }
+
+        int64_t end = digits;
+        while (end < length && str_is_digit(src[end])) {
+            end++;
+        }
+
+        *p++ = '0';
+        p = str_natural_key_count(p, (uint64_t) (end - digits));
+
+        for (int64_t d = digits; d < end; d += 2) {
+            uint8_t low = d + 1 < end ? (uint8_t) (src[d + 1] - '0') : 0;
+            *p++ = (char) ((uint8_t) (src[d] - '0') << 4 | low);
+        }
+
+        runs++;
+        i = end;
+    }
+
+    *p++ = 0;
+    *p++ = 0;
+
+    /* The leading zeros of each run only break ties between otherwise equal keys */
+    for (int64_t i = 0; runs > 0 && i < length;) {
+        if (!str_is_digit(src[i])) {
+            i++;
+            continue;
+        }
+
+        int64_t digits = i;
+        while (digits < length && src[digits] == '0') {
+            digits++;
+        }
+
+        p = str_natural_key_count(p, (uint64_t) (digits - i));
+
+        while (digits < length && str_is_digit(src[digits])) {
+            digits++;
+        }
+
+        i = digits;
+    }
+
+    str_commit_append(str, p - str->value);
+    return true;
+}
+
+bool str_equals_str(const Str *a, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    return a->length == length && memcmp(a->value, s, length) == 0;
+}
+
+int64_t str_indexof_str(const Str *str, const char *substr, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(substr);
+    }
+
+    const char *r = str_memnstr(str->value, str->length, substr, length);
+    if (r) {
+        return (int64_t) (r - str->value);
+    } else {
+        return -1;
+    }
+}
+
+bool str_contains_str(const Str *str, const char *substr, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(substr);
+    }
+
+    const char *r = str_memnstr(str->value, str->length, substr, length);
+    return r != NULL;
+}
+
+bool str_starts_with_str(const Str *str, const char *prefix, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(prefix);
+    }
+
+    return str->length >= length && memcmp(str->value, prefix, length) == 0;
+}
+
+bool str_ends_with_str(const Str *str, const char *suffix, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(suffix);
+    }
+
+    return length >= 0 && memcmp(STR_TAIL_P(str) - length, suffix, length) == 0;
+}
+
+int64_t str_find_any(const Str *str, int64_t offset, const char *set, int64_t length)
+{
+    return str_find_in_set(str, offset, set, length, true);
+}
+
+int64_t str_find_not_any(const Str *str, int64_t offset, const char *set, int64_t length)
+{
+    return str_find_in_set(str, offset, set, length, false);
+}
+
+int64_t str_span(const Str *str, int64_t offset, const char *set, int64_t length)
+{
+    if (offset < 0 || offset >= str->length) {
+        return 0;
+    }
+
+    int64_t index = str_find_in_set(str, offset, set, length, false);
+    return (index < 0 ? str->length : index) - offset;
+}
+
+int64_t str_cspan(const Str *str, int64_t offset, const char *set, int64_t length)
+{
+    if (offset < 0 || offset >= str->length) {
+        return 0;
+    }
+
+    int64_t index = str_find_in_set(str, offset, set, length, true);
+    return (index < 0 ? str->length : index) - offset;
+}
+
+bool str_append_char(Str *str, char c)
+{
+    if (str_ensure_capacity(str, str->length + 2)) {
+        str->value[str->length++] = c;
+        str->value[str->length] = '\0';
+        return true;
+    }
+
+    return false;
+}
+
+bool str_append_str(Str *str, const char *s, int64_t len)
+{
+    if (len < 0) {
+        len = str_get_len(s);
+    }
+
+    int64_t new_length = str->length + len;
+    if (str_ensure_capacity(str, new_length + 1)) {
+        memcpy(STR_TAIL_P(str), s, len);
+        str->value[new_length] = '\0';
+        str->length = new_length;
+        return true;
+    }
+
+    return false;
+}
+
+bool str_append_format(Str *str, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    bool result = str_append_vformat(str, format, args);
+    va_end(args);
+    return result;
+}
+
+bool str_append_vformat(Str *str, const char *format, va_list args)
+{
+    /* The arguments are consumed twice: once to measure, once to write */
+    va_list measure;
+    va_copy(measure, args);
+    int length = vsnprintf(NULL, 0, format, measure);
+    va_end(measure);
+
+    if (length < 0) {
+        return false;
+    }
+
+    int64_t new_length = str->length + length;
+
+    if (str_ensure_capacity(str, new_length + 1)) {
+        int written = vsnprintf(STR_TAIL_P(str), str->size - str->length, format, args);
+
+        if (written == length) {
+            str_commit_append(str, new_length);
+            return true;
+        }
+
+        /* Restore \0 if vsnprintf() removed it */
+        str->value[str->length] = '\0';
+    }
+
+    return false;
+}
+
+static const char str_digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline void str_write_2digits(char *p, unsigned value)
+{
+    memcpy(p, &str_digit_pairs[value * 2], 2);
+}
+
+static const char str_base_digits_lower[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+static const char str_base_digits_upper[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/**
+ * Writes the digits of n in the given base backwards from `end`. Returns a pointer to the first digit.
+ */
+static char *uint_to_string(char *end, uint64_t n, unsigned base, const char *digits)
+{
+    if ((base & (base - 1)) == 0) {
+        /* Powers of two only need shifts and masks */
+        int shift = str_bit_length(base) - 1;
+        do {
+            *--end = digits[n & (base - 1)];
+            n >>= shift;
+        } while (n > 0);
+    } else {
+        do {
+            *--end = digits[n % base];
+            n /= base;
+        } while (n > 0);
+    }
+
+    return end;
+}
+
+/**
+ * Writes the decimal digits of n backwards from `end`, two at a time. Returns a pointer to the first digit.
+ */
+static char *uint_to_decimal(char *end, uint64_t n)
+{
+    while (n >= 100) {
+        end -= 2;
+        str_write_2digits(end, (unsigned) (n % 100));
+        n /= 100;
+    }
+
+    if (n >= 10) {
+        end -= 2;
+        str_write_2digits(end, (unsigned) n);
+    } else {
+        *--end = (char) ('0' + n);
+    }
+
+    return end;
+}
+
+static int str_decimal_length(uint64_t n)
+{
+    int length = 1;
+
+    for (;;) {
+        if (n < 10) {
+            return length;
+        }
+        if (n < 100) {
+            return length + 1;
+        }
+        if (n < 1000) {
+            return length + 2;
+        }
+        if (n < 10000) {
+            return length + 3;
+        }
+
+        n /= 10000;
+        length += 4;
+    }
+}
+
+static int str_base_length(uint64_t n, unsigned base)
+{
+    if ((base & (base - 1)) == 0) {
+        int shift = str_bit_length(base) - 1;
+        return (str_bit_length(n) + shift - 1) / shift;
+    }
+
+    int length = 1;
+
+    while (n >= base) {
+        n /= base;
+        length++;
+    }
+
+    return length;
+}
+
+static inline uint64_t str_magnitude(int64_t value)
+{
+    return value < 0 ? ~((uint64_t) value) + 1 : (uint64_t) value;
+}
+
+/**
+ * Appends an optional minus sign and the digits of the magnitude, writing them in place.
+ */
+static bool str_append_integer(Str *str, uint64_t magnitude, bool negative, unsigned base, const char *digits)
+{
+    int length = negative + (base == 10 ? str_decimal_length(magnitude) : str_base_length(magnitude, base));
+    if (!str_ensure_capacity(str, str->length + length + 1)) {
+        return false;
+    }
+
+    char *p = STR_TAIL_P(str);
+    if (negative) {
+        *p = '-';
+    }
+
+    if (base == 10) {
+        uint_to_decimal(p + length, magnitude);
+    } else {
+        uint_to_string(p + length, magnitude, base, digits);
+    }
+
+    str_commit_append(str, str->length + length);
+    return true;
+}
+
+bool str_append_int(Str *str, int64_t value)
+{
+    return str_append_integer(str, str_magnitude(value), value < 0, 10, NULL);
+}
+
+bool str_append_uint(Str *str, uint64_t value)
+{
+    return str_append_integer(str, value, false, 10, NULL);
+}
+
+bool str_append_int_base(Str *str, int64_t value, int base, bool uppercase)
+{
+    if (base < 2 || base > 36) {
+        return false;
+    }
+
+    const char *digits = uppercase ? str_base_digits_upper : str_base_digits_lower;
+    return str_append_integer(str, str_magnitude(value), value < 0, (unsigned) base, digits);
+}
+
+bool str_append_uint_base(Str *str, uint64_t value, int base, bool uppercase)
+{
+    if (base < 2 || base > 36) {
+        return false;
+    }
+
+    const char *digits = uppercase ? str_base_digits_upper : str_base_digits_lower;
+    return str_append_integer(str, value, false, (unsigned) base, digits);
+}
+
+/**
+ * Appends an optional minus sign and the decimal digits of the magnitude, separating groups of three.
+ */
+static bool str_append_integer_grouped(Str *str, uint64_t magnitude, bool negative, char separator)
+{
+    int digits = str_decimal_length(magnitude);
+    int length = negative + digits + (digits - 1) / 3;
+    if (!str_ensure_capacity(str, str->length + length + 1)) {
+        return false;
+    }
+
+    char *p = STR_TAIL_P(str);
+    char *end = p + length;
+
+    if (negative) {
+        *p = '-';
+    }
+
+    while (magnitude >= 1000) {
+        unsigned group = (unsigned) (magnitude % 1000);
+        magnitude /= 1000;
+
+        end -= 3;
+        end[0] = (char) ('0' + group / 100);
+        str_write_2digits(end + 1, group % 100);
+        *--end = separator;
+    }
+
+    uint_to_decimal(end, magnitude);
+    str_commit_append(str, str->length + length);
+    return true;
+}
+
+bool str_append_int_grouped(Str *str, int64_t value, char separator)
+{
+    return str_append_integer_grouped(str, str_magnitude(value), value < 0, separator);
+}
+
+bool str_append_uint_grouped(Str *str, uint64_t value, char separator)
+{
+    return str_append_integer_grouped(str, value, false, separator);
+}
+
+#ifdef __SIZEOF_INT128__
+/**
+ * Appends an optional minus sign and the decimal digits of a 128-bit magnitude. The value is split into
+ * chunks of 19 digits, so that each one is formatted with 64-bit divisions.
+ */
+static bool str_append_integer128(Str *str, StrUInt128 magnitude, bool negative)
+{
+    if (magnitude <= UINT64_MAX) {
+        return str_append_integer(str, (uint64_t) magnitude, negative, 10, NULL);
+    }
+
+    uint64_t chunks[3];
+    int count = 0;
+
+    while (magnitude > UINT64_MAX) {
+        chunks[count++] = (uint64_t) (magnitude % INT128_CHUNK_DIVISOR);
+        magnitude /= INT128_CHUNK_DIVISOR;
+    }
+
+    chunks[count] = (uint64_t) magnitude;
+
+    int length = negative + str_decimal_length(chunks[count]) + count * INT128_CHUNK_DIGITS;
+    if (!str_ensure_capacity(str, str->length + length + 1)) {
+        return false;
+    }
+
+    char *p = STR_TAIL_P(str);
+    char *end = p + length;
+
+    if (negative) {
+        *p = '-';
+    }
+
+    /* The lower chunks are zero-padded to their full width */
+    for (int i = 0; i < count; i++) {
+        char *start = end - INT128_CHUNK_DIGITS;
+        char *digits = uint_to_decimal(end, chunks[i]);
+        memset(start, '0', digits - start);
+        end = start;
+    }
+
+    uint_to_decimal(end, chunks[count]);
+    str_commit_append(str, str->length + length);
+    return true;
+}
+
+bool str_append_int128(Str *str, StrInt128 value)
+{
+    StrUInt128 magnitude = value < 0 ? ~((StrUInt128) value) + 1 : (StrUInt128) value;
+    return str_append_integer128(str, magnitude, value < 0);
+}
+
+bool str_append_uint128(Str *str, StrUInt128 value)
+{
+    return str_append_integer128(str, value, false);
+}
+#endif
+
+bool str_append_float(Str *str, double value, int precision)
+{
+    return str_append_format(str, "%.*f", precision, value);
+}
+
+/**
+ * Writes the bytes padded to `width` and returns a pointer past them. Writes max(length, width) bytes.
+ */
+static char *str_write_padded(char *p, const char *s, int64_t length, int64_t width, StrAlign align, char fill)
+{
+    int64_t padding = width > length ? width - length : 0;
+    int64_t before = align == STR_ALIGN_RIGHT ? padding : align == STR_ALIGN_CENTER ? padding / 2 : 0;
+
+    memset(p, fill, before);
+    memcpy(p + before, s, length);
+    memset(p + before + length, fill, padding - before);
+    return p + length + padding;
+}
+
+bool str_append_padded(Str *str, const char *s, int64_t length, int64_t width, StrAlign align, char fill)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    int64_t total = MAX(length, width);
+    if (!str_ensure_capacity(str, str->length + total + 1)) {
+        return false;
+    }
+
+    str_write_padded(STR_TAIL_P(str), s, length, width, align, fill);
+    str_commit_append(str, str->length + total);
+    return true;
+}
+
+static bool str_append_integer_padded(Str *str, uint64_t magnitude, bool negative, int64_t width, StrAlign align,
+                                      char fill)
+{
+    int64_t length = negative + str_decimal_length(magnitude);
+    int64_t padding = width > length ? width - length : 0;
+    if (!str_ensure_capacity(str, str->length + length + padding + 1)) {
+        return false;
+    }
+
+    char *p = STR_TAIL_P(str);
+    int64_t before = align == STR_ALIGN_RIGHT ? padding : align == STR_ALIGN_CENTER ? padding / 2 : 0;
+
+    memset(p, fill, before);
+    if (negative) {
+        p[before] = '-';
+    }
+
+    uint_to_decimal(p + before + length, magnitude);
+    memset(p + before + length, fill, padding - before);
+
+    /* Like printf's %0*d, zeros go between the sign and the digits */
+    if (negative && fill == '0' && align == STR_ALIGN_RIGHT && padding > 0) {
+        p[0] = '-';
+        p[before] = '0';
+    }
+
+    str_commit_append(str, str->length + length + padding);
+    return true;
+}
+
+bool str_append_int_padded(Str *str, int64_t value, int64_t width, StrAlign align, char fill)
+{
+    return str_append_integer_padded(str, str_magnitude(value), value < 0, width, align, fill);
+}
+
+bool str_append_uint_padded(Str *str, uint64_t value, int64_t width, StrAlign align, char fill)
+{
+    return str_append_integer_padded(str, value, false, width, align, fill);
+}
+
+bool str_append_row(Str *str, const StrColumn *columns, const StrSlice *cells, int64_t count, const char *separator,
+                    int64_t separator_length)
+{
+    if (separator == NULL) {
+        separator_length = 0;
+    } else if (separator_length < 0) {
+        separator_length = str_get_len(separator);
+    }
+
+    int64_t total = count > 1 ? (count - 1) * separator_length : 0;
+    for (int64_t i = 0; i < count; i++) {
+        total += MAX(cells[i].length, columns[i].width);
+    }
+
+    if (!str_ensure_capacity(str, str->length + total + 1)) {
+        return false;
+    }
+
+    char *p = STR_TAIL_P(str);
+
+    for (int64_t i = 0; i < count; i++) {
+        if (i > 0 && separator_length > 0) {
+            memcpy(p, separator, separator_length);
+            p += separator_length;
+        }
+
+        char fill = columns[i].fill ? columns[i].fill : ' ';
+        p = str_write_padded(p, cells[i].value, cells[i].length, columns[i].width, columns[i].align, fill);
+    }
+
+    str_commit_append(str, str->length + total);
+    return true;
+}
+
+static const char str_hex_digits[] = "0123456789abcdef";
+
+static inline bool str_is_printable(uint8_t c)
+{
+    return c >= 0x20 && c < 0x7F;
+}
+
+bool str_append_hexdump(Str *str, const char *s, int64_t length, int64_t offset)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    /* Room for offsets of up to 16 digits; the dump may come out shorter */
+    int64_t line_size = 16 + 2 + HEXDUMP_HEX_WIDTH + 2 + 1;
+    int64_t total = (length + HEXDUMP_LINE_BYTES - 1) / HEXDUMP_LINE_BYTES * line_size + length;
+
+    if (!str_ensure_capacity(str, str->length + total + 1)) {
+        return false;
+    }
+
+    const uint8_t *src = (const uint8_t *) s;
+    char *p = STR_TAIL_P(str);
+
+    for (int64_t line = 0; line < length; line += HEXDUMP_LINE_BYTES) {
+        int64_t n = MIN(HEXDUMP_LINE_BYTES, length - line);
+        uint64_t position = (uint64_t) offset + (uint64_t) line;
+
+        /* Like xxd, the offset has 8 digits, or as many as it needs past 4 GiB */
+        int offset_digits = 8;
+        while (offset_digits < 16 && position >> (offset_digits * 4) != 0) {
+            offset_digits++;
+        }
+
+        for (int d = offset_digits - 1; d >= 0; d--) {
+            p[d] = str_hex_digits[position & 0x0F];
+            position >>= 4;
+        }
+
+        p += offset_digits;
+        *p++ = ':';
+        *p++ = ' ';
+
+        /* Pairs of bytes are grouped; a short last line keeps the ASCII column aligned */
+        memset(p, ' ', HEXDUMP_HEX_WIDTH + 2);
+        for (int64_t i = 0; i < n; i++) {
+            uint8_t c = src[line + i];
+            char *q = p + i * 2 + i / 2;
+            q[0] = str_hex_digits[c >> 4];
+            q[1] = str_hex_digits[c & 0x0F];
+        }
+
+        p += HEXDUMP_HEX_WIDTH + 2;
+
+        for (int64_t i = 0; i < n; i++) {
+            uint8_t c = src[line + i];
+            *p++ = str_is_printable(c) ? (char) c : '.';
+        }
+
+        *p++ = '\n';
+    }
+
+    str_commit_append(str, p - str->value);
+    return true;
+}
+
+/**
+ * The letter of the two-byte escape of each byte, or 0 if it has none.
+ */
+static const char str_escape_letters[256] = {
+    ['\a'] = 'a', ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', ['\v'] = 'v', ['\f'] = 'f', ['\r'] = 'r',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+static inline bool str_is_hex_digit(uint8_t c)
+{
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+/**
+ * Returns the length of the escaped byte. A hex digit following a \x escape is escaped too, since it
+ * would otherwise be read as part of it.
+ */
+static inline int str_escaped_length(uint8_t c, bool after_hex_escape)
+{
+    if (str_escape_letters[c]) {
+        return 2;
+    }
+
+    return str_is_printable(c) && !(after_hex_escape && str_is_hex_digit(c)) ? 1 : 4;
+}
+
+bool str_append_c_escaped(Str *str, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    const uint8_t *src = (const uint8_t *) s;
+    int64_t total = 0;
+    bool after_hex_escape = false;
+
+    for (int64_t i = 0; i < length; i++) {
+        int n = str_escaped_length(src[i], after_hex_escape);
+        total += n;
+        after_hex_escape = n == 4;
+    }
+
+    if (!str_ensure_capacity(str, str->length + total + 1)) {
+        return false;
+    }
+
+    char *p = STR_TAIL_P(str);
+    after_hex_escape = false;
+
+    for (int64_t i = 0; i < length; i++) {
+        uint8_t c = src[i];
+        int n = str_escaped_length(c, after_hex_escape);
+
+        if (n == 1) {
+            *p++ = (char) c;
+        } else if (n == 2) {
+            p[0] = '\\';
+            p[1] = str_escape_letters[c];
+            p += 2;
+        } else {
+            p[0] = '\\';
+            p[1] = 'x';
+            p[2] = str_hex_digits[c >> 4];
+            p[3] = str_hex_digits[c & 0x0F];
+            p += 4;
+        }
+
+        after_hex_escape = n == 4;
+    }
+
+    str_commit_append(str, str->length + total);
+    return true;
+}
+
+static const int64_t str_pow10[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+/**
+ * Converts days since 1970-01-01 to a proleptic Gregorian date. (Howard Hinnant's civil_from_days).
+ */
+static void str_civil_from_days(int64_t days, int64_t *year, unsigned *month, unsigned *day)
+{
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned doe = (unsigned) (days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = (int64_t) yoe + era * 400 + (*month <= 2);
+}
+
+/**
+ * The date and time of the last second rendered by str_append_timestamp(), as YYYY-MM-DDTHH:MM:SS.
+ */
+typedef struct StrTimestampCache
+{
+    int64_t seconds;
+    char text[TIMESTAMP_DATETIME_LENGTH];
+} StrTimestampCache;
+
+static STR_THREAD_LOCAL StrTimestampCache str_timestamp_cache = {INT64_MIN, {0}};
+
+static void str_render_datetime(char *p, int64_t seconds)
+{
+    int64_t days = seconds / 86400;
+    int64_t time = seconds % 86400;
+    if (time < 0) {
+        time += 86400;
+        days--;
+    }
+
+    int64_t year;
+    unsigned month, day;
+    str_civil_from_days(days, &year, &month, &day);
+
+    str_write_2digits(p, (unsigned) (year / 100));
+    str_write_2digits(p + 2, (unsigned) (year % 100));
+    p[4] = '-';
+    str_write_2digits(p + 5, month);
+    p[7] = '-';
+    str_write_2digits(p + 8, day);
+    p[10] = 'T';
+    str_write_2digits(p + 11, (unsigned) (time / 3600));
+    p[13] = ':';
+    str_write_2digits(p + 14, (unsigned) (time / 60 % 60));
+    p[16] = ':';
+    str_write_2digits(p + 17, (unsigned) (time % 60));
+}
+
+bool str_append_timestamp(Str *str, int64_t epoch, StrTimeUnit unit, int offset_minutes)
+{
+    if ((unit != STR_TIME_SECONDS && unit != STR_TIME_MILLIS && unit != STR_TIME_MICROS && unit != STR_TIME_NANOS)
+        || offset_minutes <= -1440 || offset_minutes >= 1440) {
+        return false;
+    }
+
+    int digits = (int) unit;
+    int64_t scale = str_pow10[digits];
+    int64_t seconds = epoch / scale;
+    int64_t fraction = epoch % scale;
+    if (fraction < 0) {
+        fraction += scale;
+        seconds--;
+    }
+
+    /* Checked before the offset is added, which could overflow for epochs in seconds */
+    int64_t offset_seconds = (int64_t) offset_minutes * 60;
+    if (seconds < TIMESTAMP_MIN_SECONDS - offset_seconds || seconds > TIMESTAMP_MAX_SECONDS - offset_seconds) {
+        return false;
+    }
+
+    int64_t local = seconds + offset_seconds;
+
+    int64_t length = TIMESTAMP_DATETIME_LENGTH + (digits > 0 ? digits + 1 : 0) + (offset_minutes != 0 ? 6 : 1);
+    if (!str_ensure_capacity(str, str->length + length + 1)) {
+        return false;
+    }
+
+    StrTimestampCache *cache = &str_timestamp_cache;
+    if (cache->seconds != local) {
+        str_render_datetime(cache->text, local);
+        cache->seconds = local;
+    }
+
+    char *p = STR_TAIL_P(str);
+    memcpy(p, cache->text, TIMESTAMP_DATETIME_LENGTH);
+    p += TIMESTAMP_DATETIME_LENGTH;
+
+    if (digits > 0) {
+        *p++ = '.';
+
+        /* Fill the fraction from its last digit, two at a time */
+        int i = digits;
+        for (; i >= 2; i -= 2) {
+            str_write_2digits(p + i - 2, (unsigned) (fraction % 100));
+            fraction /= 100;
+        }
+
+        if (i == 1) {
+            *p = (char) ('0' + fraction);
+        }
+
+        p += digits;
+    }
+
+    if (offset_minutes == 0) {
+        *p = 'Z';
+    } else {
+        unsigned offset = (unsigned) (offset_minutes < 0 ? -offset_minutes : offset_minutes);
+        p[0] = offset_minutes < 0 ? '-' : '+';
+        str_write_2digits(p + 1, offset / 60);
+        p[3] = ':';
+        str_write_2digits(p + 4, offset % 60);
+    }
+
+    str_commit_append(str, str->length + length);
+    return true;
+}
+
+/**
+ * Converts a proleptic Gregorian date to days since 1970-01-01. (Howard Hinnant's days_from_civil).
+ */
+static int64_t str_days_from_civil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = (unsigned) (year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (int64_t) doe - 719468;
+}
+
+/**
+ * Checks that the bytes selected by `digits` are ASCII digits and that the bytes selected by `literals`
+ * equal `pattern`, 8 bytes at a time.
+ */
+static inline bool str_swar_match(uint64_t v, uint64_t digits, uint64_t literals, uint64_t pattern)
+{
+    /* Replace the other bytes with '0', then every byte must have a high nibble of 3 both before and after adding 6 */
+    uint64_t d = (v & digits) | (SWAR_ZEROS & ~digits);
+    uint64_t check = (d & SWAR_HIGH_NIBBLES) | (((d + SWAR_SIXES) & SWAR_HIGH_NIBBLES) >> 4);
+
+    return check == SWAR_THREES && (v & literals) == pattern;
+}
+
+/**
+ * Converts every pair of digits starting at byte i into the value of byte i. The digits must be valid.
+ */
+static inline uint64_t str_swar_pairs(uint64_t v, uint64_t digits)
+{
+    uint64_t t = (v & digits) - (SWAR_ZEROS & digits);
+    return t * 10 + (t >> 8);
+}
+
+static inline bool str_parse_2digits(const char *s, unsigned *value)
+{
+    unsigned high = (unsigned) ((unsigned char) s[0] - '0');
+    unsigned low = (unsigned) ((unsigned char) s[1] - '0');
+
+    *value = high * 10 + low;
+    return high < 10 && low < 10;
+}
+
+/**
+ * Parses a UTC offset that spans the whole range: Z, +HH:MM, +HHMM or +HH.
+ */
+static bool str_parse_utc_offset(const char *s, const char *e, int64_t *offset)
+{
+    if (e - s == 1 && (*s == 'Z' || *s == 'z')) {
+        *offset = 0;
+        return true;
+    }
+
+    unsigned hours, minutes = 0;
+    if (e - s < 3 || (*s != '+' && *s != '-') || !str_parse_2digits(s + 1, &hours)) {
+        return false;
+    }
+
+    const char *p = s + 3;
+    if (p < e) {
+        p += *p == ':';
+        if (e - p != 2 || !str_parse_2digits(p, &minutes)) {
+            return false;
+        }
+    }
+
+    if (hours > 23 || minutes > 59) {
+        return false;
+    }
+
+    *offset = (int64_t) (hours * 3600 + minutes * 60) * (*s == '-' ? -1 : 1);
+    return true;
+}
+
+static bool str_timestamp_to_ns(int64_t year, unsigned month, unsigned day, unsigned hour, unsigned minute,
+                                unsigned second, int64_t fraction, int64_t offset, int64_t *epoch_ns)
+{
+    static const uint8_t days_in_month[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (month < 1 || month > 12 || day < 1 || hour > 23 || minute > 59 || second > 60) {
+        return false;
+    }
+
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day > (unsigned) (days_in_month[month - 1] + (month == 2 && leap))) {
+        return false;
+    }
+
+    /* A leap second (:60) rolls over into the next minute */
+    int64_t seconds = str_days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+    if (seconds < EPOCH_NS_MIN_SECONDS || seconds > EPOCH_NS_MAX_SECONDS) {
+        return false;
+    }
+
+    *epoch_ns = seconds * 1000000000 + fraction;
+    return true;
+}
+
+/**
+ * Parses YYYY-MM-DD, optionally followed by THH:MM:SS, a fraction and a UTC offset.
+ */
+static bool str_parse_rfc3339(const char *s, int64_t length, int64_t *epoch_ns)
+{
+    unsigned year_high, year_low, month, day, hour = 0, minute = 0, second = 0;
+    int64_t fraction = 0;
+    int64_t offset = 0;
+
+    if (length == 10) {
+        bool valid = str_parse_2digits(s, &year_high) && str_parse_2digits(s + 2, &year_low) && s[4] == '-'
+                     && str_parse_2digits(s + 5, &month) && s[7] == '-' && str_parse_2digits(s + 8, &day);
+        if (!valid) {
+            return false;
+        }
+    } else if (length >= TIMESTAMP_DATETIME_LENGTH) {
+        /* YYYY-MM- and DDTHH:MM are validated and converted 8 bytes at a time */
+        uint64_t date = str_load_u64le(s);
+        uint64_t time = str_load_u64le(s + 8);
+        char separator = s[10];
+
+        bool valid = str_swar_match(date, SWAR_DATE_DIGITS, SWAR_DATE_LITERALS, SWAR_DATE_PATTERN)
+                     && str_swar_match(time, SWAR_TIME_DIGITS, SWAR_TIME_LITERALS, SWAR_TIME_PATTERN)
+                     && (separator == 'T' || separator == 't' || separator == ' ')
+                     && s[16] == ':' && str_parse_2digits(s + 17, &second);
+        if (!valid) {
+            return false;
+        }
+
+        date = str_swar_pairs(date, SWAR_DATE_DIGITS);
+        time = str_swar_pairs(time, SWAR_TIME_DIGITS);
+        year_high = (unsigned) (date & 0xFF);
+        year_low = (unsigned) (date >> 16 & 0xFF);
+        month = (unsigned) (date >> 40 & 0xFF);
+        day = (unsigned) (time & 0xFF);
+        hour = (unsigned) (time >> 24 & 0xFF);
+        minute = (unsigned) (time >> 48 & 0xFF);
+
+        const char *p = s + TIMESTAMP_DATETIME_LENGTH;
+        const char *e = s + length;
+
+        if (p < e && (*p == '.' || *p == ',')) {
+            const char *digits = ++p;
+
+            /* Digits past nanoseconds are ignored */
+            for (int64_t scale = 100000000; p < e && (unsigned) ((unsigned char) *p - '0') < 10; p++) {
+                fraction += (*p - '0') * scale;
+                scale /= 10;
+            }
+
+            if (p == digits) {
+                return false;
+            }
+        }
+
+        if (p < e && !str_parse_utc_offset(p, e, &offset)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    return str_timestamp_to_ns(year_high * 100 + year_low, month, day, hour, minute, second, fraction, offset,
+                               epoch_ns);
+}
+
+/**
+ * Parses the timestamp of the common log format: DD/Mon/YYYY:HH:MM:SS +HHMM, optionally in brackets.
+ */
+static bool str_parse_common_log(const char *s, int64_t length, int64_t *epoch_ns)
+{
+    static const char month_names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    if (length == COMMON_LOG_TIMESTAMP_LENGTH + 2 && s[0] == '[' && s[length - 1] == ']') {
+        s++;
+        length -= 2;
+    }
+
+    if (length != COMMON_LOG_TIMESTAMP_LENGTH || s[2] != '/' || s[6] != '/' || s[11] != ':' || s[14] != ':'
+        || s[17] != ':' || s[20] != ' ') {
+        return false;
+    }
+
+    unsigned month = 0;
+    for (unsigned i = 0; i < 12; i++) {
+        if (memcmp(s + 3, month_names + 3 * i, 3) == 0) {
+            month = i + 1;
+            break;
+        }
+    }
+
+    unsigned day, year_high, year_low, hour, minute, second;
+    int64_t offset;
+
+    bool valid = month > 0 && str_parse_2digits(s, &day) && str_parse_2digits(s + 7, &year_high)
+                 && str_parse_2digits(s + 9, &year_low) && str_parse_2digits(s + 12, &hour)
+                 && str_parse_2digits(s + 15, &minute) && str_parse_2digits(s + 18, &second)
+                 && str_parse_utc_offset(s + 21, s + length, &offset);
+
+    return valid && str_timestamp_to_ns(year_high * 100 + year_low, month, day, hour, minute, second, 0, offset,
+                                        epoch_ns);
+}
+
+bool str_parse_timestamp(const char *s, int64_t length, int64_t *epoch_ns)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    if (length > 2 && (s[0] == '[' || s[2] == '/')) {
+        return str_parse_common_log(s, length, epoch_ns);
+    }
+
+    return str_parse_rfc3339(s, length, epoch_ns);
+}
+
+static void str_case_convert(const Str *str, int (*convert)(int))
+{
+    char *s = str->value;
+    const char *e = STR_TAIL_P(str);
+
+    while (s < e) {
+        *s = (char) convert(*s);
+        s++;
+    }
+
+    str_modified(str);
+}
+
+void str_to_lower(const Str *str)
+{
+    str_case_convert(str, tolower);
+}
+
+void str_to_upper(const Str *str)
+{
+    str_case_convert(str, toupper);
+}
+
+void str_trim(Str *str, StrTrimOptions options)
+{
+    const char *s = str->value;
+    const char *e = STR_TAIL_P(str);
+
+    if (options & STR_TRIM_LEFT) {
+        for (; s < e; s++) {
+            if (!isspace(*s)) {
+                break;
+            }
+        }
+
+        if (s == e) {
+            /* Trim to empty string */
+            str->value[0] = '\0';
+            str->length = 0;
+            str_modified(str);
+            return;
+        }
+
+        str->length -= s - str->value;
+        if (s > str->value) {
+            memmove(str->value, s, str->length);
+        }
+    }
+
+    if (options & STR_TRIM_RIGHT) {
+        for (e = e - 1; e >= s; e--) {
+            if (!isspace(*e)) {
+                break;
+            }
+        }
+
+        str->length = e - s + 1;
+    }
+
+    str->value[str->length] = '\0';
+    str_modified(str);
+}
+
+#if defined(__SSSE3__)
+/**
+ * Shuffle controls that move the bytes selected by an 8-bit mask to the front, in order.
+ */
+static const uint64_t str_pack_shuffle[256] = {
+    0x8080808080808080ULL, 0x8080808080808000ULL, 0x8080808080808001ULL, 0x8080808080800100ULL,
+    0x8080808080808002ULL, 0x8080808080800200ULL, 0x8080808080800201ULL, 0x8080808080020100ULL,
+    0x8080808080808003ULL, 0x8080808080800300ULL, 0x8080808080800301ULL, 0x8080808080030100ULL,
+    0x8080808080800302ULL, 0x8080808080030200ULL, 0x8080808080030201ULL, 0x8080808003020100ULL,
+    0x8080808080808004ULL, 0x8080808080800400ULL, 0x8080808080800401ULL, 0x8080808080040100ULL,
+    0x8080808080800402ULL, 0x8080808080040200ULL, 0x8080808080040201ULL, 0x8080808004020100ULL,
+    0x8080808080800403ULL, 0x8080808080040300ULL, 0x8080808080040301ULL, 0x8080808004030100ULL,
+    0x8080808080040302ULL, 0x8080808004030200ULL, 0x8080808004030201ULL, 0x8080800403020100ULL,
+    0x8080808080808005ULL, 0x8080808080800500ULL, 0x8080808080800501ULL, 0x8080808080050100ULL,
+    0x8080808080800502ULL, 0x8080808080050200ULL, 0x8080808080050201ULL, 0x8080808005020100ULL,
+    0x8080808080800503ULL, 0x8080808080050300ULL, 0x8080808080050301ULL, 0x8080808005030100ULL,
+    0x8080808080050302ULL, 0x8080808005030200ULL, 0x8080808005030201ULL, 0x8080800503020100ULL,
+    0x8080808080800504ULL, 0x8080808080050400ULL, 0x8080808080050401ULL, 0x8080808005040100ULL,
+    0x8080808080050402ULL, 0x8080808005040200ULL, 0x8080808005040201ULL, 0x8080800504020100ULL,
+    0x8080808080050403ULL, 0x8080808005040300ULL, 0x8080808005040301ULL, 0x8080800504030100ULL,
+    0x8080808005040302ULL, 0x8080800504030200ULL, 0x8080800504030201ULL, 0x8080050403020100ULL,
+    0x8080808080808006ULL, 0x8080808080800600ULL, 0x8080808080800601ULL, 0x8080808080060100ULL,
+    0x8080808080800602ULL, 0x8080808080060200ULL, 0x8080808080060201ULL, 0x8080808006020100ULL,
+    0x8080808080800603ULL, 0x8080808080060300ULL, 0x8080808080060301ULL, 0x8080808006030100ULL,
+    0x8080808080060302ULL, 0x8080808006030200ULL, 0x8080808006030201ULL, 0x8080800603020100ULL,
+    0x8080808080800604ULL, 0x8080808080060400ULL, 0x8080808080060401ULL, 0x8080808006040100ULL,
+    0x8080808080060402ULL, 0x8080808006040200ULL, 0x8080808006040201ULL, 0x8080800604020100ULL,
+    0x8080808080060403ULL, 0x8080808006040300ULL, 0x8080808006040301ULL, 0x8080800604030100ULL,
+    0x8080808006040302ULL, 0x8080800604030200ULL, 0x8080800604030201ULL, 0x8080060403020100ULL,
+    0x8080808080800605ULL, 0x8080808080060500ULL, 0x8080808080060501ULL, 0x8080808006050100ULL,
+    0x8080808080060502ULL, 0x8080808006050200ULL, 0x8080808006050201ULL, 0x8080800605020100ULL,
+    0x8080808080060503ULL, 0x8080808006050300ULL, 0x8080808006050301ULL, 0x8080800605030100ULL,
+    0x8080808006050302ULL, 0x8080800605030200ULL, 0x8080800605030201ULL, 0x8080060503020100ULL,
+    0x8080808080060504ULL, 0x8080808006050400ULL, 0x8080808006050401ULL, 0x8080800605040100ULL,
+    0x8080808006050402ULL, 0x8080800605040200ULL, 0x8080800605040201ULL, 0x8080060504020100ULL,
+    0x8080808006050403ULL, 0x8080800605040300ULL, 0x8080800605040301ULL, 0x8080060504030100ULL,
+    0x8080800605040302ULL, 0x8080060504030200ULL, 0x8080060504030201ULL, 0x8006050403020100ULL,
+    0x8080808080808007ULL, 0x8080808080800700ULL, 0x8080808080800701ULL, 0x8080808080070100ULL,
+    0x8080808080800702ULL, 0x8080808080070200ULL, 0x8080808080070201ULL, 0x8080808007020100ULL,
+    0x8080808080800703ULL, 0x8080808080070300ULL, 0x8080808080070301ULL, 0x8080808007030100ULL,
+    0x8080808080070302ULL, 0x8080808007030200ULL, 0x8080808007030201ULL, 0x8080800703020100ULL,
+    0x8080808080800704ULL, 0x8080808080070400ULL, 0x8080808080070401ULL, 0x8080808007040100ULL,
+    0x8080808080070402ULL, 0x8080808007040200ULL, 0x8080808007040201ULL, 0x8080800704020100ULL,
+    0x8080808080070403ULL, 0x8080808007040300ULL, 0x8080808007040301ULL, 0x8080800704030100ULL,
+    0x8080808007040302ULL, 0x8080800704030200ULL, 0x8080800704030201ULL, 0x8080070403020100ULL,
+    0x8080808080800705ULL, 0x8080808080070500ULL, 0x8080808080070501ULL, 0x8080808007050100ULL,
+    0x8080808080070502ULL, 0x8080808007050200ULL, 0x8080808007050201ULL, 0x8080800705020100ULL,
+    0x8080808080070503ULL, 0x8080808007050300ULL, 0x8080808007050301ULL, 0x8080800705030100ULL,
+    0x8080808007050302ULL, 0x8080800705030200ULL, 0x8080800705030201ULL, 0x8080070503020100ULL,
+    0x8080808080070504ULL, 0x8080808007050400ULL, 0x8080808007050401ULL, 0x8080800705040100ULL,
+    0x8080808007050402ULL, 0x8080800705040200ULL, 0x8080800705040201ULL, 0x8080070504020100ULL,
+    0x8080808007050403ULL, 0x8080800705040300ULL, 0x8080800705040301ULL, 0x8080070504030100ULL,
+    0x8080800705040302ULL, 0x8080070504030200ULL, 0x8080070504030201ULL, 0x8007050403020100ULL,
+    0x8080808080800706ULL, 0x8080808080070600ULL, 0x8080808080070601ULL, 0x8080808007060100ULL,
+    0x8080808080070602ULL, 0x8080808007060200ULL, 0x8080808007060201ULL, 0x8080800706020100ULL,
+    0x8080808080070603ULL, 0x8080808007060300ULL, 0x8080808007060301ULL, 0x8080800706030100ULL,
+    0x8080808007060302ULL, 0x8080800706030200ULL, 0x8080800706030201ULL, 0x8080070603020100ULL,
+    0x8080808080070604ULL, 0x8080808007060400ULL, 0x8080808007060401ULL, 0x8080800706040100ULL,
+    0x8080808007060402ULL, 0x8080800706040200ULL, 0x8080800706040201ULL, 0x8080070604020100ULL,
+    0x8080808007060403ULL, 0x8080800706040300ULL, 0x8080800706040301ULL, 0x8080070604030100ULL,
+    0x8080800706040302ULL, 0x8080070604030200ULL, 0x8080070604030201ULL, 0x8007060403020100ULL,
+    0x8080808080070605ULL, 0x8080808007060500ULL, 0x8080808007060501ULL, 0x8080800706050100ULL,
+    0x8080808007060502ULL, 0x8080800706050200ULL, 0x8080800706050201ULL, 0x8080070605020100ULL,
+    0x8080808007060503ULL, 0x8080800706050300ULL, 0x8080800706050301ULL, 0x8080070605030100ULL,
+    0x8080800706050302ULL, 0x8080070605030200ULL, 0x8080070605030201ULL, 0x8007060503020100ULL,
+    0x8080808007060504ULL, 0x8080800706050400ULL, 0x8080800706050401ULL, 0x8080070605040100ULL,
+    0x8080800706050402ULL, 0x8080070605040200ULL, 0x8080070605040201ULL, 0x8007060504020100ULL,
+    0x8080800706050403ULL, 0x8080070605040300ULL, 0x8080070605040301ULL, 0x8007060504030100ULL,
+    0x8080070605040302ULL, 0x8007060504030200ULL, 0x8007060504030201ULL, 0x0706050403020100ULL,
+};
+
+/**
+ * Stores the bytes of `v` not selected by `remove` at s + dst and returns the new dst. The stores may write
+ * up to 16 bytes past dst, so dst must not be ahead of the position `v` was loaded from.
+ */
+static inline int64_t str_compact16(char *s, int64_t dst, __m128i v, uint32_t remove)
+{
+    uint32_t keep = ~remove & 0xFFFF;
+
+    if (keep == 0xFFFF) {
+        _mm_storeu_si128((__m128i *) (s + dst), v);
+        return dst + 16;
+    }
+
+    __m128i low = _mm_loadl_epi64((const __m128i *) &str_pack_shuffle[keep & 0xFF]);
+    __m128i high = _mm_add_epi8(_mm_loadl_epi64((const __m128i *) &str_pack_shuffle[keep >> 8]), _mm_set1_epi8(8));
+    __m128i packed = _mm_shuffle_epi8(v, _mm_unpacklo_epi64(low, high));
+
+    _mm_storel_epi64((__m128i *) (s + dst), packed);
+    dst += __builtin_popcount(keep & 0xFF);
+    _mm_storel_epi64((__m128i *) (s + dst), _mm_srli_si128(packed, 8));
+    return dst + __builtin_popcount(keep >> 8);
+}
+#endif
+
+void str_translate(const Str *str, const uint8_t map[256])
+{
+    uint8_t *s = (uint8_t *) str->value;
+    int64_t length = str->length;
+    int64_t i = 0;
+
+#if defined(__SSSE3__)
+    /* Each row of 16 bytes sharing a high nibble is a pshufb table; only the rows the map changes are applied */
+    int rows[16];
+    int row_count = 0;
+
+    for (int row = 0; row < 16; row++) {
+        for (int c = row * 16; c < row * 16 + 16; c++) {
+            if (map[c] != c) {
+                rows[row_count++] = row;
+                break;
+            }
+        }
+    }
+
+    if (row_count == 0) {
+        return;
+    }
+
+    if (row_count <= TRANSLATE_MAX_ROWS) {
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        __m128i tables[16];
+        __m128i highs[16];
+
+        for (int r = 0; r < row_count; r++) {
+            tables[r] = _mm_loadu_si128((const __m128i *) (map + rows[r] * 16));
+            highs[r] = _mm_set1_epi8((char) rows[r]);
+        }
+
+#if defined(__AVX2__)
+        const __m256i nibble32 = _mm256_set1_epi8(0x0F);
+
+        for (; i + 32 <= length; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+            __m256i lo = _mm256_and_si256(v, nibble32);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble32);
+            __m256i result = v;
+
+            for (int r = 0; r < row_count; r++) {
+                __m256i selected = _mm256_cmpeq_epi8(hi, _mm256_broadcastsi128_si256(highs[r]));
+                __m256i mapped = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(tables[r]), lo);
+                result = _mm256_blendv_epi8(result, mapped, selected);
+            }
+
+            _mm256_storeu_si256((__m256i *) (s + i), result);
+        }
+#endif
+
+        for (; i + 16 <= length; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+            __m128i lo = _mm_and_si128(v, nibble);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+            __m128i result = v;
+
+            for (int r = 0; r < row_count; r++) {
+                __m128i selected = _mm_cmpeq_epi8(hi, highs[r]);
+                __m128i mapped = _mm_shuffle_epi8(tables[r], lo);
+                result = _mm_or_si128(_mm_andnot_si128(selected, result), _mm_and_si128(selected, mapped));
+            }
+
+            _mm_storeu_si128((__m128i *) (s + i), result);
+        }
+    }
+#endif
+
+    for (; i < length; i++) {
+        s[i] = map[s[i]];
+    }
+
+    str_modified(str);
+}
+
+void str_delete_chars(Str *str, const char *chars, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(chars);
+    }
+
+    StrByteSet set;
+    str_byteset_init(&set, chars, length);
+
+    char *s = str->value;
+    int64_t n = str->length;
+
+    /* Nothing moves before the first deleted byte */
+    int64_t i = str_byteset_scan(&set, s, n, true);
+    if (i == n) {
+        return;
+    }
+
+    int64_t dst = i;
+
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+    __m256i rows_low32 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) set.rows_low));
+    __m256i rows_high32 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) set.rows_high));
+
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512(s + i);
+        __m256i low = _mm512_castsi512_si256(v);
+        __m256i high = _mm512_extracti64x4_epi64(v, 1);
+        uint32_t remove_low = (uint32_t) _mm256_movemask_epi8(str_byteset_match32(rows_low32, rows_high32, low));
+        uint32_t remove_high = (uint32_t) _mm256_movemask_epi8(str_byteset_match32(rows_low32, rows_high32, high));
+        uint64_t remove = remove_low | (uint64_t) remove_high << 32;
+
+        /* vpcompressb writes exactly the kept bytes */
+        _mm512_mask_compressstoreu_epi8(s + dst, ~remove, v);
+        dst += 64 - __builtin_popcountll(remove);
+    }
+#endif
+
+#if defined(__SSSE3__)
+    __m128i rows_low = _mm_loadu_si128((const __m128i *) set.rows_low);
+    __m128i rows_high = _mm_loadu_si128((const __m128i *) set.rows_high);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        uint32_t remove = (uint32_t) _mm_movemask_epi8(str_byteset_match16(rows_low, rows_high, v));
+        dst = str_compact16(s, dst, v, remove);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (!str_byteset_contains(&set, (uint8_t) s[i])) {
+            s[dst++] = s[i];
+        }
+    }
+
+    str_set_length(str, dst);
+}
+
+void str_squeeze(Str *str, const char *chars, int64_t length)
+{
+    if (str->length < 2) {
+        return;
+    }
+
+    bool any = chars == NULL;
+    StrByteSet set;
+
+    if (!any) {
+        if (length < 0) {
+            length = str_get_len(chars);
+        }
+
+        str_byteset_init(&set, chars, length);
+    }
+
+    char *s = str->value;
+    int64_t n = str->length;
+    int64_t i = 1;
+    int64_t dst = 1;
+    char previous = s[0];
+
+#if defined(__SSSE3__)
+    __m128i rows_low = any ? _mm_setzero_si128() : _mm_loadu_si128((const __m128i *) set.rows_low);
+    __m128i rows_high = any ? _mm_setzero_si128() : _mm_loadu_si128((const __m128i *) set.rows_high);
+
+    /* The compaction may overwrite the byte before each block, so it is taken from the previous vector */
+    __m128i last = _mm_set1_epi8(previous);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i repeat = _mm_cmpeq_epi8(v, _mm_alignr_epi8(v, last, 15));
+
+        if (!any) {
+            repeat = _mm_and_si128(repeat, str_byteset_match16(rows_low, rows_high, v));
+        }
+
+        dst = str_compact16(s, dst, v, (uint32_t) _mm_movemask_epi8(repeat));
+        last = v;
+    }
+
+    previous = (char) (_mm_extract_epi16(last, 7) >> 8);
+#endif
+
+    for (; i < n; i++) {
+        char c = s[i];
+
+        if (c != previous || (!any && !str_byteset_contains(&set, (uint8_t) c))) {
+            s[dst++] = c;
+        }
+
+        previous = c;
+    }
+
+    str_set_length(str, dst);
+}
+
+/**
+ * Reverses the bytes of the range in place, swapping vectors from both ends.
+ */
+static void str_reverse_range(char *s, int64_t length)
+{
+    char *lo = s;
+    char *hi = s + length;
+
+#if defined(__AVX2__)
+    const __m256i reverse32 = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+    );
+
+    while (hi - lo >= 64) {
+        hi -= 32;
+        __m256i a = _mm256_loadu_si256((const __m256i *) lo);
+        __m256i b = _mm256_loadu_si256((const __m256i *) hi);
+
+        /* Reverse within each 128-bit lane, then swap the lanes */
+        a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, reverse32), 0x4E);
+        b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, reverse32), 0x4E);
+
+        _mm256_storeu_si256((__m256i *) lo, b);
+        _mm256_storeu_si256((__m256i *) hi, a);
+        lo += 32;
+    }
+#endif
+
+#if defined(__SSSE3__)
+    const __m128i reverse16 = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    while (hi - lo >= 32) {
+        hi -= 16;
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) lo), reverse16);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) hi), reverse16);
+
+        _mm_storeu_si128((__m128i *) lo, b);
+        _mm_storeu_si128((__m128i *) hi, a);
+        lo += 16;
+    }
+#endif
+
+    while (hi - lo >= 2) {
+        hi--;
+        char c = *lo;
+        *lo = *hi;
+        *hi = c;
+        lo++;
+    }
+}
+
+void str_reverse(const Str *str)
+{
+    str_reverse_range(str->value, str->length);
+    str_modified(str);
+}
+
+void str_reverse_codepoints(const Str *str)
+{
+    char *s = str->value;
+    int64_t n = str->length;
+    int64_t i = 0;
+
+    str_reverse_range(s, n);
+
+    /* Each multibyte sequence now ends with its lead byte; put its bytes back in order */
+    while (i < n) {
+#if defined(__SSE2__)
+        while (i + 16 <= n && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (s + i))) == 0) {
+            i += 16;
+        }
+
+        if (i >= n) {
+            break;
+        }
+#endif
+
+        if (((uint8_t) s[i] & 0xC0) != 0x80) {
+            i++;
+            continue;
+        }
+
+        int64_t j = i;
+        while (j < n && j - i < 3 && ((uint8_t) s[j] & 0xC0) == 0x80) {
+            j++;
+        }
+
+        if (j < n) {
+            uint8_t lead = (uint8_t) s[j];
+            int64_t expected = lead >= 0xF8 ? 0 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 0;
+
+            if (expected == j - i + 1) {
+                str_reverse_range(s + i, expected);
+                i = j + 1;
+                continue;
+            }
+        }
+
+        /* A continuation byte without its lead byte stays where it is */
+        i++;
+    }
+
+    str_modified(str);
+}
+
+void str_reverse_segments(const Str *str, char delimiter)
+{
+    char *s = str->value;
+    char *e = STR_TAIL_P(str);
+
+    str_reverse_range(s, str->length);
+
+    /* Reversing every segment again restores its contents */
+    while (s < e) {
+        char *end = memchr(s, delimiter, e - s);
+        if (end == NULL) {
+            end = e;
+        }
+
+        str_reverse_range(s, end - s);
+        s = end + 1;
+    }
+
+    str_modified(str);
+}
+
+bool str_repeat(Str *str, int multiply)
+{
+    if (multiply < 0) {
+        return false;
+    }
+
+    if (multiply == 0 || str->length == 0) {
+        // Truncate to empty
+        str->value[0] = '\0';
+        str->length = 0;
+        str_modified(str);
+        return true;
+    }
+
+    int64_t length = str->length * multiply;
+    if (str_ensure_capacity(str, length + 1)) {
+        if (str->length == 1) {
+            memset(str->value, str->value[0], length);
+        } else {
+            char *s = STR_TAIL_P(str);
+            const char *e = str->value + length;
+
+            while (s < e) {
+                memmove(s, str->value, str->length);
+                s += str->length;
+            }
+        }
+
+        str->value[length] = '\0';
+        str->length = length;
+        return true;
+    }
+
+    return false;
+}
+
+bool str_line_index_init(StrLineIndex *index)
+{
+    int64_t *samples = malloc(sizeof(int64_t) * STR_DEFAULT_INIT_SIZE);
+    if (samples) {
+        samples[0] = 0;
+        index->samples = samples;
+        index->sample_count = 1;
+        index->sample_size = STR_DEFAULT_INIT_SIZE;
+        index->line_count = 1;
+        index->scanned = 0;
+        return true;
+    }
+
+    return false;
+}
+
+void str_line_index_finalize(StrLineIndex *index)
+{
+    if (index && index->samples) {
+        free(index->samples);
+        index->samples = NULL;
+        index->sample_count = 0;
+        index->sample_size = 0;
+        index->line_count = 0;
+        index->scanned = 0;
+    }
+}
+
+static bool str_line_index_add_sample(StrLineIndex *index, int64_t offset)
+{
+    if (index->sample_count == index->sample_size) {
+        int64_t size = index->sample_size * 2;
+        int64_t *samples = realloc(index->samples, sizeof(int64_t) * size);
+        if (samples == NULL) {
+            return false;
+        }
+
+        index->samples = samples;
+        index->sample_size = size;
+    }
+
+    index->samples[index->sample_count++] = offset;
+    return true;
+}
+
+bool str_line_index_update(StrLineIndex *index, const Str *str)
+{
+    if (str->length < index->scanned) {
+        /* The string was truncated; the indexed contents may no longer exist */
+        index->sample_count = 1;
+        index->line_count = 1;
+        index->scanned = 0;
+    }
+
+    const char *s = str->value + index->scanned;
+    const char *e = STR_TAIL_P(str);
+
+    while (s < e) {
+        /* Line N starts after the N-th line feed, find the one that starts the next sampled line */
+        int64_t next_sample = index->sample_count * STR_LINE_INDEX_SAMPLE_RATE;
+        int64_t found;
+        const char *p = str_find_nth_newline(s, e, next_sample - (index->line_count - 1), &found);
+
+        index->line_count += found;
+
+        if (p == NULL) {
+            break;
+        }
+
+        s = p + 1;
+        index->scanned = s - str->value;
+
+        if (!str_line_index_add_sample(index, index->scanned)) {
+            /* Forget the line so that the next update finds it again */
+            index->line_count--;
+            index->scanned = p - str->value;
+            return false;
+        }
+    }
+
+    index->scanned = str->length;
+    return true;
+}
+
+bool str_line_index_get_line(const StrLineIndex *index, const Str *str, int64_t line, StrSlice *slice)
+{
+    if (line < 0 || line >= index->line_count) {
+        return false;
+    }
+
+    const char *e = str->value + index->scanned;
+    const char *s = str->value + index->samples[line / STR_LINE_INDEX_SAMPLE_RATE];
+    int64_t skip = line % STR_LINE_INDEX_SAMPLE_RATE;
+
+    if (skip > 0) {
+        int64_t found;
+        s = str_find_nth_newline(s, e, skip, &found) + 1;
+    }
+
+    const char *p = memchr(s, '\n', e - s);
+    if (p == NULL) {
+        p = e;
+    }
+
+    slice->value = s;
+    slice->length = p - s;
+    return true;
+}
+
+int64_t str_line_index_find_line(const StrLineIndex *index, const Str *str, int64_t offset)
+{
+    if (offset < 0 || offset > index->scanned) {
+        return -1;
+    }
+
+    /* Find the last sample that starts at or before the offset */
+    int64_t low = 0;
+    int64_t high = index->sample_count - 1;
+
+    while (low < high) {
+        int64_t mid = low + (high - low + 1) / 2;
+        if (index->samples[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    int64_t found;
+    str_find_nth_newline(str->value + index->samples[low], str->value + offset, INT64_MAX, &found);
+    return low * STR_LINE_INDEX_SAMPLE_RATE + found;
+}
+
+bool str_matcher_init(StrMatcher *matcher, const char *needle, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(needle);
+    }
+
+    if (length == 0) {
+        return false;
+    }
+
+    /* The failure table and the copy of the needle share one allocation */
+    int64_t *failure = malloc(sizeof(int64_t) * length + length);
+    if (failure == NULL) {
+        return false;
+    }
+
+    char *copy = (char *) (failure + length);
+    memcpy(copy, needle, length);
+
+    /* Knuth-Morris-Pratt: failure[i] is the length of the longest proper border of needle[0..i] */
+    failure[0] = 0;
+    for (int64_t i = 1, k = 0; i < length; i++) {
+        while (k > 0 && copy[i] != copy[k]) {
+            k = failure[k - 1];
+        }
+
+        if (copy[i] == copy[k]) {
+            k++;
+        }
+
+        failure[i] = k;
+    }
+
+    matcher->needle = copy;
+    matcher->failure = failure;
+    matcher->length = length;
+    matcher->matched = 0;
+    matcher->scanned = 0;
+    return true;
+}
+
+void str_matcher_finalize(StrMatcher *matcher)
+{
+    if (matcher && matcher->failure) {
+        free(matcher->failure);
+        matcher->needle = NULL;
+        matcher->failure = NULL;
+        matcher->length = 0;
+        matcher->matched = 0;
+        matcher->scanned = 0;
+    }
+}
+
+void str_matcher_reset(StrMatcher *matcher)
+{
+    matcher->matched = 0;
+    matcher->scanned = 0;
+}
+
+int64_t str_matcher_next(StrMatcher *matcher, const Str *str)
+{
+    if (str->length < matcher->scanned) {
+        str_matcher_reset(matcher);
+    }
+
+    const char *needle = matcher->needle;
+    const char *s = str->value + matcher->scanned;
+    const char *e = STR_TAIL_P(str);
+    int64_t j = matcher->matched;
+
+    while (s < e) {
+        if (j == 0) {
+            /* Nothing matched so far, skip ahead to the next candidate */
+            s = memchr(s, *needle, e - s);
+            if (s == NULL) {
+                s = e;
+                break;
+            }
+        }
+
+        while (j > 0 && *s != needle[j]) {
+            j = matcher->failure[j - 1];
+        }
+
+        if (*s == needle[j]) {
+            j++;
+        }
+
+        s++;
+
+        if (j == matcher->length) {
+            matcher->matched = 0;
+            matcher->scanned = s - str->value;
+            return matcher->scanned - matcher->length;
+        }
+    }
+
+    matcher->matched = j;
+    matcher->scanned = s - str->value;
+    return -1;
+}
+
+bool str_append_lz4_compressed(Str *str, const char *s, int64_t length, int level)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    if (length > LZ4_MAX_INPUT_SIZE) {
+        return false;
+    }
+
+    int64_t bound = str_lz4_compress_bound(length);
+    if (!str_ensure_capacity(str, str->length + bound + 1)) {
+        return false;
+    }
+
+    uint8_t *op = (uint8_t *) STR_TAIL_P(str);
+    uint8_t *end;
+
+    if (level <= STR_LZ4_LEVEL_FAST) {
+        end = lz4_compress_fast((const uint8_t *) s, length, op);
+    } else {
+        int max_attempts = 1 << (MIN(level, STR_LZ4_LEVEL_MAX) - 1);
+        end = lz4_compress_hc((const uint8_t *) s, length, op, max_attempts);
+    }
+
+    if (end == NULL) {
+        return false;
+    }
+
+    str_commit_append(str, str->length + (end - op));
+    return true;
+}
+
+/**
+ * Reads an extended length. Returns false if the input ends before the length does.
+ */
+static bool lz4_read_length(const uint8_t **ip, const uint8_t *end, int64_t *length)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+
+    return true;
+}
+
+bool str_append_lz4_decompressed(Str *str, const char *s, int64_t length, int64_t max_length)
+{
+    if (!str_ensure_capacity(str, str->length + max_length + 1)) {
+        return false;
+    }
+
+    const uint8_t *ip = (const uint8_t *) s;
+    const uint8_t *ip_end = ip + length;
+    uint8_t *start = (uint8_t *) STR_TAIL_P(str);
+    uint8_t *op = start;
+    const uint8_t *op_end = start + max_length;
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        int64_t literal_length = token >> 4;
+
+        if (literal_length == 15 && !lz4_read_length(&ip, ip_end, &literal_length)) {
+            goto corrupted;
+        }
+
+        if (literal_length > ip_end - ip || literal_length > op_end - op) {
+            goto corrupted;
+        }
+
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        if (ip == ip_end) {
+            /* The last sequence has no match */
+            break;
+        }
+
+        if (ip_end - ip < 2) {
+            goto corrupted;
+        }
+
+        int64_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > op - start) {
+            goto corrupted;
+        }
+
+        int64_t match_length = token & 15;
+        if (match_length == 15 && !lz4_read_length(&ip, ip_end, &match_length)) {
+            goto corrupted;
+        }
+
+        match_length += LZ4_MIN_MATCH;
+        if (match_length > op_end - op) {
+            goto corrupted;
+        }
+
+        /* The match may overlap the output; copy it in chunks that double as the pattern repeats */
+        for (int64_t distance = offset; match_length > 0; distance *= 2) {
+            int64_t n = MIN(distance, match_length);
+            memcpy(op, op - distance, n);
+            op += n;
+            match_length -= n;
+        }
+    }
+
+    str_commit_append(str, str->length + (op - start));
+    return true;
+
+corrupted:
+    str->value[str->length] = '\0';
+    return false;
+}
+
+static bool str_append_fixed(Str *str, uint64_t value, int size, bool big_endian)
+{
+    if (!str_ensure_capacity(str, str->length + size + 1)) {
+        return false;
+    }
+
+    uint8_t *p = (uint8_t *) STR_TAIL_P(str);
+    for (int i = 0; i < size; i++) {
+        p[big_endian ? size - 1 - i : i] = (uint8_t) (value >> (8 * i));
+    }
+
+    str_commit_append(str, str->length + size);
+    return true;
+}
+
+bool str_append_u16le(Str *str, uint16_t value)
+{
+    return str_append_fixed(str, value, 2, false);
+}
+
+bool str_append_u32le(Str *str, uint32_t value)
+{
+    return str_append_fixed(str, value, 4, false);
+}
+
+bool str_append_u64le(Str *str, uint64_t value)
+{
+    return str_append_fixed(str, value, 8, false);
+}
+
+bool str_append_u16be(Str *str, uint16_t value)
+{
+    return str_append_fixed(str, value, 2, true);
+}
+
+bool str_append_u32be(Str *str, uint32_t value)
+{
+    return str_append_fixed(str, value, 4, true);
+}
+
+bool str_append_u64be(Str *str, uint64_t value)
+{
+    return str_append_fixed(str, value, 8, true);
+}
+
+bool str_append_varint(Str *str, uint64_t value)
+{
+    if (!str_ensure_capacity(str, str->length + VARINT_MAX_LENGTH + 1)) {
+        return false;
+    }
+
+    /* The number of bytes is known upfront, so only the loop counter branches */
+    int length = (str_bit_length(value) + 6) / 7;
+    uint8_t *p = (uint8_t *) STR_TAIL_P(str);
+
+    for (int i = 0; i < length - 1; i++) {
+        p[i] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    p[length - 1] = (uint8_t) value;
+
+    str_commit_append(str, str->length + length);
+    return true;
+}
+
+bool str_append_zigzag(Str *str, int64_t value)
+{
+    return str_append_varint(str, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static bool str_decode_fixed(const char **cursor, const char *end, uint64_t *value, int size, bool big_endian)
+{
+    if (end - *cursor < size) {
+        return false;
+    }
+
+    const uint8_t *p = (const uint8_t *) *cursor;
+    uint64_t result = 0;
+
+    for (int i = 0; i < size; i++) {
+        result |= (uint64_t) p[big_endian ? size - 1 - i : i] << (8 * i);
+    }
+
+    *cursor += size;
+    *value = result;
+    return true;
+}
+
+bool str_decode_u16le(const char **cursor, const char *end, uint16_t *value)
+{
+    uint64_t v;
+    if (str_decode_fixed(cursor, end, &v, 2, false)) {
+        *value = (uint16_t) v;
+        return true;
+    }
+
+    return false;
+}
+
+bool str_decode_u32le(const char **cursor, const char *end, uint32_t *value)
+{
+    uint64_t v;
+    if (str_decode_fixed(cursor, end, &v, 4, false)) {
+        *value = (uint32_t) v;
+        return true;
+    }
+
+    return false;
+}
+
+bool str_decode_u64le(const char **cursor, const char *end, uint64_t *value)
+{
+    return str_decode_fixed(cursor, end, value, 8, false);
+}
+
+bool str_decode_u16be(const char **cursor, const char *end, uint16_t *value)
+{
+    uint64_t v;
+    if (str_decode_fixed(cursor, end, &v, 2, true)) {
+        *value = (uint16_t) v;
+        return true;
+    }
+
+    return false;
+}
+
+bool str_decode_u32be(const char **cursor, const char *end, uint32_t *value)
+{
+    uint64_t v;
+    if (str_decode_fixed(cursor, end, &v, 4, true)) {
+        *value = (uint32_t) v;
+        return true;
+    }
+
+    return false;
+}
+
+bool str_decode_u64be(const char **cursor, const char *end, uint64_t *value)
+{
+    return str_decode_fixed(cursor, end, value, 8, true);
+}
+
+bool str_decode_varint(const char **cursor, const char *end, uint64_t *value)
+{
+    const uint8_t *p = (const uint8_t *) *cursor;
+    int64_t available = end - *cursor;
+    int limit = available < VARINT_MAX_LENGTH ? (int) available : VARINT_MAX_LENGTH;
+    uint64_t result = 0;
+
+    for (int i = 0; i < limit; i++) {
+        uint8_t b = p[i];
+        result |= (uint64_t) (b & 0x7F) << (7 * i);
+
+        if (b < 0x80) {
+            if (i == VARINT_MAX_LENGTH - 1 && b > 1) {
+                /* Overflows 64 bits */
+                return false;
+            }
+
+            *cursor += i + 1;
+            *value = result;
+            return true;
+        }
+    }
+
+    /* Truncated or longer than 10 bytes */
+    return false;
+}
+
+bool str_decode_zigzag(const char **cursor, const char *end, int64_t *value)
+{
+    uint64_t v;
+    if (str_decode_varint(cursor, end, &v)) {
+        *value = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+        return true;
+    }
+
+    return false;
+}
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Writes all the buffers, resuming after partial writes and interruptions. `total` receives the number of
+ * bytes written, also when an error stops the writes.
+ */
+static bool str_writev_count(int fd, struct iovec *iov, int count, int64_t *total)
+{
+    *total = 0;
+
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, MIN(count, IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        *total += written;
+
+        /* Skip the buffers that were completely written */
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes all the buffers, resuming after partial writes and interruptions.
+ */
+static bool str_writev_all(int fd, struct iovec *iov, int count)
+{
+    int64_t total;
+    return str_writev_count(fd, iov, count, &total);
+}
+
+bool str_collection_write(int fd, const Str *strs, int64_t count)
+{
+    Str buffer;
+    if (!str_init_size(&buffer, COLLECTION_HEADER_SIZE + 8 * (COLLECTION_BATCH + 1))) {
+        return false;
+    }
+
+    bool result = str_append_str(&buffer, COLLECTION_MAGIC, 4)
+                  && str_append_u32le(&buffer, COLLECTION_VERSION)
+                  && str_append_u64le(&buffer, (uint64_t) count);
+
+    /* Offsets, in batches. Each entry is followed by its NULL terminator */
+    uint64_t offset = 0;
+    for (int64_t i = 0; result && i <= count; i++) {
+        result = str_append_u64le(&buffer, offset);
+
+        if (i < count) {
+            offset += strs[i].length + 1;
+        }
+
+        if (result && (buffer.length >= 8 * COLLECTION_BATCH || i == count)) {
+            struct iovec iov = {buffer.value, buffer.length};
+            result = str_writev_all(fd, &iov, 1);
+            str_set_length(&buffer, 0);
+        }
+    }
+
+    str_finalize(&buffer);
+
+    /* Entries, straight from the Str objects */
+    struct iovec iov[COLLECTION_BATCH];
+    for (int64_t i = 0; result && i < count; i += COLLECTION_BATCH) {
+        int n = (int) MIN(count - i, COLLECTION_BATCH);
+
+        for (int j = 0; j < n; j++) {
+            iov[j].iov_base = strs[i + j].value;
+            iov[j].iov_len = strs[i + j].length + 1;
+        }
+
+        result = str_writev_all(fd, iov, n);
+    }
+
+    return result;
+}
+
+bool str_collection_open(StrCollection *collection, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < COLLECTION_HEADER_SIZE + 8) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const char *base = map;
+    int64_t size = st.st_size;
+    const char *cursor = base + 4;
+    uint32_t version = 0;
+    uint64_t count = 0;
+
+    str_decode_u32le(&cursor, base + size, &version);
+    str_decode_u64le(&cursor, base + size, &count);
+
+    /* Only the header and the size of the table are checked here, so opening is O(1); each get checks its entry */
+    bool valid = memcmp(base, COLLECTION_MAGIC, 4) == 0
+                 && version == COLLECTION_VERSION
+                 && count < (uint64_t) (size - COLLECTION_HEADER_SIZE) / 8;
+
+    if (valid) {
+        collection->offsets = base + COLLECTION_HEADER_SIZE;
+        collection->blob = collection->offsets + 8 * (count + 1);
+        collection->blob_size = size - (collection->blob - base);
+    }
+
+    if (!valid) {
+        munmap(map, size);
+        return false;
+    }
+
+    collection->map = map;
+    collection->map_size = size;
+    collection->count = (int64_t) count;
+    return true;
+}
+
+void str_collection_close(StrCollection *collection)
+{
+    if (collection && collection->map) {
+        munmap(collection->map, collection->map_size);
+        collection->map = NULL;
+        collection->map_size = 0;
+        collection->count = 0;
+        collection->offsets = NULL;
+        collection->blob = NULL;
+        collection->blob_size = 0;
+    }
+}
+
+bool str_collection_get(const StrCollection *collection, int64_t index, StrSlice *slice)
+{
+    if (index < 0 || index >= collection->count) {
+        return false;
+    }
+
+    uint64_t start = str_load_u64le(collection->offsets + 8 * index);
+    uint64_t end = str_load_u64le(collection->offsets + 8 * (index + 1));
+
+    /* The terminator is on the page the caller is about to read */
+    if (start >= end || end > (uint64_t) collection->blob_size || collection->blob[end - 1] != '\0') {
+        return false;
+    }
+
+    slice->value = collection->blob + start;
+    slice->length = (int64_t) (end - start - 1);
+    return true;
+}
+#endif
+
+#ifdef STR_HAVE_POSIX
+static int64_t str_monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Writes the buffer to the file descriptor. Returns the time it took.
+ */
+static int64_t str_writer_write(int fd, Str *buffer, bool *result)
+{
+    int64_t started = str_monotonic_ns();
+    struct iovec iov = {buffer->value, buffer->length};
+    *result = str_writev_all(fd, &iov, 1);
+    return str_monotonic_ns() - started;
+}
+
+static void str_writer_record(StrWriter *writer, bool result, int64_t length, int64_t elapsed)
+{
+    if (result) {
+        writer->bytes_written += length;
+    } else {
+        writer->failed = true;
+    }
+
+    writer->flush_count++;
+    writer->flush_time_ns += elapsed;
+    if (elapsed > writer->max_flush_time_ns) {
+        writer->max_flush_time_ns = elapsed;
+    }
+}
+
+static bool str_writer_flush_sync(StrWriter *writer)
+{
+    bool result;
+    int64_t elapsed = str_writer_write(writer->fd, &writer->buffer, &result);
+
+    str_writer_record(writer, result, writer->buffer.length, elapsed);
+    str_set_length(&writer->buffer, 0);
+    return result;
+}
+
+#ifdef STR_HAVE_THREADS
+/**
+ * The background thread of a StrWriter and the spare buffer it writes out.
+ */
+typedef struct StrWriterThread
+{
+    bool pending;
+    bool stop;
+    Str spare;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} StrWriterThread;
+
+static void *str_writer_run(void *arg)
+{
+    StrWriter *writer = arg;
+    StrWriterThread *background = writer->thread;
+
+    pthread_mutex_lock(&background->mutex);
+
+    for (;;) {
+        while (!background->pending && !background->stop) {
+            pthread_cond_wait(&background->cond, &background->mutex);
+        }
+
+        if (!background->pending) {
+            break;
+        }
+
+        /* The spare buffer belongs to this thread until `pending` is cleared */
+        pthread_mutex_unlock(&background->mutex);
+        bool result;
+        int64_t elapsed = str_writer_write(writer->fd, &background->spare, &result);
+        pthread_mutex_lock(&background->mutex);
+
+        str_writer_record(writer, result, background->spare.length, elapsed);
+        str_set_length(&background->spare, 0);
+        background->pending = false;
+        pthread_cond_broadcast(&background->cond);
+    }
+
+    pthread_mutex_unlock(&background->mutex);
+    return NULL;
+}
+
+/**
+ * Waits for the background write in progress, if any. Must be called with the mutex held.
+ */
+static void str_writer_wait(StrWriterThread *background)
+{
+    while (background->pending) {
+        pthread_cond_wait(&background->cond, &background->mutex);
+    }
+}
+
+/**
+ * Hands the buffer off to the background thread and continues with the spare one.
+ */
+static bool str_writer_handoff(StrWriter *writer, bool wait)
+{
+    StrWriterThread *background = writer->thread;
+
+    pthread_mutex_lock(&background->mutex);
+    str_writer_wait(background);
+
+    /* An empty buffer is not handed off: only the write in progress is waited for */
+    if (writer->buffer.length > 0) {
+        Str full = writer->buffer;
+        writer->buffer = background->spare;
+        background->spare = full;
+        background->pending = true;
+        pthread_cond_broadcast(&background->cond);
+
+        if (wait) {
+            str_writer_wait(background);
+        }
+    }
+
+    bool result = !writer->failed;
+    pthread_mutex_unlock(&background->mutex);
+    return result;
+}
+
+/**
+ * Allocates the spare buffer and starts the background thread.
+ */
+static bool str_writer_start(StrWriter *writer)
+{
+    StrWriterThread *background = malloc(sizeof(StrWriterThread));
+    if (background == NULL) {
+        return false;
+    }
+
+    background->pending = false;
+    background->stop = false;
+
+    if (!str_init_size(&background->spare, writer->watermark + STR_DEFAULT_INIT_SIZE)) {
+        free(background);
+        return false;
+    }
+
+    bool started = pthread_mutex_init(&background->mutex, NULL) == 0;
+    if (started && pthread_cond_init(&background->cond, NULL) != 0) {
+        pthread_mutex_destroy(&background->mutex);
+        started = false;
+    }
+
+    writer->thread = background;
+
+    if (started && pthread_create(&background->thread, NULL, str_writer_run, writer) != 0) {
+        pthread_cond_destroy(&background->cond);
+        pthread_mutex_destroy(&background->mutex);
+        started = false;
+    }
+
+    if (!started) {
+        str_finalize(&background->spare);
+        free(background);
+        writer->thread = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Stops the background thread once its write is done and releases it.
+ */
+static void str_writer_stop(StrWriter *writer)
+{
+    StrWriterThread *background = writer->thread;
+
+    pthread_mutex_lock(&background->mutex);
+    background->stop = true;
+    pthread_cond_broadcast(&background->cond);
+    pthread_mutex_unlock(&background->mutex);
+
+    pthread_join(background->thread, NULL);
+    pthread_cond_destroy(&background->cond);
+    pthread_mutex_destroy(&background->mutex);
+    str_finalize(&background->spare);
+    free(background);
+    writer->thread = NULL;
+}
+#endif
+
+bool str_writer_init(StrWriter *writer, int fd, int64_t watermark, bool background)
+{
+    writer->fd = fd;
+    writer->watermark = watermark;
+    writer->failed = false;
+    writer->bytes_written = 0;
+    writer->flush_count = 0;
+    writer->flush_time_ns = 0;
+    writer->max_flush_time_ns = 0;
+
+    /* Leave room for the append that crosses the watermark */
+    if (!str_init_size(&writer->buffer, watermark + STR_DEFAULT_INIT_SIZE)) {
+        return false;
+    }
+
+#ifdef STR_HAVE_THREADS
+    writer->background = background;
+    writer->thread = NULL;
+
+    if (background && !str_writer_start(writer)) {
+        str_finalize(&writer->buffer);
+        return false;
+    }
+#else
+    if (background) {
+        str_finalize(&writer->buffer);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void str_writer_finalize(StrWriter *writer)
+{
+    if (writer && writer->buffer.value) {
+        str_writer_flush(writer);
+
+#ifdef STR_HAVE_THREADS
+        if (writer->background) {
+            str_writer_stop(writer);
+        }
+#endif
+
+        str_finalize(&writer->buffer);
+    }
+}
+
+bool str_writer_flush(StrWriter *writer)
+{
+#ifdef STR_HAVE_THREADS
+    if (writer->background) {
+        return str_writer_handoff(writer, true);
+    }
+#endif
+
+    if (writer->buffer.length > 0) {
+        str_writer_flush_sync(writer);
+    }
+
+    return !writer->failed;
+}
+
+bool str_writer_poll(StrWriter *writer)
+{
+    if (writer->buffer.length < writer->watermark) {
+        return true;
+    }
+
+#ifdef STR_HAVE_THREADS
+    if (writer->background) {
+        return str_writer_handoff(writer, false);
+    }
+#endif
+
+    return str_writer_flush_sync(writer);
+}
+
+bool str_writer_append_format(StrWriter *writer, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    bool result = str_append_vformat(&writer->buffer, format, args);
+    va_end(args);
+
+    return result && str_writer_poll(writer);
+}
+#endif
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Writes all the bytes at the offset. Returns the number of bytes written or a negated errno value.
+ */
+static int64_t str_pwrite_all(int fd, const char *s, int64_t length, int64_t offset)
+{
+    int64_t done = 0;
+
+    while (done < length) {
+        ssize_t written = pwrite(fd, s + done, length - done, offset + done);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -errno;
+        }
+
+        done += written;
+    }
+
+    return done;
+}
+
+#ifdef STR_HAVE_IO_URING
+static void str_io_uring_unmap(StrIoQueue *queue)
+{
+    if (queue->sqes) {
+        munmap(queue->sqes, queue->sqes_size);
+    }
+
+    if (queue->cq_ring && queue->cq_ring != queue->sq_ring) {
+        munmap(queue->cq_ring, queue->cq_ring_size);
+    }
+
+    if (queue->sq_ring) {
+        munmap(queue->sq_ring, queue->sq_ring_size);
+    }
+}
+
+static void *str_io_uring_map(int fd, size_t size, off_t offset)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+static bool str_io_uring_probe_write(int fd)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (probe == NULL) {
+        return false;
+    }
+
+    bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+                     && probe->ops_len > IORING_OP_WRITE
+                     && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    return supported;
+}
+
+static bool str_io_uring_setup(StrIoQueue *queue, unsigned capacity)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int) syscall(__NR_io_uring_setup, capacity, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    queue->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    queue->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    queue->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Newer kernels map both rings with a single mmap() */
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        queue->sq_ring_size = queue->cq_ring_size = MAX(queue->sq_ring_size, queue->cq_ring_size);
+    }
+
+    queue->sq_ring = str_io_uring_map(fd, queue->sq_ring_size, IORING_OFF_SQ_RING);
+    queue->cq_ring = single ? queue->sq_ring : str_io_uring_map(fd, queue->cq_ring_size, IORING_OFF_CQ_RING);
+    queue->sqes = str_io_uring_map(fd, queue->sqes_size, IORING_OFF_SQES);
+
+    if (!queue->sq_ring || !queue->cq_ring || !queue->sqes) {
+        str_io_uring_unmap(queue);
+        close(fd);
+        return false;
+    }
+
+    /* Kernels before 5.6 set up rings but fail IORING_OP_WRITE with -EINVAL; they use the fallback instead */
+    if (!str_io_uring_probe_write(fd)) {
+        str_io_uring_unmap(queue);
+        close(fd);
+        return false;
+    }
+
+    char *sq = queue->sq_ring;
+    char *cq = queue->cq_ring;
+    queue->sq_head = (unsigned *) (sq + params.sq_off.head);
+    queue->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    queue->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    queue->sq_array = (unsigned *) (sq + params.sq_off.array);
+    queue->cq_head = (unsigned *) (cq + params.cq_off.head);
+    queue->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    queue->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    queue->cqes = cq + params.cq_off.cqes;
+    queue->ring_fd = fd;
+    return true;
+}
+
+/**
+ * Writes the submission entry of a request, for the bytes not written yet. A write at the current file
+ * position is linked to the previous entry when that one is a write at the current position of the same
+ * file, so the kernel performs them in order.
+ */
+static void str_io_uring_prepare(StrIoQueue *queue, unsigned slot)
+{
+    StrIoRequest *request = &queue->requests[slot];
+
+    /* Only this thread moves the tail, the kernel only reads it */
+    unsigned tail = *queue->sq_tail;
+    unsigned index = tail & *queue->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *) queue->sqes + index;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->buffer_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (request->value + request->written);
+    sqe->len = (uint32_t) (request->length - request->written);
+    sqe->off = request->offset < 0 ? (uint64_t) -1 : (uint64_t) (request->offset + request->written);
+    sqe->buf_index = request->buffer_index >= 0 ? (uint16_t) request->buffer_index : 0;
+    sqe->user_data = slot | (uint64_t) request->attempt << 32;
+    request->next = -1;
+
+    if (request->offset < 0) {
+        if (queue->link_fd == request->fd && queue->link_tail == tail) {
+            struct io_uring_sqe *previous = (struct io_uring_sqe *) queue->sqes + ((tail - 1) & *queue->sq_mask);
+            previous->flags |= IOSQE_IO_LINK;
+            queue->requests[queue->link_slot].next = (int) slot;
+        }
+
+        queue->link_fd = request->fd;
+        queue->link_tail = tail + 1;
+        queue->link_slot = slot;
+    }
+
+    queue->sq_array[index] = index;
+    __atomic_store_n(queue->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queue->queued++;
+}
+
+/**
+ * Submits the queued entries and waits for `min_complete` completions. Returns the number of entries
+ * submitted or -1 on error.
+ */
+static int str_io_uring_enter(StrIoQueue *queue, unsigned min_complete)
+{
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int n = (int) syscall(__NR_io_uring_enter, queue->ring_fd, queue->queued, min_complete, flags, NULL, 0);
+
+    if (n > 0) {
+        queue->queued -= n;
+        queue->in_flight += n;
+
+        /* Links cannot span submissions */
+        queue->link_fd = -1;
+
+        /* A run cut by a partial submission ends at the last entry the kernel took */
+        if (queue->queued > 0) {
+            unsigned last = queue->sq_array[(*queue->sq_tail - queue->queued - 1) & *queue->sq_mask];
+            const struct io_uring_sqe *sqe = (const struct io_uring_sqe *) queue->sqes + last;
+            queue->requests[(uint32_t) sqe->user_data].next = -1;
+        }
+    }
+
+    return n;
+}
+
+static int str_io_uring_reap(StrIoQueue *queue, StrIoCompletion *completions, int max)
+{
+    unsigned head = *queue->cq_head;
+    unsigned tail = __atomic_load_n(queue->cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+
+    while (head != tail && count < max) {
+        const struct io_uring_cqe *cqe = (const struct io_uring_cqe *) queue->cqes + (head & *queue->cq_mask);
+        unsigned slot = (uint32_t) cqe->user_data;
+        StrIoRequest *request = &queue->requests[slot];
+        int64_t result = cqe->res;
+
+        head++;
+
+        /* A submission cancelled by a short write before it, and already submitted again (and uncounted) */
+        if ((uint32_t) (cqe->user_data >> 32) != request->attempt) {
+            continue;
+        }
+
+        queue->in_flight--;
+
+        /*
+         * Queue the rest of a short write, as the fallback keeps writing until done. The kernel cancels the
+         * writes linked after a short one, so they are submitted again behind the rest, in order; the
+         * cancelled submissions no longer count as in flight and their completions are skipped.
+         */
+        if (result > 0 && request->written + result < request->length) {
+            int next = request->next;
+
+            request->written += result;
+            str_io_uring_prepare(queue, slot);
+
+            while (next >= 0) {
+                StrIoRequest *successor = &queue->requests[next];
+                int after = successor->next;
+
+                successor->attempt++;
+                queue->in_flight--;
+                str_io_uring_prepare(queue, (unsigned) next);
+                next = after;
+            }
+
+            continue;
+        }
+
+        if (completions) {
+            completions[count].user_data = request->user_data;
+            completions[count].result = result < 0 ? result : request->written + result;
+        }
+
+        queue->free_slots[queue->free_count++] = slot;
+        count++;
+    }
+
+    __atomic_store_n(queue->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+#endif
+
+/**
+ * Performs the queued writes of the writev fallback and records their completions.
+ */
+static void str_io_fallback_submit(StrIoQueue *queue)
+{
+    struct iovec iov[STR_IO_BATCH];
+    unsigned i = 0;
+
+    while (i < queue->queued) {
+        const StrIoRequest *request = &queue->requests[i];
+        StrIoCompletion *completion = &queue->completions[queue->completion_count];
+
+        if (request->offset >= 0) {
+            completion->user_data = request->user_data;
+            completion->result = str_pwrite_all(request->fd, request->value, request->length, request->offset);
+            queue->completion_count++;
+            i++;
+            continue;
+        }
+
+        /* Merge the run of writes appending to the same file descriptor */
+        unsigned end = i;
+        int count = 0;
+        while (end < queue->queued && count < STR_IO_BATCH && queue->requests[end].fd == request->fd
+               && queue->requests[end].offset < 0) {
+            iov[count].iov_base = (void *) queue->requests[end].value;
+            iov[count].iov_len = queue->requests[end].length;
+            count++;
+            end++;
+        }
+
+        int64_t written;
+        int64_t error = str_writev_count(request->fd, iov, count, &written) ? 0 : -errno;
+
+        /*
+         * The writes the call got through complete with their length, the one it failed on with the error,
+         * and the ones after it are cancelled, as they would be with io_uring.
+         */
+        for (; i < end; i++) {
+            int64_t length = queue->requests[i].length;
+
+            completion = &queue->completions[queue->completion_count++];
+            completion->user_data = queue->requests[i].user_data;
+
+            if (written >= length) {
+                completion->result = length;
+                written -= length;
+            } else {
+                completion->result = error;
+                error = -ECANCELED;
+                written = -1;
+            }
+        }
+    }
+
+    queue->in_flight += queue->queued;
+    queue->queued = 0;
+}
+
+static bool str_io_push(StrIoQueue *queue, int fd, const char *s, int64_t length, int64_t offset,
+                        uint64_t user_data, int buffer_index)
+{
+    if (queue->queued + queue->in_flight >= queue->capacity || length > UINT32_MAX) {
+        return false;
+    }
+
+    StrIoRequest *request = &queue->requests[queue->queued];
+
+#ifdef STR_HAVE_IO_URING
+    if (queue->uring) {
+        unsigned slot = queue->free_slots[--queue->free_count];
+        request = &queue->requests[slot];
+        request->fd = fd;
+        request->value = s;
+        request->length = length;
+        request->offset = offset < 0 ? -1 : offset;
+        request->user_data = user_data;
+        request->buffer_index = buffer_index;
+        request->written = 0;
+
+        /* Attempts are never reused, in case a cancelled submission of the previous write is still pending */
+        request->attempt++;
+        str_io_uring_prepare(queue, slot);
+        return true;
+    }
+#endif
+
+    queue->queued++;
+    request->fd = fd;
+    request->value = s;
+    request->length = length;
+    request->offset = offset < 0 ? -1 : offset;
+    request->user_data = user_data;
+    request->buffer_index = buffer_index;
+    request->written = 0;
+    return true;
+}
+
+bool str_io_init(StrIoQueue *queue, unsigned capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->ring_fd = -1;
+
+    if (capacity == 0) {
+        return false;
+    }
+
+    queue->capacity = capacity;
+
+    queue->link_fd = -1;
+    queue->requests = calloc(capacity, sizeof(StrIoRequest));
+
+#ifdef STR_HAVE_IO_URING
+    queue->uring = queue->requests != NULL && str_io_uring_setup(queue, capacity);
+    if (queue->uring) {
+        queue->free_slots = malloc(sizeof(unsigned) * capacity);
+        if (queue->free_slots == NULL) {
+            str_io_uring_unmap(queue);
+            close(queue->ring_fd);
+            free(queue->requests);
+            queue->capacity = 0;
+            return false;
+        }
+
+        for (unsigned i = 0; i < capacity; i++) {
+            queue->free_slots[i] = capacity - 1 - i;
+        }
+
+        queue->free_count = capacity;
+        return true;
+    }
+#endif
+
+    queue->completions = malloc(sizeof(StrIoCompletion) * capacity);
+
+    if (queue->requests == NULL || queue->completions == NULL) {
+        free(queue->requests);
+        free(queue->completions);
+        queue->capacity = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void str_io_finalize(StrIoQueue *queue)
+{
+    if (queue && queue->capacity > 0) {
+        if (!queue->uring) {
+            str_io_fallback_submit(queue);
+        }
+
+#ifdef STR_HAVE_IO_URING
+        if (queue->uring) {
+            /* The kernel may still be reading the buffers of the submitted writes */
+            while (queue->in_flight > 0 || queue->queued > 0) {
+                if (str_io_uring_reap(queue, NULL, (int) queue->capacity) > 0) {
+                    continue;
+                }
+
+                int n = str_io_uring_enter(queue, queue->in_flight > 0 ? 1 : 0);
+                if ((n < 0 && errno != EINTR) || (n == 0 && queue->in_flight == 0)) {
+                    break;
+                }
+            }
+
+            str_io_uring_unmap(queue);
+            close(queue->ring_fd);
+        }
+#endif
+
+        free(queue->requests);
+        free(queue->completions);
+        free(queue->free_slots);
+        memset(queue, 0, sizeof(*queue));
+        queue->ring_fd = -1;
+        queue->link_fd = -1;
+    }
+}
+
+bool str_io_register_buffers(StrIoQueue *queue, Str *buffers, int count)
+{
+#ifdef STR_HAVE_IO_URING
+    if (queue->uring) {
+        if (queue->registered_count > 0) {
+            syscall(__NR_io_uring_register, queue->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+            queue->registered = NULL;
+            queue->registered_count = 0;
+        }
+
+        if (count <= 0) {
+            return true;
+        }
+
+        struct iovec *iov = malloc(sizeof(struct iovec) * count);
+        if (iov == NULL) {
+            return false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            iov[i].iov_base = buffers[i].value;
+            iov[i].iov_len = buffers[i].size;
+        }
+
+        /* The kernel copies the array */
+        bool result = syscall(__NR_io_uring_register, queue->ring_fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+        free(iov);
+
+        if (!result) {
+            return false;
+        }
+    }
+#endif
+
+    queue->registered = count > 0 ? buffers : NULL;
+    queue->registered_count = count > 0 ? count : 0;
+    return true;
+}
+
+bool str_io_queue_write(StrIoQueue *queue, int fd, const char *s, int64_t length, int64_t offset,
+                        uint64_t user_data)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    return str_io_push(queue, fd, s, length, offset, user_data, -1);
+}
+
+bool str_io_queue_write_fixed(StrIoQueue *queue, int fd, int buffer_index, int64_t offset, uint64_t user_data)
+{
+    if (buffer_index < 0 || buffer_index >= queue->registered_count) {
+        return false;
+    }
+
+    const Str *buffer = &queue->registered[buffer_index];
+    return str_io_push(queue, fd, buffer->value, buffer->length, offset, user_data, buffer_index);
+}
+
+int str_io_submit(StrIoQueue *queue)
+{
+    int submitted = (int) queue->queued;
+
+#ifdef STR_HAVE_IO_URING
+    if (queue->uring) {
+        submitted = 0;
+
+        while (queue->queued > 0) {
+            int n = str_io_uring_enter(queue, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return submitted > 0 ? submitted : -1;
+            }
+
+            /* The kernel took nothing (e.g. the completion queue is full); the rest is submitted later */
+            if (n == 0) {
+                break;
+            }
+
+            submitted += n;
+        }
+
+        return submitted;
+    }
+#endif
+
+    str_io_fallback_submit(queue);
+    return submitted;
+}
+
+int str_io_complete(StrIoQueue *queue, StrIoCompletion *completions, int max, int min)
+{
+    if (queue->queued > 0 && str_io_submit(queue) < 0) {
+        return -1;
+    }
+
+    /* Never wait for completions that cannot be reaped */
+    min = MIN(min, MIN(max, (int) queue->in_flight));
+
+#ifdef STR_HAVE_IO_URING
+    if (queue->uring) {
+        int count = str_io_uring_reap(queue, completions, max);
+
+        while (count < min) {
+            if (str_io_uring_enter(queue, (unsigned) (min - count)) < 0 && errno != EINTR) {
+                return count > 0 ? count : -1;
+            }
+
+            count += str_io_uring_reap(queue, completions + count, max - count);
+        }
+
+        return count;
+    }
+#endif
+
+    (void) min;
+    int count = MIN(max, (int) queue->completion_count);
+    memcpy(completions, queue->completions, sizeof(StrIoCompletion) * count);
+    memmove(queue->completions, queue->completions + count,
+            sizeof(StrIoCompletion) * (queue->completion_count - count));
+    queue->completion_count -= count;
+    queue->in_flight -= count;
+    return count;
+}
+#endif
+
+#ifdef STR_HAVE_THREADS
+typedef struct StrLogMessage
+{
+    _Atomic(struct StrLogMessage *) next;
+    Str text;
+} StrLogMessage;
+
+/**
+ * The queue and the writer thread of a StrLogger. Written messages go to `recycled`, where producers
+ * take them back to format the next ones.
+ */
+typedef struct StrLoggerState
+{
+    int fd;
+    StrLogOverflow overflow;
+    int64_t capacity;
+    _Atomic(StrLogMessage *) head;
+    StrLogMessage *tail;
+    StrLogMessage stub;
+    _Atomic(StrLogMessage *) recycled;
+    atomic_int_fast64_t pending;
+    atomic_int_fast64_t dropped;
+    atomic_int_fast64_t written;
+    atomic_bool running;
+    atomic_bool sleeping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake_writer;
+    pthread_cond_t wake_producers;
+} StrLoggerState;
+
+/**
+ * The message buffers owned by a thread: the first one is formatted into, the others are spares.
+ */
+typedef struct StrLogCache
+{
+    StrLogMessage *messages;
+} StrLogCache;
+
+static pthread_key_t str_log_cache_key;
+static pthread_once_t str_log_cache_once = PTHREAD_ONCE_INIT;
+static _Thread_local StrLogCache *str_log_cache;
+
+static void str_log_message_free(StrLogMessage *message)
+{
+    str_finalize(&message->text);
+    free(message);
+}
+
+static void str_log_cache_destroy(void *arg)
+{
+    StrLogCache *cache = arg;
+    StrLogMessage *message = cache->messages;
+
+    while (message) {
+        StrLogMessage *next = atomic_load_explicit(&message->next, memory_order_relaxed);
+        str_log_message_free(message);
+        message = next;
+    }
+
+    free(cache);
+}
+
+static void str_log_cache_create_key(void)
+{
+    pthread_key_create(&str_log_cache_key, str_log_cache_destroy);
+}
+
+/**
+ * Returns an empty message buffer owned by the calling thread, taking back the messages the writer thread
+ * has recycled, or allocating one. It stays owned by the thread until it is queued. The buffers are released
+ * when the thread exits.
+ */
+static StrLogMessage *str_log_get_message(StrLoggerState *state)
+{
+    if (str_log_cache == NULL) {
+        StrLogCache *cache = malloc(sizeof(StrLogCache));
+        if (cache == NULL) {
+            return NULL;
+        }
+
+        cache->messages = NULL;
+        pthread_once(&str_log_cache_once, str_log_cache_create_key);
+        pthread_setspecific(str_log_cache_key, cache);
+        str_log_cache = cache;
+    }
+
+    if (str_log_cache->messages == NULL) {
+        /* Taking the whole list at once is safe from ABA, unlike popping a single message */
+        str_log_cache->messages = atomic_exchange_explicit(&state->recycled, NULL, memory_order_acquire);
+    }
+
+    if (str_log_cache->messages == NULL) {
+        StrLogMessage *message = malloc(sizeof(StrLogMessage));
+        if (message == NULL || !str_init_size(&message->text, 256)) {
+            free(message);
+            return NULL;
+        }
+
+        atomic_init(&message->next, NULL);
+        str_log_cache->messages = message;
+    }
+
+    StrLogMessage *message = str_log_cache->messages;
+    str_set_length(&message->text, 0);
+    return message;
+}
+
+/**
+ * Gives a written message back to the producers, or frees it if it grew too large.
+ */
+static void str_logger_recycle(StrLoggerState *state, StrLogMessage *message)
+{
+    if (message->text.size > LOGGER_RECYCLE_MAX) {
+        str_log_message_free(message);
+        return;
+    }
+
+    StrLogMessage *head = atomic_load_explicit(&state->recycled, memory_order_relaxed);
+
+    do {
+        atomic_store_explicit(&message->next, head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&state->recycled, &head, message,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static void str_timed_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    deadline.tv_nsec += LOGGER_WAIT_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+static void str_logger_push(StrLoggerState *state, StrLogMessage *message)
+{
+    atomic_store_explicit(&message->next, NULL, memory_order_relaxed);
+    StrLogMessage *previous = atomic_exchange_explicit(&state->head, message, memory_order_acq_rel);
+    atomic_store_explicit(&previous->next, message, memory_order_release);
+}
+
+/**
+ * Removes the oldest message (Vyukov's intrusive MPSC queue). Returns NULL if the queue is empty or
+ * a producer is in the middle of a push.
+ */
+static StrLogMessage *str_logger_pop(StrLoggerState *state)
+{
+    StrLogMessage *tail = state->tail;
+    StrLogMessage *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &state->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+
+        state->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next) {
+        state->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&state->head, memory_order_acquire)) {
+        return NULL;
+    }
+
+    /* Last message: put the stub back behind it so it can be detached */
+    str_logger_push(state, &state->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (next) {
+        state->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static void *str_logger_run(void *arg)
+{
+    StrLoggerState *state = arg;
+    StrLogMessage *batch[LOGGER_BATCH];
+    struct iovec iov[LOGGER_BATCH];
+
+    for (;;) {
+        int n = 0;
+        StrLogMessage *message;
+
+        while (n < LOGGER_BATCH && (message = str_logger_pop(state)) != NULL) {
+            iov[n].iov_base = message->text.value;
+            iov[n].iov_len = message->text.length;
+            batch[n++] = message;
+        }
+
+        if (n > 0) {
+            int64_t bytes = 0;
+            for (int i = 0; i < n; i++) {
+                bytes += batch[i]->text.length;
+            }
+
+            if (str_writev_all(state->fd, iov, n)) {
+                atomic_fetch_add(&state->written, bytes);
+            } else {
+                atomic_fetch_add(&state->dropped, n);
+            }
+
+            for (int i = 0; i < n; i++) {
+                str_logger_recycle(state, batch[i]);
+            }
+
+            atomic_fetch_sub(&state->pending, n);
+
+            if (state->overflow == STR_LOG_BLOCK) {
+                pthread_mutex_lock(&state->mutex);
+                pthread_cond_broadcast(&state->wake_producers);
+                pthread_mutex_unlock(&state->mutex);
+            }
+
+            continue;
+        }
+
+        if (!atomic_load(&state->running) && atomic_load(&state->pending) == 0) {
+            break;
+        }
+
+        /* Nothing to write: sleep until a producer signals us (the timeout covers a push in progress) */
+        pthread_mutex_lock(&state->mutex);
+        atomic_store(&state->sleeping, true);
+
+        if (atomic_load(&state->pending) == 0 && atomic_load(&state->running)) {
+            str_timed_wait(&state->wake_writer, &state->mutex);
+        }
+
+        atomic_store(&state->sleeping, false);
+        pthread_mutex_unlock(&state->mutex);
+    }
+
+    return NULL;
+}
+
+bool str_logger_init(StrLogger *logger, int fd, int64_t capacity, StrLogOverflow overflow)
+{
+    StrLoggerState *state = malloc(sizeof(StrLoggerState));
+    if (state == NULL) {
+        return false;
+    }
+
+    state->fd = fd;
+    state->overflow = overflow;
+    state->capacity = capacity > 0 ? capacity : 1;
+    state->tail = &state->stub;
+    atomic_init(&state->stub.next, NULL);
+    atomic_init(&state->head, &state->stub);
+    atomic_init(&state->recycled, NULL);
+    atomic_init(&state->pending, 0);
+    atomic_init(&state->dropped, 0);
+    atomic_init(&state->written, 0);
+    atomic_init(&state->running, true);
+    atomic_init(&state->sleeping, false);
+
+    bool started = pthread_mutex_init(&state->mutex, NULL) == 0;
+    if (started && pthread_cond_init(&state->wake_writer, NULL) != 0) {
+        pthread_mutex_destroy(&state->mutex);
+        started = false;
+    }
+
+    if (started && pthread_cond_init(&state->wake_producers, NULL) != 0) {
+        pthread_cond_destroy(&state->wake_writer);
+        pthread_mutex_destroy(&state->mutex);
+        started = false;
+    }
+
+    if (started && pthread_create(&state->thread, NULL, str_logger_run, state) != 0) {
+        pthread_cond_destroy(&state->wake_producers);
+        pthread_cond_destroy(&state->wake_writer);
+        pthread_mutex_destroy(&state->mutex);
+        started = false;
+    }
+
+    if (!started) {
+        free(state);
+        return false;
+    }
+
+    logger->state = state;
+    return true;
+}
+
+void str_logger_finalize(StrLogger *logger)
+{
+    if (logger && logger->state) {
+        StrLoggerState *state = logger->state;
+
+        pthread_mutex_lock(&state->mutex);
+        atomic_store(&state->running, false);
+        pthread_cond_broadcast(&state->wake_writer);
+        pthread_cond_broadcast(&state->wake_producers);
+        pthread_mutex_unlock(&state->mutex);
+
+        pthread_join(state->thread, NULL);
+
+        pthread_cond_destroy(&state->wake_producers);
+        pthread_cond_destroy(&state->wake_writer);
+        pthread_mutex_destroy(&state->mutex);
+
+        StrLogMessage *message = atomic_load_explicit(&state->recycled, memory_order_acquire);
+        while (message) {
+            StrLogMessage *next = atomic_load_explicit(&message->next, memory_order_relaxed);
+            str_log_message_free(message);
+            message = next;
+        }
+
+        free(state);
+        logger->state = NULL;
+    }
+}
+
+/**
+ * Reserves a slot in the queue according to the overflow policy.
+ */
+static bool str_logger_reserve(StrLoggerState *state)
+{
+    for (;;) {
+        if (atomic_fetch_add(&state->pending, 1) < state->capacity) {
+            return true;
+        }
+
+        atomic_fetch_sub(&state->pending, 1);
+
+        if (state->overflow == STR_LOG_DROP || !atomic_load(&state->running)) {
+            atomic_fetch_add(&state->dropped, 1);
+            return false;
+        }
+
+        pthread_mutex_lock(&state->mutex);
+        if (atomic_load(&state->pending) >= state->capacity) {
+            str_timed_wait(&state->wake_producers, &state->mutex);
+        }
+
+        pthread_mutex_unlock(&state->mutex);
+    }
+}
+
+/**
+ * Queues the message returned by str_log_get_message(), which passes from the calling thread to the writer
+ * thread. If the message is dropped, the calling thread keeps it for the next one.
+ */
+static bool str_logger_queue(StrLoggerState *state, StrLogMessage *message)
+{
+    if (!str_logger_reserve(state)) {
+        return false;
+    }
+
+    str_log_cache->messages = atomic_load_explicit(&message->next, memory_order_relaxed);
+    str_logger_push(state, message);
+
+    if (atomic_load(&state->sleeping)) {
+        pthread_mutex_lock(&state->mutex);
+        pthread_cond_signal(&state->wake_writer);
+        pthread_mutex_unlock(&state->mutex);
+    }
+
+    return true;
+}
+
+bool str_logger_write(StrLogger *logger, const char *s, int64_t length)
+{
+    StrLoggerState *state = logger->state;
+    StrLogMessage *message = str_log_get_message(state);
+
+    if (message == NULL || !str_append_str(&message->text, s, length)) {
+        atomic_fetch_add(&state->dropped, 1);
+        return false;
+    }
+
+    return str_logger_queue(state, message);
+}
+
+bool str_logger_log(StrLogger *logger, const char *format, ...)
+{
+    StrLoggerState *state = logger->state;
+    StrLogMessage *message = str_log_get_message(state);
+
+    if (message == NULL) {
+        atomic_fetch_add(&state->dropped, 1);
+        return false;
+    }
+
+    va_list args;
+    va_start(args, format);
+    bool result = str_append_vformat(&message->text, format, args) && str_append_char(&message->text, '\n');
+    va_end(args);
+
+    if (!result) {
+        atomic_fetch_add(&state->dropped, 1);
+        return false;
+    }
+
+    return str_logger_queue(state, message);
+}
+
+int64_t str_logger_dropped(const StrLogger *logger)
+{
+    return atomic_load(&logger->state->dropped);
+}
+
+int64_t str_logger_written(const StrLogger *logger)
+{
+    return atomic_load(&logger->state->written);
+}
+
+/**
+ * The positions of a StrConcurrentBuffer, allocated in front of its storage.
+ */
+typedef struct StrConcurrentCounters
+{
+    atomic_int_fast64_t reserved;
+    atomic_int_fast64_t committed;
+    atomic_int_fast64_t flushed;
+} StrConcurrentCounters;
+
+bool str_concurrent_init(StrConcurrentBuffer *buffer, int64_t size)
+{
+    StrConcurrentCounters *counters = malloc(sizeof(StrConcurrentCounters) + size);
+    if (counters) {
+        atomic_init(&counters->reserved, 0);
+        atomic_init(&counters->committed, 0);
+        atomic_init(&counters->flushed, 0);
+        buffer->counters = counters;
+        buffer->value = (char *) (counters + 1);
+        buffer->size = size;
+        return true;
+    }
+
+    return false;
+}
+
+void str_concurrent_finalize(StrConcurrentBuffer *buffer)
+{
+    if (buffer && buffer->value) {
+        free(buffer->counters);
+        buffer->counters = NULL;
+        buffer->value = NULL;
+        buffer->size = 0;
+    }
+}
+
+bool str_concurrent_append(StrConcurrentBuffer *buffer, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    int64_t offset = atomic_load_explicit(&buffer->counters->reserved, memory_order_relaxed);
+
+    do {
+        /* Reserve only what fits, so a failed append leaves no gap that later writers would wait on */
+        int64_t flushed = atomic_load_explicit(&buffer->counters->flushed, memory_order_acquire);
+        if (offset + length - flushed > buffer->size) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&buffer->counters->reserved, &offset, offset + length,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    int64_t start = offset % buffer->size;
+    int64_t first = MIN(length, buffer->size - start);
+    memcpy(buffer->value + start, s, first);
+    memcpy(buffer->value, s + first, length - first);
+
+    /* Publish in reservation order */
+    for (int spins = 0; atomic_load_explicit(&buffer->counters->committed, memory_order_acquire) != offset; spins++) {
+        if (spins >= 64) {
+            sched_yield();
+        }
+#if defined(__SSE2__)
+        else {
+            _mm_pause();
+        }
+#endif
+    }
+
+    atomic_store_explicit(&buffer->counters->committed, offset + length, memory_order_release);
+    return true;
+}
+
+StrSlice str_concurrent_peek(const StrConcurrentBuffer *buffer)
+{
+    int64_t committed = atomic_load_explicit(&buffer->counters->committed, memory_order_acquire);
+    int64_t flushed = atomic_load_explicit(&buffer->counters->flushed, memory_order_relaxed);
+    int64_t start = flushed % buffer->size;
+
+    StrSlice slice = {buffer->value + start, MIN(committed - flushed, buffer->size - start)};
+    return slice;
+}
+
+bool str_concurrent_consume(StrConcurrentBuffer *buffer, int64_t n)
+{
+    int64_t committed = atomic_load_explicit(&buffer->counters->committed, memory_order_acquire);
+    int64_t flushed = atomic_load_explicit(&buffer->counters->flushed, memory_order_relaxed);
+
+    if (n < 0 || n > committed - flushed) {
+        return false;
+    }
+
+    /* Release: the reads of the consumed bytes happen before writers reuse their space */
+    atomic_store_explicit(&buffer->counters->flushed, flushed + n, memory_order_release);
+    return true;
+}
+
+bool str_concurrent_flush(StrConcurrentBuffer *buffer, int fd)
+{
+    int64_t committed = atomic_load_explicit(&buffer->counters->committed, memory_order_acquire);
+    int64_t flushed = atomic_load_explicit(&buffer->counters->flushed, memory_order_relaxed);
+    int64_t start = flushed % buffer->size;
+    int64_t length = committed - flushed;
+    int64_t first = MIN(length, buffer->size - start);
+
+    struct iovec iov[2] = {{buffer->value + start, first}, {buffer->value, length - first}};
+
+    /* The bytes are only released once written, so a failed flush can be retried */
+    if (!str_writev_all(fd, iov, length > first ? 2 : 1)) {
+        return false;
+    }
+
+    atomic_store_explicit(&buffer->counters->flushed, committed, memory_order_release);
+    return true;
+}
+
+void str_concurrent_reset(StrConcurrentBuffer *buffer)
+{
+    atomic_store(&buffer->counters->reserved, 0);
+    atomic_store(&buffer->counters->committed, 0);
+    atomic_store(&buffer->counters->flushed, 0);
+}
+#endif
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Maps the same memory twice, back to back, so that a range that wraps around the end of the ring
+ * is contiguous in the address space. The size must be a multiple of the page size.
+ */
+static char *str_ring_map_mirrored(int64_t size)
+{
+#if defined(__linux__)
+    int fd = memfd_create("str_ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    char *base = NULL;
+
+    if (ftruncate(fd, size) == 0) {
+        /* Reserve the address range, then map the file over each half */
+        base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base != MAP_FAILED) {
+            int protection = PROT_READ | PROT_WRITE;
+            bool mapped = mmap(base, size, protection, MAP_SHARED | MAP_FIXED, fd, 0) == base
+                          && mmap(base + size, size, protection, MAP_SHARED | MAP_FIXED, fd, 0) == base + size;
+
+            if (!mapped) {
+                munmap(base, 2 * size);
+                base = NULL;
+            }
+        } else {
+            base = NULL;
+        }
+    }
+
+    close(fd);
+    return base;
+#else
+    (void) size;
+    return NULL;
+#endif
+}
+
+bool str_ring_init(StrRing *ring, int64_t capacity)
+{
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t size = page > 0 ? (capacity + page - 1) / page * page : capacity;
+    char *mem = str_ring_map_mirrored(size);
+
+    ring->mirrored = mem != NULL;
+
+    if (mem == NULL) {
+        /* Without the mirror, the readable bytes are kept contiguous by compacting when needed */
+        size = capacity;
+        mem = malloc(sizeof(char) * size);
+        if (mem == NULL) {
+            return false;
+        }
+    }
+
+    ring->value = mem;
+    ring->size = size;
+    ring->start = 0;
+    ring->length = 0;
+    return true;
+}
+
+void str_ring_finalize(StrRing *ring)
+{
+    if (ring && ring->value) {
+        if (ring->mirrored) {
+            munmap(ring->value, 2 * ring->size);
+        } else {
+            free(ring->value);
+        }
+
+        ring->value = NULL;
+        ring->size = 0;
+        ring->start = 0;
+        ring->length = 0;
+    }
+}
+
+/**
+ * Returns the tail of the ring. Without the mirror, the readable bytes are moved to the beginning
+ * of the buffer when the tail has less than `needed` bytes of room.
+ */
+static char *str_ring_tail(StrRing *ring, int64_t needed, int64_t *available)
+{
+    if (ring->mirrored) {
+        *available = ring->size - ring->length;
+        return ring->value + (ring->start + ring->length) % ring->size;
+    }
+
+    if (ring->size - ring->start - ring->length < needed && ring->start > 0) {
+        memmove(ring->value, ring->value + ring->start, ring->length);
+        ring->start = 0;
+    }
+
+    *available = ring->size - ring->start - ring->length;
+    return ring->value + ring->start + ring->length;
+}
+
+char *str_ring_reserve(StrRing *ring, int64_t *available)
+{
+    /* Compacting once half of the free space is stranded before the head keeps the copies amortized */
+    return str_ring_tail(ring, (ring->size - ring->length + 1) / 2, available);
+}
+
+bool str_ring_produce(StrRing *ring, int64_t n)
+{
+    /* Without the mirror, only the room before the end of the buffer was handed out */
+    int64_t room = ring->mirrored ? ring->size - ring->length : ring->size - ring->start - ring->length;
+
+    if (n < 0 || n > room) {
+        return false;
+    }
+
+    ring->length += n;
+    return true;
+}
+
+bool str_ring_append(StrRing *ring, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    int64_t available;
+    char *tail = str_ring_tail(ring, length, &available);
+
+    if (length > available) {
+        return false;
+    }
+
+    memcpy(tail, s, length);
+    ring->length += length;
+    return true;
+}
+
+bool str_ring_consume(StrRing *ring, int64_t n)
+{
+    if (n < 0 || n > ring->length) {
+        return false;
+    }
+
+    ring->length -= n;
+
+    if (ring->length == 0) {
+        ring->start = 0;
+    } else if (ring->mirrored) {
+        ring->start = (ring->start + n) % ring->size;
+    } else {
+        ring->start += n;
+    }
+
+    return true;
+}
+
+int64_t str_ring_indexof_str(const StrRing *ring, const char *substr, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(substr);
+    }
+
+    StrSlice slice = str_ring_peek(ring);
+    const char *r = str_memnstr((char *) slice.value, slice.length, substr, length);
+    return r ? (int64_t) (r - slice.value) : -1;
+}
+#endif
+
+static inline int str_trailing_zeros(uint64_t value)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(value);
+#else
+    int n = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+static inline bool str_is_word_byte(uint8_t c)
+{
+    return c >= 0x80 || (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+#if defined(__SSE2__)
+/**
+ * Classifies 16 bytes at once. Returns 0xFF for each word byte, and for each uppercase letter in `upper`.
+ */
+static inline __m128i str_word_match16(__m128i v, __m128i *upper)
+{
+    /* Unsigned range checks, done as signed comparisons after moving the range to the bottom */
+    __m128i high = _mm_cmplt_epi8(v, _mm_setzero_si128());
+    __m128i digit = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char) (0x80 - '0'))), _mm_set1_epi8(-128 + 10));
+    __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_cmplt_epi8(_mm_add_epi8(folded, _mm_set1_epi8((char) (0x80 - 'a'))), _mm_set1_epi8(-128 + 26));
+
+    *upper = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char) (0x80 - 'A'))), _mm_set1_epi8(-128 + 26));
+    return _mm_or_si128(high, _mm_or_si128(digit, alpha));
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i str_word_match32(__m256i v, __m256i *upper)
+{
+    __m256i high = _mm256_cmpgt_epi8(_mm256_setzero_si256(), v);
+    __m256i digit = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 10),
+                                      _mm256_add_epi8(v, _mm256_set1_epi8((char) (0x80 - '0'))));
+    __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26),
+                                      _mm256_add_epi8(folded, _mm256_set1_epi8((char) (0x80 - 'a'))));
+
+    *upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), _mm256_add_epi8(v, _mm256_set1_epi8((char) (0x80 - 'A'))));
+    return _mm256_or_si256(high, _mm256_or_si256(digit, alpha));
+}
+#endif
+
+/**
+ * Returns a mask with bit i set if s[i] is a word byte, for up to 64 bytes. `upper` receives the mask
+ * of the uppercase letters.
+ */
+static uint64_t str_word_mask64(const char *s, int64_t length, uint64_t *upper)
+{
+    char padded[TOKENIZER_BLOCK];
+
+    /* A short block is classified from a copy padded with NULs, which are not word bytes */
+    if (length < TOKENIZER_BLOCK) {
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, s, length);
+        s = padded;
+    }
+
+    uint64_t mask = 0;
+    *upper = 0;
+
+#if defined(__AVX2__)
+    for (int i = 0; i < TOKENIZER_BLOCK; i += 32) {
+        __m256i up;
+        __m256i words = str_word_match32(_mm256_loadu_si256((const __m256i *) (s + i)), &up);
+        mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(words) << i;
+        *upper |= (uint64_t) (uint32_t) _mm256_movemask_epi8(up) << i;
+    }
+#elif defined(__SSE2__)
+    for (int i = 0; i < TOKENIZER_BLOCK; i += 16) {
+        __m128i up;
+        __m128i words = str_word_match16(_mm_loadu_si128((const __m128i *) (s + i)), &up);
+        mask |= (uint64_t) (uint32_t) _mm_movemask_epi8(words) << i;
+        *upper |= (uint64_t) (uint32_t) _mm_movemask_epi8(up) << i;
+    }
+#else
+    for (int i = 0; i < TOKENIZER_BLOCK; i++) {
+        uint8_t c = (uint8_t) s[i];
+        mask |= (uint64_t) str_is_word_byte(c) << i;
+        *upper |= (uint64_t) ((uint8_t) (c - 'A') < 26) << i;
+    }
+#endif
+
+    return mask;
+}
+
+/**
+ * Returns the word mask of the bytes from p on, reusing the classified block when p falls inside it.
+ * `available` receives the number of bytes the mask covers and `upper` the uppercase mask.
+ */
+static uint64_t str_tokenizer_mask(StrTokenizer *tokenizer, const char *p, int64_t *available, uint64_t *upper)
+{
+    if (p < tokenizer->block || p >= tokenizer->block + tokenizer->block_length) {
+        tokenizer->block = p;
+        tokenizer->block_length = MIN(TOKENIZER_BLOCK, tokenizer->end - p);
+        tokenizer->mask = str_word_mask64(p, tokenizer->block_length, &tokenizer->upper);
+    }
+
+    int64_t shift = p - tokenizer->block;
+    *available = tokenizer->block_length - shift;
+    *upper = tokenizer->upper >> shift;
+    return tokenizer->mask >> shift;
+}
+
+bool str_tokenizer_init(StrTokenizer *tokenizer, const char *s, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    tokenizer->position = s;
+    tokenizer->end = s + length;
+    tokenizer->block = s;
+    tokenizer->block_length = 0;
+    tokenizer->mask = 0;
+    return str_init(&tokenizer->scratch);
+}
+
+void str_tokenizer_finalize(StrTokenizer *tokenizer)
+{
+    if (tokenizer) {
+        str_finalize(&tokenizer->scratch);
+    }
+}
+
+bool str_tokenizer_next(StrTokenizer *tokenizer, StrSlice *token)
+{
+    const char *p = tokenizer->position;
+    const char *end = tokenizer->end;
+    int64_t available;
+    uint64_t upper;
+
+    /* Skip to the first word byte */
+    while (p < end) {
+        uint64_t words = str_tokenizer_mask(tokenizer, p, &available, &upper);
+        if (words) {
+            p += str_trailing_zeros(words);
+            break;
+        }
+
+        p += available;
+    }
+
+    if (p >= end) {
+        tokenizer->position = end;
+        return false;
+    }
+
+    /* Then to the first byte after the word */
+    const char *start = p;
+    bool uppercase = false;
+
+    while (p < end) {
+        uint64_t separators = ~str_tokenizer_mask(tokenizer, p, &available, &upper);
+        if (available < TOKENIZER_BLOCK) {
+            separators &= (1ULL << available) - 1;
+        }
+
+        int64_t n = separators ? str_trailing_zeros(separators) : available;
+        uppercase |= (n < TOKENIZER_BLOCK ? upper & ((1ULL << n) - 1) : upper) != 0;
+
+        p += n;
+        if (separators) {
+            break;
+        }
+    }
+
+    int64_t length = p - start;
+
+    if (uppercase) {
+        Str *scratch = &tokenizer->scratch;
+        if (!str_ensure_capacity(scratch, length + 1)) {
+            /* Leave the position at the token, so that it can be retried */
+            tokenizer->position = start;
+            return false;
+        }
+
+        for (int64_t i = 0; i < length; i++) {
+            uint8_t c = (uint8_t) start[i];
+            scratch->value[i] = (char) ((uint8_t) (c - 'A') < 26 ? c | 0x20 : c);
+        }
+
+        scratch->length = length;
+        scratch->value[length] = '\0';
+        start = scratch->value;
+    }
+
+    tokenizer->position = p;
+    token->value = start;
+    token->length = length;
+    return true;
+}
+
+bool str_term_counter_init(StrTermCounter *counter, int64_t capacity)
+{
+    int64_t slot_count = TERM_COUNTER_MIN_SLOTS;
+    while (slot_count * 3 < capacity * 4) {
+        slot_count *= 2;
+    }
+
+    int64_t size = MAX(capacity, TERM_COUNTER_MIN_SLOTS);
+
+    counter->terms = malloc(sizeof(StrTerm) * size);
+    counter->slots = malloc(sizeof(int64_t) * slot_count);
+
+    if (counter->terms == NULL || counter->slots == NULL || !str_init(&counter->keys)) {
+        free(counter->terms);
+        free(counter->slots);
+        counter->terms = NULL;
+        counter->slots = NULL;
+        return false;
+    }
+
+    memset(counter->slots, 0xFF, sizeof(int64_t) * slot_count);
+    counter->count = 0;
+    counter->size = size;
+    counter->slot_count = slot_count;
+    return true;
+}
+
+void str_term_counter_finalize(StrTermCounter *counter)
+{
+    if (counter && counter->terms) {
+        str_finalize(&counter->keys);
+        free(counter->terms);
+        free(counter->slots);
+        counter->terms = NULL;
+        counter->slots = NULL;
+        counter->count = 0;
+        counter->size = 0;
+        counter->slot_count = 0;
+    }
+}
+
+/**
+ * Returns the slot holding the term, or the empty slot where it belongs.
+ */
+static int64_t str_term_counter_find(const StrTermCounter *counter, const char *term, int64_t length, uint64_t hash)
+{
+    int64_t mask = counter->slot_count - 1;
+    int64_t slot = (int64_t) (hash & (uint64_t) mask);
+
+    for (;;) {
+        int64_t index = counter->slots[slot];
+        if (index < 0) {
+            return slot;
+        }
+
+        const StrTerm *entry = &counter->terms[index];
+        if (entry->hash == hash && entry->length == length
+            && memcmp(counter->keys.value + entry->offset, term, length) == 0) {
+            return slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+/**
+ * Doubles the table. The stored hashes are reused, so no key is hashed again.
+ */
+static bool str_term_counter_grow(StrTermCounter *counter)
+{
+    int64_t slot_count = counter->slot_count * 2;
+    int64_t *slots = malloc(sizeof(int64_t) * slot_count);
+    if (slots == NULL) {
+        return false;
+    }
+
+    memset(slots, 0xFF, sizeof(int64_t) * slot_count);
+
+    for (int64_t i = 0; i < counter->count; i++) {
+        int64_t slot = (int64_t) (counter->terms[i].hash & (uint64_t) (slot_count - 1));
+        while (slots[slot] >= 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+
+        slots[slot] = i;
+    }
+
+    free(counter->slots);
+    counter->slots = slots;
+    counter->slot_count = slot_count;
+    return true;
+}
+
+bool str_term_counter_add(StrTermCounter *counter, const char *term, int64_t length, int64_t count)
+{
+    if (length < 0) {
+        length = str_get_len(term);
+    }
+
+    uint64_t hash = str_xxh64_str(term, length, 0);
+    int64_t slot = str_term_counter_find(counter, term, length, hash);
+
+    if (counter->slots[slot] >= 0) {
+        counter->terms[counter->slots[slot]].count += count;
+        return true;
+    }
+
+    /* Keep the load factor below 3/4 */
+    if ((counter->count + 1) * 4 > counter->slot_count * 3) {
+        if (!str_term_counter_grow(counter)) {
+            return false;
+        }
+
+        slot = str_term_counter_find(counter, term, length, hash);
+    }
+
+    if (counter->count == counter->size) {
+        StrTerm *terms = realloc(counter->terms, sizeof(StrTerm) * counter->size * 2);
+        if (terms == NULL) {
+            return false;
+        }
+
+        counter->terms = terms;
+        counter->size *= 2;
+    }
+
+    int64_t offset = counter->keys.length;
+    if (!str_append_str(&counter->keys, term, length)) {
+        return false;
+    }
+
+    StrTerm *entry = &counter->terms[counter->count];
+    entry->offset = offset;
+    entry->length = length;
+    entry->hash = hash;
+    entry->count = count;
+
+    counter->slots[slot] = counter->count++;
+    return true;
+}
+
+bool str_term_counter_add_text(StrTermCounter *counter, const char *s, int64_t length)
+{
+    StrTokenizer tokenizer;
+    if (!str_tokenizer_init(&tokenizer, s, length)) {
+        return false;
+    }
+
+    StrSlice token;
+    bool result = true;
+
+    while (result && str_tokenizer_next(&tokenizer, &token)) {
+        result = str_term_counter_add(counter, token.value, token.length, 1);
+    }
+
+    /* The tokenizer also stops when lowercasing a token fails to allocate */
+    result = result && tokenizer.position == tokenizer.end;
+
+    str_tokenizer_finalize(&tokenizer);
+    return result;
+}
+
+int64_t str_term_counter_get(const StrTermCounter *counter, const char *term, int64_t length)
+{
+    if (length < 0) {
+        length = str_get_len(term);
+    }
+
+    int64_t slot = str_term_counter_find(counter, term, length, str_xxh64_str(term, length, 0));
+    int64_t index = counter->slots[slot];
+    return index >= 0 ? counter->terms[index].count : 0;
+}
+
+/**
+ * Hashes a shingle of up to 8 bytes. (The finalizer of SplitMix64).
+ */
+static inline uint64_t str_shingle_hash(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Feeds one shingle hash into the sketch. Both loops run over independent lanes, so the compiler vectorizes them.
+ */
+static inline void str_sketch_update(uint64_t hash, const uint32_t *a, const uint32_t *b, uint32_t *signature,
+                                     int count, int32_t *weights)
+{
+    if (signature) {
+        uint32_t low = (uint32_t) hash;
+        uint32_t high = (uint32_t) (hash >> 32);
+
+        /* Each hash function is a different mix of the two halves of the shingle hash */
+        for (int i = 0; i < count; i++) {
+            uint32_t value = low * a[i] + high * b[i];
+            signature[i] = value < signature[i] ? value : signature[i];
+        }
+    }
+
+    if (weights) {
+        for (int bit = 0; bit < 64; bit++) {
+            weights[bit] += (int32_t) ((hash >> bit) & 1) * 2 - 1;
+        }
+    }
+}
+
+bool str_sketch(const char *s, int64_t length, int shingle, uint32_t *signature, int count, uint64_t *simhash)
+{
+    if (shingle < 1 || shingle > 8) {
+        return false;
+    }
+
+    if (length < 0) {
+        length = str_get_len(s);
+    }
+
+    /* Odd multipliers for the hash functions, derived from the function index */
+    uint32_t a[SKETCH_BLOCK];
+    uint32_t b[SKETCH_BLOCK];
+    int32_t weights[64];
+    int32_t *w = simhash ? weights : NULL;
+
+    memset(weights, 0, sizeof(weights));
+
+    if (signature) {
+        for (int i = 0; i < count; i++) {
+            signature[i] = UINT32_MAX;
+        }
+    }
+
+    uint64_t mask = shingle == 8 ? UINT64_MAX : (1ULL << (8 * shingle)) - 1;
+    int64_t shingles = length <= shingle ? (length > 0) : length - shingle + 1;
+
+    /* The signature is processed in blocks so the multipliers fit on the stack and stay in cache */
+    for (int first = 0; first < MAX(count, 1); first += SKETCH_BLOCK) {
+        int n = signature ? MIN(SKETCH_BLOCK, count - first) : 0;
+
+        for (int i = 0; i < n; i++) {
+            a[i] = (uint32_t) str_shingle_hash(2 * (uint64_t) (first + i) + 1) | 1;
+            b[i] = (uint32_t) str_shingle_hash(2 * (uint64_t) (first + i) + 2) | 1;
+        }
+
+        for (int64_t i = 0; i < shingles; i++) {
+            uint64_t x;
+            if (i + 8 <= length) {
+                x = str_load_u64le(s + i) & mask;
+            } else {
+                char tail[8] = {0};
+                memcpy(tail, s + i, MIN(shingle, length - i));
+                x = str_load_u64le(tail) & mask;
+            }
+
+            str_sketch_update(str_shingle_hash(x), a, b, signature ? signature + first : NULL, n, w);
+        }
+
+        /* The SimHash weights only need to be accumulated once */
+        w = NULL;
+        if (!signature) {
+            break;
+        }
+    }
+
+    if (simhash) {
+        uint64_t result = 0;
+        for (int bit = 0; bit < 64; bit++) {
+            result |= (uint64_t) (weights[bit] > 0) << bit;
+        }
+
+        *simhash = result;
+    }
+
+    return true;
+}
+
+double str_minhash_similarity(const uint32_t *a, const uint32_t *b, int count)
+{
+    int equal = 0;
+
+    for (int i = 0; i < count; i++) {
+        equal += a[i] == b[i];
+    }
+
+    return count > 0 ? (double) equal / count : 0.0;
+}
+
+int str_simhash_distance(uint64_t a, uint64_t b)
+{
+    uint64_t x = a ^ b;
+
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    for (; x; x &= x - 1) {
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+bool str_lsh_init(StrLshIndex *index, int bands, int rows)
+{
+    if (bands < 1 || rows < 1) {
+        return false;
+    }
+
+    index->entries = malloc(sizeof(StrLshEntry) * LSH_MIN_SLOTS);
+    index->slots = malloc(sizeof(int64_t) * LSH_MIN_SLOTS);
+
+    if (index->entries == NULL || index->slots == NULL) {
+        free(index->entries);
+        free(index->slots);
+        index->entries = NULL;
+        index->slots = NULL;
+        return false;
+    }
+
+    memset(index->slots, 0xFF, sizeof(int64_t) * LSH_MIN_SLOTS);
+    index->bands = bands;
+    index->rows = rows;
+    index->count = 0;
+    index->size = LSH_MIN_SLOTS;
+    index->slot_count = LSH_MIN_SLOTS;
+    index->key_count = 0;
+    return true;
+}
+
+void str_lsh_finalize(StrLshIndex *index)
+{
+    if (index && index->entries) {
+        free(index->entries);
+        free(index->slots);
+        index->entries = NULL;
+        index->slots = NULL;
+        index->count = 0;
+        index->size = 0;
+        index->slot_count = 0;
+        index->key_count = 0;
+    }
+}
+
+static inline uint64_t str_lsh_key(const StrLshIndex *index, const uint32_t *signature, int band)
+{
+    const uint32_t *rows = signature + (int64_t) band * index->rows;
+    return str_xxh64_str((const char *) rows, (int64_t) sizeof(uint32_t) * index->rows, (uint64_t) band);
+}
+
+/**
+ * Returns the slot holding the chain of the key, or the empty slot where it belongs.
+ */
+static int64_t str_lsh_find(const StrLshEntry *entries, const int64_t *slots, int64_t slot_count, uint64_t key)
+{
+    int64_t slot = (int64_t) (key & (uint64_t) (slot_count - 1));
+
+    while (slots[slot] >= 0 && entries[slots[slot]].key != key) {
+        slot = (slot + 1) & (slot_count - 1);
+    }
+
+    return slot;
+}
+
+static bool str_lsh_grow(StrLshIndex *index)
+{
+    int64_t slot_count = index->slot_count * 2;
+    int64_t *slots = malloc(sizeof(int64_t) * slot_count);
+    if (slots == NULL) {
+        return false;
+    }
+
+    memset(slots, 0xFF, sizeof(int64_t) * slot_count);
+
+    for (int64_t i = 0; i < index->slot_count; i++) {
+        int64_t head = index->slots[i];
+        if (head >= 0) {
+            slots[str_lsh_find(index->entries, slots, slot_count, index->entries[head].key)] = head;
+        }
+    }
+
+    free(index->slots);
+    index->slots = slots;
+    index->slot_count = slot_count;
+    return true;
+}
+
+bool str_lsh_insert(StrLshIndex *index, const uint32_t *signature, int64_t id)
+{
+    if (index->count + index->bands > index->size) {
+        int64_t size = MAX(index->size * 2, index->count + index->bands);
+        StrLshEntry *entries = realloc(index->entries, sizeof(StrLshEntry) * size);
+        if (entries == NULL) {
+            return false;
+        }
+
+        index->entries = entries;
+        index->size = size;
+    }
+
+    for (int band = 0; band < index->bands; band++) {
+        /* Keep the load factor below 3/4 */
+        if ((index->key_count + 1) * 4 > index->slot_count * 3 && !str_lsh_grow(index)) {
+            return false;
+        }
+
+        uint64_t key = str_lsh_key(index, signature, band);
+        int64_t slot = str_lsh_find(index->entries, index->slots, index->slot_count, key);
+
+        StrLshEntry *entry = &index->entries[index->count];
+        entry->key = key;
+        entry->id = id;
+        entry->next = index->slots[slot];
+
+        index->key_count += entry->next < 0;
+        index->slots[slot] = index->count++;
+    }
+
+    return true;
+}
+
+/**
+ * Adds an id to the set of distinct candidates: an open-addressed table of positions in `candidates`,
+ * plus one so that zero marks an empty slot. Returns false if the id is already in the set.
+ */
+static bool str_lsh_set_add(int64_t *set, int64_t set_size, const int64_t *candidates, int64_t position, int64_t id)
+{
+    int64_t slot = (int64_t) (str_shingle_hash((uint64_t) id) & (uint64_t) (set_size - 1));
+
+    while (set[slot] != 0) {
+        if (candidates[set[slot] - 1] == id) {
+            return false;
+        }
+
+        slot = (slot + 1) & (set_size - 1);
+    }
+
+    set[slot] = position + 1;
+    return true;
+}
+
+/**
+ * Doubles the set and reinserts the candidates found so far.
+ */
+static int64_t *str_lsh_set_grow(int64_t *set_size, const int64_t *candidates, int64_t found)
+{
+    int64_t size = *set_size * 2;
+    int64_t *grown = calloc(size, sizeof(int64_t));
+    if (grown == NULL) {
+        return NULL;
+    }
+
+    for (int64_t i = 0; i < found; i++) {
+        str_lsh_set_add(grown, size, candidates, i, candidates[i]);
+    }
+
+    *set_size = size;
+    return grown;
+}
+
+int64_t str_lsh_query(const StrLshIndex *index, const uint32_t *signature, int64_t *candidates, int64_t max)
+{
+    /* The set is kept at most half full; it starts on the stack and moves to the heap for large results */
+    int64_t stack_set[LSH_QUERY_SLOTS] = {0};
+    int64_t *set = stack_set;
+    int64_t set_size = LSH_QUERY_SLOTS;
+    int64_t found = 0;
+
+    for (int band = 0; band < index->bands && found < max; band++) {
+        uint64_t key = str_lsh_key(index, signature, band);
+        int64_t slot = str_lsh_find(index->entries, index->slots, index->slot_count, key);
+
+        for (int64_t i = index->slots[slot]; i >= 0 && found < max; i = index->entries[i].next) {
+            if (found * 2 >= set_size) {
+                int64_t *grown = str_lsh_set_grow(&set_size, candidates, found);
+                if (set != stack_set) {
+                    free(set);
+                }
+
+                if (grown == NULL) {
+                    return -1;
+                }
+
+                set = grown;
+            }
+
+            int64_t id = index->entries[i].id;
+            if (str_lsh_set_add(set, set_size, candidates, found, id)) {
+                candidates[found++] = id;
+            }
+        }
+    }
+
+    if (set != stack_set) {
+        free(set);
+    }
+
+    return found;
+}
+
+void str_diff_init(StrDiff *diff)
+{
+    diff->edits = NULL;
+    diff->count = 0;
+    diff->size = 0;
+}
+
+void str_diff_finalize(StrDiff *diff)
+{
+    if (diff) {
+        free(diff->edits);
+        str_diff_init(diff);
+    }
+}
+
+/**
+ * Appends an edit, merging it with the previous one when possible. A deletion that follows an insertion
+ * is moved in front of it, so a change always reads as the lines removed and then the lines added.
+ */
+static bool str_diff_emit(StrDiff *diff, StrDiffOp op, int64_t a_start, int64_t b_start, int64_t length)
+{
+    if (length == 0) {
+        return true;
+    }
+
+    StrDiffEdit *last = diff->count > 0 ? &diff->edits[diff->count - 1] : NULL;
+
+    if (op == STR_DIFF_DELETE && last && last->op == STR_DIFF_INSERT) {
+        if (diff->count > 1 && diff->edits[diff->count - 2].op == STR_DIFF_DELETE) {
+            diff->edits[diff->count - 2].length += length;
+            last->a_start += length;
+            return true;
+        }
+
+        b_start = last->b_start;
+    } else if (last && last->op == op) {
+        last->length += length;
+        return true;
+    }
+
+    if (diff->count == diff->size) {
+        int64_t size = MAX(diff->size * 2, DIFF_MIN_EDITS);
+        StrDiffEdit *edits = realloc(diff->edits, sizeof(StrDiffEdit) * size);
+        if (edits == NULL) {
+            return false;
+        }
+
+        diff->edits = edits;
+        diff->size = size;
+    }
+
+    StrDiffEdit edit = {op, a_start, b_start, length};
+
+    if (op == STR_DIFF_DELETE && diff->count > 0 && diff->edits[diff->count - 1].op == STR_DIFF_INSERT) {
+        diff->edits[diff->count] = diff->edits[diff->count - 1];
+        diff->edits[diff->count].a_start += length;
+        diff->edits[diff->count - 1] = edit;
+    } else {
+        diff->edits[diff->count] = edit;
+    }
+
+    diff->count++;
+    return true;
+}
+
+/**
+ * The sequences being compared, as symbols (bytes or interned lines), and the work arrays of the search.
+ * Edits are emitted at positions shifted by `a_base` and `b_base`.
+ */
+typedef struct StrDiffContext
+{
+    StrDiff *diff;
+    const uint32_t *a;
+    const uint32_t *b;
+    int64_t a_base;
+    int64_t b_base;
+    int64_t *forward;
+    int64_t *backward;
+} StrDiffContext;
+
+static bool str_diff_compare(StrDiffContext *c, int64_t a_lo, int64_t a_hi, int64_t b_lo, int64_t b_hi);
+
+/**
+ * Finds the middle snake of a[a_lo, a_hi) and b[b_lo, b_hi) by searching forward from the start and
+ * backward from the end until the paths overlap, then diffs the two halves around it. Only the furthest
+ * reaching path of each diagonal is kept, so the memory is linear in the length of the inputs.
+ */
+static bool str_diff_bisect(StrDiffContext *c, int64_t a_lo, int64_t a_hi, int64_t b_lo, int64_t b_hi)
+{
+    const uint32_t *a = c->a + a_lo;
+    const uint32_t *b = c->b + b_lo;
+    int64_t n = a_hi - a_lo;
+    int64_t m = b_hi - b_lo;
+    int64_t max_d = (n + m + 1) / 2;
+    int64_t offset = max_d;
+    int64_t v_length = 2 * max_d + 2;
+    int64_t *v1 = c->forward;
+    int64_t *v2 = c->backward;
+
+    for (int64_t i = 0; i < v_length; i++) {
+        v1[i] = -1;
+        v2[i] = -1;
+    }
+
+    v1[offset + 1] = 0;
+    v2[offset + 1] = 0;
+
+    int64_t delta = n - m;
+    bool front = (delta & 1) != 0;
+
+    /* Diagonals that ran off the edge of the grid are skipped from then on */
+    int64_t k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+
+    for (int64_t d = 0; d < max_d; d++) {
+        for (int64_t k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+            int64_t k1_offset = offset + k1;
+            int64_t x1;
+
+            if (k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1])) {
+                x1 = v1[k1_offset + 1];
+            } else {
+                x1 = v1[k1_offset - 1] + 1;
+            }
+
+            int64_t y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                x1++;
+                y1++;
+            }
+
+            v1[k1_offset] = x1;
+
+            if (x1 > n) {
+                k1_end += 2;
+            } else if (y1 > m) {
+                k1_start += 2;
+            } else if (front) {
+                int64_t k2_offset = offset + delta - k1;
+                if (k2_offset >= 0 && k2_offset < v_length && v2[k2_offset] != -1 && x1 >= n - v2[k2_offset]) {
+                    return str_diff_compare(c, a_lo, a_lo + x1, b_lo, b_lo + y1) &&
+                           str_diff_compare(c, a_lo + x1, a_hi, b_lo + y1, b_hi);
+                }
+            }
+        }
+
+        for (int64_t k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+            int64_t k2_offset = offset + k2;
+            int64_t x2;
+
+            if (k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1])) {
+                x2 = v2[k2_offset + 1];
+            } else {
+                x2 = v2[k2_offset - 1] + 1;
+            }
+
+            int64_t y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                x2++;
+                y2++;
+            }
+
+            v2[k2_offset] = x2;
+
+            if (x2 > n) {
+                k2_end += 2;
+            } else if (y2 > m) {
+                k2_start += 2;
+            } else if (!front) {
+                int64_t k1_offset = offset + delta - k2;
+                if (k1_offset >= 0 && k1_offset < v_length && v1[k1_offset] != -1) {
+                    int64_t x1 = v1[k1_offset];
+                    int64_t y1 = offset + x1 - k1_offset;
+                    if (x1 >= n - x2) {
+                        return str_diff_compare(c, a_lo, a_lo + x1, b_lo, b_lo + y1) &&
+                               str_diff_compare(c, a_lo + x1, a_hi, b_lo + y1, b_hi);
+                    }
+                }
+            }
+        }
+    }
+
+    /* The paths did not meet: the inputs have no symbols in common, so all of a is replaced by all of b */
+    return str_diff_emit(c->diff, STR_DIFF_DELETE, c->a_base + a_lo, c->b_base + b_lo, n) &&
+           str_diff_emit(c->diff, STR_DIFF_INSERT, c->a_base + a_hi, c->b_base + b_lo, m);
+}
+
+static bool str_diff_compare(StrDiffContext *c, int64_t a_lo, int64_t a_hi, int64_t b_lo, int64_t b_hi)
+{
+    int64_t prefix = 0;
+    while (a_lo + prefix < a_hi && b_lo + prefix < b_hi && c->a[a_lo + prefix] == c->b[b_lo + prefix]) {
+        prefix++;
+    }
+
+    if (!str_diff_emit(c->diff, STR_DIFF_EQUAL, c->a_base + a_lo, c->b_base + b_lo, prefix)) {
+        return false;
+    }
+
+    a_lo += prefix;
+    b_lo += prefix;
+
+    int64_t suffix = 0;
+    while (a_lo < a_hi - suffix && b_lo < b_hi - suffix && c->a[a_hi - suffix - 1] == c->b[b_hi - suffix - 1]) {
+        suffix++;
+    }
+
+    a_hi -= suffix;
+    b_hi -= suffix;
+
+    bool ok;
+    if (a_lo == a_hi || b_lo == b_hi) {
+        ok = str_diff_emit(c->diff, STR_DIFF_DELETE, c->a_base + a_lo, c->b_base + b_lo, a_hi - a_lo) &&
+             str_diff_emit(c->diff, STR_DIFF_INSERT, c->a_base + a_hi, c->b_base + b_lo, b_hi - b_lo);
+    } else {
+        ok = str_diff_bisect(c, a_lo, a_hi, b_lo, b_hi);
+    }
+
+    return ok && str_diff_emit(c->diff, STR_DIFF_EQUAL, c->a_base + a_hi, c->b_base + b_hi, suffix);
+}
+
+/**
+ * Diffs two symbol sequences and emits the edits at positions shifted by the bases.
+ */
+static bool str_diff_symbols(StrDiff *diff, const uint32_t *a, int64_t a_count, const uint32_t *b, int64_t b_count,
+                             int64_t a_base, int64_t b_base)
+{
+    int64_t v_length = a_count + b_count + 3;
+    int64_t *v = malloc(sizeof(int64_t) * 2 * v_length);
+    if (v == NULL) {
+        return false;
+    }
+
+    StrDiffContext c = {diff, a, b, a_base, b_base, v, v + v_length};
+    bool ok = str_diff_compare(&c, 0, a_count, 0, b_count);
+
+    free(v);
+    return ok;
+}
+
+bool str_diff_bytes(StrDiff *diff, const char *a, int64_t a_length, const char *b, int64_t b_length)
+{
+    if (a_length < 0) {
+        a_length = str_get_len(a);
+    }
+
+    if (b_length < 0) {
+        b_length = str_get_len(b);
+    }
+
+    diff->count = 0;
+
+    /* Only the bytes between the common prefix and suffix are widened to symbols for the search */
+    const uint8_t *x = (const uint8_t *) a;
+    const uint8_t *y = (const uint8_t *) b;
+    int64_t prefix = str_common_prefix(x, y, MIN(a_length, b_length));
+    int64_t suffix = str_common_suffix(x + a_length, y + b_length, MIN(a_length, b_length) - prefix);
+    int64_t n = a_length - prefix - suffix;
+    int64_t m = b_length - prefix - suffix;
+
+    if (!str_diff_emit(diff, STR_DIFF_EQUAL, 0, 0, prefix)) {
+        return false;
+    }
+
+    if (n > 0 || m > 0) {
+        uint32_t *symbols = malloc(sizeof(uint32_t) * (n + m + 1));
+        if (symbols == NULL) {
+            return false;
+        }
+
+        for (int64_t i = 0; i < n; i++) {
+            symbols[i] = x[prefix + i];
+        }
+
+        for (int64_t i = 0; i < m; i++) {
+            symbols[n + i] = y[prefix + i];
+        }
+
+        bool ok = str_diff_symbols(diff, symbols, n, symbols + n, m, prefix, prefix);
+        free(symbols);
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return str_diff_emit(diff, STR_DIFF_EQUAL, a_length - suffix, b_length - suffix, suffix);
+}
+
+/**
+ * Returns the start offsets of the lines of a text, followed by its length, or NULL if the memory
+ * allocation failed.
+ */
+static int64_t *str_diff_split_lines(const char *s, int64_t length, int64_t *count)
+{
+    int64_t n = 0;
+    for (const char *p = s, *end = s + length; p < end; n++) {
+        const char *newline = memchr(p, '\n', end - p);
+        p = newline ? newline + 1 : end;
+    }
+
+    int64_t *starts = malloc(sizeof(int64_t) * (n + 1));
+    if (starts == NULL) {
+        return NULL;
+    }
+
+    int64_t i = 0;
+    for (const char *p = s, *end = s + length; p < end; i++) {
+        starts[i] = p - s;
+        const char *newline = memchr(p, '\n', end - p);
+        p = newline ? newline + 1 : end;
+    }
+
+    starts[n] = length;
+    *count = n;
+    return starts;
+}
+
+/**
+ * Returns the number of leading lines of a text that end with a '\n' at or before the offset.
+ */
+static int64_t str_diff_lines_before(const char *s, const int64_t *starts, int64_t count, int64_t offset)
+{
+    int64_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo + 1) / 2;
+        if (starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (lo == count && count > 0 && s[starts[count] - 1] != '\n') {
+        lo--;
+    }
+
+    return lo;
+}
+
+/**
+ * Replaces each line of both texts with a symbol, equal lines getting the same symbol.
+ */
+static bool str_diff_intern_lines(const char *a, const int64_t *a_starts, int64_t a_first, int64_t a_count,
+                                  const char *b, const int64_t *b_starts, int64_t b_first, int64_t b_count,
+                                  uint32_t *symbols)
+{
+    int64_t total = a_count + b_count;
+    int64_t slot_count = 16;
+    while (slot_count < total * 2) {
+        slot_count *= 2;
+    }
+
+    /* Each slot holds the index of the first line with that content, plus one */
+    int64_t *slots = calloc(slot_count, sizeof(int64_t));
+    uint64_t *hashes = malloc(sizeof(uint64_t) * (total + 1));
+    if (slots == NULL || hashes == NULL) {
+        free(slots);
+        free(hashes);
+        return false;
+    }
+
+    uint32_t next = 0;
+
+    for (int64_t i = 0; i < total; i++) {
+        const char *s = i < a_count ? a : b;
+        const int64_t *starts = i < a_count ? a_starts : b_starts;
+        int64_t line = i < a_count ? a_first + i : b_first + i - a_count;
+        int64_t length = starts[line + 1] - starts[line];
+        const char *p = s + starts[line];
+
+        uint64_t hash = str_xxh64_str(p, length, 0);
+        int64_t slot = (int64_t) (hash & (uint64_t) (slot_count - 1));
+        hashes[i] = hash;
+
+        for (;; slot = (slot + 1) & (slot_count - 1)) {
+            int64_t j = slots[slot] - 1;
+            if (j < 0) {
+                slots[slot] = i + 1;
+                symbols[i] = next++;
+                break;
+            }
+
+            const char *t = j < a_count ? a : b;
+            const int64_t *t_starts = j < a_count ? a_starts : b_starts;
+            int64_t t_line = j < a_count ? a_first + j : b_first + j - a_count;
+
+            if (hashes[j] == hash && t_starts[t_line + 1] - t_starts[t_line] == length &&
+                memcmp(t + t_starts[t_line], p, length) == 0) {
+                symbols[i] = symbols[j];
+                break;
+            }
+        }
+    }
+
+    free(slots);
+    free(hashes);
+    return true;
+}
+
+/**
+ * Computes the line diff with the line tables of both texts already split.
+ */
+static bool str_diff_line_tables(StrDiff *diff, const char *a, const int64_t *a_starts, int64_t a_lines,
+                                 const char *b, const int64_t *b_starts, int64_t b_lines)
+{
+    int64_t a_length = a_starts[a_lines];
+    int64_t b_length = b_starts[b_lines];
+
+    diff->count = 0;
+
+    if (a_length == b_length && memcmp(a, b, a_length) == 0) {
+        return str_diff_emit(diff, STR_DIFF_EQUAL, 0, 0, a_lines);
+    }
+
+    /* Trim the common lines with a word-wise comparison of the bytes, before hashing any line */
+    const uint8_t *x = (const uint8_t *) a;
+    const uint8_t *y = (const uint8_t *) b;
+    int64_t prefix_bytes = str_common_prefix(x, y, MIN(a_length, b_length));
+    int64_t prefix = str_diff_lines_before(a, a_starts, a_lines, prefix_bytes);
+
+    int64_t limit = MIN(a_length, b_length) - a_starts[prefix];
+    int64_t suffix_bytes = str_common_suffix(x + a_length, y + b_length, limit);
+
+    /* The suffix starts at the first line boundary that is a line start in both texts */
+    int64_t a_from = a_length - suffix_bytes;
+    int64_t b_from = b_length - suffix_bytes;
+    if (suffix_bytes > 0 && !((a_from == a_starts[prefix] || a[a_from - 1] == '\n') &&
+                              (b_from == b_starts[prefix] || b[b_from - 1] == '\n'))) {
+        const char *newline = memchr(a + a_from, '\n', suffix_bytes);
+        suffix_bytes = newline ? a_length - (newline + 1 - a) : 0;
+    }
+
+    int64_t suffix = 0;
+    if (suffix_bytes > 0) {
+        suffix = a_lines - str_diff_lines_before(a, a_starts, a_lines, a_length - suffix_bytes);
+    }
+
+    int64_t n = a_lines - prefix - suffix;
+    int64_t m = b_lines - prefix - suffix;
+
+    if (!str_diff_emit(diff, STR_DIFF_EQUAL, 0, 0, prefix)) {
+        return false;
+    }
+
+    if (n > 0 || m > 0) {
+        uint32_t *symbols = malloc(sizeof(uint32_t) * (n + m + 1));
+        if (symbols == NULL) {
+            return false;
+        }
+
+        bool ok = str_diff_intern_lines(a, a_starts, prefix, n, b, b_starts, prefix, m, symbols) &&
+                  str_diff_symbols(diff, symbols, n, symbols + n, m, prefix, prefix);
+        free(symbols);
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return str_diff_emit(diff, STR_DIFF_EQUAL, a_lines - suffix, b_lines - suffix, suffix);
+}
+
+bool str_diff_lines(StrDiff *diff, const char *a, int64_t a_length, const char *b, int64_t b_length)
+{
+    if (a_length < 0) {
+        a_length = str_get_len(a);
+    }
+
+    if (b_length < 0) {
+        b_length = str_get_len(b);
+    }
+
+    int64_t a_lines, b_lines;
+    int64_t *a_starts = str_diff_split_lines(a, a_length, &a_lines);
+    int64_t *b_starts = str_diff_split_lines(b, b_length, &b_lines);
+
+    bool ok = a_starts && b_starts && str_diff_line_tables(diff, a, a_starts, a_lines, b, b_starts, b_lines);
+
+    free(a_starts);
+    free(b_starts);
+    return ok;
+}
+
+/**
+ * Appends a line of a unified diff hunk, with a marker for a last line that has no newline.
+ */
+static bool str_diff_append_line(Str *str, char marker, const char *s, const int64_t *starts, int64_t line)
+{
+    const char *p = s + starts[line];
+    int64_t length = starts[line + 1] - starts[line];
+
+    if (!str_append_char(str, marker) || !str_append_str(str, p, length)) {
+        return false;
+    }
+
+    return p[length - 1] == '\n' || str_append_str(str, "\n\\ No newline at end of file\n", -1);
+}
+
+/**
+ * Appends the line range of a hunk header: the first line and the count, which is omitted when it is 1.
+ * An empty range names the line before it.
+ */
+static bool str_diff_append_range(Str *str, int64_t start, int64_t count)
+{
+    if (!str_append_uint(str, (uint64_t) (count == 0 ? start : start + 1))) {
+        return false;
+    }
+
+    return count == 1 || (str_append_char(str, ',') && str_append_uint(str, (uint64_t) count));
+}
+
+bool str_append_unified_diff(Str *str, const char *a, int64_t a_length, const char *b, int64_t b_length,
+                             const char *a_name, const char *b_name, int context)
+{
+    if (a_length < 0) {
+        a_length = str_get_len(a);
+    }
+
+    if (b_length < 0) {
+        b_length = str_get_len(b);
+    }
+
+    context = MAX(context, 0);
+
+    int64_t a_lines, b_lines;
+    int64_t *a_starts = str_diff_split_lines(a, a_length, &a_lines);
+    int64_t *b_starts = str_diff_split_lines(b, b_length, &b_lines);
+
+    StrDiff diff;
+    str_diff_init(&diff);
+
+    bool ok = a_starts && b_starts && str_diff_line_tables(&diff, a, a_starts, a_lines, b, b_starts, b_lines);
+    const StrDiffEdit *edits = diff.edits;
+    bool changed = ok && (diff.count > 1 || (diff.count == 1 && edits[0].op != STR_DIFF_EQUAL));
+
+    if (changed) {
+        ok = str_append_str(str, "--- ", 4) && str_append_str(str, a_name, -1) &&
+             str_append_str(str, "\n+++ ", 5) && str_append_str(str, b_name, -1) && str_append_char(str, '\n');
+    }
+
+    for (int64_t i = 0; changed && ok && i < diff.count; i++) {
+        if (edits[i].op == STR_DIFF_EQUAL) {
+            continue;
+        }
+
+        /* Changes separated by at most twice the context share a hunk */
+        int64_t last = i;
+        for (int64_t j = i + 1; j < diff.count; j++) {
+            if (edits[j].op != STR_DIFF_EQUAL) {
+                last = j;
+            } else if (edits[j].length > 2 * (int64_t) context || j == diff.count - 1) {
+                break;
+            }
+        }
+
+        const StrDiffEdit *end = &edits[last];
+        int64_t a_end = end->a_start + (end->op == STR_DIFF_DELETE ? end->length : 0);
+        int64_t b_end = end->b_start + (end->op == STR_DIFF_INSERT ? end->length : 0);
+        int64_t before = MIN(context, edits[i].a_start);
+        int64_t after = MIN(context, a_lines - a_end);
+        int64_t a_lo = edits[i].a_start - before;
+        int64_t b_lo = edits[i].b_start - before;
+
+        ok = str_append_str(str, "@@ -", 4) && str_diff_append_range(str, a_lo, a_end + after - a_lo) &&
+             str_append_str(str, " +", 2) && str_diff_append_range(str, b_lo, b_end + after - b_lo) &&
+             str_append_str(str, " @@\n", 4);
+
+        for (int64_t line = a_lo; ok && line < edits[i].a_start; line++) {
+            ok = str_diff_append_line(str, ' ', a, a_starts, line);
+        }
+
+        for (int64_t k = i; ok && k <= last; k++) {
+            const StrDiffEdit *edit = &edits[k];
+            for (int64_t line = 0; ok && line < edit->length; line++) {
+                if (edit->op == STR_DIFF_INSERT) {
+                    ok = str_diff_append_line(str, '+', b, b_starts, edit->b_start + line);
+                } else {
+                    ok = str_diff_append_line(str, edit->op == STR_DIFF_DELETE ? '-' : ' ', a, a_starts,
+                                              edit->a_start + line);
+                }
+            }
+        }
+
+        for (int64_t line = a_end; ok && line < a_end + after; line++) {
+            ok = str_diff_append_line(str, ' ', a, a_starts, line);
+        }
+
+        i = last;
+    }
+
+    str_diff_finalize(&diff);
+    free(a_starts);
+    free(b_starts);
+    return ok;
+}
@@ -1,17 +1,375 @@
 #pragma once
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define STR_HAVE_POSIX 1
+
+/* The logger, the concurrent buffer and the background writer use POSIX threads and C11 atomics */
+#if !defined(STR_NO_THREADS) && !defined(__STDC_NO_ATOMICS__)
+#define STR_HAVE_THREADS 1
+#endif
+#endif
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef __int128 StrInt128;
+__extension__ typedef unsigned __int128 StrUInt128;
+#endif
+
 #define STR_DEFAULT_INIT_SIZE 16
 
+#define STR_LZ4_LEVEL_FAST 1
+#define STR_LZ4_LEVEL_MAX 12
+
 typedef struct Str
 {
     char *value;
     int64_t size;
     int64_t length;
+    uint64_t generation;
 } Str;
 
+/**
+ * Running digests of the contents of a Str object, owned by the caller. Bytes appended with
+ * str_digest_append() are fed right away, so reading the digest is O(1); bytes appended to the string
+ * directly are fed on the next read. `generation` is the generation of the string the digest covers:
+ * functions that shrink a string or edit it in place bump its generation, and the digest starts over.
+ */
+typedef struct StrDigest
+{
+    Str *str;
+    uint64_t fnv1a;
+    uint32_t crc32;
+    int64_t length;
+    uint64_t generation;
+} StrDigest;
+
+/**
+ * A read-only view of a range of bytes. Slices do not own their memory and are invalidated
+ * when the Str object they point into is reallocated or finalized.
+ */
+typedef struct StrSlice
+{
+    const char *value;
+    int64_t length;
+} StrSlice;
+
+/**
+ * A bounds-checked read cursor over a range of bytes, e.g. a binary message stored in a Str object.
+ * The cursor does not own the bytes.
+ */
+typedef struct StrReader
+{
+    const char *position;
+    const char *end;
+} StrReader;
+
+/**
+ * A read-only collection of strings loaded from a snapshot file. The file is memory-mapped; its entries are
+ * accessed in place, without copies.
+ */
+typedef struct StrCollection
+{
+    void *map;
+    int64_t map_size;
+    int64_t count;
+    const char *offsets;
+    const char *blob;
+    int64_t blob_size;
+} StrCollection;
+
+/**
+ * A byte queue for streaming protocols. Bytes are appended at the tail and consumed from the head without
+ * moving the remaining bytes. On Linux, the buffer is mapped twice back to back so that the readable bytes
+ * are always contiguous, even when they wrap around; elsewhere they are compacted when the tail runs out of room.
+ */
+typedef struct StrRing
+{
+    char *value;
+    int64_t size;
+    int64_t start;
+    int64_t length;
+    bool mirrored;
+} StrRing;
+
+#ifdef STR_HAVE_THREADS
+typedef enum StrLogOverflow
+{
+    STR_LOG_BLOCK = 0,
+    STR_LOG_DROP = 1,
+} StrLogOverflow;
+
+/**
+ * Asynchronous logger. Messages are formatted on the calling thread and handed off through a lock-free
+ * multi-producer single-consumer queue to a background thread that writes them in batches. The queue and
+ * the thread are private to str.c.
+ */
+typedef struct StrLogger
+{
+    struct StrLoggerState *state;
+} StrLogger;
+
+/**
+ * Fixed-size circular buffer that many threads can append to concurrently. Bytes are stored at
+ * `position % size`, where the position counts all the bytes ever appended. Writers reserve space
+ * atomically and copy their bytes in parallel, then publish them in reservation order, so a reader can
+ * always consume the contiguous range of published bytes. Consumed space is reused by later appends.
+ * The atomic counters are private to str.c.
+ */
+typedef struct StrConcurrentBuffer
+{
+    char *value;
+    int64_t size;
+    struct StrConcurrentCounters *counters;
+} StrConcurrentBuffer;
+#endif
+
+/**
+ * An output builder bound to a file descriptor. Append to `buffer` with any str_append_*() function (or the
+ * str_writer_append_*() shortcuts); once the buffer crosses the watermark, it is written out, so memory usage
+ * stays bounded regardless of the size of the output. The counters may be read after str_writer_flush().
+ */
+typedef struct StrWriter
+{
+    Str buffer;
+    int fd;
+    int64_t watermark;
+    bool failed;
+    int64_t bytes_written;
+    int64_t flush_count;
+    int64_t flush_time_ns;
+    int64_t max_flush_time_ns;
+#ifdef STR_HAVE_THREADS
+    bool background;
+    struct StrWriterThread *thread;
+#endif
+} StrWriter;
+
+/**
+ * The outcome of a write queued on a StrIoQueue: the user data it was queued with and either the number
+ * of bytes written or a negated errno value.
+ */
+typedef struct StrIoCompletion
+{
+    uint64_t user_data;
+    int64_t result;
+} StrIoCompletion;
+
+/**
+ * A write waiting in the queue of the writev fallback, or submitted to io_uring. `written` counts the bytes
+ * of an io_uring write that were written before the kernel reported a short write. `next` is the slot of the
+ * write linked after it, or -1, and `attempt` counts its submissions, so that the completion of a submission
+ * cancelled by a short write can be told apart from the one that replaced it.
+ */
+typedef struct StrIoRequest
+{
+    int fd;
+    const char *value;
+    int64_t length;
+    int64_t offset;
+    uint64_t user_data;
+    int buffer_index;
+    int64_t written;
+    int next;
+    uint32_t attempt;
+} StrIoRequest;
+
+/**
+ * A queue of file writes submitted in batches. On Linux 5.6 and later it is backed by io_uring; elsewhere,
+ * or when the kernel refuses to set up a ring, the writes are performed with writev() when the queue is
+ * submitted. `queued` counts the writes not yet submitted and `in_flight` the submitted ones not yet reaped.
+ * With io_uring, `requests` is indexed by the user data of the submission entries and `free_slots` lists
+ * its unused entries; `link_fd`, `link_tail` and `link_slot` track the last write appended at the current file
+ * position.
+ */
+typedef struct StrIoQueue
+{
+    bool uring;
+    int ring_fd;
+    unsigned capacity;
+    unsigned queued;
+    unsigned in_flight;
+    Str *registered;
+    int registered_count;
+    void *sq_ring;
+    void *cq_ring;
+    void *sqes;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+    unsigned *free_slots;
+    unsigned free_count;
+    int link_fd;
+    unsigned link_tail;
+    unsigned link_slot;
+    StrIoRequest *requests;
+    StrIoCompletion *completions;
+    unsigned completion_count;
+} StrIoQueue;
+
+/**
+ * Splits text into lowercase word tokens. Words are runs of ASCII letters and digits and bytes of 0x80 and
+ * above, so UTF-8 text stays in one piece (only ASCII is lowercased). The bytes are classified 64 at a time.
+ */
+typedef struct StrTokenizer
+{
+    const char *position;
+    const char *end;
+    const char *block;
+    int64_t block_length;
+    uint64_t mask;
+    uint64_t upper;
+    Str scratch;
+} StrTokenizer;
+
+typedef struct StrTerm
+{
+    int64_t offset;
+    int64_t length;
+    uint64_t hash;
+    int64_t count;
+} StrTerm;
+
+/**
+ * Counts occurrences of terms. The bytes of all the terms are stored back to back in `keys` and addressed by
+ * offset, so adding a known term allocates nothing. Terms are kept in insertion order in `terms`, and `slots`
+ * is an open-addressing table of indexes into it.
+ */
+typedef struct StrTermCounter
+{
+    Str keys;
+    StrTerm *terms;
+    int64_t count;
+    int64_t size;
+    int64_t *slots;
+    int64_t slot_count;
+} StrTermCounter;
+
+typedef struct StrLshEntry
+{
+    uint64_t key;
+    int64_t id;
+    int64_t next;
+} StrLshEntry;
+
+/**
+ * Locality-sensitive hashing index of MinHash signatures. Each signature is cut into `bands` bands of `rows`
+ * values; documents sharing any band are candidates. Every (band, document) pair is an entry, chained to the
+ * previous entry with the same band hash; `slots` is an open-addressing table of the most recent entry of
+ * each distinct band hash.
+ */
+typedef struct StrLshIndex
+{
+    int bands;
+    int rows;
+    StrLshEntry *entries;
+    int64_t count;
+    int64_t size;
+    int64_t *slots;
+    int64_t slot_count;
+    int64_t key_count;
+} StrLshIndex;
+
+typedef enum StrDiffOp
+{
+    STR_DIFF_EQUAL = 0,
+    STR_DIFF_DELETE = 1,
+    STR_DIFF_INSERT = 2,
+} StrDiffOp;
+
+/**
+ * A run of `length` units (bytes or lines) kept, deleted from the old text at `a_start` or inserted from the
+ * new text at `b_start`. Both starts are always set, so every edit knows its position in both texts.
+ */
+typedef struct StrDiffEdit
+{
+    StrDiffOp op;
+    int64_t a_start;
+    int64_t b_start;
+    int64_t length;
+} StrDiffEdit;
+
+/**
+ * An edit script turning one text into another. Between two equal runs there is at most one deletion,
+ * followed by at most one insertion.
+ */
+typedef struct StrDiff
+{
+    StrDiffEdit *edits;
+    int64_t count;
+    int64_t size;
+} StrDiff;
+
+#define STR_LINE_INDEX_SAMPLE_RATE 64
+
+/**
+ * Index of the line starts of a Str object. Only the start of every STR_LINE_INDEX_SAMPLE_RATE-th line
+ * is stored; the remaining lines are located by scanning forward from the closest sample.
+ */
+typedef struct StrLineIndex
+{
+    int64_t *samples;
+    int64_t sample_count;
+    int64_t sample_size;
+    int64_t line_count;
+    int64_t scanned;
+} StrLineIndex;
+
+/**
+ * Resumable search state for a needle in a Str object that keeps growing.
+ * It remembers how far the string was scanned and how much of the needle was matched at that point.
+ */
+typedef struct StrMatcher
+{
+    char *needle;
+    int64_t *failure;
+    int64_t length;
+    int64_t matched;
+    int64_t scanned;
+} StrMatcher;
+
+/**
+ * The unit of an epoch timestamp. The value is the number of fractional digits it is rendered with.
+ */
+typedef enum StrTimeUnit
+{
+    STR_TIME_SECONDS = 0,
+    STR_TIME_MILLIS = 3,
+    STR_TIME_MICROS = 6,
+    STR_TIME_NANOS = 9,
+} StrTimeUnit;
+
+/**
+ * Where a value goes within a padded field.
+ */
+typedef enum StrAlign
+{
+    STR_ALIGN_LEFT = 0,
+    STR_ALIGN_RIGHT = 1,
+    STR_ALIGN_CENTER = 2,
+} StrAlign;
+
+/**
+ * The layout of a column of str_append_row(). A fill of '\0' pads with spaces.
+ */
+typedef struct StrColumn
+{
+    int64_t width;
+    StrAlign align;
+    char fill;
+} StrColumn;
+
 typedef enum StrTrimOptions
 {
     STR_TRIM_NONE = 0,
@@ -20,6 +378,20 @@ typedef enum StrTrimOptions
     STR_TRIM_BOTH = 3,
 } StrTrimOptions;
 
+/**
+ * Wraps a slice in a read-only Str object so it can be passed to the functions that do not modify their argument
+ * (comparison, search, checksums...). The result does not own its memory; it must not be modified or finalized.
+ *
+ * @param slice The slice to wrap.
+ *
+ * @return A read-only Str object.
+ */
+static inline Str str_from_slice(StrSlice slice)
+{
+    Str str = {(char *) slice.value, 0, slice.length, 0};
+    return str;
+}
+
 /**
  * Initializes a Str object of the given size.
  *
@@ -94,6 +466,183 @@ bool str_ensure_capacity(Str *str, int64_t min_size);
  */
 bool str_copy(const Str *source, Str *destination);
 
+/**
+ * Initializes a streaming digest of a Str object. The existing contents are hashed on the first read.
+ * The string may keep growing through any str_append_*() function. After it is shrunk or edited in place
+ * by the functions of this library (str_set_length(), str_trim(), str_to_upper(), ...), the next read hashes
+ * it again from the start. Changes made through `value` or `length` directly, or initializing the string
+ * again, require str_digest_reset(). The digest does not own the string and needs no finalization.
+ *
+ * @param digest A handle to the StrDigest object to initialize.
+ * @param str A handle to the Str object to digest.
+ */
+void str_digest_init(StrDigest *digest, Str *str);
+
+/**
+ * Makes the digest start over from the beginning of the string, e.g. after its bytes were written directly.
+ *
+ * @param digest A handle to the StrDigest object.
+ */
+void str_digest_reset(StrDigest *digest);
+
+/**
+ * Appends bytes to the digested string and feeds them to the digest right away, while they are in the cache.
+ *
+ * @param digest A handle to the StrDigest object.
+ * @param s A pointer to the bytes to append.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the bytes were appended; otherwise false.
+ */
+bool str_digest_append(StrDigest *digest, const char *s, int64_t length);
+
+/**
+ * Returns the 64-bit FNV-1a hash of the digested string. This costs only the bytes appended since the last
+ * update, or the whole string if it was modified in place.
+ *
+ * @param digest A handle to the StrDigest object.
+ *
+ * @return The hash of the whole string.
+ */
+uint64_t str_digest_fnv1a(StrDigest *digest);
+
+/**
+ * Returns the CRC-32 (ISO-HDLC, as used by zlib) of the digested string. Same cost as str_digest_fnv1a().
+ *
+ * @param digest A handle to the StrDigest object.
+ *
+ * @return The checksum of the whole string.
+ */
+uint32_t str_digest_crc32(StrDigest *digest);
+
+/**
+ * Updates a running CRC-32 (ISO-HDLC, as used by zlib and gzip) with the given bytes.
+ * When compiled with PCLMUL support, long inputs are folded 64 bytes at a time with carry-less multiplication.
+ *
+ * @param crc The CRC of the preceding bytes. Pass 0 to start a new checksum.
+ * @param s A pointer to the bytes.
+ * @param length The number of bytes.
+ *
+ * @return The updated CRC.
+ */
+uint32_t str_crc32_update(uint32_t crc, const char *s, int64_t length);
+
+/**
+ * Updates a running CRC-32C (Castagnoli) with the given bytes.
+ * When compiled with SSE 4.2 support, the crc32 instruction is used on 3 interleaved streams.
+ *
+ * @param crc The CRC of the preceding bytes. Pass 0 to start a new checksum.
+ * @param s A pointer to the bytes.
+ * @param length The number of bytes.
+ *
+ * @return The updated CRC.
+ */
+uint32_t str_crc32c_update(uint32_t crc, const char *s, int64_t length);
+
+/**
+ * Combines the CRC-32 of two consecutive chunks into the CRC-32 of their concatenation.
+ *
+ * @param crc1 The CRC of the first chunk.
+ * @param crc2 The CRC of the second chunk.
+ * @param length2 The length of the second chunk.
+ *
+ * @return The CRC of both chunks.
+ */
+uint32_t str_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t length2);
+
+/**
+ * Combines the CRC-32C of two consecutive chunks into the CRC-32C of their concatenation.
+ *
+ * @param crc1 The CRC of the first chunk.
+ * @param crc2 The CRC of the second chunk.
+ * @param length2 The length of the second chunk.
+ *
+ * @return The CRC of both chunks.
+ */
+uint32_t str_crc32c_combine(uint32_t crc1, uint32_t crc2, int64_t length2);
+
+/**
+ * Updates a running Adler-32 checksum with the given bytes.
+ *
+ * @param adler The checksum of the preceding bytes. Pass 1 to start a new checksum.
+ * @param s A pointer to the bytes.
+ * @param length The number of bytes.
+ *
+ * @return The updated checksum.
+ */
+uint32_t str_adler32_update(uint32_t adler, const char *s, int64_t length);
+
+/**
+ * Combines the Adler-32 of two consecutive chunks into the Adler-32 of their concatenation.
+ *
+ * @param adler1 The checksum of the first chunk.
+ * @param adler2 The checksum of the second chunk.
+ * @param length2 The length of the second chunk.
+ *
+ * @return The checksum of both chunks.
+ */
+uint32_t str_adler32_combine(uint32_t adler1, uint32_t adler2, int64_t length2);
+
+/**
+ * Computes the 64-bit xxHash (XXH64) of the given bytes.
+ *
+ * @param s A pointer to the bytes.
+ * @param length The number of bytes.
+ * @param seed The seed of the hash.
+ *
+ * @return The hash of the bytes.
+ */
+uint64_t str_xxh64_str(const char *s, int64_t length, uint64_t seed);
+
+/**
+ * Computes the CRC-32 of the Str object.
+ *
+ * @param str A handle to the Str object.
+ *
+ * @return The CRC of the string.
+ */
+static inline uint32_t str_crc32(const Str *str)
+{
+    return str_crc32_update(0, str->value, str->length);
+}
+
+/**
+ * Computes the CRC-32C of the Str object.
+ *
+ * @param str A handle to the Str object.
+ *
+ * @return The CRC of the string.
+ */
+static inline uint32_t str_crc32c(const Str *str)
+{
+    return str_crc32c_update(0, str->value, str->length);
+}
+
+/**
+ * Computes the Adler-32 of the Str object.
+ *
+ * @param str A handle to the Str object.
+ *
+ * @return The checksum of the string.
+ */
+static inline uint32_t str_adler32(const Str *str)
+{
+    return str_adler32_update(1, str->value, str->length);
+}
+
+/**
+ * Computes the 64-bit xxHash (XXH64) of the Str object.
+ *
+ * @param str A handle to the Str object.
+ * @param seed The seed of the hash.
+ *
+ * @return The hash of the string.
+ */
+static inline uint64_t str_xxh64(const Str *str, uint64_t seed)
+{
+    return str_xxh64_str(str->value, str->length, seed);
+}
+
 /**
  * Compares the value of two Str objects.
  *
@@ -119,6 +668,42 @@ int str_compare(const Str *a, const Str *b);
  */
 int str_compare_str(const Str *str, const char *s, int64_t length);
 
+/**
+ * Compares the value of two Str objects in natural order: runs of digits compare by their numeric value,
+ * so "file2" sorts before "file10". Of two numbers with the same value, the one with fewer leading zeros
+ * sorts first, unless the strings differ elsewhere. Other bytes compare as in str_compare().
+ *
+ * @param a A handle to the first Str object.
+ * @param b A handle to the second Str object.
+ *
+ * @return -1, 0 or 1 if the first Str object sorts before, equal to or after the second Str object.
+ */
+int str_compare_natural(const Str *a, const Str *b);
+
+/**
+ * Compares a Str object and a string in natural order, as str_compare_natural().
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the string.
+ * @param length The length of the string. Pass a negative value to calculate the length internally.
+ *
+ * @return -1, 0 or 1 if the Str object sorts before, equal to or after the string.
+ */
+int str_compare_natural_str(const Str *str, const char *s, int64_t length);
+
+/**
+ * Appends the natural sort key of a string. Comparing two keys with memcmp() orders them as
+ * str_compare_natural() orders the strings, so bulk sorts can compute the keys once. A key is at most
+ * 4 * length + 2 bytes.
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the string.
+ * @param length The length of the string. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the key was appended; false if the memory allocation failed.
+ */
+bool str_append_natural_key(Str *str, const char *s, int64_t length);
+
 /**
  * Returns true if the value of the Str object is equal to the given string.
  *
@@ -240,6 +825,54 @@ static inline bool str_ends_with(const Str *str, const Str *suffix)
     return str_ends_with_str(str, suffix->value, suffix->length);
 }
 
+/**
+ * Returns the zero-based index of the first byte that is present in the given set (like strpbrk).
+ *
+ * @param str A handle to the Str object.
+ * @param offset The index where the search starts.
+ * @param set A pointer to the bytes of the set.
+ * @param length The length of the set. Pass a negative value to calculate the length internally.
+ *
+ * @return The zero-based index of the first matching byte or -1 if there is none.
+ */
+int64_t str_find_any(const Str *str, int64_t offset, const char *set, int64_t length);
+
+/**
+ * Returns the zero-based index of the first byte that is not present in the given set.
+ *
+ * @param str A handle to the Str object.
+ * @param offset The index where the search starts.
+ * @param set A pointer to the bytes of the set.
+ * @param length The length of the set. Pass a negative value to calculate the length internally.
+ *
+ * @return The zero-based index of the first non-matching byte or -1 if there is none.
+ */
+int64_t str_find_not_any(const Str *str, int64_t offset, const char *set, int64_t length);
+
+/**
+ * Returns the number of consecutive bytes, starting at offset, that are present in the given set (like strspn).
+ *
+ * @param str A handle to the Str object.
+ * @param offset The index where the span starts.
+ * @param set A pointer to the bytes of the set.
+ * @param length The length of the set. Pass a negative value to calculate the length internally.
+ *
+ * @return The length of the span.
+ */
+int64_t str_span(const Str *str, int64_t offset, const char *set, int64_t length);
+
+/**
+ * Returns the number of consecutive bytes, starting at offset, that are not present in the given set (like strcspn).
+ *
+ * @param str A handle to the Str object.
+ * @param offset The index where the span starts.
+ * @param set A pointer to the bytes of the set.
+ * @param length The length of the set. Pass a negative value to calculate the length internally.
+ *
+ * @return The length of the span.
+ */
+int64_t str_cspan(const Str *str, int64_t offset, const char *set, int64_t length);
+
 /**
  * Appends a character.
  *
@@ -273,7 +906,18 @@ bool str_append_str(Str *str, const char *s, int64_t len);
 bool str_append_format(Str *str, const char *format, ...);
 
 /**
- * Appends a signed 64-bit integer.
+ * Appends a formatted string from a list of arguments. (Like vprintf).
+ *
+ * @param str A handle to the Str object.
+ * @param format The format string.
+ * @param args The arguments for the format string.
+ *
+ * @return True if the formatted string was appended successfully; otherwise false.
+ */
+bool str_append_vformat(Str *str, const char *format, va_list args);
+
+/**
+ * Appends a signed 64-bit integer.
  *
  * @param str A handle to the Str object.
  * @param value The value to append.
@@ -292,6 +936,76 @@ bool str_append_int(Str *str, int64_t value);
  */
 bool str_append_uint(Str *str, uint64_t value);
 
+/**
+ * Appends a signed 64-bit integer in the given base. Negative values get a minus sign.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ * @param base The base, from 2 to 36.
+ * @param uppercase True to write the digits above 9 as A-Z instead of a-z.
+ *
+ * @return True if the integer was appended successfully; false if the base is out of range or the
+ * memory allocation failed.
+ */
+bool str_append_int_base(Str *str, int64_t value, int base, bool uppercase);
+
+/**
+ * Appends an unsigned 64-bit integer in the given base.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ * @param base The base, from 2 to 36.
+ * @param uppercase True to write the digits above 9 as A-Z instead of a-z.
+ *
+ * @return True if the integer was appended successfully; false if the base is out of range or the
+ * memory allocation failed.
+ */
+bool str_append_uint_base(Str *str, uint64_t value, int base, bool uppercase);
+
+/**
+ * Appends a signed 64-bit integer with its digits in groups of three. (E.g. -1,234,567).
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ * @param separator The byte between the groups.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_int_grouped(Str *str, int64_t value, char separator);
+
+/**
+ * Appends an unsigned 64-bit integer with its digits in groups of three. (E.g. 1,234,567).
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ * @param separator The byte between the groups.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_uint_grouped(Str *str, uint64_t value, char separator);
+
+#ifdef __SIZEOF_INT128__
+/**
+ * Appends a signed 128-bit integer.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_int128(Str *str, StrInt128 value);
+
+/**
+ * Appends an unsigned 128-bit integer.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_uint128(Str *str, StrUInt128 value);
+#endif
+
 /**
  * Appends a double precision floating point (AKA double) value.
  *
@@ -303,6 +1017,120 @@ bool str_append_uint(Str *str, uint64_t value);
  */
 bool str_append_float(Str *str, double value, int precision);
 
+/**
+ * Appends a string padded to a fixed width. (Like printf's %-*s and %*s). Widths count bytes, and longer
+ * strings are appended whole.
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the string to append.
+ * @param length The length of the string. Pass a negative value to calculate the length internally.
+ * @param width The minimum number of bytes to append.
+ * @param align Where the string goes within the field. Centering puts the odd byte of padding on the right.
+ * @param fill The byte to pad with.
+ *
+ * @return True if the string was appended successfully; otherwise false.
+ */
+bool str_append_padded(Str *str, const char *s, int64_t length, int64_t width, StrAlign align, char fill);
+
+/**
+ * Appends a signed 64-bit integer padded to a fixed width. Right-aligned negative values padded with '0'
+ * keep the sign in front, like printf's %0*d.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ * @param width The minimum number of bytes to append.
+ * @param align Where the value goes within the field.
+ * @param fill The byte to pad with.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_int_padded(Str *str, int64_t value, int64_t width, StrAlign align, char fill);
+
+/**
+ * Appends an unsigned 64-bit integer padded to a fixed width.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ * @param width The minimum number of bytes to append.
+ * @param align Where the value goes within the field.
+ * @param fill The byte to pad with.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_uint_padded(Str *str, uint64_t value, int64_t width, StrAlign align, char fill);
+
+/**
+ * Appends a row of padded cells, growing the Str object once for the whole row. No line feed is appended.
+ *
+ * @param str A handle to the Str object.
+ * @param columns The layout of each column.
+ * @param cells The contents of each column.
+ * @param count The number of columns.
+ * @param separator A pointer to the string between the cells. NULL means no separator, whatever the length.
+ * @param separator_length The length of the separator. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the row was appended successfully; otherwise false.
+ */
+bool str_append_row(Str *str, const StrColumn *columns, const StrSlice *cells, int64_t count, const char *separator,
+                    int64_t separator_length);
+
+/**
+ * Appends a hex dump in the format of xxd: an offset, 16 bytes in hex and their printable characters per line.
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the bytes to dump.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ * @param offset The offset shown for the first byte.
+ *
+ * @return True if the dump was appended successfully; otherwise false.
+ */
+bool str_append_hexdump(Str *str, const char *s, int64_t length, int64_t offset);
+
+/**
+ * Appends bytes escaped as the contents of a C string literal. Printable ASCII is kept, control characters
+ * with a short escape use it and all other bytes are written as \xHH. A hex digit following a \xHH escape is
+ * escaped as well, so the output always reads back as the same bytes.
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the bytes to escape.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the escaped bytes were appended successfully; otherwise false.
+ */
+bool str_append_c_escaped(Str *str, const char *s, int64_t length);
+
+/**
+ * Appends an RFC 3339 timestamp, such as 2024-03-09T14:05:26.120Z or 2024-03-09T16:05:26.120+02:00.
+ * The date and time of the last second rendered are cached per thread, so consecutive timestamps within
+ * the same second only format the fraction.
+ *
+ * @param str A handle to the Str object.
+ * @param epoch The time since 1970-01-01T00:00:00Z, in the given unit. May be negative.
+ * @param unit The unit of the epoch, which also sets the number of fractional digits.
+ * @param offset_minutes The offset from UTC of the rendered local time. Pass 0 to render UTC with a Z suffix.
+ *
+ * @return True if the timestamp was appended successfully; false if the year falls outside 0000-9999,
+ * the offset is a day or more, or the memory allocation failed.
+ */
+bool str_append_timestamp(Str *str, int64_t epoch, StrTimeUnit unit, int offset_minutes);
+
+/**
+ * Parses a timestamp that spans the whole string, in one of these formats:
+ *
+ * - RFC 3339 / ISO 8601: 2024-03-09T14:05:26.120Z, with a T, t or space separator, an optional fraction of
+ *   any length (truncated to nanoseconds) and a Z or +HH:MM, +HHMM or +HH offset. Without an offset, or
+ *   with a date alone, the time is taken as UTC.
+ * - Common log format: 09/Mar/2024:14:05:26 +0000, with or without the surrounding brackets.
+ *
+ * @param s A pointer to the string to parse. It does not need to be NUL-terminated.
+ * @param length The length of the string. Pass a negative value to calculate the length internally.
+ * @param epoch_ns Receives the time since 1970-01-01T00:00:00Z in nanoseconds.
+ *
+ * @return True if the timestamp was parsed successfully; false if it is malformed, names an invalid date
+ * or time, or falls outside the range of epoch_ns (1677-09-21 to 2262-04-11).
+ */
+bool str_parse_timestamp(const char *s, int64_t length, int64_t *epoch_ns);
+
 /**
  * Concatenates the value of another Str object.
  *
@@ -338,6 +1166,56 @@ void str_to_upper(const Str *str);
  */
 void str_trim(Str *str, StrTrimOptions options);
 
+/**
+ * Replaces every byte of the Str object in place with its entry in the map. (Like tr).
+ *
+ * @param str A handle to the Str object.
+ * @param map The replacement for each of the 256 byte values.
+ */
+void str_translate(const Str *str, const uint8_t map[256]);
+
+/**
+ * Removes every occurrence of the given bytes from the Str object, in place. (Like tr -d).
+ *
+ * @param str A handle to the Str object.
+ * @param chars A pointer to the bytes to remove.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ */
+void str_delete_chars(Str *str, const char *chars, int64_t length);
+
+/**
+ * Replaces each run of a repeated byte with a single occurrence, in place. (Like tr -s).
+ *
+ * @param str A handle to the Str object.
+ * @param chars A pointer to the bytes whose runs are squeezed. Pass NULL to squeeze the runs of any byte.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ */
+void str_squeeze(Str *str, const char *chars, int64_t length);
+
+/**
+ * Reverses the bytes of the Str object in place.
+ *
+ * @param str A handle to the Str object.
+ */
+void str_reverse(const Str *str);
+
+/**
+ * Reverses the UTF-8 code points of the Str object in place, keeping the bytes of each one in order.
+ * Bytes that are not part of a valid sequence are reversed individually.
+ *
+ * @param str A handle to the Str object.
+ */
+void str_reverse_codepoints(const Str *str);
+
+/**
+ * Reverses the order of the segments separated by the delimiter, in place. E.g. www.example.com
+ * becomes com.example.www.
+ *
+ * @param str A handle to the Str object.
+ * @param delimiter The byte separating the segments.
+ */
+void str_reverse_segments(const Str *str, char delimiter);
+
 /**
  * Repeats the string n times.
  *
@@ -348,3 +1226,1344 @@ void str_trim(Str *str, StrTrimOptions options);
  * @return True if the string was repeated; otherwise false.
  */
 bool str_repeat(Str *str, int multiply);
+
+/**
+ * Initializes an empty line index.
+ *
+ * @param index A handle to the StrLineIndex object to initialize.
+ *
+ * @return True if the index was initialized; otherwise false.
+ */
+bool str_line_index_init(StrLineIndex *index);
+
+/**
+ * Finalizes the line index and memory resources are deallocated.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param index A handle to the StrLineIndex object to finalize.
+ */
+void str_line_index_finalize(StrLineIndex *index);
+
+/**
+ * Indexes the bytes appended to the Str object since the last update. Only the new bytes are scanned.
+ * If the string became shorter than the indexed part, the index is rebuilt from scratch.
+ *
+ * @param index A handle to the StrLineIndex object.
+ * @param str A handle to the indexed Str object.
+ *
+ * @return True if the index was updated; otherwise false.
+ */
+bool str_line_index_update(StrLineIndex *index, const Str *str);
+
+/**
+ * Gets the contents of the given line, without the line feed.
+ *
+ * @param index A handle to the StrLineIndex object.
+ * @param str A handle to the indexed Str object.
+ * @param line The zero-based line number.
+ * @param slice A handle to the slice that receives the line.
+ *
+ * @return True if the line exists; otherwise false.
+ */
+bool str_line_index_get_line(const StrLineIndex *index, const Str *str, int64_t line, StrSlice *slice);
+
+/**
+ * Returns the zero-based number of the line that contains the given offset.
+ *
+ * @param index A handle to the StrLineIndex object.
+ * @param str A handle to the indexed Str object.
+ * @param offset The zero-based offset in the string.
+ *
+ * @return The line number or -1 if the offset is outside the indexed part of the string.
+ */
+int64_t str_line_index_find_line(const StrLineIndex *index, const Str *str, int64_t offset);
+
+/**
+ * Initializes a matcher for the given needle.
+ *
+ * @param matcher A handle to the StrMatcher object to initialize.
+ * @param needle A pointer to the string to search.
+ * @param length The length of the needle. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the matcher was initialized; otherwise false. The needle must not be empty.
+ */
+bool str_matcher_init(StrMatcher *matcher, const char *needle, int64_t length);
+
+/**
+ * Finalizes the matcher and memory resources are deallocated.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param matcher A handle to the StrMatcher object to finalize.
+ */
+void str_matcher_finalize(StrMatcher *matcher);
+
+/**
+ * Forgets the scanning progress so the next search starts at the beginning of the string.
+ *
+ * @param matcher A handle to the StrMatcher object.
+ */
+void str_matcher_reset(StrMatcher *matcher);
+
+/**
+ * Searches the needle in the bytes appended since the previous call. Each byte of the string is examined once,
+ * even if the needle spans several appends. After a match, the search resumes right after it.
+ * If the string became shorter than the scanned part, the search starts over.
+ *
+ * @param matcher A handle to the StrMatcher object.
+ * @param str A handle to the Str object to search.
+ *
+ * @return The zero-based index of the next occurrence or -1 if the needle is not present (yet).
+ */
+int64_t str_matcher_next(StrMatcher *matcher, const Str *str);
+
+/**
+ * Returns the maximum size of the LZ4 block produced by compressing the given number of bytes.
+ *
+ * @param length The number of bytes to compress.
+ *
+ * @return The worst case compressed size.
+ */
+static inline int64_t str_lz4_compress_bound(int64_t length)
+{
+    return length + length / 255 + 16;
+}
+
+/**
+ * Compresses the given bytes into an LZ4 block and appends it. The block is written directly into the
+ * spare capacity of the Str object, which grows at most once to fit str_lz4_compress_bound() bytes.
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the bytes to compress.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ * @param level STR_LZ4_LEVEL_FAST (or lower) for the greedy compressor. Higher levels, up to STR_LZ4_LEVEL_MAX,
+ * search hash chains for longer matches and trade speed for ratio.
+ *
+ * @return True if the block was appended; otherwise false.
+ */
+bool str_append_lz4_compressed(Str *str, const char *s, int64_t length, int level);
+
+/**
+ * Decompresses an LZ4 block and appends the result. The input is fully validated.
+ *
+ * @param str A handle to the Str object.
+ * @param s A pointer to the LZ4 block.
+ * @param length The size of the LZ4 block.
+ * @param max_length The decompressed size (or an upper bound of it). The Str object grows at most once
+ * to fit this many bytes.
+ *
+ * @return True if the block was decompressed; otherwise false and the Str object remains unchanged.
+ */
+bool str_append_lz4_decompressed(Str *str, const char *s, int64_t length, int64_t max_length);
+
+/**
+ * Appends a 16-bit unsigned integer in little-endian byte order.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_u16le(Str *str, uint16_t value);
+
+/**
+ * Appends a 16-bit unsigned integer in big-endian byte order.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_u16be(Str *str, uint16_t value);
+
+/**
+ * Appends a 32-bit unsigned integer in little-endian byte order.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_u32le(Str *str, uint32_t value);
+
+/**
+ * Appends a 32-bit unsigned integer in big-endian byte order.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_u32be(Str *str, uint32_t value);
+
+/**
+ * Appends a 64-bit unsigned integer in little-endian byte order.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_u64le(Str *str, uint64_t value);
+
+/**
+ * Appends a 64-bit unsigned integer in big-endian byte order.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_u64be(Str *str, uint64_t value);
+
+/**
+ * Appends an unsigned integer as a LEB128 variable-length integer (1 to 10 bytes).
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_varint(Str *str, uint64_t value);
+
+/**
+ * Appends a signed integer as a ZigZag-encoded LEB128 variable-length integer, so that values close to zero
+ * take few bytes regardless of their sign.
+ *
+ * @param str A handle to the Str object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+bool str_append_zigzag(Str *str, int64_t value);
+
+/**
+ * Decodes a 16-bit unsigned integer in little-endian byte order and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false and the cursor is not moved.
+ */
+bool str_decode_u16le(const char **cursor, const char *end, uint16_t *value);
+
+/**
+ * Decodes a 16-bit unsigned integer in big-endian byte order and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false and the cursor is not moved.
+ */
+bool str_decode_u16be(const char **cursor, const char *end, uint16_t *value);
+
+/**
+ * Decodes a 32-bit unsigned integer in little-endian byte order and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false and the cursor is not moved.
+ */
+bool str_decode_u32le(const char **cursor, const char *end, uint32_t *value);
+
+/**
+ * Decodes a 32-bit unsigned integer in big-endian byte order and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false and the cursor is not moved.
+ */
+bool str_decode_u32be(const char **cursor, const char *end, uint32_t *value);
+
+/**
+ * Decodes a 64-bit unsigned integer in little-endian byte order and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false and the cursor is not moved.
+ */
+bool str_decode_u64le(const char **cursor, const char *end, uint64_t *value);
+
+/**
+ * Decodes a 64-bit unsigned integer in big-endian byte order and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false and the cursor is not moved.
+ */
+bool str_decode_u64be(const char **cursor, const char *end, uint64_t *value);
+
+/**
+ * Decodes a LEB128 variable-length integer and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false (truncated or overlong input) and the cursor is not moved.
+ */
+bool str_decode_varint(const char **cursor, const char *end, uint64_t *value);
+
+/**
+ * Decodes a ZigZag-encoded LEB128 variable-length integer and advances the cursor.
+ *
+ * @param cursor A pointer to the read position.
+ * @param end A pointer past the last readable byte.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was decoded; otherwise false (truncated or overlong input) and the cursor is not moved.
+ */
+bool str_decode_zigzag(const char **cursor, const char *end, int64_t *value);
+
+/**
+ * Initializes a reader over the given bytes.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param s A pointer to the bytes.
+ * @param length The number of bytes.
+ */
+static inline void str_reader_init_str(StrReader *reader, const char *s, int64_t length)
+{
+    reader->position = s;
+    reader->end = s + length;
+}
+
+/**
+ * Initializes a reader over the contents of the Str object.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param str A handle to the Str object.
+ */
+static inline void str_reader_init(StrReader *reader, const Str *str)
+{
+    str_reader_init_str(reader, str->value, str->length);
+}
+
+/**
+ * Returns the number of bytes left to read.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The number of remaining bytes.
+ */
+static inline int64_t str_reader_remaining(const StrReader *reader)
+{
+    return reader->end - reader->position;
+}
+
+/**
+ * Tests that at least n bytes are left to read. Check the size of a whole fixed-size structure once,
+ * then read its fields with the str_reader_*_unchecked() functions.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param n The number of bytes.
+ *
+ * @return True if at least n bytes are left; otherwise false.
+ */
+static inline bool str_reader_has(const StrReader *reader, int64_t n)
+{
+    return n >= 0 && reader->end - reader->position >= n;
+}
+
+/**
+ * Skips n bytes.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param n The number of bytes to skip.
+ *
+ * @return True if the bytes were skipped; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_skip(StrReader *reader, int64_t n)
+{
+    if (str_reader_has(reader, n)) {
+        reader->position += n;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Reads n bytes as a slice of the underlying memory. No bytes are copied.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param n The number of bytes to read.
+ * @param slice A handle to the slice that receives the bytes.
+ *
+ * @return True if the bytes were read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_bytes(StrReader *reader, int64_t n, StrSlice *slice)
+{
+    if (str_reader_has(reader, n)) {
+        slice->value = reader->position;
+        slice->length = n;
+        reader->position += n;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Reads a byte.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u8(StrReader *reader, uint8_t *value)
+{
+    if (reader->position < reader->end) {
+        *value = (uint8_t) *reader->position++;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Reads a little-endian 16-bit unsigned integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u16le(StrReader *reader, uint16_t *value)
+{
+    return str_decode_u16le(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a little-endian 32-bit unsigned integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u32le(StrReader *reader, uint32_t *value)
+{
+    return str_decode_u32le(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a little-endian 64-bit unsigned integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u64le(StrReader *reader, uint64_t *value)
+{
+    return str_decode_u64le(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a big-endian 16-bit unsigned integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u16be(StrReader *reader, uint16_t *value)
+{
+    return str_decode_u16be(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a big-endian 32-bit unsigned integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u32be(StrReader *reader, uint32_t *value)
+{
+    return str_decode_u32be(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a big-endian 64-bit unsigned integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_u64be(StrReader *reader, uint64_t *value)
+{
+    return str_decode_u64be(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a LEB128 variable-length integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_varint(StrReader *reader, uint64_t *value)
+{
+    return str_decode_varint(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a ZigZag-encoded LEB128 variable-length integer.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param value A pointer that receives the value.
+ *
+ * @return True if the value was read; otherwise false and the reader is not moved.
+ */
+static inline bool str_reader_read_zigzag(StrReader *reader, int64_t *value)
+{
+    return str_decode_zigzag(&reader->position, reader->end, value);
+}
+
+/**
+ * Reads a byte without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint8_t str_reader_read_u8_unchecked(StrReader *reader)
+{
+    return (uint8_t) *reader->position++;
+}
+
+/**
+ * Reads a little-endian 16-bit unsigned integer without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint16_t str_reader_read_u16le_unchecked(StrReader *reader)
+{
+    const uint8_t *p = (const uint8_t *) reader->position;
+    reader->position += 2;
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+/**
+ * Reads a little-endian 32-bit unsigned integer without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint32_t str_reader_read_u32le_unchecked(StrReader *reader)
+{
+    const uint8_t *p = (const uint8_t *) reader->position;
+    reader->position += 4;
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * Reads a little-endian 64-bit unsigned integer without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint64_t str_reader_read_u64le_unchecked(StrReader *reader)
+{
+    uint64_t low = str_reader_read_u32le_unchecked(reader);
+    uint64_t high = str_reader_read_u32le_unchecked(reader);
+    return low | high << 32;
+}
+
+/**
+ * Reads a big-endian 16-bit unsigned integer without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint16_t str_reader_read_u16be_unchecked(StrReader *reader)
+{
+    const uint8_t *p = (const uint8_t *) reader->position;
+    reader->position += 2;
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+/**
+ * Reads a big-endian 32-bit unsigned integer without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint32_t str_reader_read_u32be_unchecked(StrReader *reader)
+{
+    const uint8_t *p = (const uint8_t *) reader->position;
+    reader->position += 4;
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+/**
+ * Reads a big-endian 64-bit unsigned integer without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ *
+ * @return The value.
+ */
+static inline uint64_t str_reader_read_u64be_unchecked(StrReader *reader)
+{
+    uint64_t high = str_reader_read_u32be_unchecked(reader);
+    uint64_t low = str_reader_read_u32be_unchecked(reader);
+    return high << 32 | low;
+}
+
+/**
+ * Reads n bytes as a slice without bounds checking. Call str_reader_has() first.
+ *
+ * @param reader A handle to the StrReader object.
+ * @param n The number of bytes to read.
+ *
+ * @return A slice of the underlying memory.
+ */
+static inline StrSlice str_reader_read_bytes_unchecked(StrReader *reader, int64_t n)
+{
+    StrSlice slice = {reader->position, n};
+    reader->position += n;
+    return slice;
+}
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Writes a collection of strings as a snapshot that can be loaded with str_collection_open().
+ * The file stores a header, the offsets of the entries and the entries themselves (NULL-terminated). The
+ * contents of the Str objects are written with writev(), without being copied into an intermediate buffer.
+ *
+ * @param fd The file descriptor to write to.
+ * @param strs A pointer to the array of Str objects.
+ * @param count The number of Str objects.
+ *
+ * @return True if the collection was written; otherwise false.
+ */
+bool str_collection_write(int fd, const Str *strs, int64_t count);
+
+/**
+ * Opens a snapshot written by str_collection_write(). The file is memory-mapped: opening checks only the header
+ * and that the table of offsets fits, so it takes the same time for any number of entries. Each entry is checked
+ * when it is read, and the pages of the entries are read when they are accessed.
+ *
+ * @param collection A handle to the StrCollection object to initialize.
+ * @param path The path of the snapshot.
+ *
+ * @return True if the snapshot was opened; otherwise false.
+ */
+bool str_collection_open(StrCollection *collection, const char *path);
+
+/**
+ * Unmaps the snapshot. Slices obtained from the collection become invalid.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param collection A handle to the StrCollection object.
+ */
+void str_collection_close(StrCollection *collection);
+
+/**
+ * Gets an entry of the collection. The slice points into the mapped file and is NULL-terminated.
+ * Use str_from_slice() to pass it to the search and comparison functions.
+ *
+ * @param collection A handle to the StrCollection object.
+ * @param index The zero-based index of the entry.
+ * @param slice A handle to the slice that receives the entry.
+ *
+ * @return True if the entry exists and its offsets are valid; otherwise false.
+ */
+bool str_collection_get(const StrCollection *collection, int64_t index, StrSlice *slice);
+
+/**
+ * Initializes a ring buffer.
+ *
+ * @param ring A handle to the StrRing object to initialize.
+ * @param capacity The minimum number of bytes the ring can hold. It is rounded up to the page size
+ * when the buffer is mirrored.
+ *
+ * @return True if the ring was initialized; otherwise false.
+ */
+bool str_ring_init(StrRing *ring, int64_t capacity);
+
+/**
+ * Finalizes the ring buffer and memory resources are deallocated.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param ring A handle to the StrRing object to finalize.
+ */
+void str_ring_finalize(StrRing *ring);
+
+/**
+ * Returns the contiguous free space at the tail of the ring, e.g. to read() into it directly.
+ * Call str_ring_produce() with the number of bytes written.
+ *
+ * @param ring A handle to the StrRing object.
+ * @param available A pointer that receives the number of contiguous bytes that can be written.
+ *
+ * @return A pointer to the free space.
+ */
+char *str_ring_reserve(StrRing *ring, int64_t *available);
+
+/**
+ * Adds the bytes written into the space returned by str_ring_reserve() to the readable bytes.
+ *
+ * @param ring A handle to the StrRing object.
+ * @param n The number of bytes written.
+ *
+ * @return True if the bytes were added; false if `n` is more than the space str_ring_reserve() returned.
+ */
+bool str_ring_produce(StrRing *ring, int64_t n);
+
+/**
+ * Appends bytes to the ring.
+ *
+ * @param ring A handle to the StrRing object.
+ * @param s A pointer to the bytes to append.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the bytes were appended; otherwise false (not enough free space).
+ */
+bool str_ring_append(StrRing *ring, const char *s, int64_t length);
+
+/**
+ * Removes bytes from the head of the ring.
+ *
+ * @param ring A handle to the StrRing object.
+ * @param n The number of bytes to consume.
+ *
+ * @return True if the bytes were consumed; otherwise false.
+ */
+bool str_ring_consume(StrRing *ring, int64_t n);
+
+/**
+ * Returns the zero-based index, relative to the head of the ring, of the first occurrence of the needle.
+ *
+ * @param ring A handle to the StrRing object.
+ * @param substr A pointer to the string to search.
+ * @param length The length of the string. Pass a negative value to calculate the length internally.
+ *
+ * @return The zero-based index of the first occurrence or -1 if the needle is not present.
+ */
+int64_t str_ring_indexof_str(const StrRing *ring, const char *substr, int64_t length);
+
+/**
+ * Returns the readable bytes of the ring as a contiguous slice. Use str_from_slice() to pass them to the
+ * search and comparison functions.
+ *
+ * @param ring A handle to the StrRing object.
+ *
+ * @return A slice of the readable bytes. It is invalidated by the next append or consume.
+ */
+static inline StrSlice str_ring_peek(const StrRing *ring)
+{
+    StrSlice slice = {ring->value + ring->start, ring->length};
+    return slice;
+}
+#endif
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Initializes an output builder bound to a file descriptor.
+ *
+ * @param writer A handle to the StrWriter object to initialize.
+ * @param fd The file descriptor to write to.
+ * @param watermark The buffer is flushed once its length reaches this many bytes.
+ * @param background If true, full buffers are written by a background thread while appending continues into a
+ * second buffer (double buffering). Requires thread support.
+ *
+ * @return True if the writer was initialized; otherwise false.
+ */
+bool str_writer_init(StrWriter *writer, int fd, int64_t watermark, bool background);
+
+/**
+ * Flushes the pending output, stops the background thread and deallocates the resources of the writer.
+ * Call str_writer_flush() first to learn whether all the output was written.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param writer A handle to the StrWriter object to finalize.
+ */
+void str_writer_finalize(StrWriter *writer);
+
+/**
+ * Writes out everything appended so far and waits for the background write, if any, to complete.
+ *
+ * @param writer A handle to the StrWriter object.
+ *
+ * @return True if all the output so far was written; otherwise false.
+ */
+bool str_writer_flush(StrWriter *writer);
+
+/**
+ * Flushes the buffer if it crossed the watermark. Call it after appending to `buffer` directly.
+ *
+ * @param writer A handle to the StrWriter object.
+ *
+ * @return False if a write failed; otherwise true.
+ */
+bool str_writer_poll(StrWriter *writer);
+
+/**
+ * Appends a character, flushing if the watermark is crossed.
+ *
+ * @param writer A handle to the StrWriter object.
+ * @param c The character to append.
+ *
+ * @return True if the character was appended successfully; otherwise false.
+ */
+static inline bool str_writer_append_char(StrWriter *writer, char c)
+{
+    return str_append_char(&writer->buffer, c) && str_writer_poll(writer);
+}
+
+/**
+ * Appends a string, flushing if the watermark is crossed.
+ *
+ * @param writer A handle to the StrWriter object.
+ * @param s A pointer to the string to append.
+ * @param len The length of the string. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the string was appended successfully; otherwise false.
+ */
+static inline bool str_writer_append_str(StrWriter *writer, const char *s, int64_t len)
+{
+    return str_append_str(&writer->buffer, s, len) && str_writer_poll(writer);
+}
+
+/**
+ * Appends a signed 64-bit integer, flushing if the watermark is crossed.
+ *
+ * @param writer A handle to the StrWriter object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+static inline bool str_writer_append_int(StrWriter *writer, int64_t value)
+{
+    return str_append_int(&writer->buffer, value) && str_writer_poll(writer);
+}
+
+/**
+ * Appends an unsigned 64-bit integer, flushing if the watermark is crossed.
+ *
+ * @param writer A handle to the StrWriter object.
+ * @param value The value to append.
+ *
+ * @return True if the integer was appended successfully; otherwise false.
+ */
+static inline bool str_writer_append_uint(StrWriter *writer, uint64_t value)
+{
+    return str_append_uint(&writer->buffer, value) && str_writer_poll(writer);
+}
+
+/**
+ * Appends a double precision floating point value, flushing if the watermark is crossed.
+ *
+ * @param writer A handle to the StrWriter object.
+ * @param value The value to append.
+ * @param precision The number of decimals to insert.
+ *
+ * @return True if the value was appended successfully; otherwise false.
+ */
+static inline bool str_writer_append_float(StrWriter *writer, double value, int precision)
+{
+    return str_append_float(&writer->buffer, value, precision) && str_writer_poll(writer);
+}
+
+/**
+ * Appends a formatted string (like printf), flushing if the watermark is crossed.
+ *
+ * @param writer A handle to the StrWriter object.
+ * @param format The format string.
+ * @param ... A vararg list of arguments for the format string.
+ *
+ * @return True if the formatted string was appended successfully; otherwise false.
+ */
+bool str_writer_append_format(StrWriter *writer, const char *format, ...);
+#endif
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Initializes a batched write queue. io_uring is used when available; define STR_NO_IO_URING to always
+ * use the writev fallback.
+ *
+ * @param queue A handle to the StrIoQueue object to initialize.
+ * @param capacity The maximum number of writes that may be queued or awaiting completion at a time.
+ *
+ * @return True if the queue was initialized successfully.
+ */
+bool str_io_init(StrIoQueue *queue, unsigned capacity);
+
+/**
+ * Finalizes the queue. Writes that were queued but not submitted are submitted, and all writes are waited
+ * for, since the kernel may still be reading their buffers.
+ *
+ * @param queue A handle to the StrIoQueue object to finalize.
+ */
+void str_io_finalize(StrIoQueue *queue);
+
+/**
+ * Registers a pool of buffers, so that writes from them (see str_io_queue_write_fixed()) skip the page
+ * pinning the kernel would otherwise repeat for each one. The whole allocation of each Str object is
+ * registered; the objects must not be resized or finalized until they are unregistered, and the array
+ * must remain valid. Any previously registered pool is replaced. Pass a count of 0 to unregister.
+ *
+ * @param queue A handle to the StrIoQueue object.
+ * @param buffers An array of initialized Str objects.
+ * @param count The number of objects in the array.
+ *
+ * @return True if the buffers were registered successfully.
+ */
+bool str_io_register_buffers(StrIoQueue *queue, Str *buffers, int count);
+
+/**
+ * Queues a write. The bytes must remain valid and unchanged until its completion is reaped. Once `capacity`
+ * writes are queued or awaiting completion, completions must be reaped with str_io_complete() to make room.
+ * Both backends keep writing after a short write until every byte is written or an error occurs.
+ *
+ * Consecutive writes at the current position of the same file descriptor are performed in order within a
+ * batch: the fallback merges them and io_uring links them, in which case a failed write cancels the rest of
+ * the run (they complete with -ECANCELED). A short write does not: the rest of it and the writes after it are
+ * submitted again, in order. Writes of separate batches and writes at explicit offsets may be performed
+ * concurrently, so wait for a completion before queuing a write that must follow it.
+ *
+ * @param queue A handle to the StrIoQueue object.
+ * @param fd The file descriptor to write to.
+ * @param s A pointer to the bytes to write.
+ * @param length The number of bytes to write. Pass a negative value to calculate the length internally.
+ * @param offset The file offset to write at, or a negative value to write at the current file position.
+ * @param user_data A value reported back with the completion.
+ *
+ * @return True if the write was queued, false if the queue is full or the length exceeds 4 GiB.
+ */
+bool str_io_queue_write(StrIoQueue *queue, int fd, const char *s, int64_t length, int64_t offset,
+                        uint64_t user_data);
+
+/**
+ * Queues a write of the contents of a registered buffer.
+ *
+ * @param queue A handle to the StrIoQueue object.
+ * @param fd The file descriptor to write to.
+ * @param buffer_index The index of the buffer in the array passed to str_io_register_buffers().
+ * @param offset The file offset to write at, or a negative value to write at the current file position.
+ * @param user_data A value reported back with the completion.
+ *
+ * @return True if the write was queued, false if the queue is full or the index is out of range.
+ */
+bool str_io_queue_write_fixed(StrIoQueue *queue, int fd, int buffer_index, int64_t offset, uint64_t user_data);
+
+/**
+ * Submits the queued writes with a single system call. With the writev fallback, the writes are performed
+ * here, consecutive writes at the current position of the same file descriptor being merged into one
+ * writev() call. If such a call fails, the writes it completed report their length, the one it failed on
+ * reports the error and the rest report -ECANCELED, as with io_uring.
+ *
+ * @param queue A handle to the StrIoQueue object.
+ *
+ * @return The number of writes submitted, which is less than the number queued if the kernel could not take
+ * them all yet (submit again later), or -1 on error.
+ */
+int str_io_submit(StrIoQueue *queue);
+
+/**
+ * Reaps the completions of the submitted writes, submitting any queued ones first.
+ *
+ * @param queue A handle to the StrIoQueue object.
+ * @param completions An array receiving the completions.
+ * @param max The maximum number of completions to reap.
+ * @param min The number of completions to wait for. Pass 0 to return immediately.
+ *
+ * @return The number of completions stored in the array or -1 on error.
+ */
+int str_io_complete(StrIoQueue *queue, StrIoCompletion *completions, int max, int min);
+#endif
+
+#ifdef STR_HAVE_THREADS
+/**
+ * Initializes a logger and starts its writer thread.
+ *
+ * @param logger A handle to the StrLogger object to initialize.
+ * @param fd The file descriptor the messages are written to.
+ * @param capacity The maximum number of messages waiting to be written.
+ * @param overflow What to do when the queue is full: STR_LOG_BLOCK waits for the writer thread,
+ * STR_LOG_DROP discards the message and counts it (see str_logger_dropped()).
+ *
+ * @return True if the logger was initialized; otherwise false.
+ */
+bool str_logger_init(StrLogger *logger, int fd, int64_t capacity, StrLogOverflow overflow);
+
+/**
+ * Writes the pending messages, stops the writer thread and deallocates the resources of the logger.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param logger A handle to the StrLogger object to finalize.
+ */
+void str_logger_finalize(StrLogger *logger);
+
+/**
+ * Queues a copy of a message as is. This function is thread-safe.
+ *
+ * @param logger A handle to the StrLogger object.
+ * @param s A pointer to the message.
+ * @param length The length of the message. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the message was queued; otherwise false (the message was dropped or memory ran out).
+ */
+bool str_logger_write(StrLogger *logger, const char *s, int64_t length);
+
+/**
+ * Formats a message (like printf) followed by a line feed and queues it. The message is formatted into a
+ * buffer owned by the calling thread, and that buffer itself is queued; the writer thread recycles it once
+ * written. This function is thread-safe.
+ *
+ * @param logger A handle to the StrLogger object.
+ * @param format The format string.
+ * @param ... A vararg list of arguments for the format string.
+ *
+ * @return True if the message was queued; otherwise false (the message was dropped or memory ran out).
+ */
+bool str_logger_log(StrLogger *logger, const char *format, ...);
+
+/**
+ * Returns the number of messages that were dropped: discarded by STR_LOG_DROP, not queued because memory
+ * ran out, or lost because writing them failed.
+ *
+ * @param logger A handle to the StrLogger object.
+ *
+ * @return The number of dropped messages.
+ */
+int64_t str_logger_dropped(const StrLogger *logger);
+
+/**
+ * Returns the number of bytes written by the writer thread.
+ *
+ * @param logger A handle to the StrLogger object.
+ *
+ * @return The number of bytes written.
+ */
+int64_t str_logger_written(const StrLogger *logger);
+
+/**
+ * Initializes a concurrent buffer of the given size.
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object to initialize.
+ * @param size The size (in bytes) to allocate. The buffer does not grow.
+ *
+ * @return True if the buffer was initialized; otherwise false.
+ */
+bool str_concurrent_init(StrConcurrentBuffer *buffer, int64_t size);
+
+/**
+ * Finalizes the concurrent buffer and memory resources are deallocated.
+ * This function is NULL-safe. The function does nothing if NULL is passed as argument.
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object to finalize.
+ */
+void str_concurrent_finalize(StrConcurrentBuffer *buffer);
+
+/**
+ * Appends bytes to the buffer. This function is thread-safe: the copies of concurrent writers proceed in parallel,
+ * only publishing them is ordered. A writer waits for the writers that reserved space before it to finish their
+ * copy, so a writer that is descheduled between the two stalls the appends of all the others until it resumes.
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object.
+ * @param s A pointer to the bytes to append.
+ * @param length The number of bytes. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the bytes were appended; false if the free space is too small until the consumer catches up.
+ */
+bool str_concurrent_append(StrConcurrentBuffer *buffer, const char *s, int64_t length);
+
+/**
+ * Returns the committed bytes that were not consumed yet, up to the end of the storage: when they wrap
+ * around, the rest is returned after consuming this part. Only one thread may consume the buffer;
+ * writers can keep appending meanwhile.
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object.
+ *
+ * @return A slice of the committed bytes. It stays valid until they are consumed.
+ */
+StrSlice str_concurrent_peek(const StrConcurrentBuffer *buffer);
+
+/**
+ * Releases bytes returned by str_concurrent_peek(), making their space available to writers.
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object.
+ * @param n The number of bytes to release.
+ *
+ * @return True if the bytes were released; false if fewer bytes are committed.
+ */
+bool str_concurrent_consume(StrConcurrentBuffer *buffer, int64_t n);
+
+/**
+ * Writes the committed bytes that were not consumed yet to a file descriptor and consumes them.
+ * Same rules as str_concurrent_peek(). If the write fails, the bytes stay in the buffer and the next flush
+ * writes them again (including any part that was written before the failure).
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object.
+ * @param fd The file descriptor to write to.
+ *
+ * @return True if the bytes were written; otherwise false.
+ */
+bool str_concurrent_flush(StrConcurrentBuffer *buffer, int fd);
+
+/**
+ * Empties the buffer. Must not be called while writers are appending.
+ *
+ * @param buffer A handle to the StrConcurrentBuffer object.
+ */
+void str_concurrent_reset(StrConcurrentBuffer *buffer);
+#endif
+
+/**
+ * Initializes a tokenizer over a string. The string must remain valid while tokens are read.
+ *
+ * @param tokenizer A handle to the StrTokenizer object to initialize.
+ * @param s A pointer to the text.
+ * @param length The length of the text. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the tokenizer was initialized successfully.
+ */
+bool str_tokenizer_init(StrTokenizer *tokenizer, const char *s, int64_t length);
+
+/**
+ * Finalizes the tokenizer.
+ *
+ * @param tokenizer A handle to the StrTokenizer object to finalize.
+ */
+void str_tokenizer_finalize(StrTokenizer *tokenizer);
+
+/**
+ * Reads the next token. Tokens without uppercase letters point into the text; the others are lowercased
+ * into a buffer of the tokenizer.
+ *
+ * @param tokenizer A handle to the StrTokenizer object.
+ * @param token Receives the token. It is valid until the next call.
+ *
+ * @return True if a token was read; false at the end of the text or if the memory allocation failed.
+ */
+bool str_tokenizer_next(StrTokenizer *tokenizer, StrSlice *token);
+
+/**
+ * Initializes a term counter.
+ *
+ * @param counter A handle to the StrTermCounter object to initialize.
+ * @param capacity The number of distinct terms to make room for.
+ *
+ * @return True if the counter was initialized successfully.
+ */
+bool str_term_counter_init(StrTermCounter *counter, int64_t capacity);
+
+/**
+ * Finalizes the counter and releases its memory.
+ *
+ * @param counter A handle to the StrTermCounter object to finalize.
+ */
+void str_term_counter_finalize(StrTermCounter *counter);
+
+/**
+ * Adds to the count of a term, inserting it if it is new.
+ *
+ * @param counter A handle to the StrTermCounter object.
+ * @param term A pointer to the term.
+ * @param length The length of the term. Pass a negative value to calculate the length internally.
+ * @param count The number of occurrences to add.
+ *
+ * @return True if the term was counted; false if the memory allocation failed.
+ */
+bool str_term_counter_add(StrTermCounter *counter, const char *term, int64_t length, int64_t count);
+
+/**
+ * Tokenizes the text with a StrTokenizer and counts every token.
+ *
+ * @param counter A handle to the StrTermCounter object.
+ * @param s A pointer to the text.
+ * @param length The length of the text. Pass a negative value to calculate the length internally.
+ *
+ * @return True if all the tokens were counted; false if the memory allocation failed.
+ */
+bool str_term_counter_add_text(StrTermCounter *counter, const char *s, int64_t length);
+
+/**
+ * Returns the count of a term.
+ *
+ * @param counter A handle to the StrTermCounter object.
+ * @param term A pointer to the term.
+ * @param length The length of the term. Pass a negative value to calculate the length internally.
+ *
+ * @return The number of occurrences counted, 0 if the term was never added.
+ */
+int64_t str_term_counter_get(const StrTermCounter *counter, const char *term, int64_t length);
+
+/**
+ * Returns a term by its index, in insertion order. Indexes run from 0 to `count` - 1.
+ *
+ * @param counter A handle to the StrTermCounter object.
+ * @param index The index of the term.
+ * @param count Receives the number of occurrences of the term.
+ *
+ * @return A slice of the term. It is invalidated by the next insertion.
+ */
+static inline StrSlice str_term_counter_term(const StrTermCounter *counter, int64_t index, int64_t *count)
+{
+    const StrTerm *term = &counter->terms[index];
+    StrSlice slice = {counter->keys.value + term->offset, term->length};
+
+    *count = term->count;
+    return slice;
+}
+
+/**
+ * Computes the MinHash signature and the SimHash fingerprint of a text in a single pass over its shingles
+ * (every run of `shingle` consecutive bytes). Texts shorter than a shingle are a single shingle.
+ *
+ * @param s A pointer to the text.
+ * @param length The length of the text. Pass a negative value to calculate the length internally.
+ * @param shingle The number of bytes per shingle, from 1 to 8.
+ * @param signature Receives `count` minimum hash values. May be NULL.
+ * @param count The number of hash functions of the signature.
+ * @param simhash Receives the 64-bit SimHash fingerprint. May be NULL.
+ *
+ * @return True if the sketch was computed; false if the shingle size is out of range.
+ */
+bool str_sketch(const char *s, int64_t length, int shingle, uint32_t *signature, int count, uint64_t *simhash);
+
+/**
+ * Estimates the Jaccard similarity of the shingle sets of two texts from their MinHash signatures.
+ *
+ * @param a The first signature.
+ * @param b The second signature.
+ * @param count The number of values in each signature.
+ *
+ * @return The fraction of values the signatures have in common.
+ */
+double str_minhash_similarity(const uint32_t *a, const uint32_t *b, int count);
+
+/**
+ * Returns the number of bits that differ between two SimHash fingerprints.
+ *
+ * @param a The first fingerprint.
+ * @param b The second fingerprint.
+ *
+ * @return The Hamming distance, from 0 to 64.
+ */
+int str_simhash_distance(uint64_t a, uint64_t b);
+
+/**
+ * Initializes an LSH index for signatures of `bands` * `rows` values. More rows per band make candidates
+ * require a higher similarity.
+ *
+ * @param index A handle to the StrLshIndex object to initialize.
+ * @param bands The number of bands.
+ * @param rows The number of signature values per band.
+ *
+ * @return True if the index was initialized successfully.
+ */
+bool str_lsh_init(StrLshIndex *index, int bands, int rows);
+
+/**
+ * Finalizes the index and releases its memory.
+ *
+ * @param index A handle to the StrLshIndex object to finalize.
+ */
+void str_lsh_finalize(StrLshIndex *index);
+
+/**
+ * Adds a document to the index.
+ *
+ * @param index A handle to the StrLshIndex object.
+ * @param signature The MinHash signature of the document, of `bands` * `rows` values.
+ * @param id The identifier reported by queries.
+ *
+ * @return True if the document was added; false if the memory allocation failed.
+ */
+bool str_lsh_insert(StrLshIndex *index, const uint32_t *signature, int64_t id);
+
+/**
+ * Finds the documents that share at least one band with the signature.
+ *
+ * @param index A handle to the StrLshIndex object.
+ * @param signature The MinHash signature to look up, of `bands` * `rows` values.
+ * @param candidates Receives the distinct identifiers of the candidates, most recently inserted first per band.
+ * @param max The capacity of the candidates array.
+ *
+ * @return The number of identifiers stored, at most `max`, or -1 if the memory allocation failed.
+ */
+int64_t str_lsh_query(const StrLshIndex *index, const uint32_t *signature, int64_t *candidates, int64_t max);
+
+/**
+ * Initializes an empty edit script.
+ *
+ * @param diff A handle to the StrDiff object to initialize.
+ */
+void str_diff_init(StrDiff *diff);
+
+/**
+ * Finalizes the edit script and releases its memory.
+ *
+ * @param diff A handle to the StrDiff object to finalize.
+ */
+void str_diff_finalize(StrDiff *diff);
+
+/**
+ * Computes the shortest edit script between two texts, byte by byte, replacing the previous contents of
+ * the diff. Uses the linear space variant of Myers' O(ND) algorithm.
+ *
+ * @param diff A handle to the StrDiff object that receives the edits.
+ * @param a A pointer to the old text.
+ * @param a_length The length of the old text. Pass a negative value to calculate the length internally.
+ * @param b A pointer to the new text.
+ * @param b_length The length of the new text. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the diff was computed; false if the memory allocation failed.
+ */
+bool str_diff_bytes(StrDiff *diff, const char *a, int64_t a_length, const char *b, int64_t b_length);
+
+/**
+ * Computes the shortest edit script between the lines of two texts, replacing the previous contents of the
+ * diff. A line includes its '\n', so a missing newline at the end of a text changes its last line.
+ *
+ * @param diff A handle to the StrDiff object that receives the edits, counted in lines.
+ * @param a A pointer to the old text.
+ * @param a_length The length of the old text. Pass a negative value to calculate the length internally.
+ * @param b A pointer to the new text.
+ * @param b_length The length of the new text. Pass a negative value to calculate the length internally.
+ *
+ * @return True if the diff was computed; false if the memory allocation failed.
+ */
+bool str_diff_lines(StrDiff *diff, const char *a, int64_t a_length, const char *b, int64_t b_length);
+
+/**
+ * Appends the line diff of two texts in the unified format of `diff -u`. Nothing is appended if the texts
+ * are equal.
+ *
+ * @param str A handle to the Str object.
+ * @param a A pointer to the old text.
+ * @param a_length The length of the old text. Pass a negative value to calculate the length internally.
+ * @param b A pointer to the new text.
+ * @param b_length The length of the new text. Pass a negative value to calculate the length internally.
+ * @param a_name The name of the old text on the "---" line.
+ * @param b_name The name of the new text on the "+++" line.
+ * @param context The number of unchanged lines around each change.
+ *
+ * @return True if the diff was appended; false if the memory allocation failed.
+ */
+bool str_append_unified_diff(Str *str, const char *a, int64_t a_length, const char *b, int64_t b_length,
+                             const char *a_name, const char *b_name, int context);
@@ -0,0 +1,1903 @@
+#define _XOPEN_SOURCE 700
+
+#include "str.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not",
+    "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you", "were",
+    "their", "one", "all", "we", "can", "her", "has", "there", "been", "if", "more", "when", "will", "would",
+    "who", "so", "no", "index", "document", "search", "string", "buffer", "memory", "request", "server",
+    "configuration", "performance", "throughput", "latency", "version", "release", "million", "between",
+};
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report_throughput(const char *name, double seconds, int64_t bytes)
+{
+    printf("%-40s %10.1f MB/s\n", name, bytes / seconds / 1e6);
+}
+
+static void report_bandwidth(const char *name, double seconds, int64_t bytes)
+{
+    printf("%-40s %10.2f GB/s\n", name, bytes / seconds / 1e9);
+}
+
+static void report_latency(const char *name, double seconds, int64_t operations)
+{
+    printf("%-40s %10.1f ns/op\n", name, seconds / operations * 1e9);
+}
+
+/**
+ * Appends English-like sentences: lowercase words, a capital at the start of each sentence, punctuation.
+ */
+static void append_english(Str *text, int64_t length)
+{
+    int64_t sentence = 0;
+
+    while (text->length < length) {
+        const char *word = words[next_random() % (sizeof(words) / sizeof(words[0]))];
+
+        if (sentence == 0) {
+            str_append_char(text, (char) (word[0] - 'a' + 'A'));
+            str_append_str(text, word + 1, -1);
+        } else {
+            str_append_char(text, ' ');
+            str_append_str(text, word, -1);
+        }
+
+        if (++sentence == 12) {
+            str_append_str(text, ". ", 2);
+            sentence = 0;
+        }
+    }
+}
+
+/**
+ * Appends a mixed corpus: English with identifiers, numbers, URLs and non-ASCII UTF-8 words.
+ */
+static void append_mixed(Str *text, int64_t length)
+{
+    static const char *const extras[] = {
+        "HTTP/1.1", "0x7FFF", "2024-03-09", "https://example.com/a?b=c", "str_append_str()", "42", "3.14159",
+        "ID_MAX", "caf\xc3\xa9", "na\xc3\xafve", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+        "\xd0\x9c\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0",
+    };
+
+    while (text->length < length) {
+        append_english(text, text->length + 256);
+        str_append_char(text, ' ');
+        str_append_str(text, extras[next_random() % (sizeof(extras) / sizeof(extras[0]))], -1);
+        str_append_str(text, ", ", 2);
+    }
+}
+
+/**
+ * The approach the tokenizer replaces: one allocated, lowercased Str per token.
+ */
+static bool is_word_byte(char c)
+{
+    return isalnum((unsigned char) c) || (unsigned char) c >= 0x80;
+}
+
+static int64_t tokenize_with_strs(const Str *text)
+{
+    int64_t count = 0;
+
+    for (int64_t i = 0; i < text->length;) {
+        if (!is_word_byte(text->value[i])) {
+            i++;
+            continue;
+        }
+
+        Str token;
+        str_init(&token);
+
+        while (i < text->length && is_word_byte(text->value[i])) {
+            str_append_char(&token, (char) tolower((unsigned char) text->value[i++]));
+        }
+
+        count += token.length > 0;
+        str_finalize(&token);
+    }
+
+    return count;
+}
+
+/**
+ * Scans the mixed corpus for bytes of a set, and over runs of a set, against strpbrk() and strspn().
+ */
+static void bench_byteset(const Str *mixed)
+{
+    /* No line breaks or tabs in the corpus, so each call scans it all */
+    double start = now();
+    int64_t found = str_find_any(mixed, 0, "\r\n\t", -1);
+    report_throughput("find any of 3 bytes, str_find_any", now() - start, mixed->length);
+
+    start = now();
+    const char *p = strpbrk(mixed->value, "\r\n\t");
+    report_throughput("find any of 3 bytes, strpbrk", now() - start, mixed->length);
+
+    if (found != (p ? p - mixed->value : -1)) {
+        printf("  results differ\n");
+    }
+
+    /* Words: spans of letters, then of everything else */
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    int64_t words_found = 0;
+
+    start = now();
+    for (int64_t i = 0; i < mixed->length; words_found++) {
+        i += str_span(mixed, i, letters, -1);
+        i += str_cspan(mixed, i, letters, -1);
+    }
+
+    report_throughput("word spans, str_span/str_cspan", now() - start, mixed->length);
+
+    int64_t words_expected = 0;
+    start = now();
+    for (const char *s = mixed->value; *s; words_expected++) {
+        s += strspn(s, letters);
+        s += strcspn(s, letters);
+    }
+
+    report_throughput("word spans, strspn/strcspn", now() - start, mixed->length);
+
+    if (words_found != words_expected) {
+        printf("  span counts differ: %lld and %lld\n", (long long) words_found, (long long) words_expected);
+    }
+}
+
+/**
+ * Streams the English corpus in 4 KB appends and finds every occurrence of a word as it arrives, with a
+ * matcher and by searching each new chunk (plus the bytes a match could straddle) again.
+ */
+static void bench_matcher(const Str *english)
+{
+    const int64_t chunk = 4096;
+    static const char needle[] = "performance";
+    const int64_t length = sizeof(needle) - 1;
+
+    Str stream;
+    str_init(&stream);
+    str_ensure_capacity(&stream, english->length + 1);
+
+    StrMatcher matcher;
+    str_matcher_init(&matcher, needle, length);
+    int64_t found = 0;
+
+    double start = now();
+    for (int64_t i = 0; i < english->length; i += chunk) {
+        str_append_str(&stream, english->value + i, english->length - i < chunk ? english->length - i : chunk);
+
+        while (str_matcher_next(&matcher, &stream) >= 0) {
+            found++;
+        }
+    }
+
+    report_throughput("streaming search, StrMatcher", now() - start, english->length);
+
+    str_set_length(&stream, 0);
+    int64_t expected = 0;
+    int64_t searched = 0;
+
+    start = now();
+    for (int64_t i = 0; i < english->length; i += chunk) {
+        str_append_str(&stream, english->value + i, english->length - i < chunk ? english->length - i : chunk);
+
+        /* The window covers the new chunk and a match that started before it */
+        for (;;) {
+            int64_t from = stream.length - chunk - length + 1;
+            if (from < searched) {
+                from = searched;
+            }
+
+            StrSlice window = {stream.value + from, stream.length - from};
+            Str view = str_from_slice(window);
+            int64_t index = str_indexof_str(&view, needle, length);
+            if (index < 0) {
+                break;
+            }
+
+            searched = from + index + length;
+            expected++;
+        }
+    }
+
+    report_throughput("streaming search, str_indexof_str", now() - start, english->length);
+    if (found != expected) {
+        printf("  match counts differ: %lld and %lld\n", (long long) found, (long long) expected);
+    }
+
+    str_matcher_finalize(&matcher);
+    str_finalize(&stream);
+}
+
+static void bench_tokenizer(const char *name, const Str *text)
+{
+    char label[64];
+    StrTokenizer tokenizer;
+    StrSlice token;
+    int64_t tokens = 0;
+
+    double start = now();
+    str_tokenizer_init(&tokenizer, text->value, text->length);
+    while (str_tokenizer_next(&tokenizer, &token)) {
+        tokens++;
+    }
+
+    str_tokenizer_finalize(&tokenizer);
+    snprintf(label, sizeof(label), "tokenize %s", name);
+    report_throughput(label, now() - start, text->length);
+
+    StrTermCounter counter;
+    str_term_counter_init(&counter, 1024);
+
+    start = now();
+    str_term_counter_add_text(&counter, text->value, text->length);
+    snprintf(label, sizeof(label), "tokenize and count %s", name);
+    report_throughput(label, now() - start, text->length);
+
+    str_term_counter_finalize(&counter);
+
+    start = now();
+    int64_t baseline = tokenize_with_strs(text);
+    snprintf(label, sizeof(label), "  Str per token, %s", name);
+    report_throughput(label, now() - start, text->length);
+
+    if (baseline != tokens) {
+        printf("  token counts differ: %lld and %lld\n", (long long) tokens, (long long) baseline);
+    }
+}
+
+static void bench_sketch(const Str *english)
+{
+    const int64_t document_length = 2048;
+    const int64_t documents = 2048;
+    uint32_t signature[128];
+    uint64_t simhash;
+
+    double start = now();
+    for (int64_t i = 0; i < documents; i++) {
+        str_sketch(english->value + i * document_length, document_length, 5, signature, 128, &simhash);
+    }
+
+    report_throughput("sketch (128 MinHash + SimHash)", now() - start, documents * document_length);
+}
+
+/**
+ * Appends a config file of `lines` key = value lines.
+ */
+static void append_config(Str *text, int64_t lines)
+{
+    for (int64_t i = 0; i < lines; i++) {
+        str_append_format(text, "section%lld.%s_%s = %llu\n", (long long) (i / 50), words[i % 64],
+                          words[(i * 7) % 64], (unsigned long long) (next_random() % 100000));
+    }
+}
+
+/**
+ * Copies a text, changing, deleting or inserting a line at `edits` evenly spread places.
+ */
+static void append_edited(Str *copy, const Str *text, int64_t edits)
+{
+    int64_t step = text->length / (edits + 1);
+    int64_t start = 0;
+
+    for (int64_t i = 1; i <= edits; i++) {
+        const char *line = memchr(text->value + i * step, '\n', text->length - i * step);
+        int64_t end = line - text->value + 1;
+        const char *next = memchr(text->value + end, '\n', text->length - end);
+        int64_t next_end = next ? next - text->value + 1 : end;
+
+        str_append_str(copy, text->value + start, end - start);
+        switch (i % 3) {
+        case 0: /* Change the next line */
+            str_append_str(copy, "changed = true\n", -1);
+            start = next_end;
+            break;
+        case 1: /* Delete it */
+            start = next_end;
+            break;
+        default: /* Insert one before it */
+            str_append_str(copy, "inserted = true\n", -1);
+            start = end;
+            break;
+        }
+    }
+
+    str_append_str(copy, text->value + start, text->length - start);
+}
+
+static void bench_diff(void)
+{
+    Str a, b, patch;
+    str_init(&a);
+    str_init(&b);
+    str_init(&patch);
+
+    /* About 4 MB and 100000 lines, with 100 scattered edits */
+    append_config(&a, 100000);
+    append_edited(&b, &a, 100);
+
+    StrDiff diff;
+    str_diff_init(&diff);
+
+    double start = now();
+    for (int i = 0; i < 10; i++) {
+        str_diff_lines(&diff, a.value, a.length, a.value, a.length);
+    }
+
+    report_throughput("diff lines, equal (prefix trim)", (now() - start) / 10, a.length);
+
+    start = now();
+    for (int i = 0; i < 10; i++) {
+        str_diff_lines(&diff, a.value, a.length, b.value, b.length);
+    }
+
+    report_throughput("diff lines, 100 edits in 4 MB", (now() - start) / 10, a.length);
+    printf("%-40s %10lld\n", "  edits", (long long) diff.count);
+
+    start = now();
+    for (int i = 0; i < 10; i++) {
+        str_set_length(&patch, 0);
+        str_append_unified_diff(&patch, a.value, a.length, b.value, b.length, "a/app.conf", "b/app.conf", 3);
+    }
+
+    report_throughput("unified diff, 100 edits in 4 MB", (now() - start) / 10, a.length);
+
+    /* The byte diff explores the differing regions byte by byte; keep the input smaller */
+    int64_t length = 1024 * 1024;
+    str_set_length(&b, 0);
+    str_append_str(&b, a.value, length);
+    for (int64_t i = 1; i <= 100; i++) {
+        b.value[i * (length / 101)] ^= 0x20;
+    }
+
+    start = now();
+    str_diff_bytes(&diff, a.value, length, b.value, length);
+    report_throughput("diff bytes, 100 edits in 1 MB", now() - start, length);
+
+    str_diff_finalize(&diff);
+    str_finalize(&patch);
+    str_finalize(&b);
+    str_finalize(&a);
+}
+
+static int compare_strs(const void *a, const void *b)
+{
+    return str_compare(a, b);
+}
+
+static int compare_strs_natural(const void *a, const void *b)
+{
+    return str_compare_natural(a, b);
+}
+
+static const Str *sort_keys;
+static const int64_t *sort_key_offsets;
+
+static int compare_keys(const void *a, const void *b)
+{
+    int64_t i = *(const int64_t *) a;
+    int64_t j = *(const int64_t *) b;
+    int64_t i_length = sort_key_offsets[i + 1] - sort_key_offsets[i];
+    int64_t j_length = sort_key_offsets[j + 1] - sort_key_offsets[j];
+
+    int cmp = memcmp(sort_keys->value + sort_key_offsets[i], sort_keys->value + sort_key_offsets[j],
+                     i_length < j_length ? i_length : j_length);
+
+    return cmp != 0 ? cmp : (i_length > j_length) - (i_length < j_length);
+}
+
+static void bench_natural_sort(void)
+{
+    const int64_t count = 1000000;
+    Str *names = malloc(sizeof(Str) * count);
+    Str *sorted = malloc(sizeof(Str) * count);
+    int64_t *order = malloc(sizeof(int64_t) * count);
+    int64_t *offsets = malloc(sizeof(int64_t) * (count + 1));
+
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t r = next_random();
+        str_init(&names[i]);
+
+        switch (i % 4) {
+        case 0:
+            str_append_format(&names[i], "file%llu.txt", (unsigned long long) (r % 100000));
+            break;
+        case 1:
+            str_append_format(&names[i], "v%u.%u.%u", (unsigned) (r % 20), (unsigned) (r >> 8) % 40,
+                              (unsigned) (r >> 16) % 200);
+            break;
+        case 2:
+            str_append_format(&names[i], "IMG_%04u_%u.jpg", (unsigned) (r % 10000), (unsigned) (r >> 20) % 10);
+            break;
+        default:
+            str_append_format(&names[i], "%s-%llu-%s.log", words[r % 64], (unsigned long long) (r >> 8) % 1000,
+                              words[(r >> 24) % 64]);
+            break;
+        }
+    }
+
+    memcpy(sorted, names, sizeof(Str) * count);
+    double start = now();
+    qsort(sorted, count, sizeof(Str), compare_strs);
+    report_latency("sort 1M names, str_compare", now() - start, count);
+
+    memcpy(sorted, names, sizeof(Str) * count);
+    start = now();
+    qsort(sorted, count, sizeof(Str), compare_strs_natural);
+    report_latency("sort 1M names, str_compare_natural", now() - start, count);
+
+    Str keys;
+    str_init(&keys);
+
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        offsets[i] = keys.length;
+        order[i] = i;
+        str_append_natural_key(&keys, names[i].value, names[i].length);
+    }
+
+    offsets[count] = keys.length;
+    sort_keys = &keys;
+    sort_key_offsets = offsets;
+    qsort(order, count, sizeof(int64_t), compare_keys);
+    report_latency("sort 1M names, natural keys + memcmp", now() - start, count);
+
+    /* Both natural sorts must agree */
+    for (int64_t i = 0; i < count; i++) {
+        if (str_compare_natural(&names[order[i]], &sorted[i]) != 0) {
+            printf("  the natural sorts differ at %lld\n", (long long) i);
+            break;
+        }
+    }
+
+    str_finalize(&keys);
+    for (int64_t i = 0; i < count; i++) {
+        str_finalize(&names[i]);
+    }
+
+    free(offsets);
+    free(order);
+    free(sorted);
+    free(names);
+}
+
+/**
+ * A synthetic signature: documents come in clusters of 10 near duplicates that differ in a few values.
+ */
+static void lsh_signature(int64_t document, uint32_t *signature, int count)
+{
+    uint32_t cluster = (uint32_t) ((uint64_t) (document / 10) * 0x9E3779B97F4A7C15ULL >> 32);
+
+    for (int i = 0; i < count; i++) {
+        signature[i] = cluster ^ (uint32_t) (i * 0x85EBCA6B);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        signature[(document * 7 + i * 13) % count] ^= (uint32_t) (document + 1);
+    }
+}
+
+static void bench_lsh(void)
+{
+    const int64_t documents = 1000000;
+    const int64_t queries = 100000;
+    uint32_t signature[64];
+    static int64_t candidates[1024];
+
+    StrLshIndex index;
+    str_lsh_init(&index, 16, 4);
+
+    double start = now();
+    for (int64_t i = 0; i < documents; i++) {
+        lsh_signature(i, signature, 64);
+        str_lsh_insert(&index, signature, i);
+    }
+
+    report_latency("lsh insert (1M documents, 16x4)", now() - start, documents);
+
+    int64_t found = 0;
+    start = now();
+    for (int64_t i = 0; i < queries; i++) {
+        lsh_signature((int64_t) (next_random() % documents), signature, 64);
+        found += str_lsh_query(&index, signature, candidates, 1024);
+    }
+
+    report_latency("lsh query (1M documents)", now() - start, queries);
+    printf("%-40s %10.1f\n", "  candidates per query", (double) found / queries);
+
+    str_lsh_finalize(&index);
+
+    /* A crowded bucket: 10000 near duplicates, each found in every band */
+    static int64_t crowded[10000];
+    str_lsh_init(&index, 16, 4);
+    lsh_signature(0, signature, 64);
+
+    for (int64_t i = 0; i < 10000; i++) {
+        str_lsh_insert(&index, signature, i);
+    }
+
+    start = now();
+    for (int i = 0; i < 100; i++) {
+        str_lsh_query(&index, signature, crowded, 10000);
+    }
+
+    report_latency("lsh query (10000 candidates)", now() - start, 100);
+    str_lsh_finalize(&index);
+}
+
+/**
+ * Checksums the English corpus eight times over with each function, in one call per pass.
+ */
+static void bench_checksums(const Str *english)
+{
+    const int passes = 8;
+
+    double start = now();
+    for (int i = 0; i < passes; i++) {
+        str_crc32_update(0, english->value, english->length);
+    }
+
+    report_bandwidth("crc32", now() - start, passes * english->length);
+
+    start = now();
+    for (int i = 0; i < passes; i++) {
+        str_crc32c_update(0, english->value, english->length);
+    }
+
+    report_bandwidth("crc32c", now() - start, passes * english->length);
+
+    start = now();
+    for (int i = 0; i < passes; i++) {
+        str_adler32_update(1, english->value, english->length);
+    }
+
+    report_bandwidth("adler32", now() - start, passes * english->length);
+
+    start = now();
+    for (int i = 0; i < passes; i++) {
+        str_xxh64_str(english->value, english->length, 0);
+    }
+
+    report_bandwidth("xxh64", now() - start, passes * english->length);
+}
+
+/**
+ * Compresses the mixed corpus at the fast and the highest level and decompresses the blocks, in 64 KB
+ * blocks like a framed stream.
+ */
+static void bench_lz4(const Str *mixed)
+{
+    const int64_t block = 64 * 1024;
+    static const int levels[] = {STR_LZ4_LEVEL_FAST, STR_LZ4_LEVEL_MAX};
+    char label[64];
+
+    Str compressed;
+    Str decompressed;
+    str_init(&compressed);
+    str_init(&decompressed);
+    str_ensure_capacity(&decompressed, mixed->length + 1);
+
+    int64_t *sizes = malloc(sizeof(int64_t) * (mixed->length / block + 1));
+
+    for (int l = 0; l < 2; l++) {
+        str_set_length(&compressed, 0);
+        int blocks = 0;
+
+        double start = now();
+        for (int64_t i = 0; i < mixed->length; i += block) {
+            int64_t length = mixed->length - i < block ? mixed->length - i : block;
+            int64_t before = compressed.length;
+            str_append_lz4_compressed(&compressed, mixed->value + i, length, levels[l]);
+            sizes[blocks++] = compressed.length - before;
+        }
+
+        snprintf(label, sizeof(label), "lz4 compress, level %d", levels[l]);
+        report_bandwidth(label, now() - start, mixed->length);
+        printf("%-40s %10.3f\n", "  ratio", (double) compressed.length / mixed->length);
+
+        str_set_length(&decompressed, 0);
+        const char *p = compressed.value;
+
+        start = now();
+        for (int i = 0; i < blocks; i++) {
+            str_append_lz4_decompressed(&decompressed, p, sizes[i], block);
+            p += sizes[i];
+        }
+
+        snprintf(label, sizeof(label), "lz4 decompress, level %d", levels[l]);
+        report_bandwidth(label, now() - start, mixed->length);
+
+        if (decompressed.length != mixed->length || memcmp(decompressed.value, mixed->value, mixed->length) != 0) {
+            printf("  round trip failed\n");
+        }
+    }
+
+    free(sizes);
+    str_finalize(&decompressed);
+    str_finalize(&compressed);
+}
+
+/**
+ * Encodes 16 million integers of mixed magnitudes as varints and as fixed-width fields, against the usual
+ * loop that appends one byte at a time.
+ */
+static void bench_binary_appends(void)
+{
+    const int64_t count = 16 * 1024 * 1024;
+    uint64_t *values = malloc(sizeof(uint64_t) * count);
+
+    /* Mostly small values, as in message headers and lengths, with a tail of large ones */
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t r = next_random();
+        values[i] = r >> (r % 8 == 0 ? 0 : 48 + r % 16);
+    }
+
+    Str out;
+    str_init(&out);
+
+    double start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_varint(&out, values[i]);
+    }
+
+    report_latency("append varint", now() - start, count);
+    int64_t length = out.length;
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t value = values[i];
+        while (value >= 0x80) {
+            str_append_char(&out, (char) (value | 0x80));
+            value >>= 7;
+        }
+
+        str_append_char(&out, (char) value);
+    }
+
+    report_latency("append varint, byte at a time", now() - start, count);
+    if (out.length != length) {
+        printf("  lengths differ: %lld and %lld\n", (long long) length, (long long) out.length);
+    }
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_u64le(&out, values[i]);
+    }
+
+    report_latency("append u64le", now() - start, count);
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        for (int shift = 0; shift < 64; shift += 8) {
+            str_append_char(&out, (char) (values[i] >> shift));
+        }
+    }
+
+    report_latency("append u64le, byte at a time", now() - start, count);
+
+    /* Decoding reads back what was encoded */
+    str_set_length(&out, 0);
+    for (int64_t i = 0; i < count; i++) {
+        str_append_varint(&out, values[i]);
+    }
+
+    const char *cursor = out.value;
+    const char *end = out.value + out.length;
+    uint64_t value;
+    int64_t mismatches = 0;
+
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_decode_varint(&cursor, end, &value);
+        mismatches += value != values[i];
+    }
+
+    report_latency("decode varint", now() - start, count);
+    if (mismatches > 0) {
+        printf("  %lld values differ\n", (long long) mismatches);
+    }
+
+    str_finalize(&out);
+    free(values);
+}
+
+/**
+ * Parses 4 million records of an id, flags, a length-prefixed name and a timestamp with the checked reads,
+ * with one size check per fixed part and unchecked reads, and with a cursor and memcpy().
+ */
+static void bench_reader(void)
+{
+    const int64_t count = 4 * 1024 * 1024;
+    Str records;
+    str_init(&records);
+
+    for (int64_t i = 0; i < count; i++) {
+        const char *name = words[next_random() % 64];
+        str_append_u32le(&records, (uint32_t) i);
+        str_append_u16be(&records, (uint16_t) (i & 0xFFFF));
+        str_append_varint(&records, strlen(name));
+        str_append_str(&records, name, -1);
+        str_append_u64le(&records, 1700000000000ULL + (uint64_t) i);
+    }
+
+    StrReader reader;
+    uint64_t sum = 0;
+    str_reader_init(&reader, &records);
+
+    double start = now();
+    for (int64_t i = 0; i < count; i++) {
+        uint32_t id;
+        uint16_t flags;
+        uint64_t length;
+        uint64_t timestamp;
+        StrSlice name;
+
+        if (!str_reader_read_u32le(&reader, &id) || !str_reader_read_u16be(&reader, &flags)
+            || !str_reader_read_varint(&reader, &length) || !str_reader_read_bytes(&reader, (int64_t) length, &name)
+            || !str_reader_read_u64le(&reader, &timestamp)) {
+            break;
+        }
+
+        sum += id + flags + name.length + timestamp;
+    }
+
+    report_throughput("parse records, checked reads", now() - start, records.length);
+    uint64_t expected = sum;
+
+    sum = 0;
+    str_reader_init(&reader, &records);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t length;
+        StrSlice name;
+
+        if (!str_reader_has(&reader, 6)) {
+            break;
+        }
+
+        sum += str_reader_read_u32le_unchecked(&reader);
+        sum += str_reader_read_u16be_unchecked(&reader);
+
+        if (!str_reader_read_varint(&reader, &length) || !str_reader_read_bytes(&reader, (int64_t) length, &name)
+            || !str_reader_has(&reader, 8)) {
+            break;
+        }
+
+        sum += name.length + str_reader_read_u64le_unchecked(&reader);
+    }
+
+    report_throughput("parse records, unchecked reads", now() - start, records.length);
+
+    /* By hand: memcpy() for the fixed fields, a loop for the varint */
+    uint64_t by_hand = 0;
+    const unsigned char *p = (const unsigned char *) records.value;
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        uint32_t id;
+        uint64_t timestamp;
+
+        memcpy(&id, p, 4);
+        by_hand += id + ((unsigned) p[4] << 8 | p[5]);
+        p += 6;
+
+        uint64_t length = 0;
+        for (int shift = 0;; shift += 7) {
+            length |= (uint64_t) (*p & 0x7F) << shift;
+            if (*p++ < 0x80) {
+                break;
+            }
+        }
+
+        by_hand += length;
+        p += length;
+        memcpy(&timestamp, p, 8);
+        by_hand += timestamp;
+        p += 8;
+    }
+
+    report_throughput("parse records, memcpy", now() - start, records.length);
+    if (sum != expected || by_hand != expected) {
+        printf("  sums differ\n");
+    }
+
+    str_finalize(&records);
+}
+
+#ifdef STR_HAVE_THREADS
+#define LOG_CALLS 20000
+
+static StrLogger timed_logger;
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Logs LOG_CALLS messages and records how long each call took.
+ */
+static void *log_timed(void *arg)
+{
+    double *latencies = arg;
+
+    for (int i = 0; i < LOG_CALLS; i++) {
+        double start = now();
+        str_logger_log(&timed_logger, "request %d served in %d us", i, i % 1000);
+        latencies[i] = now() - start;
+    }
+
+    return NULL;
+}
+
+/**
+ * Measures the latency of str_logger_log() for 1 to 64 producer threads writing to /dev/null.
+ */
+static void bench_logger(void)
+{
+    int fd = open("/dev/null", O_WRONLY);
+
+    for (int producers = 1; producers <= 64; producers *= 4) {
+        double *latencies = malloc(sizeof(double) * LOG_CALLS * producers);
+        pthread_t threads[64];
+
+        str_logger_init(&timed_logger, fd, 4096, STR_LOG_BLOCK);
+
+        double start = now();
+        for (int i = 0; i < producers; i++) {
+            pthread_create(&threads[i], NULL, log_timed, latencies + (int64_t) i * LOG_CALLS);
+        }
+
+        for (int i = 0; i < producers; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        double seconds = now() - start;
+        str_logger_finalize(&timed_logger);
+
+        int64_t count = (int64_t) LOG_CALLS * producers;
+        qsort(latencies, count, sizeof(double), compare_doubles);
+
+        char label[64];
+        snprintf(label, sizeof(label), "logger latency, %d threads", producers);
+        printf("%-40s %10.0f / %.0f / %.0f ns (p50 / p99 / p99.9)\n", label, latencies[count / 2] * 1e9,
+               latencies[count * 99 / 100] * 1e9, latencies[count * 999 / 1000] * 1e9);
+        printf("%-40s %10.2f M messages/s\n", "  throughput", count / seconds / 1e6);
+        free(latencies);
+    }
+
+    close(fd);
+}
+
+#define CONCURRENT_RECORDS (256 * 1024)
+
+static StrConcurrentBuffer bench_buffer;
+static atomic_int writers_done;
+
+/**
+ * Appends its share of CONCURRENT_RECORDS records of 64 bytes, retrying while the buffer is full.
+ */
+static void *append_records(void *arg)
+{
+    int64_t records = (int64_t) (intptr_t) arg;
+    char record[64];
+    memset(record, 'x', sizeof(record));
+
+    for (int64_t i = 0; i < records; i++) {
+        while (!str_concurrent_append(&bench_buffer, record, sizeof(record))) {
+            sched_yield();
+        }
+    }
+
+    atomic_fetch_add(&writers_done, 1);
+    return NULL;
+}
+
+/**
+ * Measures the append throughput of a concurrent buffer shared by 1 to 64 writers, with the main thread
+ * consuming. The writers split 16 MB of records between them.
+ */
+static void bench_concurrent_buffer(void)
+{
+    for (int writers = 1; writers <= 64; writers *= 4) {
+        pthread_t threads[64];
+        int64_t consumed = 0;
+
+        str_concurrent_init(&bench_buffer, 1024 * 1024);
+        atomic_store(&writers_done, 0);
+
+        double start = now();
+        for (int i = 0; i < writers; i++) {
+            pthread_create(&threads[i], NULL, append_records, (void *) (intptr_t) (CONCURRENT_RECORDS / writers));
+        }
+
+        for (;;) {
+            bool done = atomic_load(&writers_done) == writers;
+            StrSlice slice = str_concurrent_peek(&bench_buffer);
+
+            if (slice.length > 0) {
+                str_concurrent_consume(&bench_buffer, slice.length);
+                consumed += slice.length;
+            } else if (done) {
+                break;
+            } else {
+                sched_yield();
+            }
+        }
+
+        double seconds = now() - start;
+        for (int i = 0; i < writers; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        char label[64];
+        snprintf(label, sizeof(label), "concurrent append, %d writers", writers);
+        report_throughput(label, seconds, consumed);
+        str_concurrent_finalize(&bench_buffer);
+    }
+}
+#endif
+
+/**
+ * Formats 4 million millisecond timestamps, 1 ms apart as in a busy log and scattered over decades, with
+ * str_append_timestamp(), with gmtime_r() + strftime() + snprintf() and with gmtime_r() + str_append_format().
+ */
+static void bench_timestamp_format(void)
+{
+    const int64_t count = 4 * 1024 * 1024;
+    const int64_t base = 1709993126000LL;
+    Str out;
+    str_init(&out);
+
+    for (int scattered = 0; scattered <= 1; scattered++) {
+        int64_t *epochs = malloc(sizeof(int64_t) * count);
+        for (int64_t i = 0; i < count; i++) {
+            /* Scattered over 1976-2071 */
+            epochs[i] = scattered ? base - 1500000000000LL + (int64_t) (next_random() % 3000000000000ULL) : base + i;
+        }
+
+        str_set_length(&out, 0);
+        double start = now();
+        for (int64_t i = 0; i < count; i++) {
+            str_append_timestamp(&out, epochs[i], STR_TIME_MILLIS, 0);
+            str_append_char(&out, '\n');
+        }
+
+        report_latency(scattered ? "timestamp, scattered" : "timestamp, in order", now() - start, count);
+        int64_t length = out.length;
+
+        str_set_length(&out, 0);
+        start = now();
+        for (int64_t i = 0; i < count; i++) {
+            time_t seconds = (time_t) (epochs[i] / 1000);
+            struct tm tm;
+            char text[64];
+            gmtime_r(&seconds, &tm);
+            size_t n = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+            n += snprintf(text + n, sizeof(text) - n, ".%03dZ\n", (int) (epochs[i] % 1000));
+            str_append_str(&out, text, (int64_t) n);
+        }
+
+        report_latency(scattered ? "timestamp, scattered, strftime" : "timestamp, in order, strftime",
+                       now() - start, count);
+
+        str_set_length(&out, 0);
+        start = now();
+        for (int64_t i = 0; i < count; i++) {
+            time_t seconds = (time_t) (epochs[i] / 1000);
+            struct tm tm;
+            gmtime_r(&seconds, &tm);
+            str_append_format(&out, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\n", tm.tm_year + 1900, tm.tm_mon + 1,
+                              tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, (int) (epochs[i] % 1000));
+        }
+
+        report_latency(scattered ? "timestamp, scattered, str_append_format"
+                                 : "timestamp, in order, str_append_format",
+                       now() - start, count);
+        if (out.length != length) {
+            printf("  lengths differ: %lld and %lld\n", (long long) length, (long long) out.length);
+        }
+
+        free(epochs);
+    }
+
+    str_finalize(&out);
+}
+
+/**
+ * Parses 1 million RFC 3339 timestamps with millisecond fractions, and common log format timestamps, from
+ * fields of a buffer. strptime() and sscanf() need a NUL-terminated copy of each field; they only fill in the
+ * fields of the date, without the conversion to an epoch.
+ */
+static void bench_timestamp_parse(void)
+{
+    const int64_t count = 1024 * 1024;
+    const int64_t field = 32;
+    char *fields = malloc(count * field);
+    char *clf = malloc(count * field);
+    Str out;
+    str_init(&out);
+
+    for (int64_t i = 0; i < count; i++) {
+        int64_t epoch = 1709993126000LL + (int64_t) (next_random() % 100000000000ULL);
+
+        str_set_length(&out, 0);
+        str_append_timestamp(&out, epoch, STR_TIME_MILLIS, 0);
+        memcpy(fields + i * field, out.value, out.length + 1);
+
+        time_t seconds = (time_t) (epoch / 1000);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        strftime(clf + i * field, field, "%d/%b/%Y:%H:%M:%S +0000", &tm);
+    }
+
+    int64_t sum = 0;
+    double start = now();
+    for (int64_t i = 0; i < count; i++) {
+        int64_t epoch_ns = 0;
+        str_parse_timestamp(fields + i * field, 24, &epoch_ns);
+        sum += epoch_ns / 1000000000;
+    }
+
+    report_latency("parse RFC 3339, str_parse_timestamp", now() - start, count);
+
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        int64_t epoch_ns = 0;
+        str_parse_timestamp(clf + i * field, 26, &epoch_ns);
+        sum -= epoch_ns / 1000000000;
+    }
+
+    report_latency("parse CLF, str_parse_timestamp", now() - start, count);
+    if (sum != 0) {
+        printf("  the formats parse to different seconds\n");
+    }
+
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        char copy[32];
+        struct tm tm;
+        memcpy(copy, fields + i * field, 24);
+        copy[24] = '\0';
+        const char *rest = strptime(copy, "%Y-%m-%dT%H:%M:%S", &tm);
+        sum += tm.tm_sec + (rest != NULL ? strtol(rest + 1, NULL, 10) : 0);
+    }
+
+    report_latency("parse RFC 3339, strptime", now() - start, count);
+
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        char copy[32];
+        int year, month, day, hour, minute, second, millis;
+        memcpy(copy, fields + i * field, 24);
+        copy[24] = '\0';
+        if (sscanf(copy, "%4d-%2d-%2dT%2d:%2d:%2d.%3dZ", &year, &month, &day, &hour, &minute, &second,
+                   &millis) == 7) {
+            sum += second + millis;
+        }
+    }
+
+    report_latency("parse RFC 3339, sscanf", now() - start, count);
+
+    str_finalize(&out);
+    free(clf);
+    free(fields);
+}
+
+/**
+ * Sanitizes copies of the mixed corpus: ASCII lowercasing and control characters to spaces with
+ * str_translate(), deleting punctuation and squeezing runs of spaces, against byte loops.
+ */
+static void bench_translate(const Str *mixed)
+{
+    Str copy;
+    str_init(&copy);
+    uint8_t map[256];
+    for (int c = 0; c < 256; c++) {
+        map[c] = (uint8_t) (c < 0x20 ? ' ' : c >= 'A' && c <= 'Z' ? c + 32 : c);
+    }
+
+    double elapsed = 0;
+    for (int round = 0; round < 4; round++) {
+        str_set_length(&copy, 0);
+        str_append_str(&copy, mixed->value, mixed->length);
+        double start = now();
+        str_translate(&copy, map);
+        elapsed += now() - start;
+    }
+
+    report_bandwidth("translate, str_translate", elapsed, 4 * mixed->length);
+    uint64_t expected = str_xxh64(&copy, 0);
+
+    elapsed = 0;
+    for (int round = 0; round < 4; round++) {
+        str_set_length(&copy, 0);
+        str_append_str(&copy, mixed->value, mixed->length);
+        double start = now();
+        uint8_t *p = (uint8_t *) copy.value;
+        for (int64_t i = 0; i < copy.length; i++) {
+            p[i] = map[p[i]];
+        }
+        elapsed += now() - start;
+    }
+
+    report_bandwidth("translate, byte loop", elapsed, 4 * mixed->length);
+    if (str_xxh64(&copy, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    static const char punctuation[] = ",.;:!?";
+    elapsed = 0;
+    for (int round = 0; round < 4; round++) {
+        str_set_length(&copy, 0);
+        str_append_str(&copy, mixed->value, mixed->length);
+        double start = now();
+        str_delete_chars(&copy, punctuation, -1);
+        elapsed += now() - start;
+    }
+
+    report_bandwidth("delete punctuation, str_delete_chars", elapsed, 4 * mixed->length);
+    expected = str_xxh64(&copy, 0);
+
+    elapsed = 0;
+    for (int round = 0; round < 4; round++) {
+        str_set_length(&copy, 0);
+        str_append_str(&copy, mixed->value, mixed->length);
+        double start = now();
+        int64_t dst = 0;
+        for (int64_t i = 0; i < copy.length; i++) {
+            if (strchr(punctuation, copy.value[i]) == NULL || copy.value[i] == '\0') {
+                copy.value[dst++] = copy.value[i];
+            }
+        }
+        str_set_length(&copy, dst);
+        elapsed += now() - start;
+    }
+
+    report_bandwidth("delete punctuation, byte loop", elapsed, 4 * mixed->length);
+    if (str_xxh64(&copy, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    elapsed = 0;
+    for (int round = 0; round < 4; round++) {
+        str_set_length(&copy, 0);
+        str_append_str(&copy, mixed->value, mixed->length);
+        double start = now();
+        str_squeeze(&copy, " ", 1);
+        elapsed += now() - start;
+    }
+
+    report_bandwidth("squeeze spaces, str_squeeze", elapsed, 4 * mixed->length);
+    expected = str_xxh64(&copy, 0);
+
+    elapsed = 0;
+    for (int round = 0; round < 4; round++) {
+        str_set_length(&copy, 0);
+        str_append_str(&copy, mixed->value, mixed->length);
+        double start = now();
+        int64_t dst = copy.length > 0;
+        for (int64_t i = 1; i < copy.length; i++) {
+            if (copy.value[i] != ' ' || copy.value[dst - 1] != ' ') {
+                copy.value[dst++] = copy.value[i];
+            }
+        }
+        str_set_length(&copy, dst);
+        elapsed += now() - start;
+    }
+
+    report_bandwidth("squeeze spaces, byte loop", elapsed, 4 * mixed->length);
+    if (str_xxh64(&copy, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    str_finalize(&copy);
+}
+
+/**
+ * Reverses the mixed corpus by bytes and by code points, and 1 million domain names by labels, against
+ * scalar loops.
+ */
+static void bench_reverse(const Str *mixed)
+{
+    Str copy;
+    str_init(&copy);
+    str_append_str(&copy, mixed->value, mixed->length);
+
+    double start = now();
+    for (int round = 0; round < 4; round++) {
+        str_reverse(&copy);
+    }
+
+    report_bandwidth("reverse, str_reverse", now() - start, 4 * copy.length);
+    uint64_t expected = str_xxh64(&copy, 0);
+
+    start = now();
+    for (int round = 0; round < 4; round++) {
+        for (int64_t lo = 0, hi = copy.length - 1; lo < hi; lo++, hi--) {
+            char c = copy.value[lo];
+            copy.value[lo] = copy.value[hi];
+            copy.value[hi] = c;
+        }
+    }
+
+    report_bandwidth("reverse, swap loop", now() - start, 4 * copy.length);
+    if (str_xxh64(&copy, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    start = now();
+    str_reverse_codepoints(&copy);
+    report_bandwidth("reverse UTF-8, str_reverse_codepoints", now() - start, copy.length);
+    expected = str_xxh64(&copy, 0);
+
+    /* Copying each code point to its mirrored position */
+    Str reversed;
+    str_init(&reversed);
+    str_append_str(&reversed, copy.value, copy.length);
+    str_set_length(&copy, 0);
+    str_append_str(&copy, mixed->value, mixed->length);
+
+    start = now();
+    for (int64_t i = 0; i < copy.length;) {
+        uint8_t lead = (uint8_t) copy.value[i];
+        int64_t n = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+        memcpy(reversed.value + copy.length - i - n, copy.value + i, n);
+        i += n;
+    }
+
+    report_bandwidth("reverse UTF-8, decoding loop", now() - start, copy.length);
+    if (str_xxh64(&reversed, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    const int64_t count = 1024 * 1024;
+    Str domains;
+    str_init(&domains);
+    for (int64_t i = 0; i < count; i++) {
+        str_append_str(&domains, i % 3 == 0 ? "www." : "api.", 4);
+        str_append_str(&domains, words[next_random() % 64], -1);
+        str_append_char(&domains, '.');
+        str_append_str(&domains, words[next_random() % 64], -1);
+        str_append_str(&domains, i % 2 == 0 ? ".com\n" : ".co.uk\n", -1);
+    }
+
+    start = now();
+    for (char *p = domains.value, *end; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+        Str name = str_from_slice((StrSlice) {p, end - p});
+        str_reverse_segments(&name, '.');
+    }
+
+    report_latency("reverse domain labels, segments", now() - start, count);
+    expected = str_xxh64(&domains, 0);
+
+    start = now();
+    for (char *p = domains.value, *end; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+        char labels[128];
+        int64_t length = end - p;
+        int64_t out = 0;
+
+        for (int64_t label_end = length, i = length - 1; i >= -1; i--) {
+            if (i < 0 || p[i] == '.') {
+                memcpy(labels + out, p + i + 1, label_end - i - 1);
+                out += label_end - i - 1;
+                if (i >= 0) {
+                    labels[out++] = '.';
+                }
+                label_end = i;
+            }
+        }
+
+        memcpy(p, labels, length);
+    }
+
+    report_latency("reverse domain labels, split and copy", now() - start, count);
+
+    /* Reversing twice restores the names */
+    str_set_length(&copy, 0);
+    str_append_str(&copy, domains.value, domains.length);
+    for (char *p = copy.value, *end; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+        Str name = str_from_slice((StrSlice) {p, end - p});
+        str_reverse_segments(&name, '.');
+    }
+
+    if (str_xxh64(&copy, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    str_finalize(&domains);
+    str_finalize(&reversed);
+    str_finalize(&copy);
+}
+
+/**
+ * Dumps an 8 MB binary blob as hex and escapes it as a C string, against the same output appended in
+ * formatted chunks with str_append_format().
+ */
+static void bench_hexdump(const Str *english)
+{
+    const int64_t length = 8 * 1024 * 1024;
+    char *blob = malloc(length);
+    for (int64_t i = 0; i < length; i += 8) {
+        uint64_t random = next_random();
+        memcpy(blob + i, &random, 8);
+    }
+
+    /* Half of the blob is text, so that the ASCII gutter and the escapes see printable runs */
+    memcpy(blob, english->value, length / 2);
+
+    Str out;
+    str_init(&out);
+
+    double start = now();
+    str_append_hexdump(&out, blob, length, 0);
+    report_throughput("hexdump, str_append_hexdump", now() - start, length);
+    uint64_t expected = str_xxh64(&out, 0);
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t line = 0; line < length; line += 16) {
+        const uint8_t *p = (const uint8_t *) blob + line;
+        str_append_format(&out, "%08llx: %02x%02x %02x%02x %02x%02x %02x%02x %02x%02x %02x%02x %02x%02x %02x%02x  ",
+                          (unsigned long long) line, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9],
+                          p[10], p[11], p[12], p[13], p[14], p[15]);
+        for (int i = 0; i < 16; i++) {
+            str_append_char(&out, p[i] >= 0x20 && p[i] < 0x7F ? (char) p[i] : '.');
+        }
+        str_append_char(&out, '\n');
+    }
+
+    report_throughput("hexdump, str_append_format", now() - start, length);
+    if (str_xxh64(&out, 0) != expected) {
+        printf("  results differ\n");
+    }
+
+    str_set_length(&out, 0);
+    start = now();
+    str_append_c_escaped(&out, blob, length);
+    report_throughput("C escape, str_append_c_escaped", now() - start, length);
+
+    /* A byte at a time, without escaping the hex digits that follow a \x escape */
+    static const char controls[] = "\a\b\t\n\v\f\r\"\\";
+    static const char letters[] = "abtnvfr\"\\";
+    Str formatted;
+    str_init(&formatted);
+    start = now();
+    for (int64_t i = 0; i < length; i++) {
+        uint8_t c = (uint8_t) blob[i];
+        const char *control = c != 0 ? strchr(controls, c) : NULL;
+
+        if (control != NULL) {
+            str_append_char(&formatted, '\\');
+            str_append_char(&formatted, letters[control - controls]);
+        } else if (c >= 0x20 && c < 0x7F) {
+            str_append_char(&formatted, (char) c);
+        } else {
+            str_append_format(&formatted, "\\x%02x", c);
+        }
+    }
+
+    report_throughput("C escape, str_append_format", now() - start, length);
+
+    str_finalize(&formatted);
+    str_finalize(&out);
+    free(blob);
+}
+
+/**
+ * Formats 4 million integers of every digit count in decimal, hex, grouped and 128-bit, against snprintf() and
+ * a digit-at-a-time loop for the 128-bit values.
+ */
+static void bench_integers(void)
+{
+    const int64_t count = 4 * 1024 * 1024;
+    uint64_t *values = malloc(sizeof(uint64_t) * count);
+    for (int64_t i = 0; i < count; i++) {
+        uint64_t random = next_random();
+        values[i] = random >> (random % 64);
+    }
+
+    Str out;
+    str_init(&out);
+    char text[64];
+
+    double start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_uint(&out, values[i]);
+    }
+
+    report_latency("decimal, str_append_uint", now() - start, count);
+    int64_t length = out.length;
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        int n = snprintf(text, sizeof(text), "%llu", (unsigned long long) values[i]);
+        str_append_str(&out, text, n);
+    }
+
+    report_latency("decimal, snprintf", now() - start, count);
+    if (out.length != length) {
+        printf("  lengths differ\n");
+    }
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_uint_base(&out, values[i], 16, false);
+    }
+
+    report_latency("hex, str_append_uint_base", now() - start, count);
+    length = out.length;
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        int n = snprintf(text, sizeof(text), "%llx", (unsigned long long) values[i]);
+        str_append_str(&out, text, n);
+    }
+
+    report_latency("hex, snprintf", now() - start, count);
+    if (out.length != length) {
+        printf("  lengths differ\n");
+    }
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_uint_base(&out, values[i], 36, false);
+    }
+
+    report_latency("base 36, str_append_uint_base", now() - start, count);
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_uint_grouped(&out, values[i], ',');
+    }
+
+    report_latency("grouped, str_append_uint_grouped", now() - start, count);
+    length = out.length;
+
+    /* printf groups only with a locale; insert the separators into its output instead */
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        int n = snprintf(text, sizeof(text), "%llu", (unsigned long long) values[i]);
+        for (int d = 0; d < n; d++) {
+            if (d > 0 && (n - d) % 3 == 0) {
+                str_append_char(&out, ',');
+            }
+            str_append_char(&out, text[d]);
+        }
+    }
+
+    report_latency("grouped, snprintf + separators", now() - start, count);
+    if (out.length != length) {
+        printf("  lengths differ\n");
+    }
+
+#ifdef __SIZEOF_INT128__
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        str_append_uint128(&out, (StrUInt128) values[i] << 64 | values[count - 1 - i]);
+    }
+
+    report_latency("128-bit, str_append_uint128", now() - start, count);
+    length = out.length;
+
+    str_set_length(&out, 0);
+    start = now();
+    for (int64_t i = 0; i < count; i++) {
+        StrUInt128 value = (StrUInt128) values[i] << 64 | values[count - 1 - i];
+        int n = sizeof(text);
+        do {
+            text[--n] = (char) ('0' + (int) (value % 10));
+            value /= 10;
+        } while (value > 0);
+        str_append_str(&out, text + n, (int64_t) sizeof(text) - n);
+    }
+
+    report_latency("128-bit, digit loop", now() - start, count);
+    if (out.length != length) {
+        printf("  lengths differ\n");
+    }
+#endif
+
+    str_finalize(&out);
+    free(values);
+}
+
+/**
+ * Builds a 64 MB string from the English corpus in 4 KB appends and reads its digests, once by hashing the
+ * finished string and once with the digest fed from the append path.
+ */
+static void bench_digest(const Str *english)
+{
+    const int64_t chunk = 4096;
+    const int64_t total = 64 * 1024 * 1024;
+    int64_t source = english->length - chunk;
+
+    Str str;
+    str_init(&str);
+
+    double start = now();
+    for (int64_t i = 0; i < total; i += chunk) {
+        str_append_str(&str, english->value + i % source, chunk);
+    }
+
+    StrDigest digest;
+    str_digest_init(&digest, &str);
+    uint32_t crc32 = str_digest_crc32(&digest);
+    report_throughput("build then hash", now() - start, total);
+
+    str_set_length(&str, 0);
+
+    start = now();
+    str_digest_init(&digest, &str);
+    for (int64_t i = 0; i < total; i += chunk) {
+        str_digest_append(&digest, english->value + i % source, chunk);
+    }
+
+    if (str_digest_crc32(&digest) != crc32) {
+        printf("  digests differ\n");
+    }
+
+    report_throughput("build with str_digest_append", now() - start, total);
+
+    /* With nothing appended since, a read only compares the generation and the length */
+    start = now();
+    for (int64_t i = 0; i < 1000000; i++) {
+        str_digest_crc32(&digest);
+    }
+
+    report_latency("digest read", now() - start, 1000000);
+
+    str_finalize(&str);
+}
+
+/**
+ * Writes a snapshot of 100 million one-byte entries and times opening it and reading entries at random.
+ * Opening only checks the header, so it must not depend on the number of entries.
+ */
+static void bench_collection(void)
+{
+    const int64_t count = 100000000;
+    char path[] = "/tmp/bench_str_XXXXXX";
+
+    int fd = mkstemp(path);
+    Str *strs = malloc(sizeof(Str) * count);
+    if (fd < 0 || strs == NULL) {
+        printf("%-40s %10s\n", "collection open (100M entries)", "skipped");
+        free(strs);
+        return;
+    }
+
+    /* The entries share 26 one-letter strings */
+    static char letters[] = "a\0b\0c\0d\0e\0f\0g\0h\0i\0j\0k\0l\0m\0n\0o\0p\0q\0r\0s\0t\0u\0v\0w\0x\0y\0z";
+    for (int64_t i = 0; i < count; i++) {
+        strs[i] = (Str) {letters + 2 * (i % 26), 2, 1, 0};
+    }
+
+    bool written = str_collection_write(fd, strs, count);
+    free(strs);
+    close(fd);
+
+    StrCollection collection;
+    double start = now();
+    bool opened = written && str_collection_open(&collection, path);
+    report_latency("collection open (100M entries)", now() - start, 1);
+
+    if (opened) {
+        int64_t found = 0;
+        StrSlice entry;
+
+        start = now();
+        for (int64_t i = 0; i < 1000000; i++) {
+            found += str_collection_get(&collection, (int64_t) (next_random() % count), &entry);
+        }
+
+        report_latency("collection get, random", now() - start, 1000000);
+        if (found != 1000000) {
+            printf("  %lld entries not found\n", (long long) (1000000 - found));
+        }
+
+        str_collection_close(&collection);
+    }
+
+    unlink(path);
+}
+
+/**
+ * Formats a million report rows of a name, a count and a status, with printf padding and with the padded
+ * appends.
+ */
+static void bench_padding(void)
+{
+    const int64_t rows = 1000000;
+    static const char *const statuses[] = {"ok", "failed", "skipped"};
+    Str report;
+    str_init(&report);
+
+    double start = now();
+    for (int64_t i = 0; i < rows; i++) {
+        str_append_format(&report, "%-20s %10lld %8s\n", words[i % 64], (long long) (i * 7919),
+                          statuses[i % 3]);
+    }
+
+    int64_t length = report.length;
+    report_throughput("padded row, str_append_format", now() - start, length);
+
+    str_set_length(&report, 0);
+    start = now();
+    for (int64_t i = 0; i < rows; i++) {
+        str_append_padded(&report, words[i % 64], -1, 20, STR_ALIGN_LEFT, ' ');
+        str_append_char(&report, ' ');
+        str_append_int_padded(&report, i * 7919, 10, STR_ALIGN_RIGHT, ' ');
+        str_append_char(&report, ' ');
+        str_append_padded(&report, statuses[i % 3], -1, 8, STR_ALIGN_RIGHT, ' ');
+        str_append_char(&report, '\n');
+    }
+
+    report_throughput("padded row, padded appends", now() - start, length);
+
+    static const StrColumn columns[3] = {{20, STR_ALIGN_LEFT, ' '}, {10, STR_ALIGN_RIGHT, ' '},
+                                         {8, STR_ALIGN_RIGHT, ' '}};
+    Str number;
+    str_init(&number);
+
+    str_set_length(&report, 0);
+    start = now();
+    for (int64_t i = 0; i < rows; i++) {
+        str_set_length(&number, 0);
+        str_append_int(&number, i * 7919);
+
+        StrSlice cells[3] = {{words[i % 64], (int64_t) strlen(words[i % 64])}, {number.value, number.length},
+                             {statuses[i % 3], (int64_t) strlen(statuses[i % 3])}};
+        str_append_row(&report, columns, cells, 3, " ", 1);
+        str_append_char(&report, '\n');
+    }
+
+    report_throughput("padded row, str_append_row", now() - start, length);
+    if (report.length != length) {
+        printf("  lengths differ: %lld and %lld\n", (long long) length, (long long) report.length);
+    }
+
+    str_finalize(&number);
+    str_finalize(&report);
+}
+
+/**
+ * Returns the resident set size of the process, or 0 where /proc is not available.
+ */
+static int64_t resident_bytes(void)
+{
+    long long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm != NULL) {
+        if (fscanf(statm, "%*s %lld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+
+    return (int64_t) pages * sysconf(_SC_PAGESIZE);
+}
+
+static void append_export_row(Str *out, int64_t i)
+{
+    str_append_uint(out, (uint64_t) i);
+    str_append_char(out, ',');
+    str_append_str(out, words[i % 64], -1);
+    str_append_char(out, ',');
+    str_append_int(out, i * 7919 % 1000003 - 500000);
+    str_append_char(out, '\n');
+}
+
+/**
+ * Exports 8 million CSV rows to /dev/null by building the whole output in a Str first, and through a StrWriter
+ * with a 64 KB watermark, synchronous and double-buffered. Reports the throughput and the growth of the RSS.
+ */
+static void bench_writer(void)
+{
+    const int64_t rows = 8 * 1024 * 1024;
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    int64_t resident = resident_bytes();
+    double start = now();
+    Str whole;
+    str_init(&whole);
+    for (int64_t i = 0; i < rows; i++) {
+        append_export_row(&whole, i);
+    }
+
+    if (write(fd, whole.value, whole.length) != whole.length) {
+        printf("  write failed\n");
+    }
+
+    int64_t length = whole.length;
+    report_throughput("export, whole Str then write", now() - start, length);
+    printf("%-40s %10.1f MB\n", "  RSS growth", (resident_bytes() - resident) / 1e6);
+    str_finalize(&whole);
+
+    for (int background = 0; background <= 1; background++) {
+#ifndef STR_HAVE_THREADS
+        if (background) {
+            break;
+        }
+#endif
+        StrWriter writer;
+        resident = resident_bytes();
+        start = now();
+        str_writer_init(&writer, fd, 64 * 1024, background);
+        for (int64_t i = 0; i < rows; i++) {
+            append_export_row(&writer.buffer, i);
+            str_writer_poll(&writer);
+        }
+
+        str_writer_flush(&writer);
+        report_throughput(background ? "export, StrWriter double-buffered" : "export, StrWriter", now() - start,
+                          writer.bytes_written);
+        printf("%-40s %10.1f MB\n", "  RSS growth", (resident_bytes() - resident) / 1e6);
+        printf("%-40s %10.1f us\n", "  mean flush latency", writer.flush_time_ns / 1e3 / writer.flush_count);
+        printf("%-40s %10.1f us\n", "  max flush latency", writer.max_flush_time_ns / 1e3);
+        if (writer.bytes_written != length) {
+            printf("  lengths differ: %lld and %lld\n", (long long) length, (long long) writer.bytes_written);
+        }
+
+        str_writer_finalize(&writer);
+    }
+
+    close(fd);
+}
+
+/**
+ * Streams the English text through a 64 KB ring in 4 KB reads and splits it into sentences, with the mirrored
+ * buffer and with the compacting fallback.
+ */
+static int64_t split_sentences_through_ring(StrRing *ring, const Str *english)
+{
+    int64_t sentences = 0;
+    int64_t offset = 0;
+
+    while (offset < english->length || ring->length > 0) {
+        int64_t available;
+        char *tail = str_ring_reserve(ring, &available);
+        int64_t n = english->length - offset;
+        if (n > available) {
+            n = available;
+        }
+        if (n > 4096) {
+            n = 4096;
+        }
+
+        memcpy(tail, english->value + offset, n);
+        str_ring_produce(ring, n);
+        offset += n;
+
+        int64_t end;
+        while ((end = str_ring_indexof_str(ring, ".", 1)) >= 0) {
+            str_ring_consume(ring, end + 1);
+            sentences++;
+        }
+
+        if (offset == english->length) {
+            str_ring_consume(ring, ring->length);
+        }
+    }
+
+    return sentences;
+}
+
+static void bench_ring(const Str *english)
+{
+    StrRing ring;
+    if (!str_ring_init(&ring, 64 * 1024)) {
+        return;
+    }
+
+    double start = now();
+    int64_t sentences = split_sentences_through_ring(&ring, english);
+    report_throughput(ring.mirrored ? "ring sentences, mirrored" : "ring sentences, compacting", now() - start,
+                      english->length);
+    str_ring_finalize(&ring);
+
+    ring.value = malloc(64 * 1024);
+    if (ring.value == NULL) {
+        return;
+    }
+
+    ring.size = 64 * 1024;
+    ring.start = 0;
+    ring.length = 0;
+    ring.mirrored = false;
+
+    start = now();
+    if (split_sentences_through_ring(&ring, english) != sentences) {
+        printf("  sentence counts differ\n");
+    }
+
+    report_throughput("ring sentences, compacting", now() - start, english->length);
+    str_ring_finalize(&ring);
+}
+
+int main(void)
+{
+    Str english;
+    str_init(&english);
+    append_english(&english, 16 * 1024 * 1024);
+
+    Str mixed;
+    str_init(&mixed);
+    append_mixed(&mixed, 16 * 1024 * 1024);
+
+    bench_byteset(&mixed);
+    bench_matcher(&english);
+    bench_tokenizer("English", &english);
+    bench_tokenizer("mixed", &mixed);
+    bench_diff();
+    bench_natural_sort();
+    bench_sketch(&english);
+    bench_lsh();
+    bench_checksums(&english);
+    bench_lz4(&mixed);
+    bench_timestamp_format();
+    bench_timestamp_parse();
+    bench_translate(&mixed);
+    bench_reverse(&mixed);
+    bench_hexdump(&english);
+    bench_integers();
+    bench_digest(&english);
+    bench_binary_appends();
+    bench_reader();
+#ifdef STR_HAVE_THREADS
+    bench_logger();
+    bench_concurrent_buffer();
+#endif
+    bench_collection();
+    bench_padding();
+    bench_writer();
+    bench_ring(&english);
+
+    str_finalize(&mixed);
+    str_finalize(&english);
+    return 0;
+}
@@ -0,0 +1,2850 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "str.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static int failures;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                              \
+        }                                                                            \
+    } while (0)
+
+static int64_t find_any_reference(const char *s, int64_t length, int64_t offset, const char *set, int64_t set_length,
+                                  bool present)
+{
+    for (int64_t i = offset; i < length; i++) {
+        if ((memchr(set, s[i], set_length) != NULL) == present) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void test_byteset(void)
+{
+    /* Sets with a NUL, high bytes and bytes in the same nibble rows, across the vector widths */
+    static const struct { const char *set; int64_t length; } sets[] = {
+        {"", 0}, {"a", 1}, {" \t\r\n", 4}, {"\0x", 2}, {"\x80\xff\x7f", 3}, {"0123456789", 10},
+        {"AQaq!1", 6}, {"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", 52},
+    };
+
+    static const char alphabet[] = "abc xyz\t\n0129AQ!\x80\xff\x7f";
+    char data[300];
+    for (int i = 0; i < (int) sizeof(data); i++) {
+        data[i] = alphabet[(i * 7 + i / 13) % (sizeof(alphabet) - 1)];
+    }
+
+    Str str = {data, sizeof(data), 0, 0};
+
+    for (int i = 0; i < (int) (sizeof(sets) / sizeof(sets[0])); i++) {
+        for (int64_t length = 0; length <= (int64_t) sizeof(data); length += 37) {
+            str.length = length;
+
+            for (int64_t offset = 0; offset <= length; offset += 11) {
+                const char *set = sets[i].set;
+                int64_t set_length = sets[i].length;
+                int64_t any = find_any_reference(data, length, offset, set, set_length, true);
+                int64_t not_any = find_any_reference(data, length, offset, set, set_length, false);
+
+                CHECK(str_find_any(&str, offset, set, set_length) == any);
+                CHECK(str_find_not_any(&str, offset, set, set_length) == not_any);
+                CHECK(str_span(&str, offset, set, set_length) == (not_any < 0 ? length : not_any) - offset);
+                CHECK(str_cspan(&str, offset, set, set_length) == (any < 0 ? length : any) - offset);
+            }
+        }
+    }
+
+    /* A negative set length reads a NUL-terminated set */
+    Str text = {"key = value", 12, 11, 0};
+    CHECK(str_find_any(&text, 0, " =", -1) == 3);
+    CHECK(str_span(&text, 3, " =", -1) == 3);
+    CHECK(str_find_not_any(&text, 0, "aekluvy =", -1) == -1);
+}
+
+/**
+ * Checks every line and a spread of offsets of the indexed text against a scan of the text.
+ */
+static void check_line_index(const StrLineIndex *index, const Str *text)
+{
+    int64_t line = 0;
+    int64_t start = 0;
+
+    for (int64_t i = 0; i <= text->length; i++) {
+        if (i % 7 == 0 || i == text->length) {
+            CHECK(str_line_index_find_line(index, text, i) == line);
+        }
+
+        if (i == text->length || text->value[i] == '\n') {
+            StrSlice slice;
+            CHECK(str_line_index_get_line(index, text, line, &slice));
+            CHECK(slice.value == text->value + start && slice.length == i - start);
+
+            line++;
+            start = i + 1;
+        }
+    }
+
+    CHECK(index->line_count == line);
+
+    StrSlice slice;
+    CHECK(!str_line_index_get_line(index, text, line, &slice));
+    CHECK(!str_line_index_get_line(index, text, -1, &slice));
+    CHECK(str_line_index_find_line(index, text, text->length + 1) == -1);
+}
+
+static void test_line_index(void)
+{
+    Str text;
+    StrLineIndex index;
+    str_init(&text);
+    CHECK(str_line_index_init(&index));
+
+    /* An empty string has one empty line */
+    CHECK(str_line_index_update(&index, &text));
+    check_line_index(&index, &text);
+
+    /* 1000 lines of varying length, some empty, indexed in chunks that split lines */
+    Str all;
+    str_init(&all);
+    for (int i = 0; i < 1000; i++) {
+        str_append_padded(&all, "", 0, i % 17, STR_ALIGN_LEFT, 'x');
+        if (i % 5 != 0) {
+            str_append_int(&all, i);
+        }
+
+        str_append_char(&all, '\n');
+    }
+
+    for (int64_t offset = 0; offset < all.length;) {
+        int64_t chunk = 1 + offset % 251;
+        if (chunk > all.length - offset) {
+            chunk = all.length - offset;
+        }
+
+        str_append_str(&text, all.value + offset, chunk);
+        offset += chunk;
+
+        CHECK(str_line_index_update(&index, &text));
+        if (offset % 4 == 0 || offset == all.length) {
+            check_line_index(&index, &text);
+        }
+    }
+
+    CHECK(index.line_count == 1001);
+
+    /* A truncated string is indexed again from the start */
+    CHECK(str_set_length(&text, 3000));
+    CHECK(str_line_index_update(&index, &text));
+    check_line_index(&index, &text);
+
+    str_finalize(&all);
+    str_finalize(&text);
+    str_line_index_finalize(&index);
+}
+
+static void test_matcher(void)
+{
+    static const char *const needles[] = {"a", "ab", "aab", "abab", "aaa", "babba"};
+
+    /* A two-letter text has many partial, overlapping matches */
+    char text[2000];
+    uint64_t state = 12345;
+    for (int i = 0; i < (int) sizeof(text); i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        text[i] = (state >> 62) ? 'a' : 'b';
+    }
+
+    for (int i = 0; i < (int) (sizeof(needles) / sizeof(needles[0])); i++) {
+        const char *needle = needles[i];
+        int64_t length = (int64_t) strlen(needle);
+        StrMatcher matcher;
+        CHECK(str_matcher_init(&matcher, needle, -1));
+
+        Str str;
+        str_init(&str);
+
+        /* The matches, left to right and not overlapping */
+        int64_t matches[sizeof(text)];
+        int64_t count = 0;
+        for (int64_t j = 0; j + length <= (int64_t) sizeof(text); j++) {
+            if (memcmp(text + j, needle, length) == 0) {
+                matches[count++] = j;
+                j += length - 1;
+            }
+        }
+
+        /* Each match is reported once the append that completes it is scanned */
+        int64_t k = 0;
+        for (int64_t offset = 0; offset < (int64_t) sizeof(text);) {
+            int64_t chunk = 1 + (offset * 7 + i) % 13;
+            if (chunk > (int64_t) sizeof(text) - offset) {
+                chunk = (int64_t) sizeof(text) - offset;
+            }
+
+            str_append_str(&str, text + offset, chunk);
+            offset += chunk;
+
+            while (k < count && matches[k] + length <= str.length) {
+                CHECK(str_matcher_next(&matcher, &str) == matches[k]);
+                k++;
+            }
+
+            CHECK(str_matcher_next(&matcher, &str) == -1);
+        }
+
+        CHECK(k == count);
+
+        /* A truncated string is searched again from the start */
+        str_set_length(&str, matches[0] + length);
+        CHECK(str_matcher_next(&matcher, &str) == matches[0]);
+
+        str_finalize(&str);
+        str_matcher_finalize(&matcher);
+    }
+
+    StrMatcher matcher;
+    CHECK(!str_matcher_init(&matcher, "", 0));
+}
+
+static bool encodes_to(const Str *str, const char *expected, int64_t length)
+{
+    return str->length == length && memcmp(str->value, expected, length) == 0;
+}
+
+static void test_binary_appends(void)
+{
+    Str str;
+    str_init(&str);
+
+    static const struct { uint64_t value; const char *encoded; int length; } varints[] = {
+        {0, "\x00", 1}, {1, "\x01", 1}, {127, "\x7f", 1}, {128, "\x80\x01", 2}, {300, "\xac\x02", 2},
+        {16383, "\xff\x7f", 2}, {16384, "\x80\x80\x01", 3}, {UINT32_MAX, "\xff\xff\xff\xff\x0f", 5},
+        {UINT64_MAX, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 10},
+    };
+
+    for (int i = 0; i < (int) (sizeof(varints) / sizeof(varints[0])); i++) {
+        str_set_length(&str, 0);
+        CHECK(str_append_varint(&str, varints[i].value));
+        CHECK(encodes_to(&str, varints[i].encoded, varints[i].length));
+
+        const char *cursor = str.value;
+        uint64_t value;
+        CHECK(str_decode_varint(&cursor, str.value + str.length, &value) && value == varints[i].value);
+        CHECK(cursor == str.value + str.length);
+
+        /* Every truncation is rejected and leaves the cursor alone */
+        cursor = str.value;
+        CHECK(!str_decode_varint(&cursor, str.value + str.length - 1, &value) && cursor == str.value);
+    }
+
+    /* Zigzag interleaves the signs */
+    static const int64_t signed_values[] = {0, -1, 1, -2, 2, 63, -64, 64, INT64_MAX, INT64_MIN};
+    static const uint64_t zigzagged[] = {0, 1, 2, 3, 4, 126, 127, 128, UINT64_MAX - 1, UINT64_MAX};
+
+    for (int i = 0; i < (int) (sizeof(signed_values) / sizeof(signed_values[0])); i++) {
+        str_set_length(&str, 0);
+        CHECK(str_append_zigzag(&str, signed_values[i]));
+
+        const char *cursor = str.value;
+        uint64_t raw;
+        int64_t value;
+        CHECK(str_decode_varint(&cursor, str.value + str.length, &raw) && raw == zigzagged[i]);
+        cursor = str.value;
+        CHECK(str_decode_zigzag(&cursor, str.value + str.length, &value) && value == signed_values[i]);
+    }
+
+    /* An eleventh byte, or a tenth byte above 1, does not fit 64 bits */
+    const char *cursor = "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x02";
+    uint64_t value;
+    CHECK(!str_decode_varint(&cursor, cursor + 10, &value));
+    cursor = "\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x00";
+    CHECK(!str_decode_varint(&cursor, cursor + 11, &value));
+
+    /* Fixed widths in both byte orders */
+    str_set_length(&str, 0);
+    CHECK(str_append_u16le(&str, 0x1234) && str_append_u16be(&str, 0x1234));
+    CHECK(str_append_u32le(&str, 0x12345678) && str_append_u32be(&str, 0x12345678));
+    CHECK(str_append_u64le(&str, 0x0123456789ABCDEFULL) && str_append_u64be(&str, 0x0123456789ABCDEFULL));
+    CHECK(encodes_to(&str, "\x34\x12\x12\x34\x78\x56\x34\x12\x12\x34\x56\x78"
+                           "\xef\xcd\xab\x89\x67\x45\x23\x01\x01\x23\x45\x67\x89\xab\xcd\xef", 28));
+
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+    cursor = str.value;
+    const char *end = str.value + str.length;
+    CHECK(str_decode_u16le(&cursor, end, &u16) && u16 == 0x1234);
+    CHECK(str_decode_u16be(&cursor, end, &u16) && u16 == 0x1234);
+    CHECK(str_decode_u32le(&cursor, end, &u32) && u32 == 0x12345678);
+    CHECK(str_decode_u32be(&cursor, end, &u32) && u32 == 0x12345678);
+    CHECK(str_decode_u64le(&cursor, end, &u64) && u64 == 0x0123456789ABCDEFULL);
+    CHECK(!str_decode_u64be(&cursor, end - 1, &u64));
+    CHECK(str_decode_u64be(&cursor, end, &u64) && u64 == 0x0123456789ABCDEFULL);
+    CHECK(cursor == end && !str_decode_u16le(&cursor, end, &u16));
+
+    str_finalize(&str);
+}
+
+static void test_reader(void)
+{
+    /* A message: a type, a length-prefixed name, a signed delta and a trailer */
+    Str message;
+    str_init(&message);
+    str_append_u16be(&message, 0xBEEF);
+    str_append_varint(&message, 5);
+    str_append_str(&message, "hello", 5);
+    str_append_zigzag(&message, -300);
+    str_append_u32le(&message, 0xDEADBEEF);
+    str_append_u64be(&message, 42);
+    str_append_char(&message, 0x7F);
+
+    StrReader reader;
+    str_reader_init(&reader, &message);
+    CHECK(str_reader_remaining(&reader) == message.length);
+
+    uint16_t type;
+    uint64_t length;
+    StrSlice name = {NULL, 0};
+    int64_t delta;
+    uint32_t trailer;
+    uint64_t sequence;
+    uint8_t last;
+
+    CHECK(str_reader_read_u16be(&reader, &type) && type == 0xBEEF);
+    CHECK(str_reader_read_varint(&reader, &length) && length == 5);
+    CHECK(str_reader_read_bytes(&reader, (int64_t) length, &name));
+    CHECK(name.value == message.value + 3 && name.length == 5 && memcmp(name.value, "hello", 5) == 0);
+    CHECK(str_reader_read_zigzag(&reader, &delta) && delta == -300);
+    CHECK(str_reader_read_u32le(&reader, &trailer) && trailer == 0xDEADBEEF);
+
+    /* Failed reads leave the reader where it was */
+    const char *position = reader.position;
+    CHECK(!str_reader_skip(&reader, 10));
+    CHECK(!str_reader_skip(&reader, -1));
+    CHECK(!str_reader_read_bytes(&reader, 10, &name));
+    CHECK(reader.position == position);
+
+    CHECK(str_reader_has(&reader, 9) && !str_reader_has(&reader, 10));
+    sequence = str_reader_read_u64be_unchecked(&reader);
+    last = str_reader_read_u8_unchecked(&reader);
+    CHECK(sequence == 42 && last == 0x7F);
+
+    CHECK(str_reader_remaining(&reader) == 0);
+    CHECK(!str_reader_read_u8(&reader, &last));
+    CHECK(!str_reader_read_varint(&reader, &length));
+    CHECK(str_reader_skip(&reader, 0));
+
+    /* The unchecked reads agree with the checked ones in both byte orders */
+    str_set_length(&message, 0);
+    str_append_u16le(&message, 0x0102);
+    str_append_u32le(&message, 0x03040506);
+    str_append_u64le(&message, 0x0708090A0B0C0D0EULL);
+    str_append_u16be(&message, 0x0102);
+    str_append_u32be(&message, 0x03040506);
+    str_append_u64be(&message, 0x0708090A0B0C0D0EULL);
+
+    str_reader_init_str(&reader, message.value, message.length);
+    CHECK(str_reader_read_u16le_unchecked(&reader) == 0x0102);
+    CHECK(str_reader_read_u32le_unchecked(&reader) == 0x03040506);
+    CHECK(str_reader_read_u64le_unchecked(&reader) == 0x0708090A0B0C0D0EULL);
+    CHECK(str_reader_read_u16be_unchecked(&reader) == 0x0102);
+    CHECK(str_reader_read_u32be_unchecked(&reader) == 0x03040506);
+    CHECK(str_reader_read_u64be_unchecked(&reader) == 0x0708090A0B0C0D0EULL);
+    CHECK(str_reader_remaining(&reader) == 0);
+
+    str_finalize(&message);
+}
+
+static bool append_vformat(Str *str, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    bool result = str_append_vformat(str, format, args);
+    va_end(args);
+    return result;
+}
+
+static void test_format(void)
+{
+    Str str;
+    str_init(&str);
+
+    /* Fits the initial capacity, then needs a second pass over the same arguments to grow */
+    CHECK(str_append_format(&str, "%d-%s", 42, "ok"));
+    CHECK(strcmp(str.value, "42-ok") == 0);
+    CHECK(str_append_format(&str, " %s %d %s %lld", "a longer argument", -7, "than fits", 1234567890123LL));
+    CHECK(strcmp(str.value, "42-ok a longer argument -7 than fits 1234567890123") == 0);
+
+    str_set_length(&str, 0);
+    CHECK(append_vformat(&str, "%s|%s|%s", "first argument", "second argument", "third"));
+    CHECK(strcmp(str.value, "first argument|second argument|third") == 0);
+
+    /* An empty format appends nothing */
+    CHECK(str_append_format(&str, "%s", ""));
+    CHECK(str.length == 36);
+
+    str_finalize(&str);
+}
+
+static void test_indexof(void)
+{
+    Str empty = {"", 1, 0, 0};
+    Str text = {"aab", 4, 3, 0};
+    Str longer = {"xaxaxab xab", 12, 11, 0};
+
+    /* Overlapping candidates: the scan resumes one byte after a failed one */
+    CHECK(str_indexof_str(&text, "ab", -1) == 1);
+    CHECK(str_indexof_str(&longer, "xab", -1) == 4);
+    CHECK(str_indexof_str(&longer, "axab", -1) == 3);
+
+    /* The needle at the very end, and one byte past it */
+    CHECK(str_indexof_str(&text, "b", -1) == 2);
+    CHECK(str_indexof_str(&text, "abc", -1) == -1);
+    CHECK(str_indexof_str(&text, "aabb", -1) == -1);
+
+    /* Only the empty needle is found in an empty haystack */
+    CHECK(str_indexof_str(&empty, "abc", -1) == -1);
+    CHECK(str_indexof_str(&empty, "", 0) == 0);
+    CHECK(str_indexof_str(&text, "", 0) == 0);
+
+#ifdef STR_HAVE_POSIX
+    StrRing ring;
+    CHECK(str_ring_init(&ring, 64));
+    CHECK(str_ring_indexof_str(&ring, "ab", -1) == -1);
+    CHECK(str_ring_append(&ring, "aab", 3));
+    CHECK(str_ring_indexof_str(&ring, "ab", -1) == 1);
+    str_ring_finalize(&ring);
+#endif
+}
+
+#ifdef STR_HAVE_POSIX
+/**
+ * Drives the ring with random appends, reserved writes and consumes, checking its readable bytes against a
+ * plain array after every step.
+ */
+static void exercise_ring(StrRing *ring)
+{
+    static char reference[1 << 16];
+    int64_t reference_length = 0;
+    uint32_t seed = 7;
+    int64_t produced = 0;
+
+    for (int step = 0; step < 20000; step++) {
+        seed = seed * 1103515245 + 12345;
+        int64_t n = (seed >> 16) % (ring->size / 3 + 1);
+        char chunk[1 << 14];
+
+        for (int64_t i = 0; i < n; i++) {
+            chunk[i] = (char) ('a' + (produced + i) % 26);
+        }
+
+        switch ((seed >> 8) % 3) {
+        case 0: {
+            bool fits = reference_length + n <= ring->size;
+            bool appended = str_ring_append(ring, chunk, n);
+            /* Without the mirror, the bytes are compacted to make room: only a full ring rejects an append */
+            CHECK(appended == fits);
+            if (appended) {
+                memcpy(reference + reference_length, chunk, n);
+                reference_length += n;
+                produced += n;
+            }
+            break;
+        }
+        case 1: {
+            int64_t available;
+            char *tail = str_ring_reserve(ring, &available);
+            CHECK(available >= 0 && available <= ring->size - reference_length);
+            if (n > available) {
+                n = available;
+            }
+            memcpy(tail, chunk, n);
+            CHECK(str_ring_produce(ring, n));
+            memcpy(reference + reference_length, chunk, n);
+            reference_length += n;
+            produced += n;
+            break;
+        }
+        default:
+            if (n > reference_length) {
+                CHECK(!str_ring_consume(ring, reference_length + 1));
+                n = reference_length;
+            }
+            CHECK(str_ring_consume(ring, n));
+            memmove(reference, reference + n, reference_length - n);
+            reference_length -= n;
+            break;
+        }
+
+        StrSlice slice = str_ring_peek(ring);
+        CHECK(slice.length == reference_length && memcmp(slice.value, reference, reference_length) == 0);
+    }
+}
+
+/**
+ * Checks the ring with an element straddling the end of the buffer, and the bounds of produce and consume.
+ */
+static void check_ring_bounds(StrRing *ring)
+{
+    int64_t available;
+    char *tail = str_ring_reserve(ring, &available);
+
+    CHECK(!str_ring_produce(ring, available + 1));
+    CHECK(!str_ring_produce(ring, -1));
+    CHECK(ring->length == 0);
+
+    memset(tail, 'x', available - 2);
+    CHECK(str_ring_produce(ring, available - 2));
+    CHECK(str_ring_consume(ring, available - 4));
+
+    /* Two bytes remain before the end of the buffer: with the mirror, the needle is written across it */
+    CHECK(str_ring_append(ring, "needle", 6));
+    CHECK(str_ring_indexof_str(ring, "needle", -1) == 2);
+    CHECK(str_ring_indexof_str(ring, "xneedle", -1) == 1);
+    CHECK(str_ring_indexof_str(ring, "needles", -1) == -1);
+
+    CHECK(!str_ring_consume(ring, ring->length + 1));
+    CHECK(!str_ring_consume(ring, -1));
+    CHECK(str_ring_consume(ring, ring->length));
+    CHECK(ring->length == 0 && ring->start == 0);
+    CHECK(str_ring_indexof_str(ring, "x", 1) == -1);
+}
+
+static void test_ring(void)
+{
+    StrRing ring;
+
+    CHECK(str_ring_init(&ring, 4096));
+    CHECK(ring.size >= 4096);
+    exercise_ring(&ring);
+    CHECK(str_ring_consume(&ring, ring.length));
+    check_ring_bounds(&ring);
+    str_ring_finalize(&ring);
+
+    /* The compacting fallback, used when the mirror cannot be mapped, over a size that is not a page multiple */
+    ring.value = malloc(1000);
+    ring.size = 1000;
+    ring.start = 0;
+    ring.length = 0;
+    ring.mirrored = false;
+    CHECK(ring.value != NULL);
+    exercise_ring(&ring);
+    CHECK(str_ring_consume(&ring, ring.length));
+    check_ring_bounds(&ring);
+    str_ring_finalize(&ring);
+    CHECK(ring.value == NULL);
+}
+#endif
+
+static void test_checksums(void)
+{
+    static const char check[] = "123456789";
+
+    CHECK(str_crc32_update(0, check, 9) == 0xCBF43926);
+    CHECK(str_crc32c_update(0, check, 9) == 0xE3069283);
+    CHECK(str_adler32_update(1, "Wikipedia", 9) == 0x11E60398);
+    CHECK(str_xxh64_str("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    CHECK(str_xxh64_str("a", 1, 0) == 0xD24EC4F1A98C6E5BULL);
+    CHECK(str_xxh64_str("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+
+    CHECK(str_crc32_update(0, "", 0) == 0);
+    CHECK(str_crc32c_update(0, "", 0) == 0);
+    CHECK(str_adler32_update(1, "", 0) == 1);
+
+    /* Long inputs take the vectorized paths; they must agree with chunked updates and combining */
+    char data[4099];
+    for (int i = 0; i < (int) sizeof(data); i++) {
+        data[i] = (char) (i * 131 + (i >> 7));
+    }
+
+    for (int64_t split = 0; split <= (int64_t) sizeof(data); split += 373) {
+        int64_t rest = sizeof(data) - split;
+
+        uint32_t crc1 = str_crc32_update(0, data, split);
+        uint32_t crc2 = str_crc32_update(0, data + split, rest);
+        CHECK(str_crc32_update(crc1, data + split, rest) == str_crc32_update(0, data, sizeof(data)));
+        CHECK(str_crc32_combine(crc1, crc2, rest) == str_crc32_update(0, data, sizeof(data)));
+
+        uint32_t crcc1 = str_crc32c_update(0, data, split);
+        uint32_t crcc2 = str_crc32c_update(0, data + split, rest);
+        CHECK(str_crc32c_update(crcc1, data + split, rest) == str_crc32c_update(0, data, sizeof(data)));
+        CHECK(str_crc32c_combine(crcc1, crcc2, rest) == str_crc32c_update(0, data, sizeof(data)));
+
+        uint32_t adler1 = str_adler32_update(1, data, split);
+        uint32_t adler2 = str_adler32_update(1, data + split, rest);
+        CHECK(str_adler32_update(adler1, data + split, rest) == str_adler32_update(1, data, sizeof(data)));
+        CHECK(str_adler32_combine(adler1, adler2, rest) == str_adler32_update(1, data, sizeof(data)));
+    }
+
+    /* Every length up to two stripes, so the tails are covered too */
+    uint64_t previous = str_xxh64_str("", 0, 0);
+    for (int64_t length = 1; length <= 64; length++) {
+        uint64_t hash = str_xxh64_str(data, length, 0);
+        CHECK(hash != previous);
+        CHECK(str_xxh64_str(data, length, 1) != hash);
+        previous = hash;
+    }
+}
+
+/**
+ * Checks that the block decompresses to the expected bytes, after the existing contents of the string.
+ */
+static bool lz4_decompresses_to(const char *block, int64_t block_length, const char *expected, int64_t length)
+{
+    Str out;
+    str_init(&out);
+    str_append_str(&out, "prefix", 6);
+
+    bool result = str_append_lz4_decompressed(&out, block, block_length, length)
+                  && out.length == 6 + length && memcmp(out.value, "prefix", 6) == 0
+                  && memcmp(out.value + 6, expected, length) == 0 && out.value[out.length] == '\0';
+
+    str_finalize(&out);
+    return result;
+}
+
+static bool lz4_round_trip(const char *s, int64_t length, int level)
+{
+    Str block;
+    str_init(&block);
+
+    bool result = str_append_lz4_compressed(&block, s, length, level)
+                  && block.length <= str_lz4_compress_bound(length)
+                  && lz4_decompresses_to(block.value, block.length, s, length);
+
+    str_finalize(&block);
+    return result;
+}
+
+static void test_lz4(void)
+{
+    static const char text[] = "The quick brown fox jumps over the lazy dog. "
+                               "The quick brown fox jumps over the lazy dog.";
+    int64_t text_length = sizeof(text) - 1;
+
+    /* Produced by the reference implementation (lz4 -12): 45 literals, a match of 39 at offset 45, 5 literals */
+    static const char reference[] = "\xff\x1e" "The quick brown fox jumps over the lazy dog. "
+                                    "\x2d\x00\x14\x50" " dog.";
+    int64_t reference_length = sizeof(reference) - 1;
+
+    CHECK(reference_length == 56);
+    CHECK(lz4_decompresses_to(reference, reference_length, text, text_length));
+
+    /* Round trips at every level, over empty, incompressible, repetitive and overlapping inputs */
+    static char data[70000];
+    uint32_t seed = 1;
+    for (int i = 0; i < (int) sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = i < 30000 ? (char) (seed >> 24) : (char) "abcab"[i % 5] ^ (char) (i / 7000);
+    }
+
+    for (int level = 0; level <= STR_LZ4_LEVEL_MAX; level += 3) {
+        CHECK(lz4_round_trip("", 0, level));
+        CHECK(lz4_round_trip("a", 1, level));
+        CHECK(lz4_round_trip(text, text_length, level));
+        CHECK(lz4_round_trip(data, sizeof(data), level));
+        CHECK(lz4_round_trip(data + 30000, 40000, level));
+
+        for (int64_t length = 1; length < 40; length++) {
+            CHECK(lz4_round_trip(data + 40000, length, level));
+        }
+    }
+
+    Str repetitive;
+    str_init(&repetitive);
+    str_append_lz4_compressed(&repetitive, data + 30000, 40000, STR_LZ4_LEVEL_FAST);
+    CHECK(repetitive.length < 40000 / 10);
+    str_finalize(&repetitive);
+
+    Str out;
+    str_init(&out);
+    str_append_str(&out, "prefix", 6);
+
+    /* The output bound is enforced */
+    CHECK(!str_append_lz4_decompressed(&out, reference, reference_length, text_length - 1));
+    CHECK(out.length == 6 && strcmp(out.value, "prefix") == 0);
+
+    /* A zero offset, and an offset reaching before the start of the output */
+    char corrupt[56];
+    memcpy(corrupt, reference, sizeof(corrupt));
+    corrupt[47] = 0;
+    CHECK(!str_append_lz4_decompressed(&out, corrupt, sizeof(corrupt), text_length));
+    corrupt[47] = 46;
+    CHECK(!str_append_lz4_decompressed(&out, corrupt, sizeof(corrupt), text_length));
+
+    /* More literals than the block holds */
+    corrupt[47] = 45;
+    corrupt[1] = 100;
+    CHECK(!str_append_lz4_decompressed(&out, corrupt, sizeof(corrupt), 1000));
+
+    /* A length extension that runs off the end of the block */
+    CHECK(!str_append_lz4_decompressed(&out, "\xf0\xff\xff", 3, 1000));
+    CHECK(!str_append_lz4_decompressed(&out, "\x1f" "a" "\x01\x00\xff", 5, 1000));
+    CHECK(out.length == 6 && strcmp(out.value, "prefix") == 0);
+
+    /* Every truncation either fails and leaves the string alone, or yields a prefix of the text */
+    for (int64_t length = 1; length < reference_length; length++) {
+        str_set_length(&out, 6);
+
+        if (str_append_lz4_decompressed(&out, reference, length, text_length)) {
+            CHECK(out.length < 6 + text_length && memcmp(out.value + 6, text, out.length - 6) == 0);
+        } else {
+            CHECK(out.length == 6 && strcmp(out.value, "prefix") == 0);
+        }
+    }
+
+    str_finalize(&out);
+}
+
+static bool timestamp_is(int64_t epoch, StrTimeUnit unit, int offset_minutes, const char *expected)
+{
+    Str out;
+    str_init(&out);
+
+    bool result = str_append_timestamp(&out, epoch, unit, offset_minutes) && strcmp(out.value, expected) == 0;
+
+    str_finalize(&out);
+    return result;
+}
+
+static bool parses_to(const char *s, int64_t expected_ns)
+{
+    int64_t epoch_ns = -1;
+    return str_parse_timestamp(s, -1, &epoch_ns) && epoch_ns == expected_ns;
+}
+
+static bool rejects(const char *s)
+{
+    int64_t epoch_ns;
+    return !str_parse_timestamp(s, -1, &epoch_ns);
+}
+
+static void test_timestamps(void)
+{
+    const int64_t second = 1000000000;
+
+    CHECK(timestamp_is(0, STR_TIME_SECONDS, 0, "1970-01-01T00:00:00Z"));
+    CHECK(timestamp_is(1709993126120, STR_TIME_MILLIS, 0, "2024-03-09T14:05:26.120Z"));
+    CHECK(timestamp_is(1709993126120, STR_TIME_MILLIS, 120, "2024-03-09T16:05:26.120+02:00"));
+    CHECK(timestamp_is(1709993126120, STR_TIME_MILLIS, -330, "2024-03-09T08:35:26.120-05:30"));
+    CHECK(timestamp_is(1709993126000001, STR_TIME_MICROS, 0, "2024-03-09T14:05:26.000001Z"));
+    CHECK(timestamp_is(-1, STR_TIME_SECONDS, 0, "1969-12-31T23:59:59Z"));
+    CHECK(timestamp_is(-1, STR_TIME_NANOS, 0, "1969-12-31T23:59:59.999999999Z"));
+    CHECK(timestamp_is(-62167219200, STR_TIME_SECONDS, 0, "0000-01-01T00:00:00Z"));
+    CHECK(timestamp_is(253402300799, STR_TIME_SECONDS, 0, "9999-12-31T23:59:59Z"));
+    CHECK(!timestamp_is(253402300800, STR_TIME_SECONDS, 0, "10000-01-01T00:00:00Z"));
+    CHECK(!timestamp_is(0, STR_TIME_SECONDS, 24 * 60, ""));
+    CHECK(!timestamp_is(INT64_MIN, STR_TIME_SECONDS, -60, ""));
+    CHECK(!timestamp_is(INT64_MAX, STR_TIME_SECONDS, 60, ""));
+
+    /* Leap days: every fourth year, except centuries not divisible by 400 */
+    CHECK(timestamp_is(951782400, STR_TIME_SECONDS, 0, "2000-02-29T00:00:00Z"));
+    CHECK(timestamp_is(1709164800, STR_TIME_SECONDS, 0, "2024-02-29T00:00:00Z"));
+    CHECK(timestamp_is(1735603200, STR_TIME_SECONDS, 0, "2024-12-31T00:00:00Z"));
+    CHECK(timestamp_is(4107542400, STR_TIME_SECONDS, 0, "2100-03-01T00:00:00Z"));
+    CHECK(parses_to("2000-02-29", 951782400 * second));
+    CHECK(parses_to("2024-02-29T00:00:00Z", 1709164800 * second));
+    CHECK(rejects("2023-02-29"));
+    CHECK(rejects("2100-02-29"));
+    CHECK(rejects("1900-02-29"));
+    CHECK(rejects("2024-02-30"));
+    CHECK(rejects("2024-04-31"));
+
+    /* Offsets, separators and fractions */
+    int64_t expected = 1709993126 * second;
+    CHECK(parses_to("2024-03-09T14:05:26Z", expected));
+    CHECK(parses_to("2024-03-09t14:05:26z", expected));
+    CHECK(parses_to("2024-03-09 14:05:26", expected));
+    CHECK(parses_to("2024-03-09T16:05:26+02:00", expected));
+    CHECK(parses_to("2024-03-09T16:05:26+0200", expected));
+    CHECK(parses_to("2024-03-09T16:05:26+02", expected));
+    CHECK(parses_to("2024-03-09T08:35:26-05:30", expected));
+    CHECK(parses_to("2024-03-10T00:05:26+10:00", expected));
+    CHECK(parses_to("2024-03-09T14:05:26.120Z", expected + 120000000));
+    CHECK(parses_to("2024-03-09T14:05:26.1Z", expected + 100000000));
+    CHECK(parses_to("2024-03-09T14:05:26.1234567891234Z", expected + 123456789));
+    CHECK(parses_to("09/Mar/2024:14:05:26 +0000", expected));
+    CHECK(parses_to("[09/Mar/2024:16:05:26 +0200]", expected));
+    CHECK(parses_to("1969-12-31T23:59:59.5Z", -second / 2));
+
+    /* Malformed input */
+    CHECK(rejects(""));
+    CHECK(rejects("2024"));
+    CHECK(rejects("2024-3-09"));
+    CHECK(rejects("2024-03-09T"));
+    CHECK(rejects("2024-03-09T14:05"));
+    CHECK(rejects("2024-03-09T14:05:26."));
+    CHECK(rejects("2024-03-09T14:05:26.Z"));
+    CHECK(rejects("2024-03-09T14:05:26Zjunk"));
+    CHECK(rejects("2024-03-09T14:05:26+2"));
+    CHECK(rejects("2024-03-09T14:05:26+02:0"));
+    CHECK(rejects("2024-03-09X14:05:26Z"));
+    CHECK(rejects("2024-00-09T14:05:26Z"));
+    CHECK(rejects("2024-13-09T14:05:26Z"));
+    CHECK(rejects("2024-03-00T14:05:26Z"));
+    CHECK(rejects("2024-03-09T24:00:00Z"));
+    CHECK(rejects("2024-03-09T14:60:00Z"));
+    CHECK(rejects("2024-03-09T14:05:61Z"));
+    CHECK(rejects("2024-03-09T14:05:26+24:00"));
+    CHECK(rejects("2024-03-09T14:05:26+02:60"));
+    CHECK(rejects("2024-03-09T14:05:26 Z"));
+    CHECK(rejects("09/Mar/2024:14:05:26"));
+    CHECK(rejects("09/Mrz/2024:14:05:26 +0000"));
+    CHECK(rejects("[09/Mar/2024:14:05:26 +0000"));
+    CHECK(rejects("1677-09-20T00:00:00Z"));
+    CHECK(rejects("2262-04-12T00:00:00Z"));
+
+    /* Round trips through the cached formatter, across month, year and leap day boundaries */
+    static const int offsets[] = {0, 60, -480, 345};
+    Str out;
+    str_init(&out);
+
+    for (int64_t epoch = -2 * 366 * 86400LL; epoch < 12 * 366 * 86400LL; epoch += 86400 * 13 + 3607) {
+        for (int i = 0; i < 4; i++) {
+            for (int64_t fraction = 0; fraction < second; fraction += 333333333) {
+                int64_t epoch_ns = epoch * second + fraction;
+                int64_t parsed = 0;
+
+                str_set_length(&out, 0);
+                CHECK(str_append_timestamp(&out, epoch_ns, STR_TIME_NANOS, offsets[i]));
+                CHECK(str_parse_timestamp(out.value, out.length, &parsed) && parsed == epoch_ns);
+            }
+        }
+    }
+
+    str_finalize(&out);
+}
+
+/**
+ * Renders pseudo-random times over years 0000-9999 at every unit and a range of offsets, and compares them with
+ * gmtime_r(). Returns the number of mismatches.
+ */
+static void *count_timestamp_mismatches(void *arg)
+{
+    uint64_t seed = (uint64_t) (uintptr_t) arg;
+    intptr_t mismatches = 0;
+    static const StrTimeUnit units[] = {STR_TIME_SECONDS, STR_TIME_MILLIS, STR_TIME_MICROS, STR_TIME_NANOS};
+    const int64_t span = 253402300800LL + 62167219200LL;
+    Str out;
+    str_init(&out);
+
+    for (int i = 0; i < 20000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t draw = seed >> 16;
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+        StrTimeUnit unit = units[draw % 4];
+        int offset = (int) (draw / 4 % 2879) - 1439;
+        int64_t scale = 1;
+        for (int digits = 0; digits < (int) unit; digits++) {
+            scale *= 10;
+        }
+
+        /* In nanoseconds, int64_t spans only 1677-2262 */
+        uint64_t range = unit == STR_TIME_NANOS ? 18000000000ULL : (uint64_t) span;
+        int64_t seconds = (int64_t) ((seed >> 8) % range) - (unit == STR_TIME_NANOS ? 9000000000LL : 62167219200LL);
+        int64_t fraction = (int64_t) (draw / 4 / 2879 % (uint64_t) scale);
+
+        int64_t local = seconds + offset * 60;
+        time_t t = (time_t) local;
+        struct tm tm;
+        str_set_length(&out, 0);
+        bool appended = str_append_timestamp(&out, seconds * scale + fraction, unit, offset);
+
+        if (local < -62167219200LL || local > 253402300799LL) {
+            mismatches += appended;
+            continue;
+        }
+
+        if (gmtime_r(&t, &tm) == NULL) {
+            continue;
+        }
+
+        char expected[64];
+        int length = snprintf(expected, sizeof(expected), "%04d-%02d-%02dT%02d:%02d:%02d", tm.tm_year + 1900,
+                              tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        if (unit != STR_TIME_SECONDS) {
+            length += snprintf(expected + length, sizeof(expected) - length, ".%0*lld", (int) unit,
+                               (long long) fraction);
+        }
+        if (offset == 0) {
+            snprintf(expected + length, sizeof(expected) - length, "Z");
+        } else {
+            snprintf(expected + length, sizeof(expected) - length, "%c%02d:%02d", offset < 0 ? '-' : '+',
+                     abs(offset) / 60, abs(offset) % 60);
+        }
+
+        if (!appended || strcmp(out.value, expected) != 0) {
+            mismatches++;
+        }
+    }
+
+    str_finalize(&out);
+    return (void *) mismatches;
+}
+
+static void test_timestamp_format(void)
+{
+    /* Appends after the existing contents; a rejected timestamp appends nothing */
+    Str out;
+    str_init(&out);
+    str_append_str(&out, "at ", -1);
+    CHECK(str_append_timestamp(&out, 86400, STR_TIME_SECONDS, 0));
+    CHECK(strcmp(out.value, "at 1970-01-02T00:00:00Z") == 0);
+    CHECK(!str_append_timestamp(&out, 0, (StrTimeUnit) 2, 0));
+    CHECK(!str_append_timestamp(&out, 0, STR_TIME_SECONDS, -1440));
+    CHECK(!str_append_timestamp(&out, 253402300799, STR_TIME_SECONDS, 1));
+    CHECK(strcmp(out.value, "at 1970-01-02T00:00:00Z") == 0);
+    str_finalize(&out);
+
+    /* The fraction of a negative epoch counts up from the previous second */
+    CHECK(timestamp_is(-1, STR_TIME_MILLIS, 0, "1969-12-31T23:59:59.999Z"));
+    CHECK(timestamp_is(-1000, STR_TIME_MILLIS, 0, "1969-12-31T23:59:59.000Z"));
+    CHECK(timestamp_is(-1001, STR_TIME_MILLIS, 0, "1969-12-31T23:59:58.999Z"));
+    CHECK(timestamp_is(-999999, STR_TIME_MICROS, 0, "1969-12-31T23:59:59.000001Z"));
+    CHECK(timestamp_is(INT64_MIN, STR_TIME_NANOS, 0, "1677-09-21T00:12:43.145224192Z"));
+    CHECK(timestamp_is(INT64_MAX, STR_TIME_NANOS, 0, "2262-04-11T23:47:16.854775807Z"));
+
+    /* Offsets up to a minute short of a day, and the year range applying to the local time */
+    CHECK(timestamp_is(0, STR_TIME_SECONDS, 1439, "1970-01-01T23:59:00+23:59"));
+    CHECK(timestamp_is(0, STR_TIME_SECONDS, -1439, "1969-12-31T00:01:00-23:59"));
+    CHECK(timestamp_is(0, STR_TIME_SECONDS, 1, "1970-01-01T00:01:00+00:01"));
+    CHECK(timestamp_is(253402300799, STR_TIME_SECONDS, -60, "9999-12-31T22:59:59-01:00"));
+    CHECK(timestamp_is(-62167219200, STR_TIME_SECONDS, 60, "0000-01-01T01:00:00+01:00"));
+    CHECK(!timestamp_is(-62167219200, STR_TIME_SECONDS, -1, ""));
+    CHECK(timestamp_is(-30610656000, STR_TIME_SECONDS, 0, "0999-12-27T00:00:00Z"));
+
+    /* The cache holds the local second: the same instant at two offsets and two instants at one local time */
+    CHECK(timestamp_is(3600, STR_TIME_SECONDS, 0, "1970-01-01T01:00:00Z"));
+    CHECK(timestamp_is(3600, STR_TIME_SECONDS, 60, "1970-01-01T02:00:00+01:00"));
+    CHECK(timestamp_is(0, STR_TIME_SECONDS, 60, "1970-01-01T01:00:00+01:00"));
+    CHECK(timestamp_is(3600, STR_TIME_SECONDS, 0, "1970-01-01T01:00:00Z"));
+    CHECK(timestamp_is(3601, STR_TIME_SECONDS, 0, "1970-01-01T01:00:01Z"));
+    CHECK(timestamp_is(3599999, STR_TIME_MILLIS, 0, "1970-01-01T00:59:59.999Z"));
+    CHECK(timestamp_is(3600001, STR_TIME_MILLIS, 0, "1970-01-01T01:00:00.001Z"));
+
+    CHECK(count_timestamp_mismatches((void *) 1) == NULL);
+
+#ifdef STR_HAVE_THREADS
+    /* Each thread has its own cache */
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        CHECK(pthread_create(&threads[i], NULL, count_timestamp_mismatches, (void *) (uintptr_t) (i + 2)) == 0);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        void *mismatches;
+        pthread_join(threads[i], &mismatches);
+        CHECK(mismatches == NULL);
+    }
+#endif
+}
+
+static bool translates_to(const char *s, const uint8_t map[256], const char *expected)
+{
+    Str str;
+    str_init(&str);
+    str_append_str(&str, s, -1);
+    str_translate(&str, map);
+
+    bool result = strcmp(str.value, expected) == 0;
+    str_finalize(&str);
+    return result;
+}
+
+static bool deletes_to(const char *s, const char *chars, const char *expected)
+{
+    Str str;
+    str_init(&str);
+    str_append_str(&str, s, -1);
+    str_delete_chars(&str, chars, -1);
+
+    bool result = str.length == (int64_t) strlen(expected) && strcmp(str.value, expected) == 0;
+    str_finalize(&str);
+    return result;
+}
+
+static bool squeezes_to(const char *s, const char *chars, const char *expected)
+{
+    Str str;
+    str_init(&str);
+    str_append_str(&str, s, -1);
+    str_squeeze(&str, chars, -1);
+
+    bool result = str.length == (int64_t) strlen(expected) && strcmp(str.value, expected) == 0;
+    str_finalize(&str);
+    return result;
+}
+
+static void test_translate(void)
+{
+    uint8_t map[256];
+    for (int c = 0; c < 256; c++) {
+        map[c] = (uint8_t) (c < 0x20 ? ' ' : c);
+    }
+
+    /* Control characters to spaces, like tr '\000-\037' ' ' */
+    CHECK(translates_to("", map, ""));
+    CHECK(translates_to("a\tb\r\nc", map, "a b  c"));
+    CHECK(deletes_to("line one\r\nline two\r\n", "\r", "line one\nline two\n"));
+    CHECK(deletes_to("aaaa", "a", ""));
+    CHECK(deletes_to("abc", "", "abc"));
+    CHECK(squeezes_to("a  b   c    ", " ", "a b c "));
+    CHECK(squeezes_to("aaabccddd", NULL, "abcd"));
+    CHECK(squeezes_to("aaabccddd", "c", "aaabcddd"));
+    CHECK(squeezes_to("x", NULL, "x"));
+
+    /* Random data over the vector widths, against byte loops: maps that change few rows (the pshufb tables)
+     * and every row, and sets with NUL and high bytes */
+    static const char alphabet[] = "aab  \r\n\t\x00\x01zz\x80\x80\xff\xfe" "0011";
+    static char data[700];
+    static char expected[700];
+    uint32_t seed = 11;
+
+    for (int round = 0; round < 40; round++) {
+        int64_t length = round * 17 % 700;
+        for (int64_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+
+        for (int c = 0; c < 256; c++) {
+            seed = seed * 1103515245 + 12345;
+            map[c] = round % 2 == 0 ? (uint8_t) (seed >> 16) : (uint8_t) c;
+        }
+        if (round % 2 == 1) {
+            map['a'] = 'A';
+            map[0x80] = 0;
+            map[0xff] = '\n';
+        }
+
+        Str str;
+        str_init(&str);
+        str_append_str(&str, data, length);
+        str_translate(&str, map);
+        for (int64_t i = 0; i < length; i++) {
+            expected[i] = (char) map[(uint8_t) data[i]];
+        }
+        CHECK(str.length == length && memcmp(str.value, expected, length) == 0);
+
+        static const struct { const char *set; int64_t length; } sets[] = {
+            {"\r", 1}, {" \t\r\n", 4}, {"\0\x80", 2}, {"a0\xff", 3},
+        };
+        const char *set = sets[round % 4].set;
+        int64_t set_length = sets[round % 4].length;
+
+        str_set_length(&str, 0);
+        str_append_str(&str, data, length);
+        str_delete_chars(&str, set, set_length);
+        int64_t kept = 0;
+        for (int64_t i = 0; i < length; i++) {
+            if (memchr(set, data[i], set_length) == NULL) {
+                expected[kept++] = data[i];
+            }
+        }
+        CHECK(str.length == kept && memcmp(str.value, expected, kept) == 0);
+
+        str_set_length(&str, 0);
+        str_append_str(&str, data, length);
+        bool any = round % 3 == 0;
+        str_squeeze(&str, any ? NULL : set, set_length);
+        kept = 0;
+        for (int64_t i = 0; i < length; i++) {
+            if (i == 0 || data[i] != data[i - 1] || (!any && memchr(set, data[i], set_length) == NULL)) {
+                expected[kept++] = data[i];
+            }
+        }
+        CHECK(str.length == kept && memcmp(str.value, expected, kept) == 0);
+
+        str_finalize(&str);
+    }
+}
+
+/**
+ * Returns the length of the code point at s[i] as str_reverse_codepoints() reads it: a lead byte followed by
+ * its continuation bytes, or else a single byte.
+ */
+static int64_t codepoint_length(const char *s, int64_t n, int64_t i)
+{
+    uint8_t lead = (uint8_t) s[i];
+    int64_t length = lead >= 0xF8 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+
+    if (i + length > n) {
+        return 1;
+    }
+
+    for (int64_t k = 1; k < length; k++) {
+        if (((uint8_t) s[i + k] & 0xC0) != 0x80) {
+            return 1;
+        }
+    }
+
+    return length;
+}
+
+static bool reverses_to(void (*reverse)(const Str *), const char *s, const char *expected)
+{
+    Str str;
+    str_init(&str);
+    str_append_str(&str, s, -1);
+    reverse(&str);
+
+    bool result = strcmp(str.value, expected) == 0;
+    str_finalize(&str);
+    return result;
+}
+
+static void reverse_dots(const Str *str)
+{
+    str_reverse_segments(str, '.');
+}
+
+static void test_reverse(void)
+{
+    CHECK(reverses_to(str_reverse, "", ""));
+    CHECK(reverses_to(str_reverse, "a", "a"));
+    CHECK(reverses_to(str_reverse, "example.com", "moc.elpmaxe"));
+    CHECK(reverses_to(str_reverse_codepoints, "h\xc3\xa9llo", "oll\xc3\xa9h"));
+    CHECK(reverses_to(str_reverse_codepoints, "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+                      "\xe8\xaa\x9e\xe6\x9c\xac\xe6\x97\xa5"));
+    CHECK(reverses_to(str_reverse_codepoints, "a\xf0\x9f\x98\x80" "b", "b\xf0\x9f\x98\x80" "a"));
+    CHECK(reverses_to(str_reverse_codepoints, "a\xff\xc3" "b", "b\xc3\xff" "a"));
+    CHECK(reverses_to(str_reverse_codepoints, "a\xe6\x97", "\x97\xe6" "a"));
+    CHECK(reverses_to(str_reverse_codepoints, "\x80\xc3\xa9", "\xc3\xa9\x80"));
+    CHECK(reverses_to(reverse_dots, "www.example.com", "com.example.www"));
+    CHECK(reverses_to(reverse_dots, "a..b", "b..a"));
+    CHECK(reverses_to(reverse_dots, ".a.b.", ".b.a."));
+    CHECK(reverses_to(reverse_dots, "localhost", "localhost"));
+    CHECK(reverses_to(reverse_dots, "", ""));
+
+    /* Random data over the vector widths, against a byte loop, a decoding loop and a split */
+    static const char alphabet[] = "ab..\xc3\xa9\xe6\x97\xf0\x9f\x80\xff";
+    static char data[600];
+    static char expected[600];
+    uint32_t seed = 5;
+    Str str;
+    str_init(&str);
+
+    for (int64_t length = 0; length < 600; length += length < 80 ? 1 : 37) {
+        for (int64_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+
+        str_set_length(&str, 0);
+        str_append_str(&str, data, length);
+        str_reverse(&str);
+        for (int64_t i = 0; i < length; i++) {
+            expected[length - 1 - i] = data[i];
+        }
+        CHECK(str.length == length && memcmp(str.value, expected, length) == 0);
+
+        str_set_length(&str, 0);
+        str_append_str(&str, data, length);
+        str_reverse_codepoints(&str);
+        for (int64_t i = 0, n; i < length; i += n) {
+            n = codepoint_length(data, length, i);
+            memcpy(expected + length - i - n, data + i, n);
+        }
+        CHECK(str.length == length && memcmp(str.value, expected, length) == 0);
+
+        str_set_length(&str, 0);
+        str_append_str(&str, data, length);
+        str_reverse_segments(&str, '.');
+        int64_t end = length;
+        for (int64_t i = length - 1, out = 0; i >= -1; i--) {
+            if (i < 0 || data[i] == '.') {
+                memcpy(expected + out, data + i + 1, end - i - 1);
+                out += end - i - 1;
+                if (i >= 0) {
+                    expected[out++] = '.';
+                }
+                end = i;
+            }
+        }
+        CHECK(str.length == length && memcmp(str.value, expected, length) == 0);
+    }
+
+    str_finalize(&str);
+}
+
+static bool dumps_to(const char *s, int64_t length, int64_t offset, const char *expected)
+{
+    Str str;
+    str_init(&str);
+
+    bool result = str_append_hexdump(&str, s, length, offset) && str.length == (int64_t) strlen(expected)
+                  && strcmp(str.value, expected) == 0;
+    str_finalize(&str);
+    return result;
+}
+
+static bool escapes_to(const char *s, int64_t length, const char *expected)
+{
+    Str str;
+    str_init(&str);
+
+    bool result = str_append_c_escaped(&str, s, length) && strcmp(str.value, expected) == 0;
+    str_finalize(&str);
+    return result;
+}
+
+/**
+ * Reads back the contents of a C string literal, with hex escapes taking every hex digit that follows as C
+ * does. Returns the number of bytes, or -1 if an escape is malformed or out of range.
+ */
+static int64_t c_unescape(const char *s, int64_t length, char *out)
+{
+    static const char letters[] = "abtnvfr\"\\";
+    static const char values[] = "\a\b\t\n\v\f\r\"\\";
+    int64_t n = 0;
+
+    for (int64_t i = 0; i < length; i++) {
+        if (s[i] != '\\') {
+            out[n++] = s[i];
+            continue;
+        }
+
+        if (++i == length) {
+            return -1;
+        }
+
+        const char *letter = strchr(letters, s[i]);
+        if (letter != NULL && s[i] != '\0') {
+            out[n++] = values[letter - letters];
+        } else if (s[i] == 'x') {
+            unsigned value = 0;
+            int digits = 0;
+            while (i + 1 < length && strchr("0123456789abcdefABCDEF", s[i + 1]) != NULL && s[i + 1] != '\0') {
+                char c = s[++i];
+                value = value * 16 + (unsigned) (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                digits++;
+            }
+
+            if (digits == 0 || value > 0xFF) {
+                return -1;
+            }
+            out[n++] = (char) value;
+        } else {
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+static void test_hexdump(void)
+{
+    /* Known answers, produced by xxd (with -o for the offsets) */
+    CHECK(dumps_to("", 0, 0, ""));
+    CHECK(dumps_to("Hello, world!\n", -1, 0,
+                   "00000000: 4865 6c6c 6f2c 2077 6f72 6c64 210a       Hello, world!.\n"));
+    CHECK(dumps_to("Hello, world!\n", -1, 0x1000,
+                   "00001000: 4865 6c6c 6f2c 2077 6f72 6c64 210a       Hello, world!.\n"));
+    CHECK(dumps_to("abcdefghijklmnopq", -1, 0xfffffff8,
+                   "fffffff8: 6162 6364 6566 6768 696a 6b6c 6d6e 6f70  abcdefghijklmnop\n"
+                   "100000008: 71                                       q\n"));
+    CHECK(dumps_to("ab", -1, 0x7ffffffffffffff0,
+                   "7ffffffffffffff0: 6162                                     ab\n"));
+
+    char bytes[256];
+    for (int i = 0; i < 256; i++) {
+        bytes[i] = (char) i;
+    }
+
+    CHECK(dumps_to(bytes, 256, 0,
+        "00000000: 0001 0203 0405 0607 0809 0a0b 0c0d 0e0f  ................\n"
+        "00000010: 1011 1213 1415 1617 1819 1a1b 1c1d 1e1f  ................\n"
+        "00000020: 2021 2223 2425 2627 2829 2a2b 2c2d 2e2f   !\"#$%&'()*+,-./\n"
+        "00000030: 3031 3233 3435 3637 3839 3a3b 3c3d 3e3f  0123456789:;<=>?\n"
+        "00000040: 4041 4243 4445 4647 4849 4a4b 4c4d 4e4f  @ABCDEFGHIJKLMNO\n"
+        "00000050: 5051 5253 5455 5657 5859 5a5b 5c5d 5e5f  PQRSTUVWXYZ[\\]^_\n"
+        "00000060: 6061 6263 6465 6667 6869 6a6b 6c6d 6e6f  `abcdefghijklmno\n"
+        "00000070: 7071 7273 7475 7677 7879 7a7b 7c7d 7e7f  pqrstuvwxyz{|}~.\n"
+        "00000080: 8081 8283 8485 8687 8889 8a8b 8c8d 8e8f  ................\n"
+        "00000090: 9091 9293 9495 9697 9899 9a9b 9c9d 9e9f  ................\n"
+        "000000a0: a0a1 a2a3 a4a5 a6a7 a8a9 aaab acad aeaf  ................\n"
+        "000000b0: b0b1 b2b3 b4b5 b6b7 b8b9 babb bcbd bebf  ................\n"
+        "000000c0: c0c1 c2c3 c4c5 c6c7 c8c9 cacb cccd cecf  ................\n"
+        "000000d0: d0d1 d2d3 d4d5 d6d7 d8d9 dadb dcdd dedf  ................\n"
+        "000000e0: e0e1 e2e3 e4e5 e6e7 e8e9 eaeb eced eeef  ................\n"
+        "000000f0: f0f1 f2f3 f4f5 f6f7 f8f9 fafb fcfd feff  ................\n"));
+
+    /* Appends after the existing contents */
+    Str str;
+    str_init(&str);
+    str_append_str(&str, "dump:\n", -1);
+    CHECK(str_append_hexdump(&str, "\x00\xff", 2, 16));
+    CHECK(strcmp(str.value, "dump:\n00000010: 00ff                                     ..\n") == 0);
+
+    CHECK(escapes_to("", 0, ""));
+    CHECK(escapes_to("plain text", -1, "plain text"));
+    CHECK(escapes_to("tab\there \"quoted\" back\\slash\r\n", -1, "tab\\there \\\"quoted\\\" back\\\\slash\\r\\n"));
+    CHECK(escapes_to("\a\b\v\f\x7f", -1, "\\a\\b\\v\\f\\x7f"));
+    CHECK(escapes_to("\0" "1", 2, "\\x00\\x31"));
+    CHECK(escapes_to("\xff" "fg", -1, "\\xff\\x66g"));
+    CHECK(escapes_to("caf\xc3\xa9", -1, "caf\\xc3\\xa9"));
+
+    /* Every byte, and random bytes over hex digits, read back the same */
+    char escaped_back[1024];
+    str_set_length(&str, 0);
+    CHECK(str_append_c_escaped(&str, bytes, 256));
+    CHECK(c_unescape(str.value, str.length, escaped_back) == 256 && memcmp(escaped_back, bytes, 256) == 0);
+
+    static const char alphabet[] = "09afAFgz\x00\x01\xfe\\\"\n ";
+    uint32_t seed = 3;
+    for (int round = 0; round < 200; round++) {
+        char data[200];
+        int64_t length = round;
+        for (int64_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+
+        str_set_length(&str, 0);
+        CHECK(str_append_c_escaped(&str, data, length));
+        CHECK(c_unescape(str.value, str.length, escaped_back) == length && memcmp(escaped_back, data, length) == 0);
+    }
+
+    str_finalize(&str);
+}
+
+/**
+ * Formats a value digit by digit, as a reference for the integer appends.
+ */
+static void format_reference(char *out, uint64_t value, bool negative, int base, bool uppercase, char separator)
+{
+    const char *digits = uppercase ? "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                   : "0123456789abcdefghijklmnopqrstuvwxyz";
+    char reversed[160];
+    int n = 0;
+
+    do {
+        if (separator != 0 && n % 4 == 3) {
+            reversed[n++] = separator;
+        }
+        reversed[n++] = digits[value % (uint64_t) base];
+        value /= (uint64_t) base;
+    } while (value > 0);
+
+    if (negative) {
+        *out++ = '-';
+    }
+    while (n > 0) {
+        *out++ = reversed[--n];
+    }
+    *out = '\0';
+}
+
+static void test_integers(void)
+{
+    static const int64_t edges[] = {0, 1, -1, 9, 10, -10, 99, 100, 999, 1000, 999999, -1000000, INT32_MAX, INT32_MIN,
+                                    INT64_MAX, INT64_MIN, INT64_MAX - 1, INT64_MIN + 1};
+    char expected[160];
+    Str str;
+    str_init(&str);
+
+    uint64_t seed = 17;
+    for (int i = 0; i < 20000; i++) {
+        int64_t value;
+        if (i < (int) (sizeof(edges) / sizeof(edges[0]))) {
+            value = edges[i];
+        } else {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            /* Values of every digit count */
+            value = (int64_t) (seed >> (seed % 64));
+            value = i % 2 == 0 ? value : -value;
+        }
+
+        uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+
+        str_set_length(&str, 0);
+        CHECK(str_append_int(&str, value));
+        snprintf(expected, sizeof(expected), "%lld", (long long) value);
+        CHECK(strcmp(str.value, expected) == 0);
+
+        str_set_length(&str, 0);
+        CHECK(str_append_uint(&str, (uint64_t) value));
+        snprintf(expected, sizeof(expected), "%llu", (unsigned long long) value);
+        CHECK(strcmp(str.value, expected) == 0);
+
+        int base = 2 + i % 35;
+        bool uppercase = i % 3 == 0;
+        str_set_length(&str, 0);
+        CHECK(str_append_int_base(&str, value, base, uppercase));
+        format_reference(expected, magnitude, value < 0, base, uppercase, 0);
+        CHECK(strcmp(str.value, expected) == 0);
+
+        str_set_length(&str, 0);
+        CHECK(str_append_uint_base(&str, (uint64_t) value, base, uppercase));
+        format_reference(expected, (uint64_t) value, false, base, uppercase, 0);
+        CHECK(strcmp(str.value, expected) == 0);
+
+        str_set_length(&str, 0);
+        CHECK(str_append_int_grouped(&str, value, ','));
+        format_reference(expected, magnitude, value < 0, 10, false, ',');
+        CHECK(strcmp(str.value, expected) == 0);
+
+        str_set_length(&str, 0);
+        CHECK(str_append_uint_grouped(&str, (uint64_t) value, '_'));
+        format_reference(expected, (uint64_t) value, false, 10, false, '_');
+        CHECK(strcmp(str.value, expected) == 0);
+    }
+
+    /* Known answers, and the bases printf knows */
+    str_set_length(&str, 0);
+    CHECK(str_append_uint_base(&str, 0xDEADBEEF, 16, false));
+    CHECK(str_append_char(&str, ' '));
+    CHECK(str_append_uint_base(&str, 0xDEADBEEF, 16, true));
+    CHECK(str_append_char(&str, ' '));
+    CHECK(str_append_uint_base(&str, 8, 8, false));
+    CHECK(str_append_char(&str, ' '));
+    CHECK(str_append_int_base(&str, -35, 36, true));
+    CHECK(str_append_char(&str, ' '));
+    CHECK(str_append_int_grouped(&str, INT64_MIN, '.'));
+    CHECK(strcmp(str.value, "deadbeef DEADBEEF 10 -Z -9.223.372.036.854.775.808") == 0);
+
+    str_set_length(&str, 0);
+    CHECK(str_append_int_base(&str, INT64_MIN, 2, false));
+    CHECK(str.length == 65 && str.value[0] == '-' && str.value[1] == '1' && strspn(str.value + 2, "0") == 63);
+
+    /* A base out of range appends nothing */
+    str_set_length(&str, 0);
+    CHECK(!str_append_uint_base(&str, 5, 1, false));
+    CHECK(!str_append_uint_base(&str, 5, 37, false));
+    CHECK(!str_append_int_base(&str, 5, 0, false));
+    CHECK(str.length == 0);
+
+#ifdef __SIZEOF_INT128__
+    static const struct { StrUInt128 value; const char *text; } unsigned_answers[] = {
+        {0, "0"},
+        {(StrUInt128) 1 << 64, "18446744073709551616"},
+        {(StrUInt128) 10000000000000000000ULL, "10000000000000000000"},
+        {(StrUInt128) 10000000000000000000ULL - 1, "9999999999999999999"},
+        {(StrUInt128) 10000000000000000000ULL * 5 + 7, "50000000000000000007"},
+        {(StrUInt128) 10000000000000000000ULL * 10000000000000000000ULL, "100000000000000000000000000000000000000"},
+        {~(StrUInt128) 0, "340282366920938463463374607431768211455"},
+    };
+
+    for (int i = 0; i < (int) (sizeof(unsigned_answers) / sizeof(unsigned_answers[0])); i++) {
+        str_set_length(&str, 0);
+        CHECK(str_append_uint128(&str, unsigned_answers[i].value));
+        CHECK(strcmp(str.value, unsigned_answers[i].text) == 0);
+    }
+
+    StrInt128 min = (StrInt128) ((StrUInt128) 1 << 127);
+    str_set_length(&str, 0);
+    CHECK(str_append_int128(&str, min));
+    CHECK(str_append_char(&str, ' '));
+    CHECK(str_append_int128(&str, -min - 1));
+    CHECK(str_append_char(&str, ' '));
+    CHECK(str_append_int128(&str, -1));
+    CHECK(strcmp(str.value,
+                 "-170141183460469231731687303715884105728 170141183460469231731687303715884105727 -1") == 0);
+
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t high = seed >> (seed % 64);
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        StrUInt128 value = (StrUInt128) high << 64 | seed;
+        bool negative = i % 2 == 1 && (StrInt128) value < 0;
+        StrUInt128 magnitude = negative ? -value : value;
+
+        char reversed[48];
+        int n = 0;
+        do {
+            reversed[n++] = (char) ('0' + (int) (magnitude % 10));
+            magnitude /= 10;
+        } while (magnitude > 0);
+
+        int length = 0;
+        if (negative) {
+            expected[length++] = '-';
+        }
+        while (n > 0) {
+            expected[length++] = reversed[--n];
+        }
+        expected[length] = '\0';
+
+        str_set_length(&str, 0);
+        if (i % 2 == 0) {
+            CHECK(str_append_uint128(&str, value));
+        } else {
+            CHECK(str_append_int128(&str, (StrInt128) value));
+        }
+        CHECK(strcmp(str.value, expected) == 0);
+    }
+#endif
+
+    str_finalize(&str);
+}
+
+static bool is_token_byte(char c)
+{
+    uint8_t b = (uint8_t) c;
+    return (b >= '0' && b <= '9') || ((b | 0x20) >= 'a' && (b | 0x20) <= 'z') || b >= 0x80;
+}
+
+/**
+ * Checks the tokens of a text against a byte loop: the runs of word bytes, lowercased. Tokens without
+ * uppercase letters must point into the text.
+ */
+static void check_tokens(const char *text, int64_t length)
+{
+    StrTokenizer tokenizer;
+    StrSlice token;
+    char expected[1024];
+    int64_t i = 0;
+
+    CHECK(str_tokenizer_init(&tokenizer, text, length));
+
+    for (;;) {
+        while (i < length && !is_token_byte(text[i])) {
+            i++;
+        }
+
+        if (i == length) {
+            break;
+        }
+
+        int64_t start = i;
+        bool upper = false;
+        while (i < length && is_token_byte(text[i])) {
+            upper |= text[i] >= 'A' && text[i] <= 'Z';
+            expected[i - start] = (char) (text[i] >= 'A' && text[i] <= 'Z' ? text[i] | 0x20 : text[i]);
+            i++;
+        }
+
+        if (!str_tokenizer_next(&tokenizer, &token)) {
+            CHECK(!"missing token");
+            break;
+        }
+
+        CHECK(token.length == i - start && memcmp(token.value, expected, token.length) == 0);
+        CHECK(upper || token.value == text + start);
+    }
+
+    CHECK(!str_tokenizer_next(&tokenizer, &token));
+    str_tokenizer_finalize(&tokenizer);
+}
+
+static void test_tokenizer(void)
+{
+    static const char *const words[] = {"hello", "world", "42x", "caf\xc3\xa9", "na\xc3\xafve"};
+    const char *text = "Hello, WORLD! 42x -- caf\xc3\xa9 (na\xc3\xafve)...";
+    StrTokenizer tokenizer;
+    StrSlice token;
+    int n = 0;
+
+    CHECK(str_tokenizer_init(&tokenizer, text, -1));
+    while (str_tokenizer_next(&tokenizer, &token)) {
+        CHECK(n < 5 && token.length == (int64_t) strlen(words[n]) && memcmp(token.value, words[n], token.length) == 0);
+        n++;
+    }
+    CHECK(n == 5);
+    str_tokenizer_finalize(&tokenizer);
+
+    check_tokens("", 0);
+    check_tokens(" ,.;!? \n\t", 9);
+    check_tokens("word", 4);
+
+    /* Words across the 64-byte blocks, longer than a block, and with uppercase letters on either side */
+    static const char alphabet[] = "abcXYZ09\xc3\xa9 .,-\n";
+    static char data[1000];
+    uint32_t seed = 9;
+
+    for (int round = 0; round < 300; round++) {
+        int64_t length = round < 200 ? round : (round - 199) * 9;
+
+        /* Two rounds in three separate words with spaces only, so that the words run longer */
+        unsigned separators = round % 3 == 0 ? 5 : 1;
+        for (int64_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned pick = (seed >> 16) % (sizeof(alphabet) - 1 - 5 + separators);
+            data[i] = alphabet[pick];
+        }
+
+        check_tokens(data, length);
+    }
+
+    memset(data, 'A', 300);
+    data[300] = ' ';
+    memset(data + 301, 'b', 200);
+    check_tokens(data, 501);
+}
+
+static void test_term_counter(void)
+{
+    StrTermCounter counter;
+
+    /* Growth from a capacity of one, with the counts checked after every insertion */
+    CHECK(str_term_counter_init(&counter, 1));
+    char term[32];
+
+    for (int i = 0; i < 5000; i++) {
+        int length = snprintf(term, sizeof(term), "term%d", i);
+        CHECK(str_term_counter_add(&counter, term, length, i + 1));
+        CHECK(str_term_counter_add(&counter, term, -1, 1));
+    }
+
+    CHECK(counter.count == 5000);
+    for (int i = 0; i < 5000; i++) {
+        snprintf(term, sizeof(term), "term%d", i);
+        CHECK(str_term_counter_get(&counter, term, -1) == i + 2);
+
+        int64_t count;
+        StrSlice slice = str_term_counter_term(&counter, i, &count);
+        CHECK(count == i + 2 && slice.length == (int64_t) strlen(term) && memcmp(slice.value, term, slice.length) == 0);
+    }
+
+    CHECK(str_term_counter_get(&counter, "term5000", -1) == 0);
+    CHECK(str_term_counter_get(&counter, "term", -1) == 0);
+    CHECK(str_term_counter_get(&counter, "term1\0", 6) == 0);
+    str_term_counter_finalize(&counter);
+
+    /* Counting a text: terms differing only in case are the same */
+    CHECK(str_term_counter_init(&counter, 16));
+    CHECK(str_term_counter_add_text(&counter, "The cat and THE dog. the end; Cat!", -1));
+    CHECK(str_term_counter_add_text(&counter, "", 0));
+    CHECK(counter.count == 5);
+    CHECK(str_term_counter_get(&counter, "the", -1) == 3);
+    CHECK(str_term_counter_get(&counter, "cat", -1) == 2);
+    CHECK(str_term_counter_get(&counter, "dog", -1) == 1);
+    CHECK(str_term_counter_get(&counter, "The", -1) == 0);
+
+    int64_t count;
+    StrSlice first = str_term_counter_term(&counter, 0, &count);
+    CHECK(first.length == 3 && memcmp(first.value, "the", 3) == 0 && count == 3);
+    str_term_counter_finalize(&counter);
+}
+
+static void test_lsh(void)
+{
+    StrLshIndex index;
+    CHECK(str_lsh_init(&index, 4, 2));
+
+    uint32_t signature[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint32_t other[8] = {1, 2, 30, 40, 50, 60, 70, 80};
+
+    /* Every document matches in all four bands, so each id is seen four times */
+    for (int64_t id = 0; id < 1000; id++) {
+        CHECK(str_lsh_insert(&index, signature, id * 7));
+    }
+
+    CHECK(str_lsh_insert(&index, other, 5));
+
+    static int64_t candidates[2000];
+    static bool seen[7000];
+
+    int64_t n = str_lsh_query(&index, signature, candidates, 2000);
+    CHECK(n == 1001);
+
+    for (int64_t i = 0; i < n; i++) {
+        CHECK(candidates[i] >= 0 && candidates[i] < 7000 && !seen[candidates[i]]);
+        seen[candidates[i]] = true;
+    }
+
+    CHECK(seen[5] && seen[0] && seen[6993]);
+    CHECK(str_lsh_query(&index, signature, candidates, 10) == 10);
+    CHECK(str_lsh_query(&index, other, candidates, 2000) == 1001);
+
+    uint32_t unrelated[8] = {9, 9, 9, 9, 9, 9, 9, 9};
+    CHECK(str_lsh_query(&index, unrelated, candidates, 2000) == 0);
+
+    str_lsh_finalize(&index);
+}
+
+static uint64_t fnv1a(const char *s, int64_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int64_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t) s[i]) * 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Checks both digests against hashing the whole string from scratch.
+ */
+static bool digest_matches(StrDigest *digest, const Str *str)
+{
+    return str_digest_crc32(digest) == str_crc32_update(0, str->value, str->length)
+           && str_digest_fnv1a(digest) == fnv1a(str->value, str->length);
+}
+
+/**
+ * Splits a text into lines, each with its '\n', storing count + 1 starts. Returns the number of lines.
+ */
+static int64_t split_lines(const char *s, int64_t length, int64_t *starts)
+{
+    int64_t count = 0;
+    starts[0] = 0;
+    for (int64_t i = 0; i < length; i++) {
+        if (s[i] == '\n' || i == length - 1) starts[++count] = i + 1;
+    }
+
+    return count;
+}
+
+static int64_t split_bytes(int64_t length, int64_t *starts)
+{
+    for (int64_t i = 0; i <= length; i++) starts[i] = i;
+    return length;
+}
+
+static bool units_equal(const char *a, const int64_t *a_starts, int64_t i, const char *b, const int64_t *b_starts,
+                        int64_t j)
+{
+    int64_t length = a_starts[i + 1] - a_starts[i];
+    return length == b_starts[j + 1] - b_starts[j] && memcmp(a + a_starts[i], b + b_starts[j], length) == 0;
+}
+
+/**
+ * Returns the length of the shortest edit script, n + m - 2 * LCS, by dynamic programming.
+ */
+static int64_t edit_distance_reference(const char *a, const int64_t *a_starts, int64_t n, const char *b,
+                                       const int64_t *b_starts, int64_t m)
+{
+    int64_t *row = malloc((m + 1) * sizeof(int64_t));
+    for (int64_t j = 0; j <= m; j++) row[j] = j;
+
+    for (int64_t i = 1; i <= n; i++) {
+        int64_t diagonal = row[0];
+        row[0] = i;
+        for (int64_t j = 1; j <= m; j++) {
+            int64_t above = row[j];
+            if (units_equal(a, a_starts, i - 1, b, b_starts, j - 1)) {
+                row[j] = diagonal;
+            } else {
+                row[j] = (above < row[j - 1] ? above : row[j - 1]) + 1;
+            }
+            diagonal = above;
+        }
+    }
+
+    int64_t distance = row[m];
+    free(row);
+    return distance;
+}
+
+/**
+ * Checks that the edits are contiguous, well formed and shortest, and that applying them to `a` yields `b`.
+ */
+static void check_diff(const StrDiff *diff, const char *a, const int64_t *a_starts, int64_t n, const char *b,
+                       const int64_t *b_starts, int64_t m)
+{
+    Str rebuilt;
+    str_init(&rebuilt);
+    int64_t i = 0, j = 0, distance = 0;
+
+    for (int64_t e = 0; e < diff->count; e++) {
+        const StrDiffEdit *edit = &diff->edits[e];
+        bool valid = edit->length > 0 && edit->a_start == i && edit->b_start == j;
+        if (edit->op != STR_DIFF_INSERT) valid = valid && i + edit->length <= n;
+        if (edit->op != STR_DIFF_DELETE) valid = valid && j + edit->length <= m;
+        CHECK(valid);
+        if (!valid) break;
+
+        /* A deletion may follow an equal run; an insertion an equal run or a deletion */
+        if (e > 0) {
+            StrDiffOp previous = diff->edits[e - 1].op;
+            CHECK(edit->op > previous || (edit->op == STR_DIFF_EQUAL && previous != STR_DIFF_EQUAL));
+        }
+
+        if (edit->op == STR_DIFF_EQUAL) {
+            for (int64_t k = 0; k < edit->length; k++) CHECK(units_equal(a, a_starts, i + k, b, b_starts, j + k));
+            str_append_str(&rebuilt, a + a_starts[i], a_starts[i + edit->length] - a_starts[i]);
+            i += edit->length;
+            j += edit->length;
+        } else if (edit->op == STR_DIFF_DELETE) {
+            i += edit->length;
+            distance += edit->length;
+        } else {
+            str_append_str(&rebuilt, b + b_starts[j], b_starts[j + edit->length] - b_starts[j]);
+            j += edit->length;
+            distance += edit->length;
+        }
+    }
+
+    CHECK(i == n && j == m);
+    CHECK(str_equals_str(&rebuilt, b, b_starts[m]));
+    CHECK(distance == edit_distance_reference(a, a_starts, n, b, b_starts, m));
+    str_finalize(&rebuilt);
+}
+
+static void check_diff_bytes(StrDiff *diff, const char *a, int64_t a_length, const char *b, int64_t b_length)
+{
+    static int64_t a_starts[4097], b_starts[4097];
+    int64_t n = split_bytes(a_length, a_starts);
+    int64_t m = split_bytes(b_length, b_starts);
+
+    CHECK(str_diff_bytes(diff, a, a_length, b, b_length));
+    check_diff(diff, a, a_starts, n, b, b_starts, m);
+}
+
+/**
+ * Returns the line of a patch at the offset, without its '\n', and moves the offset past it.
+ */
+static StrSlice next_patch_line(const Str *patch, int64_t *offset)
+{
+    const char *start = patch->value + *offset;
+    const char *end = memchr(start, '\n', patch->length - *offset);
+    int64_t length = end ? end - start : patch->length - *offset;
+    *offset += length + (end != NULL);
+    return (StrSlice) {.value = start, .length = length};
+}
+
+/**
+ * Parses a hunk range such as "-3,4" or "+7", where a missing count means one line.
+ */
+static bool parse_hunk_range(const char **p, char sign, int64_t *start, int64_t *count)
+{
+    if (**p != sign) return false;
+    char *end;
+    *start = strtoll(*p + 1, &end, 10);
+    *count = 1;
+    if (*end == ',') *count = strtoll(end + 1, &end, 10);
+    *p = end;
+    return true;
+}
+
+/**
+ * Applies a unified diff to the old text as `patch` does, checking every context and deleted line and the
+ * line counts of every hunk.
+ */
+static bool apply_unified_diff(const Str *patch, const char *a, const int64_t *a_starts, int64_t n, Str *out)
+{
+    int64_t offset = 0, line = 0;
+    StrSlice header = next_patch_line(patch, &offset);
+    if (header.length < 4 || memcmp(header.value, "--- ", 4) != 0) return false;
+    header = next_patch_line(patch, &offset);
+    if (header.length < 4 || memcmp(header.value, "+++ ", 4) != 0) return false;
+
+    while (offset < patch->length) {
+        StrSlice hunk = next_patch_line(patch, &offset);
+        const char *p = hunk.value + 3;
+        int64_t a_start, a_count, b_start, b_count;
+        if (hunk.length < 3 || memcmp(hunk.value, "@@ ", 3) != 0) return false;
+        if (!parse_hunk_range(&p, '-', &a_start, &a_count) || *p++ != ' ') return false;
+        if (!parse_hunk_range(&p, '+', &b_start, &b_count) || memcmp(p, " @@", 3) != 0) return false;
+
+        /* An empty range names the line after which the hunk goes */
+        int64_t first = a_count == 0 ? a_start : a_start - 1;
+        if (first < line || first > n) return false;
+        str_append_str(out, a + a_starts[line], a_starts[first] - a_starts[line]);
+        line = first;
+
+        while (a_count > 0 || b_count > 0) {
+            if (offset >= patch->length) return false;
+            StrSlice body = next_patch_line(patch, &offset);
+            bool newline = offset >= patch->length || patch->value[offset] != '\\';
+            if (!newline) next_patch_line(patch, &offset);
+            if (body.length == 0) return false;
+
+            char kind = body.value[0];
+            const char *text = body.value + 1;
+            int64_t length = body.length - 1;
+            if (kind == ' ' || kind == '-') {
+                if (line >= n || a_count == 0) return false;
+                const char *old = a + a_starts[line];
+                if (a_starts[line + 1] - a_starts[line] != length + newline || memcmp(old, text, length) != 0) {
+                    return false;
+                }
+                line++;
+                a_count--;
+            }
+
+            if (kind == ' ' || kind == '+') {
+                if (b_count == 0) return false;
+                str_append_str(out, text, length);
+                if (newline) str_append_str(out, "\n", 1);
+                b_count--;
+            } else if (kind != '-') {
+                return false;
+            }
+        }
+    }
+
+    str_append_str(out, a + a_starts[line], a_starts[n] - a_starts[line]);
+    return true;
+}
+
+static void check_diff_lines(StrDiff *diff, const char *a, int64_t a_length, const char *b, int64_t b_length)
+{
+    static int64_t a_starts[4097], b_starts[4097];
+    int64_t n = split_lines(a, a_length, a_starts);
+    int64_t m = split_lines(b, b_length, b_starts);
+
+    CHECK(str_diff_lines(diff, a, a_length, b, b_length));
+    check_diff(diff, a, a_starts, n, b, b_starts, m);
+
+    /* The unified diff round trips through a patcher for every amount of context */
+    Str patch, patched;
+    str_init(&patch);
+    str_init(&patched);
+    for (int context = 0; context <= 3; context++) {
+        str_set_length(&patch, 0);
+        str_set_length(&patched, 0);
+        CHECK(str_append_unified_diff(&patch, a, a_length, b, b_length, "a", "b", context));
+        if (patch.length == 0) {
+            CHECK(a_length == b_length && memcmp(a, b, a_length) == 0);
+            continue;
+        }
+
+        CHECK(apply_unified_diff(&patch, a, a_starts, n, &patched));
+        CHECK(str_equals_str(&patched, b, b_length));
+    }
+
+    str_finalize(&patch);
+    str_finalize(&patched);
+}
+
+/**
+ * Fills a text with random units from a pool, returning its length. Derived texts copy runs of the
+ * original with random deletions, insertions and replacements, so that they share long equal runs.
+ */
+static int64_t random_text(char *out, int64_t units, const char *const *pool, int pool_size, const char *original,
+                           int64_t original_length, uint32_t *seed)
+{
+    int64_t length = 0, copied = 0;
+    for (int64_t i = 0; i < units; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        unsigned pick = *seed >> 16;
+        if (original && pick % 8 != 0) {
+            if (copied < original_length) out[length++] = original[copied++];
+            continue;
+        }
+
+        if (original && pick % 3 == 0) copied += 1 + (pick >> 4) % 3;
+        const char *unit = pool[(pick >> 8) % pool_size];
+        int64_t unit_length = (int64_t) strlen(unit);
+        memcpy(out + length, unit, unit_length);
+        length += unit_length;
+    }
+
+    return length;
+}
+
+static void test_diff(void)
+{
+    StrDiff diff;
+    str_diff_init(&diff);
+
+    /* Known answers */
+    CHECK(str_diff_bytes(&diff, "abc", -1, "abd", -1));
+    CHECK(diff.count == 3);
+    CHECK(diff.edits[0].op == STR_DIFF_EQUAL && diff.edits[0].a_start == 0 && diff.edits[0].length == 2);
+    CHECK(diff.edits[1].op == STR_DIFF_DELETE && diff.edits[1].a_start == 2 && diff.edits[1].b_start == 2);
+    CHECK(diff.edits[2].op == STR_DIFF_INSERT && diff.edits[2].a_start == 3 && diff.edits[2].b_start == 2);
+
+    CHECK(str_diff_bytes(&diff, "x", -1, "y", -1));
+    CHECK(diff.count == 2 && diff.edits[0].op == STR_DIFF_DELETE && diff.edits[1].op == STR_DIFF_INSERT);
+    CHECK(str_diff_bytes(&diff, "", 0, "", 0));
+    CHECK(diff.count == 0);
+    CHECK(str_diff_bytes(&diff, "", 0, "ab", 2));
+    CHECK(diff.count == 1 && diff.edits[0].op == STR_DIFF_INSERT && diff.edits[0].length == 2);
+    CHECK(str_diff_bytes(&diff, "ab", 2, "", 0));
+    CHECK(diff.count == 1 && diff.edits[0].op == STR_DIFF_DELETE && diff.edits[0].length == 2);
+
+    /* A missing newline at the end changes the last line */
+    CHECK(str_diff_lines(&diff, "a\nb\n", -1, "a\nb", -1));
+    CHECK(diff.count == 3 && diff.edits[0].length == 1);
+    CHECK(diff.edits[1].op == STR_DIFF_DELETE && diff.edits[1].a_start == 1 && diff.edits[1].length == 1);
+    CHECK(diff.edits[2].op == STR_DIFF_INSERT && diff.edits[2].b_start == 1 && diff.edits[2].length == 1);
+
+    /* Unified diffs as printed by `diff -u` */
+    Str patch;
+    str_init(&patch);
+    const char *a = "one\ntwo\nthree\nfour\nfive\nsix\nseven\neight\nnine\nten\n";
+    const char *b = "one\n2\nthree\nfour\nfive\nsix\nseven\neight\nnine\nten\neleven";
+    CHECK(str_append_unified_diff(&patch, a, -1, b, -1, "a.txt", "b.txt", 3));
+    CHECK(str_equals_str(&patch,
+                         "--- a.txt\n+++ b.txt\n"
+                         "@@ -1,5 +1,5 @@\n one\n-two\n+2\n three\n four\n five\n"
+                         "@@ -8,3 +8,4 @@\n eight\n nine\n ten\n+eleven\n\\ No newline at end of file\n",
+                         -1));
+
+    str_set_length(&patch, 0);
+    CHECK(str_append_unified_diff(&patch, "", -1, "x\ny\n", -1, "a", "b", 3));
+    CHECK(str_equals_str(&patch, "--- a\n+++ b\n@@ -0,0 +1,2 @@\n+x\n+y\n", -1));
+    str_set_length(&patch, 0);
+    CHECK(str_append_unified_diff(&patch, "a\nb\nc\n", -1, "a\nc\n", -1, "a", "b", 0));
+    CHECK(str_equals_str(&patch, "--- a\n+++ b\n@@ -2 +1,0 @@\n-b\n", -1));
+    str_set_length(&patch, 0);
+    CHECK(str_append_unified_diff(&patch, "a\nb", -1, "a\nb\n", -1, "a", "b", 1));
+    CHECK(str_equals_str(&patch, "--- a\n+++ b\n@@ -1,2 +1,2 @@\n a\n-b\n\\ No newline at end of file\n+b\n", -1));
+    str_set_length(&patch, 0);
+    CHECK(str_append_unified_diff(&patch, a, -1, a, -1, "a", "b", 3));
+    CHECK(patch.length == 0);
+    str_finalize(&patch);
+
+    /* Random texts: independent, and derived from each other with a few edits */
+    static const char *const letters[] = {"a", "b", "c"};
+    static const char *const lines[] = {"a\n", "b\n", "c\n", "ab\n", "\n", "a"};
+    static char old_text[4096], new_text[4096];
+    uint32_t seed = 99;
+
+    for (int round = 0; round < 310; round++) {
+        int64_t units = round < 300 ? round % 100 : 1000 + round;
+        bool derived = round % 2 == 0;
+        int64_t old_length = random_text(old_text, units, letters, 3, NULL, 0, &seed);
+        int64_t new_length = random_text(new_text, units, letters, 3, derived ? old_text : NULL, old_length, &seed);
+        check_diff_bytes(&diff, old_text, old_length, new_text, new_length);
+        check_diff_bytes(&diff, new_text, new_length, old_text, old_length);
+    }
+
+    for (int round = 0; round < 210; round++) {
+        int64_t units = round < 200 ? round % 50 : 500;
+        bool derived = round % 2 == 0;
+
+        /* Only the last line may lack its '\n' */
+        int64_t old_length = random_text(old_text, units, lines, 5, NULL, 0, &seed);
+        if (round % 5 == 0) old_text[old_length++] = 'a';
+        int64_t new_length = random_text(new_text, units, lines, 5, derived ? old_text : NULL, old_length, &seed);
+        if (new_length > 0 && new_text[new_length - 1] == '\n' && round % 3 == 0) new_length--;
+        check_diff_lines(&diff, old_text, old_length, new_text, new_length);
+        check_diff_lines(&diff, new_text, new_length, old_text, old_length);
+    }
+
+    str_diff_finalize(&diff);
+}
+
+/**
+ * Compares two strings in natural order by splitting them into bytes and numbers, as a reference.
+ */
+static int natural_reference(const char *a, int64_t a_length, const char *b, int64_t b_length)
+{
+    int64_t i = 0, j = 0;
+    int zeros = 0;
+
+    while (i < a_length && j < b_length) {
+        bool a_number = a[i] >= '0' && a[i] <= '9';
+        bool b_number = b[j] >= '0' && b[j] <= '9';
+
+        /* No other byte lies between the digits, so a number orders against a byte as any digit does */
+        if (!a_number || !b_number) {
+            uint8_t x = a_number ? '0' : (uint8_t) a[i], y = b_number ? '0' : (uint8_t) b[j];
+            if (x != y) return x < y ? -1 : 1;
+            i++;
+            j++;
+            continue;
+        }
+
+        int64_t a_zeros = i, b_zeros = j, a_digits = 0, b_digits = 0;
+        while (i < a_length && a[i] == '0') i++;
+        while (j < b_length && b[j] == '0') j++;
+        a_zeros = i - a_zeros;
+        b_zeros = j - b_zeros;
+        while (i + a_digits < a_length && a[i + a_digits] >= '0' && a[i + a_digits] <= '9') a_digits++;
+        while (j + b_digits < b_length && b[j + b_digits] >= '0' && b[j + b_digits] <= '9') b_digits++;
+
+        if (a_digits != b_digits) return a_digits < b_digits ? -1 : 1;
+        int r = memcmp(a + i, b + j, a_digits);
+        if (r != 0) return r < 0 ? -1 : 1;
+        if (zeros == 0 && a_zeros != b_zeros) zeros = a_zeros < b_zeros ? -1 : 1;
+        i += a_digits;
+        j += b_digits;
+    }
+
+    if (i < a_length || j < b_length) return i < a_length ? 1 : -1;
+    return zeros;
+}
+
+static int natural_sign(int r)
+{
+    return (r > 0) - (r < 0);
+}
+
+static void check_natural(const char *a, int64_t a_length, const char *b, int64_t b_length)
+{
+    Str x = {.value = (char *) a, .length = a_length};
+    Str y = {.value = (char *) b, .length = b_length};
+    int expected = natural_reference(a, a_length, b, b_length);
+
+    CHECK(str_compare_natural(&x, &y) == expected);
+    CHECK(str_compare_natural(&y, &x) == -expected);
+    CHECK(str_compare_natural_str(&x, b, b_length) == expected);
+
+    /* The keys order as the strings do under memcmp(), the shorter key first on a common prefix */
+    Str a_key, b_key;
+    str_init(&a_key);
+    str_init(&b_key);
+    CHECK(str_append_natural_key(&a_key, a, a_length));
+    CHECK(str_append_natural_key(&b_key, b, b_length));
+    CHECK(a_key.length <= 4 * a_length + 2 && b_key.length <= 4 * b_length + 2);
+
+    int64_t common = a_key.length < b_key.length ? a_key.length : b_key.length;
+    int r = natural_sign(memcmp(a_key.value, b_key.value, common));
+    if (r == 0) r = (a_key.length > b_key.length) - (a_key.length < b_key.length);
+    CHECK(r == expected);
+    str_finalize(&a_key);
+    str_finalize(&b_key);
+}
+
+static int compare_natural_strings(const void *a, const void *b)
+{
+    Str x = {.value = *(char *const *) a, .length = (int64_t) strlen(*(char *const *) a)};
+    return str_compare_natural_str(&x, *(const char *const *) b, -1);
+}
+
+static void test_natural(void)
+{
+    /* Known answers, each pair in ascending order */
+    static const char *const pairs[][2] = {
+        {"file2", "file10"}, {"file2", "file02"}, {"x01y", "x1z"}, {"a1b02", "a01b2"}, {"", "0"}, {"9", "10"},
+        {"a", "a0"}, {"a/", "a0"}, {"a9", "a:"}, {"0", "00"}, {"v1.9", "v1.10"}, {"1e", "18446744073709551616"},
+        {"12345678901234567", "12345678901234568"}, {"abcdefgh1", "abcdefgh01"}, {"abcdefg12", "abcdefgh1"},
+    };
+
+    for (int i = 0; i < (int) (sizeof(pairs) / sizeof(pairs[0])); i++) {
+        Str a = {.value = (char *) pairs[i][0], .length = (int64_t) strlen(pairs[i][0])};
+        CHECK(str_compare_natural_str(&a, pairs[i][1], -1) == -1);
+        check_natural(pairs[i][0], a.length, pairs[i][1], (int64_t) strlen(pairs[i][1]));
+    }
+
+    Str same = {.value = "img007", .length = 6};
+    CHECK(str_compare_natural_str(&same, "img007", -1) == 0);
+    check_natural("a\0b", 3, "a", 1);
+    check_natural("a\0", 2, "a\0\0", 3);
+
+    const char *names[] = {"img12.png", "img10.png", "IMG3.png", "img2.png", "img1.png", "img02.png", "img"};
+    const char *const sorted[] = {"IMG3.png", "img", "img1.png", "img2.png", "img02.png", "img10.png", "img12.png"};
+    qsort(names, 7, sizeof(names[0]), compare_natural_strings);
+    for (int i = 0; i < 7; i++) CHECK(strcmp(names[i], sorted[i]) == 0);
+
+    /* Random strings, with digit runs across the 8-byte blocks and longer than 255 significant digits */
+    static const char alphabet[] = "0000123456789ab.:/\0";
+    static char a[600], b[600];
+    uint32_t seed = 100;
+
+    for (int round = 0; round < 20000; round++) {
+        int64_t a_length = 0, b_length = 0;
+        int64_t length = round < 19900 ? round % 24 : 300 + round % 7;
+
+        for (int64_t i = 0; i < length; i++) {
+            seed = seed * 1103515245 + 12345;
+            a[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+        a_length = length;
+
+        /* Most pairs share a prefix and differ by a few bytes, so that the comparison reaches the numbers */
+        memcpy(b, a, length);
+        b_length = length;
+        seed = seed * 1103515245 + 12345;
+        int edits = (seed >> 16) % 3;
+        for (int e = 0; e < edits; e++) {
+            seed = seed * 1103515245 + 12345;
+            int64_t at = length > 0 ? (seed >> 8) % length : 0;
+            char c = alphabet[(seed >> 20) % (sizeof(alphabet) - 1)];
+            if ((seed >> 28) % 2 == 0 && b_length < (int64_t) sizeof(b)) {
+                memmove(b + at + 1, b + at, b_length - at);
+                b[at] = c;
+                b_length++;
+            } else if (b_length > 0) {
+                b[at < b_length ? at : b_length - 1] = c;
+            }
+        }
+
+        check_natural(a, a_length, b, b_length);
+    }
+
+    /* Numbers of 300 digits, which differ in the last digit, in length or in leading zeros */
+    memset(a, '7', 300);
+    memcpy(b, a, 300);
+    b[299] = '8';
+    check_natural(a, 300, b, 300);
+    check_natural(a, 300, b, 299);
+    b[0] = '0';
+    check_natural(a, 300, b, 300);
+    check_natural(a, 299, b, 300);
+    check_natural(a, 256, "12", 2);
+    check_natural(a, 255, a, 256);
+}
+
+static void test_digest(void)
+{
+    Str str;
+    StrDigest digest;
+    str_init(&str);
+    str_digest_init(&digest, &str);
+
+    CHECK(digest_matches(&digest, &str));
+    CHECK(str_digest_append(&digest, "hello world", -1));
+    CHECK(digest_matches(&digest, &str));
+
+    /* Direct appends are fed on the next read */
+    CHECK(str_append_str(&str, ", again", -1));
+    CHECK(digest_matches(&digest, &str));
+
+    /* Truncating and growing back past the old length must not keep the stale prefix */
+    CHECK(str_set_length(&str, 5));
+    CHECK(str_append_str(&str, " there, something longer", -1));
+    CHECK(digest_matches(&digest, &str));
+
+    /* In-place edits keep the length */
+    str_to_upper(&str);
+    CHECK(digest_matches(&digest, &str));
+    str_reverse(&str);
+    CHECK(digest_matches(&digest, &str));
+
+    CHECK(str_append_str(&str, "  ", 2));
+    CHECK(digest_matches(&digest, &str));
+    str_trim(&str, STR_TRIM_BOTH);
+    CHECK(str_digest_append(&digest, "tail", -1));
+    CHECK(digest_matches(&digest, &str));
+
+    /* Truncation to empty and regrowth to a different string of the same length */
+    CHECK(str_repeat(&str, 0));
+    CHECK(str_digest_append(&digest, "abc", 3));
+    CHECK(digest_matches(&digest, &str));
+    CHECK(str_set_length(&str, 0));
+    CHECK(str_append_str(&str, "xyz", 3));
+    CHECK(digest_matches(&digest, &str));
+
+    str_finalize(&str);
+}
+
+/**
+ * Writes a large append and a small one to a non-blocking pipe, whose capacity forces short writes. With
+ * io_uring the two are linked, and the small one must still land after all of the large one.
+ */
+static bool read_file(int fd, Str *contents)
+{
+    char buffer[65536];
+    ssize_t n;
+
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        str_append_str(contents, buffer, n);
+    }
+
+    return n == 0;
+}
+
+/**
+ * Writes a file with appends at the current position, writes at offsets and writes from registered buffers,
+ * then reads it back. Runs on both backends (see the test_str_writev target).
+ */
+static void test_io_round_trip(void)
+{
+    StrIoQueue queue;
+    CHECK(str_io_init(&queue, 8));
+
+    char path[] = "/tmp/test_str_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+
+    Str buffers[2];
+    str_init(&buffers[0]);
+    str_init(&buffers[1]);
+    str_append_str(&buffers[0], "fixed at 200", -1);
+    str_append_str(&buffers[1], "fixed appended\n", -1);
+    CHECK(str_io_register_buffers(&queue, buffers, 2));
+    CHECK(!str_io_queue_write_fixed(&queue, fd, 2, 0, 0));
+    CHECK(!str_io_queue_write_fixed(&queue, fd, -1, 0, 0));
+
+    static const int64_t lengths[9] = {0, 6, 7, 6, 15, 5, 12, 4, 0};
+    CHECK(str_io_queue_write(&queue, fd, "hello ", -1, -1, 1));
+    CHECK(str_io_queue_write(&queue, fd, "queued ", -1, -1, 2));
+    CHECK(str_io_queue_write(&queue, fd, "world\n", -1, -1, 3));
+    CHECK(str_io_queue_write_fixed(&queue, fd, 1, -1, 4));
+    CHECK(str_io_queue_write(&queue, fd, "at100", -1, 100, 5));
+    CHECK(str_io_queue_write_fixed(&queue, fd, 0, 200, 6));
+    CHECK(str_io_queue_write(&queue, fd, "at50", -1, 50, 7));
+    CHECK(str_io_queue_write(&queue, fd, "", 0, 60, 8));
+
+    /* The queue holds `capacity` writes until their completions are reaped */
+    CHECK(!str_io_queue_write(&queue, fd, "full", -1, -1, 9));
+
+    bool seen[9] = {false};
+    StrIoCompletion completions[8];
+    for (int completed = 0; completed < 8;) {
+        int count = str_io_complete(&queue, completions, 8, 8 - completed);
+        CHECK(count > 0);
+        if (count <= 0) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint64_t id = completions[i].user_data;
+            CHECK(id >= 1 && id <= 8 && !seen[id]);
+            if (id >= 1 && id <= 8) {
+                CHECK(completions[i].result == lengths[id]);
+                seen[id] = true;
+            }
+        }
+
+        completed += count;
+    }
+
+    CHECK(str_io_queue_write(&queue, fd, "!", -1, 212, 9));
+    CHECK(str_io_complete(&queue, completions, 8, 1) == 1);
+    CHECK(completions[0].user_data == 9 && completions[0].result == 1);
+    CHECK(str_io_register_buffers(&queue, NULL, 0));
+    CHECK(!str_io_queue_write_fixed(&queue, fd, 0, 0, 0));
+
+    Str contents;
+    str_init(&contents);
+    CHECK(read_file(fd, &contents));
+    CHECK(contents.length == 213);
+
+    char expected[213] = {0};
+    memcpy(expected, "hello queued world\nfixed appended\n", 34);
+    memcpy(expected + 50, "at50", 4);
+    memcpy(expected + 100, "at100", 5);
+    memcpy(expected + 200, "fixed at 200!", 13);
+    CHECK(contents.length == 213 && memcmp(contents.value, expected, 213) == 0);
+
+    str_finalize(&contents);
+    str_io_finalize(&queue);
+    str_finalize(&buffers[0]);
+    str_finalize(&buffers[1]);
+    close(fd);
+    unlink(path);
+}
+
+static void test_io_short_writes(void)
+{
+    StrIoQueue queue;
+    int fds[2];
+
+    CHECK(str_io_init(&queue, 8));
+    if (!queue.uring || pipe(fds) < 0) {
+        str_io_finalize(&queue);
+        return;
+    }
+
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    static char large[200000];
+    memset(large, 'a', sizeof(large));
+
+    CHECK(str_io_queue_write(&queue, fds[1], large, sizeof(large), -1, 1));
+    CHECK(str_io_queue_write(&queue, fds[1], "bbbb", 4, -1, 2));
+    CHECK(str_io_submit(&queue) == 2);
+
+    Str received;
+    str_init(&received);
+    char buffer[65536];
+    int completed = 0;
+
+    while (completed < 2) {
+        ssize_t n = read(fds[0], buffer, sizeof(buffer));
+        if (n > 0) {
+            str_append_str(&received, buffer, n);
+        }
+
+        StrIoCompletion completions[2];
+        int count = str_io_complete(&queue, completions, 2, 0);
+        CHECK(count >= 0);
+
+        for (int i = 0; i < count; i++) {
+            CHECK(completions[i].result == (completions[i].user_data == 1 ? (int64_t) sizeof(large) : 4));
+            completed++;
+        }
+    }
+
+    for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+        str_append_str(&received, buffer, n);
+    }
+
+    CHECK(received.length == 200004);
+    CHECK(str_ends_with_str(&received, "abbbb", -1));
+
+    str_finalize(&received);
+    str_io_finalize(&queue);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * Appends three writes to a file whose size limit stops the second one partway. The first completes, the
+ * second reports the error and the third is cancelled. io_uring does not apply the limit to its writes, so
+ * this runs with the writev() fallback only.
+ */
+static void test_io_errors(void)
+{
+    StrIoQueue queue;
+    CHECK(str_io_init(&queue, 8));
+    if (queue.uring) {
+        str_io_finalize(&queue);
+        return;
+    }
+
+    char path[] = "/tmp/test_str_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit small = {10, limit.rlim_max};
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    CHECK(setrlimit(RLIMIT_FSIZE, &small) == 0);
+
+    CHECK(str_io_queue_write(&queue, fd, "aaaaaa", 6, -1, 1));
+    CHECK(str_io_queue_write(&queue, fd, "bbbbbb", 6, -1, 2));
+    CHECK(str_io_queue_write(&queue, fd, "ccc", 3, -1, 3));
+
+    int64_t results[4] = {0};
+    StrIoCompletion completions[3];
+    for (int completed = 0; completed < 3;) {
+        int count = str_io_complete(&queue, completions, 3, 1);
+        CHECK(count > 0);
+        if (count <= 0) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            results[completions[i].user_data] = completions[i].result;
+        }
+
+        completed += count;
+    }
+
+    CHECK(results[1] == 6);
+    CHECK(results[2] == -EFBIG);
+    CHECK(results[3] == -ECANCELED);
+
+    str_io_finalize(&queue);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, handler);
+    close(fd);
+    unlink(path);
+}
+
+static void test_padding(void)
+{
+    static const int64_t values[] = {0, 7, -7, 42, -42, 12345, -12345, INT64_MAX, INT64_MIN};
+    char expected[64];
+    Str str;
+    str_init(&str);
+
+    /* Right and left alignment against printf */
+    for (int i = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++) {
+        for (int width = 0; width <= 24; width += 3) {
+            long long value = values[i];
+
+            str_set_length(&str, 0);
+            CHECK(str_append_int_padded(&str, values[i], width, STR_ALIGN_RIGHT, ' '));
+            snprintf(expected, sizeof(expected), "%*lld", width, value);
+            CHECK(strcmp(str.value, expected) == 0);
+
+            str_set_length(&str, 0);
+            CHECK(str_append_int_padded(&str, values[i], width, STR_ALIGN_RIGHT, '0'));
+            snprintf(expected, sizeof(expected), "%0*lld", width, value);
+            CHECK(strcmp(str.value, expected) == 0);
+
+            str_set_length(&str, 0);
+            CHECK(str_append_int_padded(&str, values[i], width, STR_ALIGN_LEFT, ' '));
+            snprintf(expected, sizeof(expected), "%-*lld", width, value);
+            CHECK(strcmp(str.value, expected) == 0);
+
+            str_set_length(&str, 0);
+            CHECK(str_append_uint_padded(&str, (uint64_t) values[i], width, STR_ALIGN_RIGHT, ' '));
+            snprintf(expected, sizeof(expected), "%*llu", width, (unsigned long long) values[i]);
+            CHECK(strcmp(str.value, expected) == 0);
+        }
+    }
+
+    /* Centering puts the odd byte on the right; the sign only moves with right-aligned zeros */
+    str_set_length(&str, 0);
+    CHECK(str_append_int_padded(&str, -42, 8, STR_ALIGN_CENTER, '0'));
+    CHECK(strcmp(str.value, "00-42000") == 0);
+    str_set_length(&str, 0);
+    CHECK(str_append_int_padded(&str, -42, 5, STR_ALIGN_LEFT, '0'));
+    CHECK(strcmp(str.value, "-4200") == 0);
+    str_set_length(&str, 0);
+    CHECK(str_append_padded(&str, "abc", -1, 8, STR_ALIGN_CENTER, '*'));
+    CHECK(strcmp(str.value, "**abc***") == 0);
+    CHECK(str_append_padded(&str, "too long", -1, 3, STR_ALIGN_RIGHT, '*'));
+    CHECK(strcmp(str.value, "**abc***too long") == 0);
+
+    /* A row grows the string once and pads every cell */
+    StrColumn columns[3] = {{6, STR_ALIGN_LEFT, 0}, {5, STR_ALIGN_RIGHT, '.'}, {4, STR_ALIGN_CENTER, '-'}};
+    StrSlice cells[3] = {{"name", 4}, {"42", 2}, {"ok", 2}};
+
+    str_set_length(&str, 0);
+    CHECK(str_append_row(&str, columns, cells, 3, " | ", -1));
+    CHECK(strcmp(str.value, "name   | ...42 | -ok-") == 0);
+    CHECK(str_append_row(&str, columns, cells, 3, NULL, 5));
+    CHECK(strcmp(str.value, "name   | ...42 | -ok-name  ...42-ok-") == 0);
+
+    str_set_length(&str, 0);
+    CHECK(str_append_row(&str, columns, cells, 0, ", ", -1));
+    CHECK(str.length == 0);
+
+    str_finalize(&str);
+}
+
+#ifdef STR_HAVE_THREADS
+#define LOG_THREADS 8
+#define LOG_MESSAGES 20000
+
+static StrLogger logger;
+
+/**
+ * Logs "thread:sequence" lines, alternating between formatted messages and copies.
+ */
+static void *log_messages(void *arg)
+{
+    int thread = (int) (intptr_t) arg;
+    char line[32];
+
+    for (int i = 0; i < LOG_MESSAGES; i++) {
+        if (i % 2 == 0) {
+            str_logger_log(&logger, "%d:%d", thread, i);
+        } else {
+            int length = snprintf(line, sizeof(line), "%d:%d\n", thread, i);
+            str_logger_write(&logger, line, length);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Counts the lines a logger wrote to the file, per thread. The messages of each thread must come out whole
+ * and in the order they were logged.
+ */
+static int64_t check_logged_lines(int fd, int64_t *per_thread)
+{
+    Str contents;
+    str_init(&contents);
+    CHECK(read_file(fd, &contents));
+
+    int next[LOG_THREADS] = {0};
+    int64_t lines = 0;
+    const char *p = contents.value;
+    const char *end = contents.value + contents.length;
+
+    while (p < end) {
+        int thread, sequence, consumed = 0;
+        if (sscanf(p, "%d:%d\n%n", &thread, &sequence, &consumed) != 2 || consumed == 0 || thread < 0
+            || thread >= LOG_THREADS || sequence < next[thread]) {
+            CHECK(!"malformed or reordered log line");
+            break;
+        }
+
+        next[thread] = sequence + 1;
+        per_thread[thread]++;
+        lines++;
+        p += consumed;
+    }
+
+    str_finalize(&contents);
+    return lines;
+}
+
+static void test_logger(void)
+{
+    static const StrLogOverflow modes[] = {STR_LOG_BLOCK, STR_LOG_DROP};
+
+    for (int m = 0; m < 2; m++) {
+        char path[] = "/tmp/test_str_XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        CHECK(str_logger_init(&logger, fd, 64, modes[m]));
+
+        pthread_t threads[LOG_THREADS];
+        for (int i = 0; i < LOG_THREADS; i++) {
+            CHECK(pthread_create(&threads[i], NULL, log_messages, (void *) (intptr_t) i) == 0);
+        }
+
+        for (int i = 0; i < LOG_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        int64_t dropped = str_logger_dropped(&logger);
+        str_logger_finalize(&logger);
+
+        int64_t per_thread[LOG_THREADS] = {0};
+        int64_t lines = check_logged_lines(fd, per_thread);
+
+        /* Blocking loses nothing; dropping loses only what it counts */
+        CHECK(lines + dropped == LOG_THREADS * LOG_MESSAGES);
+        if (modes[m] == STR_LOG_BLOCK) {
+            CHECK(dropped == 0);
+            for (int i = 0; i < LOG_THREADS; i++) {
+                CHECK(per_thread[i] == LOG_MESSAGES);
+            }
+        }
+
+        close(fd);
+        unlink(path);
+    }
+
+    /* Messages that cannot be written count as dropped */
+    CHECK(str_logger_init(&logger, -1, 8, STR_LOG_BLOCK));
+    for (int i = 0; i < 100; i++) {
+        CHECK(str_logger_log(&logger, "lost %d", i));
+    }
+
+    struct timespec pause = {0, 1000000};
+    for (int i = 0; i < 5000 && str_logger_dropped(&logger) < 100; i++) {
+        nanosleep(&pause, NULL);
+    }
+
+    CHECK(str_logger_dropped(&logger) == 100);
+    CHECK(str_logger_written(&logger) == 0);
+    str_logger_finalize(&logger);
+}
+
+static StrConcurrentBuffer concurrent;
+static atomic_int concurrent_done;
+
+/**
+ * Appends "thread:sequence" records, retrying while the consumer has not freed enough space.
+ */
+static void *append_records(void *arg)
+{
+    int thread = (int) (intptr_t) arg;
+    char record[32];
+
+    for (int i = 0; i < LOG_MESSAGES; i++) {
+        int length = snprintf(record, sizeof(record), "%d:%d\n", thread, i);
+        while (!str_concurrent_append(&concurrent, record, length)) {
+            sched_yield();
+        }
+    }
+
+    atomic_fetch_add(&concurrent_done, 1);
+    return NULL;
+}
+
+static void test_concurrent_buffer(void)
+{
+    /* A small buffer, so that the appends wrap around and wait for the consumer all the time */
+    CHECK(str_concurrent_init(&concurrent, 1000));
+    atomic_store(&concurrent_done, 0);
+
+    pthread_t threads[LOG_THREADS];
+    for (int i = 0; i < LOG_THREADS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, append_records, (void *) (intptr_t) i) == 0);
+    }
+
+    Str received;
+    str_init(&received);
+
+    for (;;) {
+        bool done = atomic_load(&concurrent_done) == LOG_THREADS;
+        StrSlice slice = str_concurrent_peek(&concurrent);
+
+        if (slice.length > 0) {
+            str_append_str(&received, slice.value, slice.length);
+            CHECK(str_concurrent_consume(&concurrent, slice.length));
+        } else if (done) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+
+    for (int i = 0; i < LOG_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Every record arrives whole, and the records of each thread in order */
+    int next[LOG_THREADS] = {0};
+    const char *p = received.value;
+    const char *end = received.value + received.length;
+
+    while (p < end) {
+        int thread, sequence, consumed = 0;
+        if (sscanf(p, "%d:%d\n%n", &thread, &sequence, &consumed) != 2 || consumed == 0 || thread < 0
+            || thread >= LOG_THREADS || sequence != next[thread]) {
+            CHECK(!"malformed or reordered record");
+            break;
+        }
+
+        next[thread]++;
+        p += consumed;
+    }
+
+    for (int i = 0; i < LOG_THREADS; i++) {
+        CHECK(next[i] == LOG_MESSAGES);
+    }
+
+    /* Consuming more than was committed fails, and so does an append larger than the free space */
+    str_concurrent_reset(&concurrent);
+    CHECK(str_concurrent_append(&concurrent, "abc", 3));
+    CHECK(!str_concurrent_consume(&concurrent, 4));
+    CHECK(str_concurrent_peek(&concurrent).length == 3);
+    CHECK(!str_concurrent_append(&concurrent, received.value, 998));
+    CHECK(str_concurrent_append(&concurrent, received.value, 997));
+
+    /* A failed flush keeps the bytes */
+    CHECK(!str_concurrent_flush(&concurrent, -1));
+    CHECK(str_concurrent_peek(&concurrent).length == 1000);
+
+    str_finalize(&received);
+    str_concurrent_finalize(&concurrent);
+}
+
+/**
+ * Reads a pipe to the end in small reads, pausing now and then so that the writes on the other end block.
+ */
+static void *drain_pipe(void *arg)
+{
+    int fd = *(int *) arg;
+    Str *contents = malloc(sizeof(Str));
+    char buffer[1024];
+    ssize_t n;
+    int reads = 0;
+
+    str_init(contents);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        str_append_str(contents, buffer, n);
+        if (++reads % 64 == 0) {
+            struct timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    return contents;
+}
+
+static void test_writer(void)
+{
+    for (int background = 0; background <= 1; background++) {
+        int fds[2];
+        CHECK(pipe(fds) == 0);
+
+        pthread_t reader;
+        CHECK(pthread_create(&reader, NULL, drain_pipe, &fds[0]) == 0);
+
+        StrWriter writer;
+        CHECK(str_writer_init(&writer, fds[1], 4096, background));
+        CHECK(str_writer_flush(&writer));
+        CHECK(writer.flush_count == 0);
+
+        /* The same lines go to the writer and to a plain Str: the pipe must receive them unchanged */
+        Str expected;
+        str_init(&expected);
+
+        for (int i = 0; i < 100000; i++) {
+            switch (i % 4) {
+            case 0:
+                CHECK(str_writer_append_int(&writer, -i));
+                CHECK(str_writer_append_char(&writer, '\n'));
+                str_append_int(&expected, -i);
+                str_append_char(&expected, '\n');
+                break;
+            case 1:
+                CHECK(str_writer_append_format(&writer, "%d:%s\n", i, "format"));
+                str_append_format(&expected, "%d:%s\n", i, "format");
+                break;
+            case 2:
+                CHECK(str_writer_append_str(&writer, "a line of text\n", -1));
+                str_append_str(&expected, "a line of text\n", -1);
+                break;
+            default:
+                /* Appending to the buffer directly, then polling */
+                str_append_uint(&writer.buffer, (uint64_t) i * 1000003);
+                str_append_char(&writer.buffer, '\n');
+                CHECK(str_writer_poll(&writer));
+                str_append_uint(&expected, (uint64_t) i * 1000003);
+                str_append_char(&expected, '\n');
+                break;
+            }
+
+            /* The buffer never grows much past the watermark */
+            CHECK(writer.buffer.length < 4096 + 64);
+        }
+
+        CHECK(str_writer_flush(&writer));
+        CHECK(writer.bytes_written == expected.length);
+        CHECK(writer.flush_count >= expected.length / (4096 + 64));
+        CHECK(writer.max_flush_time_ns <= writer.flush_time_ns);
+        str_writer_finalize(&writer);
+        close(fds[1]);
+
+        Str *received;
+        pthread_join(reader, (void **) &received);
+        close(fds[0]);
+
+        CHECK(received->length == expected.length);
+        CHECK(memcmp(received->value, expected.value, expected.length) == 0);
+
+        str_finalize(received);
+        free(received);
+        str_finalize(&expected);
+
+        /* A failed write is reported by the flush and by every later flush */
+        int fd = open("/dev/null", O_RDONLY);
+        CHECK(fd >= 0);
+        CHECK(str_writer_init(&writer, fd, 16, background));
+        CHECK(str_writer_append_str(&writer, "lost", -1));
+        CHECK(!str_writer_flush(&writer));
+        CHECK(writer.failed && writer.bytes_written == 0 && writer.flush_count == 1);
+        CHECK(str_writer_append_str(&writer, "more", -1));
+        CHECK(!str_writer_flush(&writer));
+        str_writer_finalize(&writer);
+        close(fd);
+    }
+}
+#endif
+
+int main(void)
+{
+    test_byteset();
+    test_line_index();
+    test_matcher();
+    test_binary_appends();
+    test_reader();
+    test_format();
+    test_indexof();
+#ifdef STR_HAVE_POSIX
+    test_ring();
+#endif
+    test_checksums();
+    test_digest();
+    test_lz4();
+    test_timestamps();
+    test_timestamp_format();
+    test_translate();
+    test_reverse();
+    test_integers();
+    test_tokenizer();
+    test_term_counter();
+    test_lsh();
+    test_diff();
+    test_natural();
+    test_padding();
+    test_hexdump();
+    test_io_round_trip();
+    test_io_short_writes();
+    test_io_errors();
+#ifdef STR_HAVE_THREADS
+    test_logger();
+    test_concurrent_buffer();
+    test_writer();
+#endif
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}